@@ -0,0 +1,141 @@
+#!/usr/bin/env bash
+#
+# Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+# contributor license agreements.  See the NOTICE file distributed with
+# this work for additional information regarding copyright ownership.
+# The OpenAirInterface Software Alliance licenses this file to You under
+# the OAI Public License, Version 1.1  (the "License"); you may not use this file
+# except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.openairinterface.org/?page_id=698
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#-------------------------------------------------------------------------------
+# For more information about the OpenAirInterface (OAI) Software Alliance:
+#      contact@openairinterface.org
+#
+# Scaling run of the xApps against the E2 node emulator (../src/e2_node_emu.c).
+#
+#   bench_e2_scale.sh [-n "1 4 16"] [-u "10 100 1000"] [-d seconds] [-w seconds]
+#
+#   -n  E2 node counts to run (default "1 4 16")
+#   -u  UEs per slice and node to run (default "10 100 1000")
+#   -d  measurement time of a step (default 30 s)
+#   -w  warm-up of a step, after the xApps restarted (default 10 s)
+#
+# For every nodes x UEs step the emulator is started, then XAPP_RESTART is run since the xApps
+# only subscribe to the E2 nodes connected when they start, and the Prometheus metrics of
+# xapp-kpm-mon are read at the start and at the end of the measurement. One line per step:
+# indications/s, UE reports/s, MySQL rows/s and ring drops/s, the xApp processing latency
+# (collectStartTime to callback, and decode) as p50/p99, and the p99 wait for the shard lock,
+# which grows when several nodes share a shard (KPM_SHARDS of xapp-kpm-mon). With RC_LOADGEN
+# set, each step also runs rc_ctrl_loadgen against xapp-rc-ctrl and prints its control latency.
+#
+# Environment:
+#   E2EMU          emulator binary (default ./e2_node_emu)
+#   FLEXRIC_CONF   flexric.conf of the nearRT-RIC (default ../deployment/flexric.conf)
+#   KPM_METRICS    metrics of xapp-kpm-mon (default http://127.0.0.1:8090/metrics)
+#   XAPP_RESTART   command restarting the xApps (default: docker restart of both containers)
+#   RC_LOADGEN     rc_ctrl_loadgen binary, unset to skip the controls
+#   RC_HTTP        REST address of xapp-rc-ctrl for rc_ctrl_loadgen (default 127.0.0.1:8080)
+# The E2EMU_* variables other than E2EMU_NODES and E2EMU_UES_PER_SLICE go to the emulator.
+
+set -u
+
+NODES="1 4 16"
+UES="10 100 1000"
+DURATION=30
+WARMUP=10
+
+while getopts "n:u:d:w:" opt; do
+  case $opt in
+    n) NODES=$OPTARG ;;
+    u) UES=$OPTARG ;;
+    d) DURATION=$OPTARG ;;
+    w) WARMUP=$OPTARG ;;
+    *) sed -n '22,46p' "$0"; exit 1 ;;
+  esac
+done
+
+E2EMU=${E2EMU:-./e2_node_emu}
+FLEXRIC_CONF=${FLEXRIC_CONF:-../deployment/flexric.conf}
+KPM_METRICS=${KPM_METRICS:-http://127.0.0.1:8090/metrics}
+XAPP_RESTART=${XAPP_RESTART:-docker restart oai-xapp-kpm-mon oai-xapp-rc-slice-ctrl}
+RC_LOADGEN=${RC_LOADGEN:-}
+RC_HTTP=${RC_HTTP:-127.0.0.1:8080}
+
+EMU_PID=
+stop_emu() {
+  if [ -n "$EMU_PID" ]; then
+    kill -TERM "$EMU_PID" 2>/dev/null
+    wait "$EMU_PID" 2>/dev/null
+    EMU_PID=
+  fi
+}
+trap 'stop_emu; exit 1' INT TERM
+
+# Sum of the samples of metric $2 in the scrape $1; the plain name also matches its labeled series,
+# a name with labels only that series
+metric_sum() {
+  awk -v m="$2" '$1 == m || index($1, m "{") == 1 { s += $2 } END { printf "%.0f", s }' <<< "$1"
+}
+
+# Quantile $3 of the unlabeled summary $2, in ms
+metric_q_ms() {
+  awk -v k="$2{quantile=\"$3\"}" '$1 == k { printf "%.3f", $2 * 1000; f = 1 } END { if (!f) printf "-" }' <<< "$1"
+}
+
+# Rows stored in MySQL only, each sink of KPM_SINKS counts the same rows
+DB_ROWS='kpm_sink_rows_total{sink="mysql"}'
+
+rate() {
+  awk -v a="$1" -v b="$2" -v t="$3" 'BEGIN { printf "%.1f", (b - a) / t }'
+}
+
+printf "%5s %6s %10s %12s %10s %8s %9s %9s %10s %10s %11s\n" \
+  nodes ues ind/s ue_rep/s db_rows/s drop/s e2_p50ms e2_p99ms dec_p50ms dec_p99ms lock_p99ms
+
+for n in $NODES; do
+  for u in $UES; do
+    E2EMU_NODES=$n E2EMU_UES_PER_SLICE=$u E2EMU_STATS_S=0 "$E2EMU" -c "$FLEXRIC_CONF" > "e2emu_${n}x${u}.log" 2>&1 &
+    EMU_PID=$!
+    # The nodes start E2EMU_SPAWN_MS apart
+    sleep $(( 2 + n * ${E2EMU_SPAWN_MS:-50} / 1000 ))
+
+    if ! eval "$XAPP_RESTART" > /dev/null; then
+      echo "XAPP_RESTART failed" >&2
+      stop_emu
+      exit 1
+    fi
+    sleep "$WARMUP"
+
+    m0=$(curl -s "$KPM_METRICS")
+    sleep "$DURATION"
+    m1=$(curl -s "$KPM_METRICS")
+    if [ -z "$m0" ] || [ -z "$m1" ]; then
+      echo "no metrics at $KPM_METRICS" >&2
+      stop_emu
+      exit 1
+    fi
+
+    printf "%5s %6s %10s %12s %10s %8s %9s %9s %10s %10s %11s\n" "$n" "$u" \
+      "$(rate "$(metric_sum "$m0" kpm_indications_total)" "$(metric_sum "$m1" kpm_indications_total)" "$DURATION")" \
+      "$(rate "$(metric_sum "$m0" kpm_ue_reports_total)" "$(metric_sum "$m1" kpm_ue_reports_total)" "$DURATION")" \
+      "$(rate "$(metric_sum "$m0" "$DB_ROWS")" "$(metric_sum "$m1" "$DB_ROWS")" "$DURATION")" \
+      "$(rate "$(metric_sum "$m0" kpm_ring_dropped_total)" "$(metric_sum "$m1" kpm_ring_dropped_total)" "$DURATION")" \
+      "$(metric_q_ms "$m1" kpm_e2_latency_seconds 0.5)" "$(metric_q_ms "$m1" kpm_e2_latency_seconds 0.99)" \
+      "$(metric_q_ms "$m1" kpm_decode_seconds 0.5)" "$(metric_q_ms "$m1" kpm_decode_seconds 0.99)" \
+      "$(metric_q_ms "$m1" kpm_lock_wait_seconds 0.99)"
+
+    if [ -n "$RC_LOADGEN" ]; then
+      echo "      controls: $("$RC_LOADGEN" --http "$RC_HTTP" -n 200 -w | tail -n 1)"
+    fi
+
+    stop_emu
+  done
+done
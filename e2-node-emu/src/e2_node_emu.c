@@ -0,0 +1,711 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// E2 node emulator, to load the xApps without the gNB, rfsim and core stack.
+//
+// Build it inside the FlexRIC tree next to examples/emulator/agent, linking e2_agent and the
+// KPM and RC service models like the agent emulator there, and run it against the nearRT-RIC
+// of flexric.conf:
+//   ./e2_node_emu -c ../deployment/flexric.conf
+//
+// A FlexRIC agent is one E2 node per process, so the emulator forks E2EMU_NODES children, one
+// gNB each with nb_id E2EMU_NB_ID, E2EMU_NB_ID + 1, ... Every node offers KPM and RC:
+//   - KPM report style 4: E2EMU_UES_PER_SLICE UEs in each slice of E2EMU_SLICES, reported in
+//     format 3 indications. The report period is the one of the subscription, i.e. the
+//     KPM_SLICES of xapp-kpm-mon and the RC_KPM_SLICES of xapp-rc-ctrl.
+//   - RC control: slice level PRB quotas and handovers are acked after E2EMU_CTRL_DELAY_US.
+//     A quota scales the PRBs reported for its slice and a handover moves the UE to the
+//     destination slice, so a control shows in the next indications as with OAI.
+// The children print their counters every E2EMU_STATS_S seconds; SIGINT or SIGTERM stops them
+// all. bench/bench_e2_scale.sh drives the emulator and the xApps over growing loads.
+
+#include "../../../../src/agent/e2_agent_api.h"
+#include "../../../../src/sm/kpm_sm/kpm_data_ie_wrapper.h"
+#include "../../../../src/sm/rc_sm/ie/rc_data_ie.h"
+#include "../../../../src/util/alg_ds/ds/lock_guard/lock_guard.h"
+#include "../../../../src/util/byte_array.h"
+#include "../../../../src/util/time_now_us.h"
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define EMU_MAX_NODES 256
+#define EMU_MAX_SLICES 16
+
+// ======================================== Configuration ========================================
+
+typedef struct {
+  uint8_t sst;
+  uint32_t sd;
+} emu_slice_cfg_t;
+
+typedef struct {
+  size_t nodes;
+  uint32_t nb_id;
+  int mcc;
+  int mnc;
+  int mnc_digit_len;
+  size_t slice_len;
+  emu_slice_cfg_t slice[EMU_MAX_SLICES];
+  size_t ues_per_slice;
+  uint32_t prb;             // PRBs of the cell, shared by the slices
+  int64_t ctrl_delay_us;
+  int stats_s;
+  int spawn_ms;             // Between two node starts, not to storm the E2 setup of the RIC
+} emu_cfg_t;
+
+static emu_cfg_t emu_cfg = {
+  .nodes = 1,
+  .nb_id = 3584,
+  .mcc = 1,
+  .mnc = 1,
+  .mnc_digit_len = 2,
+  .ues_per_slice = 10,
+  .prb = 106,
+  .ctrl_delay_us = 0,
+  .stats_s = 10,
+  .spawn_ms = 50,
+};
+
+// 0x means hex and a plain number decimal, as the SD strings of xapp-rc-ctrl
+static
+uint32_t emu_sd_value(const char* str)
+{
+  if (strncmp(str, "0x", 2) == 0 || strncmp(str, "0X", 2) == 0)
+    return (uint32_t)strtoul(str, NULL, 16);
+  for (const char* p = str; *p != '\0'; p++) {
+    if (!isdigit((unsigned char)*p))
+      return (uint32_t)strtoul(str, NULL, 16);
+  }
+  return (uint32_t)strtoul(str, NULL, 10);
+}
+
+static
+void load_emu_cfg(emu_cfg_t* cfg)
+{
+  const char* nodes_str = getenv("E2EMU_NODES");
+  if (nodes_str && atoi(nodes_str) > 0) cfg->nodes = (size_t)atoi(nodes_str);
+  if (cfg->nodes > EMU_MAX_NODES) {
+    fprintf(stderr, "[E2EMU]: at most %d E2 nodes\n", EMU_MAX_NODES);
+    exit(EXIT_FAILURE);
+  }
+
+  const char* nb_id_str = getenv("E2EMU_NB_ID");
+  if (nb_id_str && atoi(nb_id_str) > 0) cfg->nb_id = (uint32_t)atoi(nb_id_str);
+
+  const char* mcc_str = getenv("E2EMU_MCC");
+  if (mcc_str) cfg->mcc = atoi(mcc_str);
+  const char* mnc_str = getenv("E2EMU_MNC");
+  if (mnc_str) {
+    cfg->mnc = atoi(mnc_str);
+    cfg->mnc_digit_len = strlen(mnc_str) == 3 ? 3 : 2;
+  }
+
+  const char* ues_str = getenv("E2EMU_UES_PER_SLICE");
+  if (ues_str && atoi(ues_str) >= 0) cfg->ues_per_slice = (size_t)atoi(ues_str);
+
+  const char* prb_str = getenv("E2EMU_PRB");
+  if (prb_str && atoi(prb_str) > 0) cfg->prb = (uint32_t)atoi(prb_str);
+
+  const char* delay_str = getenv("E2EMU_CTRL_DELAY_US");
+  if (delay_str && atoi(delay_str) >= 0) cfg->ctrl_delay_us = atoi(delay_str);
+
+  const char* stats_str = getenv("E2EMU_STATS_S");
+  if (stats_str && atoi(stats_str) >= 0) cfg->stats_s = atoi(stats_str);
+
+  const char* spawn_str = getenv("E2EMU_SPAWN_MS");
+  if (spawn_str && atoi(spawn_str) >= 0) cfg->spawn_ms = atoi(spawn_str);
+
+  // sst:sd,... as KPM_SLICES, the same three slices as OAI by default
+  const char* slices = getenv("E2EMU_SLICES");
+  if (slices == NULL || slices[0] == '\0')
+    slices = "1:0x000001,128:0x000080,5:0x000082";
+  char* dup = strdup(slices);
+  assert(dup != NULL && "Memory exhausted");
+  char* save = NULL;
+  for (char* tok = strtok_r(dup, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    char* colon = strchr(tok, ':');
+    if (colon == NULL || cfg->slice_len == EMU_MAX_SLICES) {
+      fprintf(stderr, "[E2EMU]: E2EMU_SLICES takes at most %d sst:sd entries, not %s\n", EMU_MAX_SLICES, slices);
+      exit(EXIT_FAILURE);
+    }
+    *colon = '\0';
+    while (isspace((unsigned char)*tok))
+      tok++;
+    cfg->slice[cfg->slice_len++] = (emu_slice_cfg_t){.sst = (uint8_t)atoi(tok), .sd = emu_sd_value(colon + 1)};
+  }
+  free(dup);
+}
+
+// ======================================== Configuration ========================================
+
+// ======================================== UE Model ========================================
+
+// The UEs of this node. Each slice gets ratio % of the cell PRBs (100 until an RC quota says
+// otherwise), shared evenly by its UEs with some noise; the other measurements follow the PRBs.
+// The indication and the control callbacks run on different agent threads.
+
+typedef struct {
+  uint64_t amf_ue_ngap_id;
+  uint64_t ran_ue_id;
+  size_t slice;
+} emu_ue_t;
+
+static struct {
+  pthread_mutex_t mtx;
+  uint32_t nb_id;
+  emu_ue_t* ue;
+  size_t ue_len;
+  int ratio[EMU_MAX_SLICES];
+  unsigned int seed;
+
+  _Atomic uint64_t indications;
+  _Atomic uint64_t ue_reports;
+  _Atomic uint64_t quotas;
+  _Atomic uint64_t handovers;
+  _Atomic uint64_t ctrl_unknown;
+} emu_node = {
+  .mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+void init_emu_node(size_t idx)
+{
+  emu_node.nb_id = emu_cfg.nb_id + (uint32_t)idx;
+  emu_node.seed = emu_node.nb_id;
+  emu_node.ue_len = emu_cfg.slice_len * emu_cfg.ues_per_slice;
+  emu_node.ue = calloc(emu_node.ue_len > 0 ? emu_node.ue_len : 1, sizeof(emu_ue_t));
+  assert(emu_node.ue != NULL && "Memory exhausted");
+
+  // AMF UE NGAP IDs unique over the nodes, so the xApps can tell the UEs apart
+  for (size_t i = 0; i < emu_node.ue_len; i++) {
+    emu_ue_t* ue = &emu_node.ue[i];
+    ue->amf_ue_ngap_id = ((uint64_t)(idx + 1) << 24) | i;
+    ue->ran_ue_id = i + 1;
+    ue->slice = i / emu_cfg.ues_per_slice;
+  }
+  for (size_t s = 0; s < emu_cfg.slice_len; s++)
+    emu_node.ratio[s] = 100;
+}
+
+// Call with emu_node.mtx held
+static
+double emu_noise(void)
+{
+  return 0.8 + 0.2 * (double)rand_r(&emu_node.seed) / RAND_MAX;
+}
+
+// One record of measurement name for a UE getting prb PRBs
+static
+meas_record_lst_t emu_meas_record(byte_array_t name, double prb, uint32_t period_ms)
+{
+  meas_record_lst_t r = {0};
+  // Same value types as OAI: PRB and PDCP volume are integers, delay and throughput reals
+  double const thp_kbps = prb * 250.0;
+  if (cmp_str_ba("RRU.PrbTotDl", name) == 0) {
+    r.value = INTEGER_MEAS_VALUE;
+    r.int_val = (uint32_t)prb;
+  } else if (cmp_str_ba("RRU.PrbTotUl", name) == 0) {
+    r.value = INTEGER_MEAS_VALUE;
+    r.int_val = (uint32_t)(prb / 4);
+  } else if (cmp_str_ba("DRB.PdcpSduVolumeDL", name) == 0) {
+    r.value = INTEGER_MEAS_VALUE;
+    r.int_val = (uint32_t)(thp_kbps * period_ms / 8000.0);
+  } else if (cmp_str_ba("DRB.PdcpSduVolumeUL", name) == 0) {
+    r.value = INTEGER_MEAS_VALUE;
+    r.int_val = (uint32_t)(thp_kbps * period_ms / 32000.0);
+  } else if (cmp_str_ba("DRB.RlcSduDelayDl", name) == 0) {
+    r.value = REAL_MEAS_VALUE;
+    r.real_val = prb > 0 ? 1000.0 / prb : 1000.0;
+  } else if (cmp_str_ba("DRB.UEThpDl", name) == 0) {
+    r.value = REAL_MEAS_VALUE;
+    r.real_val = thp_kbps;
+  } else if (cmp_str_ba("DRB.UEThpUl", name) == 0) {
+    r.value = REAL_MEAS_VALUE;
+    r.real_val = thp_kbps / 4;
+  } else {
+    r.value = INTEGER_MEAS_VALUE;
+    r.int_val = 0;
+  }
+  return r;
+}
+
+// ======================================== UE Model ========================================
+
+// ======================================== KPM RAN Function ========================================
+
+static const char* const emu_kpm_meas[] = {
+  "RRU.PrbTotDl",
+  "RRU.PrbTotUl",
+  "DRB.PdcpSduVolumeDL",
+  "DRB.PdcpSduVolumeUL",
+  "DRB.RlcSduDelayDl",
+  "DRB.UEThpDl",
+  "DRB.UEThpUl",
+};
+
+#define EMU_KPM_MEAS_LEN (sizeof(emu_kpm_meas) / sizeof(emu_kpm_meas[0]))
+
+// Report style 4 of the measurements above, periodic event trigger
+static
+kpm_ran_function_def_t gen_emu_kpm_ran_func_def(void)
+{
+  // The RAN function name is filled by the KPM service model of the agent
+  kpm_ran_function_def_t def = {0};
+
+  def.sz_ric_event_trigger_style_list = 1;
+  def.ric_event_trigger_style_list = calloc(1, sizeof(ric_event_trigger_style_item_t));
+  assert(def.ric_event_trigger_style_list != NULL && "Memory exhausted");
+  def.ric_event_trigger_style_list[0].style_type = STYLE_1_RIC_EVENT_TRIGGER;
+  def.ric_event_trigger_style_list[0].style_name = cp_str_to_ba("Periodic report");
+  def.ric_event_trigger_style_list[0].format_type = FORMAT_1_RIC_EVENT_TRIGGER;
+
+  def.sz_ric_report_style_list = 1;
+  def.ric_report_style_list = calloc(1, sizeof(ric_report_style_item_t));
+  assert(def.ric_report_style_list != NULL && "Memory exhausted");
+  ric_report_style_item_t* report = &def.ric_report_style_list[0];
+  report->report_style_type = STYLE_4_RIC_SERVICE_REPORT;
+  report->report_style_name = cp_str_to_ba("Common condition-based, UE-level measurement");
+  report->act_def_format_type = FORMAT_4_ACTION_DEFINITION;
+  report->ind_hdr_format_type = FORMAT_1_INDICATION_HEADER;
+  report->ind_msg_format_type = FORMAT_3_INDICATION_MESSAGE;
+  report->meas_info_for_action_lst_len = EMU_KPM_MEAS_LEN;
+  report->meas_info_for_action_lst = calloc(EMU_KPM_MEAS_LEN, sizeof(meas_info_for_action_lst_t));
+  assert(report->meas_info_for_action_lst != NULL && "Memory exhausted");
+  for (size_t i = 0; i < EMU_KPM_MEAS_LEN; i++)
+    report->meas_info_for_action_lst[i].name = cp_str_to_ba(emu_kpm_meas[i]);
+
+  return def;
+}
+
+static
+void read_emu_kpm_setup(void* data)
+{
+  assert(data != NULL);
+  kpm_e2_setup_t* kpm = (kpm_e2_setup_t*)data;
+  kpm->ran_func_def = gen_emu_kpm_ran_func_def();
+}
+
+// Index of the slice the S-NSSAI condition of the action definition matches, or -1
+static
+int find_emu_slice(kpm_act_def_format_4_t const* frm_4)
+{
+  for (size_t i = 0; i < frm_4->matching_cond_lst_len; i++) {
+    test_info_lst_t const* test = &frm_4->matching_cond_lst[i].test_info_lst;
+    if (test->test_cond_type != S_NSSAI_TEST_COND_TYPE || test->test_cond_value == NULL
+        || test->test_cond_value->octet_string_value == NULL)
+      continue;
+    // sst, then sd on 3 bytes, as filter_predicate() of the xApps
+    byte_array_t const* v = test->test_cond_value->octet_string_value;
+    if (v->len < 1)
+      continue;
+    uint8_t const sst = v->buf[0];
+    uint32_t const sd = v->len >= 4 ? ((uint32_t)v->buf[1] << 16) | ((uint32_t)v->buf[2] << 8) | v->buf[3] : 0xffffff;
+    for (size_t s = 0; s < emu_cfg.slice_len; s++) {
+      if (emu_cfg.slice[s].sst == sst && (v->len < 4 || emu_cfg.slice[s].sd == sd))
+        return (int)s;
+    }
+  }
+  return -1;
+}
+
+// Format 1 report of one UE, with the measurements of the action definition in its order
+static
+void fill_emu_ue_report(meas_report_per_ue_t* dst, emu_ue_t const* ue, kpm_act_def_format_1_t const* frm_1, double prb)
+{
+  dst->ue_meas_report_lst.type = GNB_UE_ID_E2SM;
+  dst->ue_meas_report_lst.gnb.amf_ue_ngap_id = ue->amf_ue_ngap_id;
+  dst->ue_meas_report_lst.gnb.ran_ue_id = calloc(1, sizeof(uint64_t));
+  assert(dst->ue_meas_report_lst.gnb.ran_ue_id != NULL && "Memory exhausted");
+  *dst->ue_meas_report_lst.gnb.ran_ue_id = ue->ran_ue_id;
+
+  kpm_ind_msg_format_1_t* msg = &dst->ind_msg_format_1;
+  size_t const len = frm_1->meas_info_lst_len;
+  msg->meas_info_lst_len = len;
+  msg->meas_info_lst = calloc(len, sizeof(meas_info_format_1_lst_t));
+  assert(msg->meas_info_lst != NULL && "Memory exhausted");
+  msg->meas_data_lst_len = 1;
+  msg->meas_data_lst = calloc(1, sizeof(meas_data_lst_t));
+  assert(msg->meas_data_lst != NULL && "Memory exhausted");
+  msg->meas_data_lst[0].meas_record_len = len;
+  msg->meas_data_lst[0].meas_record_lst = calloc(len, sizeof(meas_record_lst_t));
+  assert(msg->meas_data_lst[0].meas_record_lst != NULL && "Memory exhausted");
+
+  for (size_t i = 0; i < len; i++) {
+    meas_info_format_1_lst_t* info = &msg->meas_info_lst[i];
+    info->meas_type.type = NAME_MEAS_TYPE;
+    info->meas_type.name = copy_byte_array(frm_1->meas_info_lst[i].meas_type.name);
+    info->label_info_lst_len = 1;
+    info->label_info_lst = calloc(1, sizeof(label_info_lst_t));
+    assert(info->label_info_lst != NULL && "Memory exhausted");
+    info->label_info_lst[0].noLabel = calloc(1, sizeof(enum_value_e));
+    assert(info->label_info_lst[0].noLabel != NULL && "Memory exhausted");
+    *info->label_info_lst[0].noLabel = TRUE_ENUM_VALUE;
+
+    msg->meas_data_lst[0].meas_record_lst[i] = emu_meas_record(info->meas_type.name, prb, frm_1->gran_period_ms);
+  }
+}
+
+// Called by the agent every report period of a subscription; the agent encodes and frees kpm->ind
+static
+bool read_emu_kpm(void* data)
+{
+  assert(data != NULL);
+  kpm_rd_ind_data_t* kpm = (kpm_rd_ind_data_t*)data;
+  assert(kpm->act_def != NULL && "Cannot be NULL");
+
+  if (kpm->act_def->type != FORMAT_4_ACTION_DEFINITION) {
+    static _Atomic bool warned = false;
+    if (!atomic_exchange(&warned, true))
+      fprintf(stderr, "[E2EMU]: nb_id = %u only reports action definition format 4\n", emu_node.nb_id);
+    return false;
+  }
+
+  kpm_act_def_format_4_t const* frm_4 = &kpm->act_def->frm_4;
+  int const slice = find_emu_slice(frm_4);
+
+  kpm->ind.hdr.type = FORMAT_1_INDICATION_HEADER;
+  // In μs, as the xApps read it
+  kpm->ind.hdr.kpm_ric_ind_hdr_format_1.collectStartTime = (uint64_t)time_now_us();
+  kpm->ind.msg.type = FORMAT_3_INDICATION_MESSAGE;
+  kpm_ind_msg_format_3_t* msg = &kpm->ind.msg.frm_3;
+
+  lock_guard(&emu_node.mtx);
+  size_t n = 0;
+  for (size_t i = 0; i < emu_node.ue_len; i++)
+    n += slice >= 0 && emu_node.ue[i].slice == (size_t)slice;
+
+  // OAI sends no indication when no UE matches
+  if (n == 0)
+    return false;
+
+  msg->ue_meas_report_lst_len = n;
+  msg->meas_report_per_ue = calloc(n, sizeof(meas_report_per_ue_t));
+  assert(msg->meas_report_per_ue != NULL && "Memory exhausted");
+
+  double const prb_per_ue = (double)emu_cfg.prb * emu_node.ratio[slice] / 100.0 / n;
+  size_t j = 0;
+  for (size_t i = 0; i < emu_node.ue_len; i++) {
+    if (emu_node.ue[i].slice != (size_t)slice)
+      continue;
+    fill_emu_ue_report(&msg->meas_report_per_ue[j++], &emu_node.ue[i], &frm_4->action_def_format_1, prb_per_ue * emu_noise());
+  }
+
+  atomic_fetch_add(&emu_node.indications, 1);
+  atomic_fetch_add(&emu_node.ue_reports, n);
+  return true;
+}
+
+// ======================================== KPM RAN Function ========================================
+
+// ======================================== RC RAN Function ========================================
+
+// The RIC and the xApps only need the RAN function to be announced, with the name of the RC
+// service model of FlexRIC; the control styles are recognised when the controls come
+static
+void read_emu_rc_setup(void* data)
+{
+  assert(data != NULL);
+  rc_e2_setup_t* rc = (rc_e2_setup_t*)data;
+  rc->ran_func_def.name.name_short = cp_str_to_ba("ORAN-E2SM-RC");
+  rc->ran_func_def.name.name_e2sm_oid = cp_str_to_ba("1.3.6.1.4.1.53148.1.1.2.3");
+  rc->ran_func_def.name.name_description = cp_str_to_ba("RAN Control");
+}
+
+// RAN parameter IDs of xapp-rc-ctrl (8.4.3.6 of E2SM-RC and its handover template)
+#define EMU_RC_SST 8
+#define EMU_RC_SD 9
+#define EMU_RC_DEDICATED_RATIO 12
+#define EMU_RC_HO_DEST_SST 3
+#define EMU_RC_HO_DEST_SD 4
+
+typedef struct {
+  bool has_sst;
+  bool has_sd;
+  bool has_ratio;
+  char sst[16];
+  char sd[16];
+  int ratio;
+} emu_rc_leaves_t;
+
+static
+void find_emu_rc_leaves(seq_ran_param_t const* p, size_t len, uint32_t sst_id, uint32_t sd_id, emu_rc_leaves_t* out);
+
+static
+void find_emu_rc_leaf(seq_ran_param_t const* p, uint32_t sst_id, uint32_t sd_id, emu_rc_leaves_t* out)
+{
+  ran_parameter_value_t const* leaf = NULL;
+  if (p->ran_param_val.type == ELEMENT_KEY_FLAG_FALSE_RAN_PARAMETER_VAL_TYPE)
+    leaf = p->ran_param_val.flag_false;
+  else if (p->ran_param_val.type == ELEMENT_KEY_FLAG_TRUE_RAN_PARAMETER_VAL_TYPE)
+    leaf = p->ran_param_val.flag_true;
+
+  if (leaf != NULL) {
+    if (leaf->type == OCTET_STRING_RAN_PARAMETER_VALUE && (p->ran_param_id == sst_id || p->ran_param_id == sd_id)) {
+      char* dst = p->ran_param_id == sst_id ? out->sst : out->sd;
+      size_t const n = leaf->octet_str_ran.len < 15 ? leaf->octet_str_ran.len : 15;
+      memcpy(dst, leaf->octet_str_ran.buf, n);
+      dst[n] = '\0';
+      if (p->ran_param_id == sst_id)
+        out->has_sst = true;
+      else
+        out->has_sd = true;
+    } else if (leaf->type == INTEGER_RAN_PARAMETER_VALUE && p->ran_param_id == EMU_RC_DEDICATED_RATIO) {
+      out->ratio = (int)leaf->int_ran;
+      out->has_ratio = true;
+    }
+  } else if (p->ran_param_val.type == STRUCTURE_RAN_PARAMETER_VAL_TYPE && p->ran_param_val.strct != NULL) {
+    ran_param_struct_t const* strct = p->ran_param_val.strct;
+    find_emu_rc_leaves(strct->ran_param_struct, strct->sz_ran_param_struct, sst_id, sd_id, out);
+  } else if (p->ran_param_val.type == LIST_RAN_PARAMETER_VAL_TYPE && p->ran_param_val.lst != NULL) {
+    ran_param_list_t const* lst = p->ran_param_val.lst;
+    for (size_t i = 0; i < lst->sz_lst_ran_param; i++) {
+      ran_param_struct_t const* item = &lst->lst_ran_param[i].ran_param_struct;
+      find_emu_rc_leaves(item->ran_param_struct, item->sz_ran_param_struct, sst_id, sd_id, out);
+    }
+  }
+}
+
+static
+void find_emu_rc_leaves(seq_ran_param_t const* p, size_t len, uint32_t sst_id, uint32_t sd_id, emu_rc_leaves_t* out)
+{
+  for (size_t i = 0; i < len; i++)
+    find_emu_rc_leaf(&p[i], sst_id, sd_id, out);
+}
+
+// Call with emu_node.mtx held
+static
+int find_emu_slice_str(emu_rc_leaves_t const* l)
+{
+  if (!l->has_sst || !l->has_sd)
+    return -1;
+  uint8_t const sst = (uint8_t)atoi(l->sst);
+  uint32_t const sd = emu_sd_value(l->sd);
+  for (size_t s = 0; s < emu_cfg.slice_len; s++) {
+    if (emu_cfg.slice[s].sst == sst && emu_cfg.slice[s].sd == sd)
+      return (int)s;
+  }
+  return -1;
+}
+
+// Slice level PRB quota: one RRM Policy Ratio Group per slice in the RRM Policy Ratio List
+static
+void apply_emu_prb_quota(e2sm_rc_ctrl_msg_frmt_1_t const* msg)
+{
+  for (size_t i = 0; i < msg->sz_ran_param; i++) {
+    seq_ran_param_t const* list = &msg->ran_param[i];
+    if (list->ran_param_val.type != LIST_RAN_PARAMETER_VAL_TYPE || list->ran_param_val.lst == NULL)
+      continue;
+    for (size_t j = 0; j < list->ran_param_val.lst->sz_lst_ran_param; j++) {
+      ran_param_struct_t const* grp = &list->ran_param_val.lst->lst_ran_param[j].ran_param_struct;
+      emu_rc_leaves_t l = {0};
+      find_emu_rc_leaves(grp->ran_param_struct, grp->sz_ran_param_struct, EMU_RC_SST, EMU_RC_SD, &l);
+
+      lock_guard(&emu_node.mtx);
+      int const s = find_emu_slice_str(&l);
+      if (s >= 0 && l.has_ratio)
+        emu_node.ratio[s] = l.ratio < 0 ? 0 : l.ratio > 100 ? 100 : l.ratio;
+    }
+  }
+  atomic_fetch_add(&emu_node.quotas, 1);
+}
+
+// Handover to the destination slice of the message
+static
+void apply_emu_handover(ue_id_e2sm_t const* ue_id, e2sm_rc_ctrl_msg_frmt_1_t const* msg)
+{
+  emu_rc_leaves_t l = {0};
+  find_emu_rc_leaves(msg->ran_param, msg->sz_ran_param, EMU_RC_HO_DEST_SST, EMU_RC_HO_DEST_SD, &l);
+
+  lock_guard(&emu_node.mtx);
+  int const s = find_emu_slice_str(&l);
+  if (s < 0 || ue_id->type != GNB_UE_ID_E2SM) {
+    atomic_fetch_add(&emu_node.ctrl_unknown, 1);
+    return;
+  }
+  for (size_t i = 0; i < emu_node.ue_len; i++) {
+    if (emu_node.ue[i].amf_ue_ngap_id == ue_id->gnb.amf_ue_ngap_id) {
+      emu_node.ue[i].slice = (size_t)s;
+      atomic_fetch_add(&emu_node.handovers, 1);
+      return;
+    }
+  }
+  atomic_fetch_add(&emu_node.ctrl_unknown, 1);
+}
+
+static
+sm_ag_if_ans_t write_emu_rc_ctrl(void const* data)
+{
+  assert(data != NULL);
+  rc_ctrl_req_data_t const* ctrl = (rc_ctrl_req_data_t const*)data;
+
+  if (emu_cfg.ctrl_delay_us > 0)
+    usleep((useconds_t)emu_cfg.ctrl_delay_us);
+
+  if (ctrl->hdr.format == FORMAT_1_E2SM_RC_CTRL_HDR && ctrl->msg.format == FORMAT_1_E2SM_RC_CTRL_MSG) {
+    e2sm_rc_ctrl_hdr_frmt_1_t const* hdr = &ctrl->hdr.frmt_1;
+    // Style 2 action 6: slice level PRB quota; style 3 action 1: handover
+    if (hdr->ric_style_type == 2 && hdr->ctrl_act_id == 6)
+      apply_emu_prb_quota(&ctrl->msg.frmt_1);
+    else if (hdr->ric_style_type == 3 && hdr->ctrl_act_id == 1)
+      apply_emu_handover(&hdr->ue_id, &ctrl->msg.frmt_1);
+    else
+      atomic_fetch_add(&emu_node.ctrl_unknown, 1);
+  } else {
+    atomic_fetch_add(&emu_node.ctrl_unknown, 1);
+  }
+
+  // Acked whatever it is, as OAI does
+  sm_ag_if_ans_t ans = {.type = CTRL_OUTCOME_SM_AG_IF_ANS_V0};
+  ans.ctrl_out.type = RAN_CTRL_V1_3_AGENT_IF_CTRL_ANS_V0;
+  return ans;
+}
+
+// ======================================== RC RAN Function ========================================
+
+// ======================================== E2 Node ========================================
+
+#if defined(E2AP_V2) || defined(E2AP_V3)
+// E2 node component of the E2 setup, required since E2AP v2; the content is not checked
+static
+void read_emu_setup_ran(void* data, const ngran_node_t node_type)
+{
+  assert(data != NULL);
+  (void)node_type;
+  arr_node_component_config_add_t* dst = (arr_node_component_config_add_t*)data;
+
+  dst->len_cca = 1;
+  dst->cca = calloc(1, sizeof(e2ap_node_component_config_add_t));
+  assert(dst->cca != NULL && "Memory exhausted");
+  dst->cca[0].e2_node_comp_interface_type = NG_E2AP_NODE_COMP_INTERFACE_TYPE;
+  dst->cca[0].e2_node_comp_id.type = NG_E2AP_NODE_COMP_INTERFACE_TYPE;
+  dst->cca[0].e2_node_comp_id.ng_amf_name = cp_str_to_ba("nginterf");
+  dst->cca[0].e2_node_comp_conf.request = cp_str_to_ba("ngrequest");
+  dst->cca[0].e2_node_comp_conf.response = cp_str_to_ba("ngresponse");
+}
+#endif
+
+static
+sm_io_ag_ran_t init_emu_io(void)
+{
+  sm_io_ag_ran_t io = {0};
+  io.read_ind_tbl[KPM_STATS_V3_0] = read_emu_kpm;
+  io.read_setup_tbl[KPM_V3_0_AGENT_IF_E2_SETUP_ANS_V0] = read_emu_kpm_setup;
+  io.read_setup_tbl[RAN_CTRL_V1_3_AGENT_IF_E2_SETUP_ANS_V0] = read_emu_rc_setup;
+  io.write_ctrl_tbl[RAN_CONTROL_CTRL_V1_03] = write_emu_rc_ctrl;
+#if defined(E2AP_V2) || defined(E2AP_V3)
+  io.read_setup_ran = read_emu_setup_ran;
+#endif
+  return io;
+}
+
+static
+void print_emu_stats(int64_t elapsed_us)
+{
+  double const s = elapsed_us / 1e6;
+  uint64_t const ind = atomic_load(&emu_node.indications);
+  uint64_t const ues = atomic_load(&emu_node.ue_reports);
+  printf("[E2EMU]: nb_id = %u: %lu indications (%.1f/s), %lu UE reports (%.1f/s), %lu PRB quotas, %lu handovers, %lu other controls\n",
+         emu_node.nb_id, ind, ind / s, ues, ues / s, atomic_load(&emu_node.quotas), atomic_load(&emu_node.handovers),
+         atomic_load(&emu_node.ctrl_unknown));
+  fflush(stdout);
+}
+
+// One E2 node, until SIGINT or SIGTERM; signal_set is blocked already
+static
+int run_emu_node(size_t idx, fr_args_t const* args, sigset_t const* signal_set)
+{
+  init_emu_node(idx);
+  sm_io_ag_ran_t const io = init_emu_io();
+  init_agent_api(emu_cfg.mcc, emu_cfg.mnc, emu_cfg.mnc_digit_len, (int)emu_node.nb_id, 0, ngran_gNB, io, args);
+  printf("[E2EMU]: E2 node nb_id = %u up with %zu UEs\n", emu_node.nb_id, emu_node.ue_len);
+  fflush(stdout);
+
+  int64_t const start = time_now_us();
+  struct timespec const period = {.tv_sec = emu_cfg.stats_s > 0 ? emu_cfg.stats_s : 3600};
+  for (;;) {
+    int const sig = sigtimedwait(signal_set, NULL, &period);
+    if (sig == SIGINT || sig == SIGTERM)
+      break;
+    if (emu_cfg.stats_s > 0)
+      print_emu_stats(time_now_us() - start);
+  }
+
+  print_emu_stats(time_now_us() - start);
+  stop_agent_api();
+  free(emu_node.ue);
+  return EXIT_SUCCESS;
+}
+
+// ======================================== E2 Node ========================================
+
+int main(int argc, char *argv[])
+{
+  fr_args_t args = init_fr_args(argc, argv);
+  load_emu_cfg(&emu_cfg);
+
+  // Blocked before the agents start their threads; the children inherit the mask
+  sigset_t signal_set;
+  sigemptyset(&signal_set);
+  sigaddset(&signal_set, SIGINT);
+  sigaddset(&signal_set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
+
+  printf("[E2EMU]: %zu E2 nodes from nb_id = %u, %zu slices x %zu UEs each, %u PRBs\n",
+         emu_cfg.nodes, emu_cfg.nb_id, emu_cfg.slice_len, emu_cfg.ues_per_slice, emu_cfg.prb);
+  fflush(stdout);
+
+  if (emu_cfg.nodes == 1)
+    return run_emu_node(0, &args, &signal_set);
+
+  pid_t child[EMU_MAX_NODES] = {0};
+  size_t started = 0;
+  for (; started < emu_cfg.nodes; started++) {
+    pid_t const pid = fork();
+    if (pid < 0) {
+      perror("[E2EMU]: fork");
+      break;
+    }
+    if (pid == 0)
+      return run_emu_node(started, &args, &signal_set);
+    child[started] = pid;
+    usleep((useconds_t)emu_cfg.spawn_ms * 1000);
+  }
+
+  int sig = 0;
+  if (started == emu_cfg.nodes)
+    sigwait(&signal_set, &sig);
+
+  for (size_t i = 0; i < started; i++)
+    kill(child[i], SIGTERM);
+  for (size_t i = 0; i < started; i++)
+    waitpid(child[i], NULL, 0);
+
+  printf("[E2EMU]: %zu E2 nodes stopped\n", started);
+  return started == emu_cfg.nodes ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,324 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Per-indication cost of decoding a synthetic KPM format 3 indication.
+//
+// Build it next to the xApp inside the FlexRIC tree, with the same libraries as
+// xapp_kpm_moni_3slices, and run:
+//   ./bench_kpm_decode [num_ues] [iterations] [nodes ...]
+//
+// Three paths are timed over the same indication:
+//   strcmp chain - the former per-record name comparison, kept here as the baseline
+//   slot decode  - decode_kpm_ind_frm_3(), names resolved once per subscription
+//   sm_cb_kpm    - slot decode + UE table + sliding windows + shared snapshot + record ring push,
+//                  i.e. the whole callback
+//
+// Then, for every node count (default 1 4 16), one thread per emulated E2 node feeds its own
+// indications through sm_cb_kpm() while db_writer_thread drains the rings, first with every
+// node in a single shard (one lock, as before the shards) and then with a shard per node.
+// Each line gives the throughput of all the nodes together and the p99 lock wait.
+
+#define KPM_MON_BENCH
+#include "../src/xapp_kpm_moni_3slices.c"
+
+static
+void fill_synth_ue_report(meas_report_per_ue_t* ue, size_t i, size_t first_ue)
+{
+  ue->ue_meas_report_lst.type = GNB_UE_ID_E2SM;
+  ue->ue_meas_report_lst.gnb.amf_ue_ngap_id = first_ue + i + 1;
+  ue->ue_meas_report_lst.gnb.ran_ue_id = calloc(1, sizeof(uint64_t));
+  assert(ue->ue_meas_report_lst.gnb.ran_ue_id != NULL && "Memory exhausted");
+  *ue->ue_meas_report_lst.gnb.ran_ue_id = 0x1000 + i;
+
+  kpm_ind_msg_format_1_t* frm_1 = &ue->ind_msg_format_1;
+
+  frm_1->meas_info_lst_len = END_KPM_MEAS;
+  frm_1->meas_info_lst = calloc(END_KPM_MEAS, sizeof(meas_info_format_1_lst_t));
+  assert(frm_1->meas_info_lst != NULL && "Memory exhausted");
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    meas_info_format_1_lst_t* info = &frm_1->meas_info_lst[k];
+    info->meas_type.type = NAME_MEAS_TYPE;
+    info->meas_type.name = cp_str_to_ba(kpm_meas_name[k]);
+    info->label_info_lst_len = 1;
+    info->label_info_lst = calloc(1, sizeof(label_info_lst_t));
+    assert(info->label_info_lst != NULL && "Memory exhausted");
+    info->label_info_lst[0] = fill_kpm_label();
+  }
+
+  frm_1->meas_data_lst_len = 1;
+  frm_1->meas_data_lst = calloc(1, sizeof(meas_data_lst_t));
+  assert(frm_1->meas_data_lst != NULL && "Memory exhausted");
+  meas_data_lst_t* data = &frm_1->meas_data_lst[0];
+  data->meas_record_len = END_KPM_MEAS;
+  data->meas_record_lst = calloc(END_KPM_MEAS, sizeof(meas_record_lst_t));
+  assert(data->meas_record_lst != NULL && "Memory exhausted");
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    // Same value types as OAI: PRB and PDCP volume are integers, delay and throughput reals
+    if (k <= DRB_PDCP_SDU_VOLUME_UL) {
+      data->meas_record_lst[k].value = INTEGER_MEAS_VALUE;
+      data->meas_record_lst[k].int_val = (uint32_t)(i * 10 + k);
+    } else {
+      data->meas_record_lst[k].value = REAL_MEAS_VALUE;
+      data->meas_record_lst[k].real_val = (double)i + k * 0.25;
+    }
+  }
+}
+
+// UEs first_ue + 1 .. first_ue + num_ues
+static
+kpm_ind_data_t gen_synth_ind(size_t num_ues, size_t first_ue)
+{
+  kpm_ind_data_t ind = {0};
+
+  ind.hdr.type = FORMAT_1_INDICATION_HEADER;
+  ind.hdr.kpm_ric_ind_hdr_format_1.collectStartTime = (uint64_t)time_now_us();
+
+  ind.msg.type = FORMAT_3_INDICATION_MESSAGE;
+  ind.msg.frm_3.ue_meas_report_lst_len = num_ues;
+  ind.msg.frm_3.meas_report_per_ue = calloc(num_ues, sizeof(meas_report_per_ue_t));
+  assert(ind.msg.frm_3.meas_report_per_ue != NULL && "Memory exhausted");
+  for (size_t i = 0; i < num_ues; i++)
+    fill_synth_ue_report(&ind.msg.frm_3.meas_report_per_ue[i], i, first_ue);
+
+  return ind;
+}
+
+// The decode loop as it was before slot resolution
+static
+void decode_strcmp_chain(kpm_ind_msg_format_3_t const* msg_frm_3, kpi_metrics_t* out)
+{
+  for (size_t i = 0; i < msg_frm_3->ue_meas_report_lst_len; i++) {
+    kpm_ind_msg_format_1_t const* msg_frm_1 = &msg_frm_3->meas_report_per_ue[i].ind_msg_format_1;
+    kpi_metrics_t* m = &out[i];
+
+    for (size_t j = 0; j < msg_frm_1->meas_data_lst_len; j++) {
+      meas_data_lst_t const data_item = msg_frm_1->meas_data_lst[j];
+      for (size_t z = 0; z < data_item.meas_record_len; z++) {
+        byte_array_t const name = msg_frm_1->meas_info_lst[z].meas_type.name;
+        meas_record_lst_t const r = data_item.meas_record_lst[z];
+
+        if (cmp_str_ba("RRU.PrbTotDl", name) == 0) {
+          m->meas[RRU_PRB_TOT_DL] = (double)r.int_val;
+        } else if (cmp_str_ba("RRU.PrbTotUl", name) == 0) {
+          m->meas[RRU_PRB_TOT_UL] = (double)r.int_val;
+        } else if (cmp_str_ba("DRB.PdcpSduVolumeDL", name) == 0) {
+          m->meas[DRB_PDCP_SDU_VOLUME_DL] = (double)r.int_val;
+        } else if (cmp_str_ba("DRB.PdcpSduVolumeUL", name) == 0) {
+          m->meas[DRB_PDCP_SDU_VOLUME_UL] = (double)r.int_val;
+        } else if (cmp_str_ba("DRB.RlcSduDelayDl", name) == 0) {
+          m->meas[DRB_RLC_SDU_DELAY_DL] = r.real_val;
+        } else if (cmp_str_ba("DRB.UEThpDl", name) == 0) {
+          m->meas[DRB_UE_THP_DL] = r.real_val;
+        } else if (cmp_str_ba("DRB.UEThpUl", name) == 0) {
+          m->meas[DRB_UE_THP_UL] = r.real_val;
+        }
+      }
+    }
+  }
+}
+
+static
+void print_result(const char* name, int64_t elapsed_us, size_t iter, size_t num_ues)
+{
+  double const per_ind_us = (double)elapsed_us / iter;
+  printf("%-14s %10.2f [μs/indication] %8.1f [ns/UE]\n", name, per_ind_us, per_ind_us * 1000.0 / num_ues);
+}
+
+typedef struct {
+  pthread_t thread;
+  pthread_barrier_t* start;
+  sm_ag_if_rd_t rd;
+  kpm_sub_ctx_t* ctx;
+  size_t iter;
+} scale_node_t;
+
+static
+void* scale_node_thread(void* arg)
+{
+  scale_node_t* n = arg;
+  pthread_barrier_wait(n->start);
+  for (size_t it = 0; it < n->iter; it++)
+    sm_cb_kpm(&n->rd, n->ctx);
+  return NULL;
+}
+
+// nodes E2 nodes with num_ues UEs each, in shards shards; one line of the result table
+static
+void run_scale(size_t nodes, size_t shards, size_t num_ues, size_t iter, char* line, size_t line_sz)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%zu", shards);
+  setenv("KPM_SHARDS", buf, 1);
+  // A shard holds the UEs of all its nodes
+  snprintf(buf, sizeof(buf), "%zu", num_ues * ((nodes + shards - 1) / shards));
+  setenv("KPM_UE_TABLE_SIZE", buf, 1);
+
+  memset(&kpm_metrics, 0, sizeof(kpm_metrics));
+  memset(kpm_sub_ctx, 0, sizeof(kpm_sub_ctx));
+  kpm_sub_ctx_len = 0;
+  init_kpm_shards();
+  init_kpm_agg(&kpm_agg, kpm_shards_ue_cap());
+  init_kpm_shm(&kpm_shm, kpm_shards_ue_cap());
+  start_db_writer(kpm_shard_len);
+
+  pthread_barrier_t start;
+  pthread_barrier_init(&start, NULL, (unsigned)nodes + 1);
+  scale_node_t* node = calloc(nodes, sizeof(scale_node_t));
+  assert(node != NULL && "Memory exhausted");
+  for (size_t i = 0; i < nodes; i++) {
+    scale_node_t* n = &node[i];
+    n->start = &start;
+    n->rd = (sm_ag_if_rd_t){.type = INDICATION_MSG_AGENT_IF_ANS_V0};
+    n->rd.ind.type = KPM_STATS_V3_0;
+    n->rd.ind.kpm.ind = gen_synth_ind(num_ues, i * num_ues);
+    n->ctx = &kpm_sub_ctx[add_kpm_sub_ctx(i, (uint32_t)i + 1, &kpm_cfg.slice[0])];
+    n->iter = iter;
+    int const rc = pthread_create(&n->thread, NULL, scale_node_thread, n);
+    assert(rc == 0);
+  }
+
+  pthread_barrier_wait(&start);
+  int64_t const t0 = time_now_us();
+  for (size_t i = 0; i < nodes; i++)
+    pthread_join(node[i].thread, NULL);
+  double const elapsed = (time_now_us() - t0) / 1e6;
+  // The writer drains what is left in the rings
+  stop_db_writer();
+
+  kpm_hist_t lock_wait;
+  kpm_hist_merge(&lock_wait, kpm_metrics.lock_wait);
+  double const inds = (double)nodes * iter;
+  snprintf(line, line_sz, "%5zu %6zu %12.1f %14.1f %14.2f\n", nodes, shards, inds / elapsed, inds * num_ues / elapsed,
+           kpm_hist_quantile(&lock_wait, 0.99) / 1e3);
+
+  for (size_t i = 0; i < nodes; i++)
+    free_kpm_ind_data(&node[i].rd.ind.kpm.ind);
+  free(node);
+  pthread_barrier_destroy(&start);
+  close_kpm_shm(&kpm_shm);
+  free_kpm_agg(&kpm_agg);
+  free_kpm_shards();
+}
+
+int main(int argc, char* argv[])
+{
+  size_t const num_ues = argc > 1 ? (size_t)atoi(argv[1]) : 1000;
+  size_t const iter = argc > 2 ? (size_t)atoi(argv[2]) : 1000;
+  assert(num_ues > 0 && iter > 0);
+
+  // Every UE must fit in the table and every row of one indication in the ring
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%zu", num_ues);
+  setenv("KPM_UE_TABLE_SIZE", buf, 0);
+  setenv("DB_RING_SIZE", buf, 0);
+  setenv("KPM_SHM_NAME", "/kpm_mon_bench", 0);
+  setenv("KPM_SHARDS", "1", 1);
+
+  load_kpm_mon_cfg(&kpm_cfg);
+
+  // The single-threaded paths drain the ring of the only shard themselves
+  init_kpm_shards();
+  init_kpm_ring(&kpm_ring[0]);
+  kpm_ring_len = 1;
+  kpm_shard_t* sh = &kpm_shard[0];
+
+  init_kpm_agg(&kpm_agg, kpm_shards_ue_cap());
+  init_kpm_shm(&kpm_shm, kpm_shards_ue_cap());
+  kpm_sub_ctx_t* ctx = &kpm_sub_ctx[add_kpm_sub_ctx(0, 0, &kpm_cfg.slice[0])];
+
+  sm_ag_if_rd_t rd = {.type = INDICATION_MSG_AGENT_IF_ANS_V0};
+  rd.ind.type = KPM_STATS_V3_0;
+  rd.ind.kpm.ind = gen_synth_ind(num_ues, 0);
+  kpm_ind_msg_format_3_t const* msg_frm_3 = &rd.ind.kpm.ind.msg.frm_3;
+
+  printf("Decoding a format 3 indication with %zu UEs x %d measurements, %zu iterations\n",
+         num_ues, END_KPM_MEAS, iter);
+
+  kpi_metrics_t* legacy = calloc(num_ues, sizeof(kpi_metrics_t));
+  assert(legacy != NULL && "Memory exhausted");
+  int64_t start = time_now_us();
+  for (size_t it = 0; it < iter; it++)
+    decode_strcmp_chain(msg_frm_3, legacy);
+  print_result("strcmp chain", time_now_us() - start, iter, num_ues);
+
+  start = time_now_us();
+  for (size_t it = 0; it < iter; it++)
+    decode_kpm_ind_frm_3(ctx, msg_frm_3, &sh->block);
+  print_result("slot decode", time_now_us() - start, iter, num_ues);
+
+  // Both paths must agree on the subscribed measurements
+  for (size_t i = 0; i < num_ues; i++) {
+    for (size_t j = 0; j < kpm_cfg.meas_len; j++) {
+      kpm_meas_e const k = kpm_cfg.meas[j];
+      assert(legacy[i].meas[k] == sh->block.col[k][i] && "Decoders disagree");
+    }
+  }
+
+  kpm_rec_t rec = {0};
+  int64_t drain_us = 0;
+  start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    sm_cb_kpm(&rd, ctx);
+
+    // Drain outside of the measurement, db_writer_thread does this in the xApp
+    int64_t const t0 = time_now_us();
+    while (pop_kpm_ring(&kpm_ring[0], &rec))
+      ;
+    drain_us += time_now_us() - t0;
+  }
+  print_result("sm_cb_kpm", time_now_us() - start - drain_us, iter, num_ues);
+
+  free(legacy);
+  free_kpm_ind_data(&rd.ind.kpm.ind);
+  free_kpm_ring(&kpm_ring[0]);
+  kpm_ring_len = 0;
+  free_kpm_agg(&kpm_agg);
+  close_kpm_shm(&kpm_shm);
+  free_kpm_shards();
+
+  // Scaling over the E2 nodes; no row may be dropped on the way to the writer
+  setenv("DB_RING_OVERFLOW", "block", 1);
+  setenv("DB_RING_SIZE", "4096", 1);
+  size_t nodes[MAX_KPM_SUBS] = {1, 4, 16};
+  size_t nodes_len = 3;
+  if (argc > 3) {
+    nodes_len = 0;
+    for (int i = 3; i < argc && nodes_len < MAX_KPM_SUBS; i++)
+      nodes[nodes_len++] = (size_t)atoi(argv[i]);
+  }
+
+  // Printed once the runs are over, their setup logs would split the table
+  char line[2 * MAX_KPM_SUBS][96] = {{0}};
+  size_t line_len = 0;
+  for (size_t i = 0; i < nodes_len; i++) {
+    assert(nodes[i] > 0 && nodes[i] <= MAX_KPM_SUBS && "1 to MAX_KPM_SUBS nodes");
+    run_scale(nodes[i], 1, num_ues, iter, line[line_len++], sizeof(line[0]));
+    if (nodes[i] > 1) {
+      size_t const shards = nodes[i] < MAX_KPM_SHARDS ? nodes[i] : MAX_KPM_SHARDS;
+      run_scale(nodes[i], shards, num_ues, iter, line[line_len++], sizeof(line[0]));
+    }
+  }
+
+  printf("\n%5s %6s %12s %14s %14s\n", "nodes", "shards", "ind/s", "ue_rep/s", "lock_p99_us");
+  for (size_t i = 0; i < line_len; i++)
+    fputs(line[i], stdout);
+  return EXIT_SUCCESS;
+}
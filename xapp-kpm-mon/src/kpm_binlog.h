@@ -0,0 +1,117 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+#ifndef KPM_BINLOG_H
+#define KPM_BINLOG_H
+
+// Append-only KPM telemetry log written by the binlog sink of xapp_kpm_moni_3slices.
+//
+// A file is a kpm_binlog_file_hdr_t followed by blocks. A block is a kpm_binlog_blk_hdr_t
+// followed by its payload: the rows of the block stored column after column, in this order
+//
+//   int64_t  ts_us[rows]             xApp reception time [μs since epoch]
+//   int64_t  collect_start_us[rows]  collectStartTime of the indication [μs]
+//   uint64_t amf_ue_ngap_id[rows]
+//   uint64_t ran_ue_id[rows]
+//   uint32_t ind_seq[rows]
+//   uint32_t sd[rows]
+//   uint32_t present[rows]           bit k set if measurement k was reported
+//   uint8_t  sst[rows]
+//   double   meas_k[rows]            for every bit k of meas_mask, in ascending k
+//
+// in host byte order (little endian on every platform we run on). The payload is stored as
+// is or zlib compressed, see codec; crc covers the stored bytes. A file cut by a crash ends
+// with a partial block, which readers detect by size or crc and skip.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KPM_BINLOG_MAGIC 0x4c4d504bu     // "KPML"
+#define KPM_BINLOG_BLK_MAGIC 0x424d504bu // "KPMB"
+#define KPM_BINLOG_VERSION 1
+#define KPM_BINLOG_MAX_MEAS 16
+#define KPM_BINLOG_MEAS_NAME_LEN 32
+
+typedef enum {
+  KPM_BINLOG_CODEC_RAW = 0,
+  KPM_BINLOG_CODEC_ZLIB = 1,
+} kpm_binlog_codec_e;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdr_size;
+  uint32_t meas_len;   // Entries of meas_name, bit k of a meas_mask refers to meas_name[k]
+  uint32_t reserved;
+  int64_t created_us;
+  char meas_name[KPM_BINLOG_MAX_MEAS][KPM_BINLOG_MEAS_NAME_LEN];
+} kpm_binlog_file_hdr_t;
+
+_Static_assert(sizeof(kpm_binlog_file_hdr_t) == 536, "kpm_binlog_file_hdr_t layout changed, bump KPM_BINLOG_VERSION");
+
+typedef struct {
+  uint32_t magic;
+  uint32_t rows;
+  uint32_t codec;       // kpm_binlog_codec_e
+  uint32_t meas_mask;   // Measurement columns present in the payload
+  uint32_t raw_size;    // Payload size before compression
+  uint32_t stored_size; // Payload bytes following this header
+  uint32_t crc;         // CRC-32 of the stored payload
+  uint32_t reserved;
+  int64_t first_ts_us;
+  int64_t last_ts_us;
+} kpm_binlog_blk_hdr_t;
+
+_Static_assert(sizeof(kpm_binlog_blk_hdr_t) == 48, "kpm_binlog_blk_hdr_t layout changed, bump KPM_BINLOG_VERSION");
+
+// Bytes per row outside of the measurement columns
+#define KPM_BINLOG_KEY_ROW_SIZE (4 * sizeof(int64_t) + 3 * sizeof(uint32_t) + sizeof(uint8_t))
+
+static inline
+size_t kpm_binlog_raw_size(uint32_t rows, uint32_t meas_mask)
+{
+  return (size_t)rows * (KPM_BINLOG_KEY_ROW_SIZE + (size_t)__builtin_popcount(meas_mask) * sizeof(double));
+}
+
+// CRC-32 (IEEE 802.3), the same polynomial as zlib's crc32()
+static inline
+uint32_t kpm_binlog_crc32(uint32_t crc, void const* buf, size_t len)
+{
+  static uint32_t table[256];
+  static int init = 0;
+  if (!init) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int j = 0; j < 8; j++)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    init = 1;
+  }
+
+  uint8_t const* p = buf;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+    crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+#ifndef KPM_SHM_H
+#define KPM_SHM_H
+
+// Latest KPM snapshot published by xapp_kpm_moni_3slices for readers on the same host.
+//
+// The segment is a POSIX shm object ("/kpm_mon") or a regular file mapped by path
+// ("/dev/shm/xapp-kpm-mon/kpm_mon.shm"), laid out as
+//
+//   [ kpm_shm_hdr_t, padded to KPM_SHM_HDR_SIZE ][ ue_cap UE records ][ slice_cap slice records ]
+//
+// UE record i mirrors UE slot i of the monitor (the UE tables of its shards, one after the
+// other); slice record i is subscription i (E2 node, S-NSSAI). Every record is guarded by its
+// own sequence lock: its single writer, the shard owning it, makes seq odd, updates the record
+// and makes it even again, so readers never block it and retry when they raced with an update. The layout only changes together with
+// KPM_SHM_VERSION.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KPM_SHM_MAGIC 0x534d504bu // "KPMS"
+#define KPM_SHM_VERSION 1
+#define KPM_SHM_HDR_SIZE 4096
+#define KPM_SHM_MAX_MEAS 16
+#define KPM_SHM_MEAS_NAME_LEN 32
+
+typedef enum {
+  KPM_SHM_REC_FREE = 0,
+  KPM_SHM_REC_UE,
+  KPM_SHM_REC_SLICE,
+} kpm_shm_rec_e;
+
+typedef struct {
+  _Atomic uint32_t seq;
+  uint32_t kind;            // kpm_shm_rec_e
+  uint64_t amf_ue_ngap_id;  // UE records
+  uint64_t ran_ue_id;
+  int64_t ts_us;            // collectStartTime of the indication [μs]
+  uint64_t ind_seq;         // Indication counter of the monitor
+  uint32_t present;         // Bit k set if meas[k] was reported
+  uint32_t sd;
+  uint32_t nb_id;           // Slice records: E2 node
+  uint32_t n_ues;           // Slice records: UEs in the indication
+  uint8_t sst;
+  uint8_t reserved[7];
+  double meas[KPM_SHM_MAX_MEAS];
+} kpm_shm_rec_t;
+
+_Static_assert(sizeof(kpm_shm_rec_t) == 192, "kpm_shm_rec_t layout changed, bump KPM_SHM_VERSION");
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hdr_size;
+  uint32_t rec_size;
+  uint32_t ue_cap;
+  uint32_t slice_cap;
+  uint32_t meas_len;
+  uint32_t writer_pid;
+  int64_t start_us;           // Changes when the monitor restarts
+  _Atomic uint32_t alive;     // Cleared by the monitor on shutdown
+  uint32_t reserved;
+  _Atomic uint64_t updates;   // Bumped after every indication
+  char meas_name[KPM_SHM_MAX_MEAS][KPM_SHM_MEAS_NAME_LEN]; // Name of meas[k], as reported by the E2 node
+} kpm_shm_hdr_t;
+
+_Static_assert(sizeof(kpm_shm_hdr_t) <= KPM_SHM_HDR_SIZE, "kpm_shm_hdr_t does not fit KPM_SHM_HDR_SIZE");
+
+typedef struct {
+  kpm_shm_hdr_t* hdr;
+  kpm_shm_rec_t* ue;
+  kpm_shm_rec_t* slice;
+  size_t size;
+} kpm_shm_t;
+
+static inline
+size_t kpm_shm_size(uint32_t ue_cap, uint32_t slice_cap)
+{
+  return KPM_SHM_HDR_SIZE + ((size_t)ue_cap + slice_cap) * sizeof(kpm_shm_rec_t);
+}
+
+// A name with a second '/' is a file path, otherwise a POSIX shm object name
+static inline
+int kpm_shm_open_fd(const char* name, int flags, mode_t mode)
+{
+  if (strchr(name + 1, '/') != NULL)
+    return open(name, flags, mode);
+  return shm_open(name, flags, mode);
+}
+
+static inline
+void kpm_shm_map_recs(kpm_shm_t* shm)
+{
+  uint8_t* base = (uint8_t*)shm->hdr;
+  shm->ue = (kpm_shm_rec_t*)(base + KPM_SHM_HDR_SIZE);
+  shm->slice = shm->ue + shm->hdr->ue_cap;
+}
+
+// ======================================== Writer ========================================
+
+static inline
+int kpm_shm_unlink(const char* name)
+{
+  if (strchr(name + 1, '/') != NULL)
+    return unlink(name);
+  return shm_unlink(name);
+}
+
+static inline
+void kpm_shm_write_begin(kpm_shm_rec_t* r)
+{
+  uint32_t const seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+  atomic_store_explicit(&r->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline
+void kpm_shm_write_end(kpm_shm_rec_t* r)
+{
+  uint32_t const seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+  atomic_store_explicit(&r->seq, seq + 1, memory_order_release);
+}
+
+// ======================================== Writer ========================================
+
+// ======================================== Reader ========================================
+
+// Map an existing segment read-only; 0 on success, -errno or -EPROTO for a foreign layout
+static inline
+int kpm_shm_open(kpm_shm_t* shm, const char* name)
+{
+  memset(shm, 0, sizeof(*shm));
+
+  int fd = kpm_shm_open_fd(name, O_RDONLY, 0);
+  if (fd < 0)
+    return -errno;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < KPM_SHM_HDR_SIZE) {
+    close(fd);
+    return -EPROTO;
+  }
+
+  void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return -errno;
+
+  kpm_shm_hdr_t* hdr = p;
+  if (hdr->magic != KPM_SHM_MAGIC || hdr->version != KPM_SHM_VERSION || hdr->hdr_size != KPM_SHM_HDR_SIZE
+      || hdr->rec_size != sizeof(kpm_shm_rec_t) || kpm_shm_size(hdr->ue_cap, hdr->slice_cap) > (size_t)st.st_size) {
+    munmap(p, (size_t)st.st_size);
+    return -EPROTO;
+  }
+
+  shm->hdr = hdr;
+  shm->size = (size_t)st.st_size;
+  kpm_shm_map_recs(shm);
+  return 0;
+}
+
+static inline
+void kpm_shm_close(kpm_shm_t* shm)
+{
+  if (shm->hdr != NULL)
+    munmap(shm->hdr, shm->size);
+  memset(shm, 0, sizeof(*shm));
+}
+
+// Consistent copy of *r; false if the record is free or kept changing for max_retry attempts
+static inline
+bool kpm_shm_read(kpm_shm_rec_t const* r, kpm_shm_rec_t* out, unsigned max_retry)
+{
+  kpm_shm_rec_t* w = (kpm_shm_rec_t*)r;
+
+  for (unsigned i = 0; i <= max_retry; i++) {
+    uint32_t const s0 = atomic_load_explicit(&w->seq, memory_order_acquire);
+    if (s0 & 1u)
+      continue;
+
+    memcpy(out, r, sizeof(*out));
+    atomic_thread_fence(memory_order_acquire);
+
+    uint32_t const s1 = atomic_load_explicit(&w->seq, memory_order_relaxed);
+    if (s0 == s1)
+      return out->kind != KPM_SHM_REC_FREE;
+  }
+  return false;
+}
+
+// ======================================== Reader ========================================
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+#ifndef KPM_TRACE_H
+#define KPM_TRACE_H
+
+// Trace of the KPM indications received by xapp_kpm_moni_3slices (KPM_TRACE_FILE), which it
+// feeds back through sm_cb_kpm() with KPM_REPLAY.
+//
+// A file is a kpm_trace_file_hdr_t followed by records. A record is a kpm_trace_rec_hdr_t
+// followed by len payload bytes:
+//
+//   KPM_TRACE_SUB  kpm_trace_sub_t, the subscription context sub refers to from now on
+//   KPM_TRACE_IND  one indication of subscription sub, received at recv_us:
+//
+//     uint64_t collect_start_us      collectStartTime of the indication header
+//     uint32_t ue_len
+//     info list                      measurements of the UE reports, unless they carry their own
+//     ue_len x UE report
+//
+//   info list:  uint16_t len, then len x (uint8_t meas_type_e, then NAME: uint8_t name_len and
+//               the name bytes, ID: uint16_t id)
+//   UE report:  uint8_t ue_id_e2sm_e, uint8_t flags (kpm_trace_ue_flag_e), then by UE ID type
+//                 gNB:       uint64_t amf_ue_ngap_id, uint16_t n, uint32_t gnb_cu_ue_f1ap[n]
+//                 gNB-DU:    uint32_t gnb_cu_ue_f1ap
+//                 gNB-CU-UP: uint32_t gnb_cu_cp_ue_e1ap
+//               [uint64_t ran_ue_id], [info list], uint16_t data_len, then data_len x
+//               (uint8_t incomplete, uint16_t rec_len, rec_len x (uint8_t meas_value_e, then
+//               INTEGER: uint32_t, REAL: double, NO_VALUE: nothing))
+//
+// Only what sm_cb_kpm() reads is kept, on purpose: of the indication header only
+// collectStartTime (not fileFormatversion, senderName, senderType nor vendorName), of the
+// incompleteFlag only whether it is set, and no labels nor other UE ID types. A replay therefore
+// stores the same rows as the live run, but the trace is not a full copy of the indications.
+// Integers and doubles are unaligned, in host byte order (little endian on every platform we run on).
+// A file cut by a crash ends with a partial record, which readers detect by its size.
+
+#include <stdint.h>
+
+#define KPM_TRACE_MAGIC 0x544d504bu  // "KPMT"
+#define KPM_TRACE_VERSION 1
+
+typedef enum {
+  KPM_TRACE_SUB = 1,
+  KPM_TRACE_IND = 2,
+} kpm_trace_rec_e;
+
+typedef enum {
+  KPM_TRACE_UE_RAN_UE_ID = 1 << 0,  // ran_ue_id follows the UE ID
+  KPM_TRACE_UE_OWN_INFO = 1 << 1,   // The UE report has its own info list
+} kpm_trace_ue_flag_e;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdr_size;
+  int64_t created_us;
+} kpm_trace_file_hdr_t;
+
+_Static_assert(sizeof(kpm_trace_file_hdr_t) == 16, "kpm_trace_file_hdr_t layout changed, bump KPM_TRACE_VERSION");
+
+typedef struct {
+  uint32_t len;       // Payload bytes following this header
+  uint8_t type;       // kpm_trace_rec_e
+  uint8_t reserved;
+  uint16_t sub;       // Subscription, as declared by its KPM_TRACE_SUB record
+  int64_t recv_us;    // xApp reception time [μs since epoch]
+} kpm_trace_rec_hdr_t;
+
+_Static_assert(sizeof(kpm_trace_rec_hdr_t) == 16, "kpm_trace_rec_hdr_t layout changed, bump KPM_TRACE_VERSION");
+
+typedef struct {
+  uint32_t nb_id;
+  uint32_t sd;
+  uint32_t report_period_ms;
+  uint32_t gran_period_ms;
+  uint8_t sst;
+  uint8_t reserved[7];
+} kpm_trace_sub_t;
+
+_Static_assert(sizeof(kpm_trace_sub_t) == 24, "kpm_trace_sub_t layout changed, bump KPM_TRACE_VERSION");
+
+#endif
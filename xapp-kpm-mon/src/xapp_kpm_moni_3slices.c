@@ -24,6 +24,9 @@
 #include "../../../../src/util/time_now_us.h"
 #include "../../../../src/util/alg_ds/ds/lock_guard/lock_guard.h"
 #include "../../../../src/util/e.h"
+#include "kpm_shm.h"
+#include "kpm_binlog.h"
+#include "kpm_trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,294 +36,4682 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <microhttpd.h>
+#include <json-c/json.h>
+#ifdef KPM_BINLOG_ZLIB
+#include <zlib.h>
+#endif
+
+volatile sig_atomic_t sig_recv = 0;
+
+void signal_handler_thread(void *arg){
+  sigset_t signal_set;
+  int sig_number;
+
+  // Block SIGINT and SIGTERM
+  sigemptyset(&signal_set);
+  sigaddset(&signal_set, SIGINT);
+  sigaddset(&signal_set, SIGTERM);
+
+  if(sigwait(&signal_set, &sig_number) == 0) {
+    printf("Received %d, cleaning up", sig_number);
+    sig_recv = 1;
+  }
+}
+
+// ======================================== Subscription Config ========================================
+
+// The subscription set is read from the environment (deployment/xapp_kpm_mon.env) at startup:
+//   KPM_SLICES        comma separated sst:sd[:report_ms[:gran_ms]], e.g. "1:0x000001:100:100,5:0x000082"
+//   KPM_REPORT_MS     report period of the slices that do not set one (default 1000)
+//   KPM_GRAN_MS       granularity period of the slices that do not set one (default: their report period)
+//   KPM_MEASUREMENTS  comma separated E2 measurement names to subscribe (default: all in kpm_meas_name)
+
+// Supported measurements, in column order of xapp_kpi_metrics
+typedef enum {
+  RRU_PRB_TOT_DL = 0,
+  RRU_PRB_TOT_UL,
+  DRB_PDCP_SDU_VOLUME_DL,
+  DRB_PDCP_SDU_VOLUME_UL,
+  DRB_RLC_SDU_DELAY_DL,
+  DRB_UE_THP_DL,
+  DRB_UE_THP_UL,
+  END_KPM_MEAS
+} kpm_meas_e;
+
+// Measurement names as reported by the E2 node
+static const char* const kpm_meas_name[END_KPM_MEAS] = {
+  "RRU.PrbTotDl",
+  "RRU.PrbTotUl",
+  "DRB.PdcpSduVolumeDL",
+  "DRB.PdcpSduVolumeUL",
+  "DRB.RlcSduDelayDl",
+  "DRB.UEThpDl",
+  "DRB.UEThpUl",
+};
+
+#define MAX_KPM_SLICES 16
+
+typedef struct {
+  int nssai[4]; // {sst, sd16, sd8, sd0}, as filter_predicate() expects
+  uint32_t report_period_ms;
+  uint32_t gran_period_ms;
+} kpm_slice_cfg_t;
+
+typedef struct {
+  kpm_slice_cfg_t slice[MAX_KPM_SLICES];
+  size_t slice_len;
+
+  // Subscribed measurements in kpm_meas_e order, and the same set as a bit mask
+  kpm_meas_e meas[END_KPM_MEAS];
+  size_t meas_len;
+  uint32_t meas_mask;
+
+  uint32_t max_report_period_ms;
+} kpm_mon_cfg_t;
+
+static kpm_mon_cfg_t kpm_cfg = {0};
+
+// The set this xApp was built for: three slices reported every second
+static const char* const default_kpm_slices = "128:0x000080,1:0x000001,5:0x000082";
+
+static
+void cfg_error(const char* var, const char* what, const char* val)
+{
+  fprintf(stderr, "%s: %s '%s'\n", var, what, val);
+  exit(EXIT_FAILURE);
+}
+
+// Integer variable var, def if unset; a value that is not an integer in [min, max] is replaced
+// by def with a warning
+static
+long cfg_long(const char* var, long def, long min, long max)
+{
+  const char* val = getenv(var);
+  if (val == NULL)
+    return def;
+
+  char* end = NULL;
+  errno = 0;
+  long const v = strtol(val, &end, 10);
+  if (end == val || *end != '\0' || errno == ERANGE || v < min || v > max) {
+    fprintf(stderr, "%s: expected an integer in [%ld, %ld], got '%s', using %ld\n", var, min, max, val, def);
+    return def;
+  }
+  return v;
+}
+
+static
+uint32_t cfg_period_ms(const char* var, const char* val)
+{
+  char* end = NULL;
+  unsigned long const ms = strtoul(val, &end, 10);
+  if (end == val || *end != '\0' || ms == 0 || ms > UINT32_MAX)
+    cfg_error(var, "invalid period", val);
+  return (uint32_t)ms;
+}
+
+// gran_ms == 0 means "same as the report period"
+static
+void parse_kpm_slice(const char* tok, uint32_t report_ms, uint32_t gran_ms, kpm_slice_cfg_t* s)
+{
+  char buf[64];
+  if ((size_t)snprintf(buf, sizeof(buf), "%s", tok) >= sizeof(buf))
+    cfg_error("KPM_SLICES", "slice too long", tok);
+
+  char* field[4] = {0};
+  size_t n = 0;
+  char* save = NULL;
+  for (char* f = strtok_r(buf, ":", &save); f != NULL; f = strtok_r(NULL, ":", &save)) {
+    if (n == 4)
+      cfg_error("KPM_SLICES", "expected sst:sd[:report_ms[:gran_ms]], got", tok);
+    field[n++] = f;
+  }
+  if (n < 2)
+    cfg_error("KPM_SLICES", "expected sst:sd[:report_ms[:gran_ms]], got", tok);
+
+  char* end = NULL;
+  // SST in decimal as everywhere else, SD in hex with 0x or decimal
+  unsigned long const sst = strtoul(field[0], &end, 10);
+  if (*end != '\0' || sst > 0xFF)
+    cfg_error("KPM_SLICES", "invalid sst in", tok);
+  unsigned long const sd = strtoul(field[1], &end, 0);
+  if (*end != '\0' || sd > 0xFFFFFF)
+    cfg_error("KPM_SLICES", "invalid sd in", tok);
+
+  s->nssai[0] = (int)sst;
+  s->nssai[1] = (int)(sd >> 16) & 0xFF;
+  s->nssai[2] = (int)(sd >> 8) & 0xFF;
+  s->nssai[3] = (int)sd & 0xFF;
+
+  s->report_period_ms = n > 2 ? cfg_period_ms("KPM_SLICES", field[2]) : report_ms;
+  s->gran_period_ms = n > 3 ? cfg_period_ms("KPM_SLICES", field[3]) : gran_ms;
+  if (s->gran_period_ms == 0)
+    s->gran_period_ms = s->report_period_ms;
+
+  // A report carries whole granularity periods
+  if (s->gran_period_ms > s->report_period_ms || s->report_period_ms % s->gran_period_ms != 0)
+    cfg_error("KPM_SLICES", "report period is not a multiple of the granularity period in", tok);
+}
+
+static
+void parse_kpm_meas(const char* val, kpm_mon_cfg_t* cfg)
+{
+  char* buf = strdup(val);
+  assert(buf != NULL && "Memory exhausted");
+
+  char* save = NULL;
+  for (char* tok = strtok_r(buf, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+    size_t k = 0;
+    while (k < END_KPM_MEAS && strcmp(kpm_meas_name[k], tok) != 0)
+      k++;
+    if (k == END_KPM_MEAS)
+      cfg_error("KPM_MEASUREMENTS", "unsupported measurement", tok);
+    cfg->meas_mask |= 1u << k;
+  }
+  free(buf);
+
+  if (cfg->meas_mask == 0)
+    cfg_error("KPM_MEASUREMENTS", "no measurement in", val);
+}
+
+static
+void load_kpm_mon_cfg(kpm_mon_cfg_t* cfg)
+{
+  memset(cfg, 0, sizeof(*cfg));
+
+  const char* report_str = getenv("KPM_REPORT_MS");
+  uint32_t const report_ms = report_str ? cfg_period_ms("KPM_REPORT_MS", report_str) : 1000;
+
+  const char* gran_str = getenv("KPM_GRAN_MS");
+  uint32_t const gran_ms = gran_str ? cfg_period_ms("KPM_GRAN_MS", gran_str) : 0;
+
+  const char* slices = getenv("KPM_SLICES");
+  if (!slices) slices = default_kpm_slices;
+
+  char* buf = strdup(slices);
+  assert(buf != NULL && "Memory exhausted");
+  char* save = NULL;
+  for (char* tok = strtok_r(buf, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+    if (cfg->slice_len == MAX_KPM_SLICES)
+      cfg_error("KPM_SLICES", "too many slices, raise MAX_KPM_SLICES", slices);
+
+    kpm_slice_cfg_t* s = &cfg->slice[cfg->slice_len];
+    parse_kpm_slice(tok, report_ms, gran_ms, s);
+    for (size_t i = 0; i < cfg->slice_len; i++) {
+      if (memcmp(cfg->slice[i].nssai, s->nssai, sizeof(s->nssai)) == 0)
+        cfg_error("KPM_SLICES", "duplicated S-NSSAI", tok);
+    }
+
+    if (s->report_period_ms > cfg->max_report_period_ms)
+      cfg->max_report_period_ms = s->report_period_ms;
+    cfg->slice_len++;
+  }
+  free(buf);
+
+  if (cfg->slice_len == 0)
+    cfg_error("KPM_SLICES", "no slice in", slices);
+
+  const char* meas = getenv("KPM_MEASUREMENTS");
+  if (meas)
+    parse_kpm_meas(meas, cfg);
+  else
+    cfg->meas_mask = (1u << END_KPM_MEAS) - 1;
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    if (cfg->meas_mask & (1u << k))
+      cfg->meas[cfg->meas_len++] = (kpm_meas_e)k;
+  }
+
+  for (size_t i = 0; i < cfg->slice_len; i++) {
+    kpm_slice_cfg_t const* s = &cfg->slice[i];
+    printf("[CFG]: slice sst = %d, sd = %02x%02x%02x, report period = %u [ms], granularity period = %u [ms]\n",
+           s->nssai[0], s->nssai[1], s->nssai[2], s->nssai[3], s->report_period_ms, s->gran_period_ms);
+  }
+  printf("[CFG]: %zu of %d measurements subscribed\n", cfg->meas_len, END_KPM_MEAS);
+}
+
+// ======================================== Subscription Config ========================================
+
+// ======================================== Instrumentation ========================================
+
+// Messages of the indication path go through KPM_LOG. Levels above KPM_LOG_MAX_LEVEL (debug
+// by default) are compiled out, the rest are filtered at run time by KPM_LOG_LEVEL =
+// error | warn | info | debug. Durations are recorded into lock-free log-linear histograms
+// that GET /metrics serves in the Prometheus text format and db_writer_thread summarizes
+// with its periodic stats.
+
+typedef enum {
+  KPM_LOG_ERROR,
+  KPM_LOG_WARN,
+  KPM_LOG_INFO,
+  KPM_LOG_DEBUG,
+} kpm_log_level_e;
+
+#ifndef KPM_LOG_MAX_LEVEL
+#define KPM_LOG_MAX_LEVEL KPM_LOG_INFO
+#endif
+
+static kpm_log_level_e kpm_log_level = KPM_LOG_INFO;
+
+#define KPM_LOG(lvl, ...) \
+  do { \
+    if ((lvl) <= KPM_LOG_MAX_LEVEL && (lvl) <= kpm_log_level) \
+      fprintf((lvl) <= KPM_LOG_WARN ? stderr : stdout, __VA_ARGS__); \
+  } while (0)
+
+static
+void init_kpm_log(void)
+{
+  static const char* const names[] = {"error", "warn", "info", "debug"};
+
+  const char* val = getenv("KPM_LOG_LEVEL");
+  if (val == NULL)
+    return;
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(val, names[i]) == 0) {
+      kpm_log_level = (kpm_log_level_e)i;
+      if (kpm_log_level > KPM_LOG_MAX_LEVEL)
+        printf("[CFG]: KPM_LOG_LEVEL = %s, but messages above %s are compiled out\n", val, names[KPM_LOG_MAX_LEVEL]);
+      return;
+    }
+  }
+  cfg_error("KPM_LOG_LEVEL", "expected error, warn, info or debug:", val);
+}
+
+// Values in [2^e, 2^(e+1)) are split into KPM_HIST_SUB linear buckets, so a quantile is off by
+// at most 1 / KPM_HIST_SUB of its value; values below KPM_HIST_SUB have a bucket each
+#define KPM_HIST_SUB_BITS 3
+#define KPM_HIST_SUB (1u << KPM_HIST_SUB_BITS)
+#define KPM_HIST_BUCKETS ((64 - KPM_HIST_SUB_BITS + 1) * KPM_HIST_SUB)
+
+typedef struct {
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  _Atomic uint64_t bucket[KPM_HIST_BUCKETS];
+} kpm_hist_t;
+
+typedef enum {
+  KPM_SINK_MYSQL,
+  KPM_SINK_BINLOG,
+  END_KPM_SINK,
+} kpm_sink_e;
+
+static const char* const kpm_sink_name[END_KPM_SINK] = {"mysql", "binlog"};
+
+// Indication shards, see Indication Shards
+#define MAX_KPM_SHARDS 16
+
+typedef struct {
+  // Per shard, so that the shards never write to the same histogram
+  kpm_hist_t e2_latency[MAX_KPM_SHARDS];  // collectStartTime -> sm_cb_kpm, every subscription
+  kpm_hist_t decode[MAX_KPM_SHARDS];      // decode_kpm_ind_frm_3() of an indication
+  kpm_hist_t lock_wait[MAX_KPM_SHARDS];   // Wait for the shard lock in sm_cb_kpm
+  kpm_hist_t flush[END_KPM_SINK];  // One batch written by the sink
+  _Atomic uint64_t sink_rows[END_KPM_SINK];
+  _Atomic uint64_t sink_failed[END_KPM_SINK];
+  _Atomic uint64_t db_connected;   // 1 while the MySQL sink has a connection
+  _Atomic uint64_t db_reconnects;  // Connections after the first one
+  _Atomic uint64_t spool_rows;     // Rows waiting in DB_SPOOL_FILE
+  _Atomic uint64_t spool_bytes;
+  _Atomic uint64_t spool_dropped;  // Rows lost while MySQL was unreachable: spool full or disabled
+  _Atomic uint64_t spool_replayed; // Spooled rows written once MySQL was back
+} kpm_metrics_t;
+
+static kpm_metrics_t kpm_metrics;
+
+static inline
+int64_t mono_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline
+size_t kpm_hist_idx(uint64_t v)
+{
+  if (v < KPM_HIST_SUB)
+    return (size_t)v;
+  unsigned const e = 63 - (unsigned)__builtin_clzll(v);
+  return (size_t)(e - KPM_HIST_SUB_BITS + 1) * KPM_HIST_SUB + ((v >> (e - KPM_HIST_SUB_BITS)) & (KPM_HIST_SUB - 1));
+}
+
+// Largest value falling into bucket idx
+static
+uint64_t kpm_hist_upper(size_t idx)
+{
+  if (idx < KPM_HIST_SUB)
+    return idx;
+  unsigned const shift = (unsigned)(idx / KPM_HIST_SUB) - 1;
+  uint64_t const lower = (uint64_t)(KPM_HIST_SUB + idx % KPM_HIST_SUB) << shift;
+  return lower + ((uint64_t)1 << shift) - 1;
+}
+
+// Any thread may record; readers see counts that are at most a few records apart
+static inline
+void kpm_hist_record(kpm_hist_t* h, int64_t v)
+{
+  uint64_t const u = v > 0 ? (uint64_t)v : 0;
+  atomic_fetch_add_explicit(&h->bucket[kpm_hist_idx(u)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, u, memory_order_relaxed);
+
+  uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  while (u > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, u, memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+// Nearest-rank quantile q of every value recorded so far, as the upper bound of its bucket
+static
+uint64_t kpm_hist_quantile(kpm_hist_t const* h, double q)
+{
+  kpm_hist_t* w = (kpm_hist_t*)h;
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < KPM_HIST_BUCKETS; i++)
+    total += atomic_load_explicit(&w->bucket[i], memory_order_relaxed);
+  if (total == 0)
+    return 0;
+
+  uint64_t const rank = (uint64_t)ceil(q * (double)total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < KPM_HIST_BUCKETS; i++) {
+    seen += atomic_load_explicit(&w->bucket[i], memory_order_relaxed);
+    if (seen >= rank && seen > 0) {
+      uint64_t const max = atomic_load_explicit(&w->max, memory_order_relaxed);
+      uint64_t const upper = kpm_hist_upper(i);
+      return upper < max ? upper : max;
+    }
+  }
+  return atomic_load_explicit(&w->max, memory_order_relaxed);
+}
+
+// Sum of the per-shard histograms h[0..MAX_KPM_SHARDS), for the readers
+static
+void kpm_hist_merge(kpm_hist_t* out, kpm_hist_t const* h)
+{
+  memset(out, 0, sizeof(*out));
+  for (size_t s = 0; s < MAX_KPM_SHARDS; s++) {
+    kpm_hist_t* w = (kpm_hist_t*)&h[s];
+    for (size_t i = 0; i < KPM_HIST_BUCKETS; i++)
+      out->bucket[i] += atomic_load_explicit(&w->bucket[i], memory_order_relaxed);
+    out->count += atomic_load_explicit(&w->count, memory_order_relaxed);
+    out->sum += atomic_load_explicit(&w->sum, memory_order_relaxed);
+    uint64_t const max = atomic_load_explicit(&w->max, memory_order_relaxed);
+    if (max > out->max)
+      out->max = max;
+  }
+}
+
+static
+void report_kpm_latency(void)
+{
+  kpm_metrics_t const* m = &kpm_metrics;
+  static kpm_hist_t e2_latency, decode, lock_wait;
+  kpm_hist_merge(&e2_latency, m->e2_latency);
+  kpm_hist_merge(&decode, m->decode);
+  kpm_hist_merge(&lock_wait, m->lock_wait);
+
+  printf("[LAT]: E2 p50 = %.1f p99 = %.1f max = %.1f, decode p50 = %.1f p99 = %.1f, lock wait p99 = %.1f",
+         kpm_hist_quantile(&e2_latency, 0.5) / 1e3, kpm_hist_quantile(&e2_latency, 0.99) / 1e3,
+         atomic_load(&e2_latency.max) / 1e3, kpm_hist_quantile(&decode, 0.5) / 1e3,
+         kpm_hist_quantile(&decode, 0.99) / 1e3, kpm_hist_quantile(&lock_wait, 0.99) / 1e3);
+  for (size_t i = 0; i < END_KPM_SINK; i++) {
+    if (atomic_load(&m->flush[i].count) > 0)
+      printf(", %s flush p99 = %.1f", kpm_sink_name[i], kpm_hist_quantile(&m->flush[i], 0.99) / 1e3);
+  }
+  printf(" [μs]\n");
+}
+
+// ======================================== Instrumentation ========================================
+
+// ======================================== MySql Functions ========================================
+
+// Column of each measurement; only the subscribed ones are created and written
+static const char* const kpm_meas_col[END_KPM_MEAS] = {
+    "rru_prb_tot_dl",
+    "rru_prb_tot_ul",
+    "drb_pdcp_sdu_volume_dl",
+    "drb_pdcp_sdu_volume_ul",
+    "drb_rlc_sdu_delay_dl",
+    "drb_ue_thp_dl",
+    "drb_ue_thp_ul",
+};
+
+// Define a structure to hold KPI metrics
+typedef struct {
+    double meas[END_KPM_MEAS];
+    uint32_t present; // Bit i set if meas[i] was reported, the rest is written as NULL
+    unsigned long amf_ue_ngap_id;
+    unsigned long ran_ue_id;
+    uint8_t sst;      // S-NSSAI of the subscription that reported the UE
+    uint32_t sd;
+} kpi_metrics_t;
+
+static MYSQL* conn = NULL;
+
+// Rows are not sent one INSERT at a time. insert_to_database() only queues the current
+// kpi_metrics into db_batch, and flush_database() writes the whole batch through prepared
+// multi-row INSERTs (up to DB_STMT_ROWS rows each) inside a single transaction.
+#define DB_BATCH_ROWS 1024
+#define DB_STMT_ROWS 128
+#define DB_KEY_COLS 7 // amf_ue_ngap_id, ran_ue_id, sst, sd, timestamp, ts_us, collect_start_us
+#define DB_COLS_PER_ROW (END_KPM_MEAS + DB_KEY_COLS)
+#define DB_STATS_PERIOD_US 10000000
+
+typedef struct {
+    kpi_metrics_t rows[DB_BATCH_ROWS];
+    bool is_null[DB_BATCH_ROWS][END_KPM_MEAS];
+    long long ts[DB_BATCH_ROWS];         // Seconds, as before ts_us existed
+    long long ts_us[DB_BATCH_ROWS];
+    long long collect_us[DB_BATCH_ROWS];
+    size_t len;
+    int64_t first_us; // time_now_us() of the oldest queued row
+} db_batch_t;
+
+typedef struct {
+    uint64_t rows;
+    uint64_t batches;
+    uint64_t failed;
+    int64_t lat_sum_us;
+    int64_t lat_max_us;
+    // Reporting window
+    int64_t win_start_us;
+    uint64_t win_rows;
+    uint64_t win_batches;
+    int64_t win_lat_sum_us;
+    int64_t win_lat_max_us;
+    uint64_t win_replayed;
+} db_stats_t;
+
+static db_batch_t db_batch = {0};
+
+static db_stats_t db_stats = {0};
+
+// Prepared statements indexed by number of rows, created on first use
+static MYSQL_STMT* db_stmt[DB_STMT_ROWS + 1] = {0};
+
+static MYSQL_BIND db_bind[DB_STMT_ROWS * DB_COLS_PER_ROW];
+
+// Flush every indication (0) or accumulate indications for DB_FLUSH_MS
+static int64_t db_flush_us = 0;
+
+// xapp_kpi_metrics and its rollups xapp_kpi_rollup_1s / _1m are range partitioned on their
+// time column in seconds. Each table keeps DB_PARTITIONS_AHEAD empty partitions ahead of the
+// current one, in front of p_future (LESS THAN MAXVALUE), and loses whole partitions once
+// they are past its retention instead of DELETEs. maintain_database() does both every
+// DB_MAINT_PERIOD_US on the writer thread. A rollup row summarizes the rows of one UE and
+// slice in one second or minute of reception time; it is upserted in the transaction that
+// inserts those rows. A UE is (amf_ue_ngap_id, ran_ue_id) as in the UE table: the UEs of a DU
+// or CU-UP report no amf_ue_ngap_id (0) and are told apart by their ran_ue_id only.
+#define DB_PARTITIONS_AHEAD 3
+#define DB_LEGACY_PARTITION "p_legacy" // Rows of a table partitioned by migrate_partitions()
+#define DB_MAINT_PERIOD_US 60000000
+#define DB_ROLLUP_COLS(meas_len) (6 + 4 * (meas_len)) // sst, sd, amf_ue_ngap_id, ran_ue_id, ts, samples, then cnt, sum, min, max
+
+typedef enum {
+    DB_TABLE_RAW,
+    DB_TABLE_1S,
+    DB_TABLE_1M,
+    END_DB_TABLE,
+} db_table_e;
+
+typedef struct {
+    const char* name;
+    const char* ts_col;   // Partitioning column [s]
+    int64_t bucket_s;     // Rollup resolution, 0 for the raw rows
+    int64_t width_s;      // Partition width
+    int64_t retention_s;  // Partitions older than this are dropped, 0 keeps them all
+} db_table_t;
+
+static db_table_t db_tables[END_DB_TABLE] = {
+    [DB_TABLE_RAW] = {"xapp_kpi_metrics", "timestamp", 0, 3600, 24 * 3600},
+    [DB_TABLE_1S] = {"xapp_kpi_rollup_1s", "ts", 1, 3600, 7 * 24 * 3600},
+    [DB_TABLE_1M] = {"xapp_kpi_rollup_1m", "ts", 60, 24 * 3600, 90 * 24 * 3600},
+};
+
+typedef struct {
+    unsigned long amf_ue_ngap_id;
+    unsigned long ran_ue_id;
+    long long ts;         // Start of the second or minute
+    uint32_t sd;
+    uint8_t sst;
+    uint32_t samples;
+    uint32_t cnt[END_KPM_MEAS];
+    double sum[END_KPM_MEAS];
+    double min[END_KPM_MEAS];
+    double max[END_KPM_MEAS];
+    bool no_val[END_KPM_MEAS]; // cnt == 0, min and max are written as NULL
+} db_rollup_t;
+
+#define DB_ROLLUP_SLOTS (2 * DB_BATCH_ROWS)
+
+// The groups of one batch and one resolution, found through an open addressing index
+typedef struct {
+    db_rollup_t groups[DB_BATCH_ROWS];
+    int32_t slot[DB_ROLLUP_SLOTS]; // -1 = free
+    size_t len;
+} db_rollup_batch_t;
+
+static db_rollup_batch_t db_rollup = {0};
+
+static MYSQL_STMT* db_rollup_stmt[END_DB_TABLE][DB_STMT_ROWS + 1] = {0};
+
+static MYSQL_BIND db_rollup_bind[DB_STMT_ROWS * DB_ROLLUP_COLS(END_KPM_MEAS)];
+
+static bool db_rollups = true;
+
+static int64_t db_maint_next_us = 0;
+
+// A lost connection does not lose rows. Batches flushed while MySQL is unreachable are
+// appended to the spool file DB_SPOOL_FILE, up to DB_SPOOL_MAX_MB, and maybe_flush_database()
+// reconnects with exponential backoff (DB_RECONNECT_MIN_US up to DB_RECONNECT_MAX_MS). Once
+// connected it replays the spool in transactions of DB_BATCH_ROWS rows, for at most
+// DB_SPOOL_REPLAY_US per call so that the writer thread keeps draining the ring. The header
+// keeps the offset of the first row not replayed, so the spool of a run that stopped before
+// MySQL came back is replayed by the next one. Every spooled row has a sequence number, and a
+// replay transaction stores the one following its last row in xapp_kpi_spool. A batch
+// committed by a replay whose connection was lost before the header moved on is therefore
+// skipped, not counted twice in the rollups. A live batch whose COMMIT is cut is spooled, and
+// may still be written twice.
+#define DB_SPOOL_MAGIC 0x324c5053u // "SPL2"
+#define DB_SPOOL_REPLAY_US 50000
+#define DB_RECONNECT_MIN_US 500000
+#define DB_CONNECT_TIMEOUT_S 5
+#define DB_IO_TIMEOUT_S 30
+
+typedef struct {
+    uint32_t magic;
+    uint32_t rec_size;    // sizeof(db_spool_rec_t), the spool of another build is discarded
+    uint64_t read_off;    // First row not replayed yet
+    uint64_t spool_id;    // Key of the spool in xapp_kpi_spool, drawn when the file is created
+    uint64_t base_seq;    // Sequence number of the row at sizeof(db_spool_hdr_t)
+} db_spool_hdr_t;
+
+typedef struct {
+    kpi_metrics_t row;
+    int64_t ts_us;
+    int64_t collect_us;
+} db_spool_rec_t;
+
+typedef struct {
+    int fd;               // -1 without spool
+    char path[256];
+    uint64_t max_bytes;
+    uint64_t read_off;
+    uint64_t write_off;   // End of the last complete row
+    uint64_t spool_id;
+    uint64_t base_seq;
+    int64_t replay_start_us;
+    uint64_t replay_rows; // Since replay_start_us
+    db_spool_rec_t buf[DB_BATCH_ROWS];
+} db_spool_t;
+
+static db_spool_t db_spool = {.fd = -1};
+
+static const char* db_host;
+static const char* db_user;
+static const char* db_password;
+static const char* db_name;
+static unsigned int db_port;
+
+// The connection failed while in use: flush_database() spools, maybe_flush_database() reconnects
+static bool db_lost = false;
+
+static int64_t db_reconnect_at_us = 0;
+static int64_t db_backoff_us = DB_RECONNECT_MIN_US;
+static int64_t db_backoff_max_us = 30000000;
+static uint64_t db_connects = 0;
+
+// Client errors after which the connection is gone, as opposed to a rejected statement
+static bool db_conn_error(unsigned int err) {
+    return err == CR_CONNECTION_ERROR || err == CR_CONN_HOST_ERROR || err == CR_SERVER_GONE_ERROR
+           || err == CR_SERVER_LOST || err == CR_SERVER_LOST_EXTENDED;
+}
+
+static void note_db_error(unsigned int err) {
+    if (db_conn_error(err))
+        db_lost = true;
+}
+
+// A rejected statement is fatal. After a lost connection the rest of the setup is skipped
+// and connect_database() runs it again once reconnected.
+static void exec_schema_sql(const char* sql, const char* what) {
+    if (db_lost)
+        return;
+    if (mysql_query(conn, sql)) {
+        fprintf(stderr, "%s failed: %s\n", what, mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        if (db_lost)
+            return;
+        mysql_close(conn);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// True if the information_schema query returns at least one row. Once the connection is
+// lost it answers true, so that no ALTER follows.
+static bool schema_has(const char* query) {
+    if (db_lost)
+        return true;
+    if (mysql_query(conn, query)) {
+        fprintf(stderr, "schema lookup failed: %s\n", mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        return db_lost;
+    }
+    MYSQL_RES* res = mysql_store_result(conn);
+    if (res == NULL)
+        return false;
+    bool const found = mysql_num_rows(res) > 0;
+    mysql_free_result(res);
+    return found;
+}
+
+// A measurement added to KPM_MEASUREMENTS after the table was created gets its column
+static void migrate_meas_columns() {
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        const char* col = kpm_meas_col[kpm_cfg.meas[i]];
+        char query[256];
+        snprintf(query, sizeof(query),
+                 "SELECT 1 FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+                 "AND TABLE_NAME = 'xapp_kpi_metrics' AND COLUMN_NAME = '%s'", col);
+        if (schema_has(query))
+            continue;
+
+        snprintf(query, sizeof(query), "ALTER TABLE xapp_kpi_metrics ADD COLUMN %s DOUBLE;", col);
+        exec_schema_sql(query, "add measurement column");
+    }
+}
+
+// Tables created before rows carried their slice get the S-NSSAI columns and index added
+static void migrate_slice_columns() {
+    if (!schema_has("SELECT 1 FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+                    "AND TABLE_NAME = 'xapp_kpi_metrics' AND COLUMN_NAME = 'sst'")) {
+        exec_schema_sql("ALTER TABLE xapp_kpi_metrics ADD COLUMN sst TINYINT UNSIGNED, ADD COLUMN sd INT UNSIGNED;",
+                        "add slice columns");
+    }
+
+    if (!schema_has("SELECT 1 FROM information_schema.STATISTICS WHERE TABLE_SCHEMA = DATABASE() "
+                    "AND TABLE_NAME = 'xapp_kpi_metrics' AND INDEX_NAME = 'idx_slice_ts'")) {
+        exec_schema_sql("CREATE INDEX idx_slice_ts ON xapp_kpi_metrics (sst, sd, timestamp);",
+                        "create slice index");
+    }
+}
+
+// Tables created with second resolution only get the microsecond timestamps added
+static void migrate_time_columns() {
+    if (!schema_has("SELECT 1 FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+                    "AND TABLE_NAME = 'xapp_kpi_metrics' AND COLUMN_NAME = 'ts_us'")) {
+        exec_schema_sql("ALTER TABLE xapp_kpi_metrics ADD COLUMN ts_us BIGINT, ADD COLUMN collect_start_us BIGINT;",
+                        "add microsecond timestamp columns");
+    }
+}
+
+// "PARTITION <p + UTC start> VALUES LESS THAN (to)", for the rows in [from, to)
+static int fmt_partition(char* out, size_t sz, int64_t from, int64_t to) {
+    time_t const sec = (time_t) from;
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char name[32];
+    strftime(name, sizeof(name), "p%Y%m%d%H%M", &tm);
+    return snprintf(out, sz, "PARTITION %s VALUES LESS THAN (%ld)", name, to);
+}
+
+// Partitioning of a table: the current partition, DB_PARTITIONS_AHEAD partitions ahead and
+// p_future. The older rows of a migrated table go to DB_LEGACY_PARTITION, else to the current one.
+static void fmt_partition_by(db_table_t const* t, int64_t now_s, bool legacy, char* out, size_t sz) {
+    int64_t const from = now_s / t->width_s * t->width_s;
+    size_t pos = (size_t) snprintf(out, sz, " PARTITION BY RANGE (%s) (", t->ts_col);
+    if (legacy)
+        pos += (size_t) snprintf(out + pos, sz - pos, "PARTITION %s VALUES LESS THAN (%ld), ", DB_LEGACY_PARTITION, from);
+    for (int64_t i = 0; i <= DB_PARTITIONS_AHEAD && pos < sz; i++) {
+        pos += (size_t) fmt_partition(out + pos, sz - pos, from + i * t->width_s, from + (i + 1) * t->width_s);
+        pos += (size_t) snprintf(out + pos, sz - pos, ", ");
+    }
+    if (pos < sz)
+        snprintf(out + pos, sz - pos, "PARTITION p_future VALUES LESS THAN MAXVALUE)");
+}
+
+static bool table_partitioned(db_table_t const* t) {
+    char query[256];
+    snprintf(query, sizeof(query),
+             "SELECT 1 FROM information_schema.PARTITIONS WHERE TABLE_SCHEMA = DATABASE() "
+             "AND TABLE_NAME = '%s' AND PARTITION_NAME IS NOT NULL", t->name);
+    return schema_has(query);
+}
+
+// Tables created before partitioning get the per UE index, then the BIGINT id and the primary
+// key the partitioning requires (a unique key must hold the partitioning column), then are
+// partitioned. The ALTERs copy the table once; the rows older than the current partition land
+// in DB_LEGACY_PARTITION, which the retention never drops.
+static void migrate_partitions(int64_t now_s) {
+    if (!schema_has("SELECT 1 FROM information_schema.STATISTICS WHERE TABLE_SCHEMA = DATABASE() "
+                    "AND TABLE_NAME = 'xapp_kpi_metrics' AND INDEX_NAME = 'idx_slice_ue_ts'")) {
+        exec_schema_sql("CREATE INDEX idx_slice_ue_ts ON xapp_kpi_metrics (sst, sd, amf_ue_ngap_id, timestamp);",
+                        "create UE index");
+    }
+
+    db_table_t const* t = &db_tables[DB_TABLE_RAW];
+    if (table_partitioned(t))
+        return;
+
+    printf("[DB]: partitioning %s, this copies the table\n", t->name);
+    exec_schema_sql("ALTER TABLE xapp_kpi_metrics MODIFY id BIGINT NOT NULL AUTO_INCREMENT, "
+                    "DROP PRIMARY KEY, ADD PRIMARY KEY (id, timestamp);",
+                    "change primary key");
+
+    char sql[1024];
+    int const len = snprintf(sql, sizeof(sql), "ALTER TABLE %s", t->name);
+    fmt_partition_by(t, now_s, true, sql + len, sizeof(sql) - (size_t) len);
+    exec_schema_sql(sql, "partition table");
+}
+
+// Rollup table with the count, sum, min and max of every subscribed measurement. min and max
+// are NULL while count is 0. A measurement added to KPM_MEASUREMENTS later gets its columns.
+static void init_rollup_table(db_table_t const* t, int64_t now_s) {
+    char sql[4096];
+    size_t pos = (size_t) snprintf(sql, sizeof(sql),
+                                   "CREATE TABLE IF NOT EXISTS %s ("
+                                   "sst TINYINT UNSIGNED NOT NULL, "
+                                   "sd INT UNSIGNED NOT NULL, "
+                                   "amf_ue_ngap_id BIGINT UNSIGNED NOT NULL, "
+                                   "ran_ue_id BIGINT UNSIGNED NOT NULL DEFAULT 0, "
+                                   "ts BIGINT NOT NULL, "
+                                   "samples INT UNSIGNED NOT NULL, ", t->name);
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        const char* col = kpm_meas_col[kpm_cfg.meas[i]];
+        pos += (size_t) snprintf(sql + pos, sizeof(sql) - pos,
+                                 "%s_cnt INT UNSIGNED NOT NULL DEFAULT 0, %s_sum DOUBLE NOT NULL DEFAULT 0, "
+                                 "%s_min DOUBLE, %s_max DOUBLE, ", col, col, col, col);
+    }
+    pos += (size_t) snprintf(sql + pos, sizeof(sql) - pos, "PRIMARY KEY (sst, sd, amf_ue_ngap_id, ran_ue_id, ts))");
+    fmt_partition_by(t, now_s, false, sql + pos, sizeof(sql) - pos);
+    exec_schema_sql(sql, "create rollup table");
+
+    // Tables keyed without ran_ue_id folded every DU and CU-UP UE of a slice into one row; the
+    // rows already there keep ran_ue_id 0
+    char query[512];
+    snprintf(query, sizeof(query),
+             "SELECT 1 FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+             "AND TABLE_NAME = '%s' AND COLUMN_NAME = 'ran_ue_id'", t->name);
+    if (!schema_has(query)) {
+        snprintf(query, sizeof(query),
+                 "ALTER TABLE %s ADD COLUMN ran_ue_id BIGINT UNSIGNED NOT NULL DEFAULT 0 AFTER amf_ue_ngap_id, "
+                 "DROP PRIMARY KEY, ADD PRIMARY KEY (sst, sd, amf_ue_ngap_id, ran_ue_id, ts);", t->name);
+        exec_schema_sql(query, "add rollup ran_ue_id");
+    }
+
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        const char* col = kpm_meas_col[kpm_cfg.meas[i]];
+        snprintf(query, sizeof(query),
+                 "SELECT 1 FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+                 "AND TABLE_NAME = '%s' AND COLUMN_NAME = '%s_cnt'", t->name, col);
+        if (schema_has(query))
+            continue;
+
+        snprintf(query, sizeof(query),
+                 "ALTER TABLE %s ADD COLUMN %s_cnt INT UNSIGNED NOT NULL DEFAULT 0, "
+                 "ADD COLUMN %s_sum DOUBLE NOT NULL DEFAULT 0, ADD COLUMN %s_min DOUBLE, ADD COLUMN %s_max DOUBLE;",
+                 t->name, col, col, col, col);
+        exec_schema_sql(query, "add rollup columns");
+    }
+}
+
+// Failures are logged and retried at the next maintenance, the xApp keeps writing
+static bool exec_maint_sql(const char* sql, const char* what, const char* table) {
+    if (db_lost)
+        return false;
+    if (mysql_query(conn, sql)) {
+        fprintf(stderr, "[DB]: %s of %s failed: %s\n", what, table, mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        return false;
+    }
+    return true;
+}
+
+// Add the partitions up to DB_PARTITIONS_AHEAD past the current one, and drop those whose
+// rows are all older than the retention. The current partition is never dropped, since the
+// retention is at least one partition wide, and neither is DB_LEGACY_PARTITION.
+static void maintain_partitions(db_table_t const* t, int64_t now_s) {
+    char query[512];
+    snprintf(query, sizeof(query),
+             "SELECT PARTITION_NAME, PARTITION_DESCRIPTION FROM information_schema.PARTITIONS "
+             "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = '%s' AND PARTITION_NAME IS NOT NULL "
+             "ORDER BY PARTITION_ORDINAL_POSITION", t->name);
+    if (!exec_maint_sql(query, "listing the partitions", t->name))
+        return;
+    MYSQL_RES* res = mysql_store_result(conn);
+    if (res == NULL)
+        return;
+
+    int64_t const cutoff = now_s - t->retention_s;
+    int64_t last = INT64_MIN;
+    bool has_future = false;
+    size_t bounded = 0;
+    size_t dropped = 0;
+    char drop[2048];
+    size_t drop_len = (size_t) snprintf(drop, sizeof(drop), "ALTER TABLE %s DROP PARTITION ", t->name);
+
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        if (row[0] == NULL || row[1] == NULL)
+            continue;
+        if (strcmp(row[1], "MAXVALUE") == 0) {
+            has_future = true;
+            continue;
+        }
+        int64_t const less_than = strtoll(row[1], NULL, 10);
+        bounded++;
+        if (less_than > last)
+            last = less_than;
+        if (t->retention_s > 0 && less_than <= cutoff && strcmp(row[0], DB_LEGACY_PARTITION) != 0 && drop_len + strlen(row[0]) + 3 < sizeof(drop)) {
+            drop_len += (size_t) snprintf(drop + drop_len, sizeof(drop) - drop_len, "%s%s", dropped ? ", " : "", row[0]);
+            dropped++;
+        }
+    }
+    mysql_free_result(res);
+    if (bounded == 0)
+        return;
+
+    int64_t const cur = now_s / t->width_s * t->width_s;
+    int64_t const target = cur + (DB_PARTITIONS_AHEAD + 1) * t->width_s;
+    if (last < target) {
+        char parts[1024];
+        size_t pos = 0;
+        int64_t from = last;
+        // The time the xApp was down gets a single partition
+        if (from < cur) {
+            pos += (size_t) fmt_partition(parts + pos, sizeof(parts) - pos, from, cur);
+            from = cur;
+        }
+        for (; from < target && pos < sizeof(parts); from += t->width_s) {
+            pos += (size_t) snprintf(parts + pos, sizeof(parts) - pos, "%s", pos ? ", " : "");
+            pos += (size_t) fmt_partition(parts + pos, sizeof(parts) - pos, from, from + t->width_s);
+        }
+
+        char sql[1280];
+        if (has_future)
+            snprintf(sql, sizeof(sql), "ALTER TABLE %s REORGANIZE PARTITION p_future INTO (%s, "
+                     "PARTITION p_future VALUES LESS THAN MAXVALUE);", t->name, parts);
+        else
+            snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD PARTITION (%s);", t->name, parts);
+        if (exec_maint_sql(sql, "adding partitions", t->name))
+            KPM_LOG(KPM_LOG_INFO, "[DB]: %s: partitions added up to %ld\n", t->name, target);
+    }
+
+    // MySQL keeps at least one partition
+    if (dropped > 0 && (dropped < bounded || has_future)) {
+        if (exec_maint_sql(drop, "dropping partitions", t->name))
+            KPM_LOG(KPM_LOG_INFO, "[DB]: %s: %zu partitions past the %ld h retention dropped\n",
+                    t->name, dropped, t->retention_s / 3600);
+    }
+}
+
+// Partition DDL commits implicitly: this runs between two flush_database() transactions
+static void maintain_database(int64_t now_us) {
+    db_maint_next_us = now_us + DB_MAINT_PERIOD_US;
+    if (conn == NULL)
+        return;
+
+    for (db_table_e t = DB_TABLE_RAW; t < END_DB_TABLE; t++) {
+        if (t == DB_TABLE_RAW || db_rollups)
+            maintain_partitions(&db_tables[t], now_us / 1000000);
+    }
+}
+
+// Partition width and retention of a table, from DB_PARTITION_MIN and its *_RETENTION_H
+static void init_table_cfg(db_table_t* t, const char* width_var, const char* retention_var) {
+    const char* width_str = width_var ? getenv(width_var) : NULL;
+    if (width_str) {
+        if (atoi(width_str) <= 0)
+            cfg_error(width_var, "expected minutes > 0:", width_str);
+        t->width_s = (int64_t) atoi(width_str) * 60;
+    }
+
+    const char* retention_str = getenv(retention_var);
+    if (retention_str) {
+        if (atoi(retention_str) < 0)
+            cfg_error(retention_var, "expected hours >= 0:", retention_str);
+        t->retention_s = (int64_t) atoi(retention_str) * 3600;
+    }
+    if (t->retention_s > 0 && t->retention_s < t->width_s)
+        cfg_error(retention_var, "retention shorter than one partition:", retention_str ? retention_str : "default");
+}
+
+// Create or migrate the schema, on every new connection
+static void setup_database() {
+    int64_t const now_s = time_now_us() / 1000000;
+
+    // SQL statement to create the table, with a column per subscribed measurement
+    char sql[4096] = "CREATE TABLE IF NOT EXISTS xapp_kpi_metrics ("
+                     "id BIGINT AUTO_INCREMENT, ";
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        strcat(sql, kpm_meas_col[kpm_cfg.meas[i]]);
+        strcat(sql, " DOUBLE, ");
+    }
+    strcat(sql, "amf_ue_ngap_id BIGINT, "
+                "ran_ue_id BIGINT, "
+                "sst TINYINT UNSIGNED, "
+                "sd INT UNSIGNED, "
+                "timestamp BIGINT NOT NULL, "
+                "ts_us BIGINT, "
+                "collect_start_us BIGINT, "
+                "PRIMARY KEY (id, timestamp), "
+                "INDEX idx_slice_ts (sst, sd, timestamp), "
+                "INDEX idx_slice_ue_ts (sst, sd, amf_ue_ngap_id, timestamp))");
+    fmt_partition_by(&db_tables[DB_TABLE_RAW], now_s, false, sql + strlen(sql), sizeof(sql) - strlen(sql));
+
+    // Execute the SQL statement
+    exec_schema_sql(sql, "create table");
+    migrate_meas_columns();
+    migrate_slice_columns();
+    migrate_time_columns();
+    migrate_partitions(now_s);
+
+    if (db_rollups) {
+        init_rollup_table(&db_tables[DB_TABLE_1S], now_s);
+        init_rollup_table(&db_tables[DB_TABLE_1M], now_s);
+    }
+    // Replay progress of each spool, see replay_spool()
+    if (db_spool.fd >= 0) {
+        exec_schema_sql("CREATE TABLE IF NOT EXISTS xapp_kpi_spool ("
+                        "spool_id BIGINT UNSIGNED NOT NULL PRIMARY KEY, "
+                        "replayed BIGINT UNSIGNED NOT NULL)", "create spool table");
+    }
+    // Catch up on the partitions a previous run left
+    maintain_database(time_now_us());
+
+    // Every flush is committed explicitly as one transaction
+    if (!db_lost && mysql_autocommit(conn, 0)) {
+        fprintf(stderr, "disabling autocommit failed: %s\n", mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        if (!db_lost) {
+            mysql_close(conn);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+}
+
+static void publish_spool() {
+    uint64_t const bytes = db_spool.write_off - db_spool.read_off;
+    atomic_store(&kpm_metrics.spool_bytes, bytes);
+    atomic_store(&kpm_metrics.spool_rows, bytes / sizeof(db_spool_rec_t));
+}
+
+static bool write_spool_hdr() {
+    db_spool_hdr_t const hdr = {
+        .magic = DB_SPOOL_MAGIC,
+        .rec_size = sizeof(db_spool_rec_t),
+        .read_off = db_spool.read_off,
+        .spool_id = db_spool.spool_id,
+        .base_seq = db_spool.base_seq,
+    };
+    return pwrite(db_spool.fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr);
+}
+
+// Open DB_SPOOL_FILE, keeping the rows a previous run could not write
+static void init_db_spool() {
+    const char* path = getenv("DB_SPOOL_FILE");
+    if (!path) path = "kpm_mysql.spool";
+    if (path[0] == '\0') {
+        printf("[DB]: no DB_SPOOL_FILE, rows are lost while MySQL is unreachable\n");
+        return;
+    }
+    if (strlen(path) >= sizeof(db_spool.path))
+        cfg_error("DB_SPOOL_FILE", "path too long", path);
+    snprintf(db_spool.path, sizeof(db_spool.path), "%s", path);
+
+    db_spool.max_bytes = (uint64_t) cfg_long("DB_SPOOL_MAX_MB", 256, 0, 1L << 20) << 20;
+
+    db_spool.fd = open(db_spool.path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (db_spool.fd < 0 || fstat(db_spool.fd, &st) != 0) {
+        fprintf(stderr, "[DB]: cannot open the spool %s: %s\n", db_spool.path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    db_spool_hdr_t hdr = {0};
+    uint64_t const size = (uint64_t) st.st_size;
+    bool const valid = size >= sizeof(hdr)
+                       && pread(db_spool.fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr)
+                       && hdr.magic == DB_SPOOL_MAGIC
+                       && hdr.rec_size == sizeof(db_spool_rec_t)
+                       && hdr.read_off >= sizeof(hdr) && hdr.read_off <= size
+                       && hdr.spool_id != 0;
+    if (valid) {
+        // A row cut by a crash is dropped
+        db_spool.spool_id = hdr.spool_id;
+        db_spool.base_seq = hdr.base_seq;
+        db_spool.read_off = hdr.read_off;
+        db_spool.write_off = hdr.read_off + (size - hdr.read_off) / sizeof(db_spool_rec_t) * sizeof(db_spool_rec_t);
+    } else {
+        if (size > 0)
+            fprintf(stderr, "[DB]: %s is not a spool of this build, discarding it\n", db_spool.path);
+        // A new spool must not match the progress stored for an older one
+        db_spool.spool_id = ((uint64_t) time_now_us() << 16 ^ (uint64_t) getpid()) | 1;
+        db_spool.base_seq = 0;
+        db_spool.read_off = sizeof(hdr);
+        db_spool.write_off = sizeof(hdr);
+    }
+
+    if (ftruncate(db_spool.fd, (off_t) db_spool.write_off) != 0 || !write_spool_hdr()) {
+        fprintf(stderr, "[DB]: cannot write the spool %s: %s\n", db_spool.path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    publish_spool();
+
+    if (db_spool.write_off > db_spool.read_off)
+        printf("[DB]: %lu rows spooled by a previous run in %s\n",
+               (db_spool.write_off - db_spool.read_off) / sizeof(db_spool_rec_t), db_spool.path);
+}
+
+// Sequence number of the spooled row at offset off
+static uint64_t spool_seq(uint64_t off) {
+    return db_spool.base_seq + (off - sizeof(db_spool_hdr_t)) / sizeof(db_spool_rec_t);
+}
+
+// Append the queued rows to the spool, as many as DB_SPOOL_MAX_MB leaves room for
+static void spool_batch() {
+    size_t n = 0;
+    if (db_spool.fd >= 0) {
+        uint64_t const room = db_spool.max_bytes > db_spool.write_off
+                              ? (db_spool.max_bytes - db_spool.write_off) / sizeof(db_spool_rec_t) : 0;
+        n = db_batch.len < room ? db_batch.len : (size_t) room;
+        for (size_t i = 0; i < n; i++) {
+            db_spool.buf[i].row = db_batch.rows[i];
+            db_spool.buf[i].ts_us = db_batch.ts_us[i];
+            db_spool.buf[i].collect_us = db_batch.collect_us[i];
+        }
+
+        ssize_t const len = (ssize_t)(n * sizeof(db_spool_rec_t));
+        if (n > 0 && pwrite(db_spool.fd, db_spool.buf, (size_t) len, (off_t) db_spool.write_off) != len) {
+            fprintf(stderr, "[DB]: spool write failed: %s\n", strerror(errno));
+            // No partial row may follow write_off
+            if (ftruncate(db_spool.fd, (off_t) db_spool.write_off) != 0)
+                fprintf(stderr, "[DB]: spool truncate failed: %s\n", strerror(errno));
+            n = 0;
+        }
+        db_spool.write_off += n * sizeof(db_spool_rec_t);
+        publish_spool();
+    }
+
+    if (n < db_batch.len)
+        atomic_fetch_add_explicit(&kpm_metrics.spool_dropped, db_batch.len - n, memory_order_relaxed);
+}
+
+static void close_db_stmts() {
+    for (size_t i = 0; i <= DB_STMT_ROWS; i++) {
+        if (db_stmt[i] != NULL)
+            mysql_stmt_close(db_stmt[i]);
+        db_stmt[i] = NULL;
+    }
+    for (db_table_e t = DB_TABLE_RAW; t < END_DB_TABLE; t++) {
+        for (size_t i = 0; i <= DB_STMT_ROWS; i++) {
+            if (db_rollup_stmt[t][i] != NULL)
+                mysql_stmt_close(db_rollup_stmt[t][i]);
+            db_rollup_stmt[t][i] = NULL;
+        }
+    }
+}
+
+static void schedule_reconnect(int64_t now) {
+    db_reconnect_at_us = now + db_backoff_us;
+    db_backoff_us = 2 * db_backoff_us < db_backoff_max_us ? 2 * db_backoff_us : db_backoff_max_us;
+}
+
+// Drop a connection that failed, maybe_flush_database() makes a new one after the backoff
+static void disconnect_database(int64_t now) {
+    close_db_stmts();
+    mysql_close(conn);
+    conn = NULL;
+    db_lost = false;
+    atomic_store(&kpm_metrics.db_connected, 0);
+    schedule_reconnect(now);
+    fprintf(stderr, "[DB]: connection lost, spooling rows, reconnecting in %ld [ms]\n",
+            (db_reconnect_at_us - now) / 1000);
+}
+
+static bool connect_database(int64_t now) {
+    conn = mysql_init(NULL);
+    if (conn == NULL) {
+        fprintf(stderr, "mysql_init() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A server that stops answering is detected as a lost connection
+    unsigned int const connect_timeout = DB_CONNECT_TIMEOUT_S;
+    unsigned int const io_timeout = DB_IO_TIMEOUT_S;
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+    mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &io_timeout);
+    mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &io_timeout);
+
+    // Connect to the database
+    if (mysql_real_connect(conn, db_host, db_user, db_password, db_name, db_port, NULL, 0) == NULL) {
+        schedule_reconnect(now);
+        fprintf(stderr, "mysql_real_connect() failed: %s, retrying in %ld [ms]\n", mysql_error(conn),
+                (db_reconnect_at_us - now) / 1000);
+        mysql_close(conn);
+        conn = NULL;
+        return false;
+    }
+
+    db_lost = false;
+    setup_database();
+    if (db_lost) {
+        disconnect_database(now);
+        return false;
+    }
+
+    if (db_connects++ > 0)
+        atomic_fetch_add_explicit(&kpm_metrics.db_reconnects, 1, memory_order_relaxed);
+    atomic_store(&kpm_metrics.db_connected, 1);
+    db_backoff_us = DB_RECONNECT_MIN_US;
+    printf("[DB]: connected to %s:%u/%s\n", db_host, db_port, db_name);
+    return true;
+}
+
+static void init_database() {
+    db_host = getenv("DB_HOST");
+    if (!db_host) db_host = "127.0.0.1";
+
+    db_user = getenv("DB_USER");
+    if (!db_user) db_user = "admin";
+
+    db_password = getenv("DB_PASSWORD");
+    if (!db_password) db_password = "password";
+
+    db_name = getenv("DB_NAME");
+    if (!db_name) db_name = "flexric_db";
+
+    db_port = (unsigned int) cfg_long("DB_PORT", 3307, 1, 65535);
+    db_flush_us = (int64_t) cfg_long("DB_FLUSH_MS", 0, 0, 60000) * 1000;
+    db_rollups = cfg_long("DB_ROLLUPS", 1, 0, 1) != 0;
+    db_backoff_max_us = (int64_t) cfg_long("DB_RECONNECT_MAX_MS", 30000, DB_RECONNECT_MIN_US / 1000, 3600000) * 1000;
+
+    init_table_cfg(&db_tables[DB_TABLE_RAW], "DB_PARTITION_MIN", "DB_RETENTION_H");
+    init_table_cfg(&db_tables[DB_TABLE_1S], "DB_PARTITION_MIN", "DB_ROLLUP_1S_RETENTION_H");
+    init_table_cfg(&db_tables[DB_TABLE_1M], NULL, "DB_ROLLUP_1M_RETENTION_H");
+
+    init_db_spool();
+
+    db_stats.win_start_us = time_now_us();
+
+    // MySQL may come up after the xApp, the writer thread keeps trying
+    if (connect_database(time_now_us()))
+        printf("database and table initialized successfully.\n");
+}
+
+// Prepare "INSERT ... VALUES (?,...),(?,...)" for n rows
+static MYSQL_STMT* get_insert_stmt(size_t n) {
+    assert(n > 0 && n <= DB_STMT_ROWS);
+
+    if (db_stmt[n] != NULL)
+        return db_stmt[n];
+
+    char head[512] = "INSERT INTO xapp_kpi_metrics (";
+    char row[2 * DB_COLS_PER_ROW + 2] = "(";
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        strcat(head, kpm_meas_col[kpm_cfg.meas[i]]);
+        strcat(head, ", ");
+        strcat(row, "?,");
+    }
+    strcat(head, "amf_ue_ngap_id, ran_ue_id, sst, sd, timestamp, ts_us, collect_start_us) VALUES ");
+    strcat(row, "?,?,?,?,?,?,?)");
+
+    size_t const sz = strlen(head) + n * (strlen(row) + 1) + 1;
+    char* query = calloc(sz, sizeof(char));
+    assert(query != NULL && "Memory exhausted");
+
+    size_t pos = (size_t) snprintf(query, sz, "%s", head);
+    for (size_t i = 0; i < n; i++)
+        pos += (size_t) snprintf(query + pos, sz - pos, "%s%s", i == 0 ? "" : ",", row);
+
+    MYSQL_STMT* stmt = mysql_stmt_init(conn);
+    assert(stmt != NULL && "Memory exhausted");
+    if (mysql_stmt_prepare(stmt, query, (unsigned long) pos)) {
+        fprintf(stderr, "prepare insert failed: %s\n", mysql_stmt_error(stmt));
+        note_db_error(mysql_stmt_errno(stmt));
+        mysql_stmt_close(stmt);
+        free(query);
+        return NULL;
+    }
+    free(query);
+
+    db_stmt[n] = stmt;
+    return stmt;
+}
+
+static void bind_double(MYSQL_BIND* b, double* val, bool* is_null) {
+    b->buffer_type = MYSQL_TYPE_DOUBLE;
+    b->buffer = val;
+    b->is_null = is_null;
+}
+
+static void bind_ulonglong(MYSQL_BIND* b, void* val) {
+    b->buffer_type = MYSQL_TYPE_LONGLONG;
+    b->buffer = val;
+    b->is_unsigned = true;
+}
+
+// Point the parameter array at rows [off, off + n) of the batch
+static void bind_batch_rows(size_t off, size_t n) {
+    size_t const meas_len = kpm_cfg.meas_len;
+    size_t const cols = meas_len + DB_KEY_COLS;
+    memset(db_bind, 0, n * cols * sizeof(MYSQL_BIND));
+
+    for (size_t i = 0; i < n; i++) {
+        kpi_metrics_t* m = &db_batch.rows[off + i];
+        MYSQL_BIND* b = &db_bind[i * cols];
+
+        for (size_t j = 0; j < meas_len; j++) {
+            kpm_meas_e const k = kpm_cfg.meas[j];
+            bind_double(&b[j], &m->meas[k], &db_batch.is_null[off + i][k]);
+        }
+        bind_ulonglong(&b[meas_len], &m->amf_ue_ngap_id);
+        bind_ulonglong(&b[meas_len + 1], &m->ran_ue_id);
+        b[meas_len + 2].buffer_type = MYSQL_TYPE_TINY;
+        b[meas_len + 2].buffer = &m->sst;
+        b[meas_len + 2].is_unsigned = true;
+        b[meas_len + 3].buffer_type = MYSQL_TYPE_LONG;
+        b[meas_len + 3].buffer = &m->sd;
+        b[meas_len + 3].is_unsigned = true;
+        b[meas_len + 4].buffer_type = MYSQL_TYPE_LONGLONG;
+        b[meas_len + 4].buffer = &db_batch.ts[off + i];
+        b[meas_len + 5].buffer_type = MYSQL_TYPE_LONGLONG;
+        b[meas_len + 5].buffer = &db_batch.ts_us[off + i];
+        b[meas_len + 6].buffer_type = MYSQL_TYPE_LONGLONG;
+        b[meas_len + 6].buffer = &db_batch.collect_us[off + i];
+    }
+}
+
+// Fold the queued rows into one group per slice, UE (amf_ue_ngap_id, ran_ue_id) and bucket_s
+// interval
+static void build_rollup(int64_t bucket_s) {
+    db_rollup_batch_t* r = &db_rollup;
+    r->len = 0;
+    memset(r->slot, 0xff, sizeof(r->slot));
+
+    for (size_t i = 0; i < db_batch.len; i++) {
+        kpi_metrics_t const* m = &db_batch.rows[i];
+        long long const ts = db_batch.ts[i] / bucket_s * bucket_s;
+
+        uint64_t h = (uint64_t) m->amf_ue_ngap_id * 0x9e3779b97f4a7c15ull;
+        h ^= (uint64_t) m->ran_ue_id * 0x165667b19e3779f9ull;
+        h ^= ((uint64_t) ts * 0xc2b2ae3d27d4eb4full) ^ ((uint64_t) m->sd << 8 | m->sst);
+        h ^= h >> 31;
+        size_t s = (size_t) h & (DB_ROLLUP_SLOTS - 1);
+
+        db_rollup_t* g = NULL;
+        for (; r->slot[s] >= 0; s = (s + 1) & (DB_ROLLUP_SLOTS - 1)) {
+            db_rollup_t* c = &r->groups[r->slot[s]];
+            if (c->amf_ue_ngap_id == m->amf_ue_ngap_id && c->ran_ue_id == m->ran_ue_id && c->ts == ts
+                && c->sst == m->sst && c->sd == m->sd) {
+                g = c;
+                break;
+            }
+        }
+        if (g == NULL) {
+            r->slot[s] = (int32_t) r->len;
+            g = &r->groups[r->len++];
+            memset(g, 0, sizeof(*g));
+            g->amf_ue_ngap_id = m->amf_ue_ngap_id;
+            g->ran_ue_id = m->ran_ue_id;
+            g->ts = ts;
+            g->sst = m->sst;
+            g->sd = m->sd;
+            for (size_t k = 0; k < END_KPM_MEAS; k++)
+                g->no_val[k] = true;
+        }
+
+        g->samples++;
+        for (size_t k = 0; k < END_KPM_MEAS; k++) {
+            if ((m->present & (1u << k)) == 0)
+                continue;
+            double const v = m->meas[k];
+            if (g->cnt[k] == 0 || v < g->min[k]) g->min[k] = v;
+            if (g->cnt[k] == 0 || v > g->max[k]) g->max[k] = v;
+            g->sum[k] += v;
+            g->cnt[k]++;
+            g->no_val[k] = false;
+        }
+    }
+}
+
+// Prepare the upsert of n groups into rollup table t, merging them with the stored ones
+static MYSQL_STMT* get_rollup_stmt(db_table_e t, size_t n) {
+    assert(n > 0 && n <= DB_STMT_ROWS);
+
+    if (db_rollup_stmt[t][n] != NULL)
+        return db_rollup_stmt[t][n];
+
+    char head[1024];
+    char row[2 * DB_ROLLUP_COLS(END_KPM_MEAS) + 2] = "(?,?,?,?,?,?";
+    char tail[4096] = " AS new ON DUPLICATE KEY UPDATE samples = samples + new.samples";
+    size_t head_len = (size_t) snprintf(head, sizeof(head), "INSERT INTO %s (sst, sd, amf_ue_ngap_id, ran_ue_id, ts, samples",
+                                        db_tables[t].name);
+    size_t tail_len = strlen(tail);
+    for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+        const char* c = kpm_meas_col[kpm_cfg.meas[i]];
+        head_len += (size_t) snprintf(head + head_len, sizeof(head) - head_len,
+                                      ", %s_cnt, %s_sum, %s_min, %s_max", c, c, c, c);
+        strcat(row, ",?,?,?,?");
+        tail_len += (size_t) snprintf(tail + tail_len, sizeof(tail) - tail_len,
+                                      ", %s_cnt = %s_cnt + new.%s_cnt, %s_sum = %s_sum + new.%s_sum"
+                                      ", %s_min = LEAST(COALESCE(%s_min, new.%s_min), COALESCE(new.%s_min, %s_min))"
+                                      ", %s_max = GREATEST(COALESCE(%s_max, new.%s_max), COALESCE(new.%s_max, %s_max))",
+                                      c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c);
+    }
+    snprintf(head + head_len, sizeof(head) - head_len, ") VALUES ");
+    strcat(row, ")");
+
+    size_t const sz = strlen(head) + n * (strlen(row) + 1) + tail_len + 1;
+    char* query = calloc(sz, sizeof(char));
+    assert(query != NULL && "Memory exhausted");
+
+    size_t pos = (size_t) snprintf(query, sz, "%s", head);
+    for (size_t i = 0; i < n; i++)
+        pos += (size_t) snprintf(query + pos, sz - pos, "%s%s", i == 0 ? "" : ",", row);
+    pos += (size_t) snprintf(query + pos, sz - pos, "%s", tail);
+
+    MYSQL_STMT* stmt = mysql_stmt_init(conn);
+    assert(stmt != NULL && "Memory exhausted");
+    if (mysql_stmt_prepare(stmt, query, (unsigned long) pos)) {
+        fprintf(stderr, "prepare rollup failed: %s\n", mysql_stmt_error(stmt));
+        note_db_error(mysql_stmt_errno(stmt));
+        mysql_stmt_close(stmt);
+        free(query);
+        return NULL;
+    }
+    free(query);
+
+    db_rollup_stmt[t][n] = stmt;
+    return stmt;
+}
+
+// Point the parameter array at groups [off, off + n) of db_rollup
+static void bind_rollup_groups(size_t off, size_t n) {
+    size_t const meas_len = kpm_cfg.meas_len;
+    size_t const cols = DB_ROLLUP_COLS(meas_len);
+    memset(db_rollup_bind, 0, n * cols * sizeof(MYSQL_BIND));
+
+    for (size_t i = 0; i < n; i++) {
+        db_rollup_t* g = &db_rollup.groups[off + i];
+        MYSQL_BIND* b = &db_rollup_bind[i * cols];
+
+        b[0].buffer_type = MYSQL_TYPE_TINY;
+        b[0].buffer = &g->sst;
+        b[0].is_unsigned = true;
+        b[1].buffer_type = MYSQL_TYPE_LONG;
+        b[1].buffer = &g->sd;
+        b[1].is_unsigned = true;
+        bind_ulonglong(&b[2], &g->amf_ue_ngap_id);
+        bind_ulonglong(&b[3], &g->ran_ue_id);
+        b[4].buffer_type = MYSQL_TYPE_LONGLONG;
+        b[4].buffer = &g->ts;
+        b[5].buffer_type = MYSQL_TYPE_LONG;
+        b[5].buffer = &g->samples;
+        b[5].is_unsigned = true;
+
+        for (size_t j = 0; j < meas_len; j++) {
+            kpm_meas_e const k = kpm_cfg.meas[j];
+            MYSQL_BIND* c = &b[6 + 4 * j];
+            c[0].buffer_type = MYSQL_TYPE_LONG;
+            c[0].buffer = &g->cnt[k];
+            c[0].is_unsigned = true;
+            bind_double(&c[1], &g->sum[k], NULL);
+            bind_double(&c[2], &g->min[k], &g->no_val[k]);
+            bind_double(&c[3], &g->max[k], &g->no_val[k]);
+        }
+    }
+}
+
+// Merge the queued rows into rollup table t, within the transaction of flush_database()
+static bool upsert_rollup(db_table_e t) {
+    build_rollup(db_tables[t].bucket_s);
+
+    for (size_t off = 0; off < db_rollup.len; off += DB_STMT_ROWS) {
+        size_t const n = db_rollup.len - off < DB_STMT_ROWS ? db_rollup.len - off : DB_STMT_ROWS;
+        MYSQL_STMT* stmt = get_rollup_stmt(t, n);
+        if (stmt == NULL)
+            return false;
+
+        bind_rollup_groups(off, n);
+        if (mysql_stmt_bind_param(stmt, db_rollup_bind) || mysql_stmt_execute(stmt)) {
+            fprintf(stderr, "%s upsert failed: %s\n", db_tables[t].name, mysql_stmt_error(stmt));
+            note_db_error(mysql_stmt_errno(stmt));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report_db_stats(int64_t now) {
+    int64_t const elapsed = now - db_stats.win_start_us;
+    if (elapsed <= 0)
+        return;
+
+    printf("[DB]: %.1f rows/s, %lu batches, batch latency avg = %ld [μs] max = %ld [μs] (total rows = %lu, failed batches = %lu)\n",
+           db_stats.win_rows * 1000000.0 / elapsed,
+           db_stats.win_batches,
+           db_stats.win_batches ? db_stats.win_lat_sum_us / (int64_t) db_stats.win_batches : 0,
+           db_stats.win_lat_max_us,
+           db_stats.rows,
+           db_stats.failed);
+
+    if (conn == NULL || db_spool.write_off > db_spool.read_off || db_stats.win_replayed > 0)
+        printf("[DB]: %s, spool = %lu rows (%.1f MB), replay = %.1f rows/s, dropped = %lu rows\n",
+               conn != NULL ? "connected" : "disconnected",
+               atomic_load(&kpm_metrics.spool_rows),
+               atomic_load(&kpm_metrics.spool_bytes) / 1048576.0,
+               db_stats.win_replayed * 1000000.0 / elapsed,
+               atomic_load(&kpm_metrics.spool_dropped));
+
+    db_stats.win_start_us = now;
+    db_stats.win_rows = 0;
+    db_stats.win_batches = 0;
+    db_stats.win_lat_sum_us = 0;
+    db_stats.win_lat_max_us = 0;
+    db_stats.win_replayed = 0;
+}
+
+typedef enum {
+    DB_WRITE_OK,
+    DB_WRITE_FAILED, // Rejected by the server, the rows are dropped
+    DB_WRITE_LOST,   // The connection is gone, the rows are not written
+} db_write_e;
+
+// Rows of the spool a replay already committed: the sequence number stored in xapp_kpi_spool,
+// locked until the transaction ends. False if the lookup failed.
+static bool get_spool_replayed(uint64_t* seq) {
+    char query[128];
+    snprintf(query, sizeof(query), "SELECT replayed FROM xapp_kpi_spool WHERE spool_id = %lu FOR UPDATE",
+             db_spool.spool_id);
+    if (mysql_query(conn, query)) {
+        fprintf(stderr, "[DB]: spool lookup failed: %s\n", mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        return false;
+    }
+    MYSQL_RES* res = mysql_store_result(conn);
+    if (res == NULL) {
+        note_db_error(mysql_errno(conn));
+        return false;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    *seq = row != NULL && row[0] != NULL ? strtoull(row[0], NULL, 10) : 0;
+    mysql_free_result(res);
+    return true;
+}
+
+static bool set_spool_replayed(uint64_t seq) {
+    char sql[192];
+    snprintf(sql, sizeof(sql), "INSERT INTO xapp_kpi_spool (spool_id, replayed) VALUES (%lu, %lu) AS new "
+             "ON DUPLICATE KEY UPDATE replayed = new.replayed", db_spool.spool_id, seq);
+    if (mysql_query(conn, sql)) {
+        fprintf(stderr, "[DB]: spool progress update failed: %s\n", mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        return false;
+    }
+    return true;
+}
+
+// Write every queued row in one transaction; the caller empties the batch. A spool replay
+// passes the sequence number following its rows, 0 for the live rows.
+static db_write_e commit_batch(uint64_t spool_end) {
+    int64_t const start = time_now_us();
+    bool ok = true;
+
+    for (size_t off = 0; off < db_batch.len && ok; off += DB_STMT_ROWS) {
+        size_t const n = db_batch.len - off < DB_STMT_ROWS ? db_batch.len - off : DB_STMT_ROWS;
+        MYSQL_STMT* stmt = get_insert_stmt(n);
+        if (stmt == NULL) {
+            ok = false;
+            break;
+        }
+
+        bind_batch_rows(off, n);
+        if (mysql_stmt_bind_param(stmt, db_bind) || mysql_stmt_execute(stmt)) {
+            fprintf(stderr, "insert failed: %s\n", mysql_stmt_error(stmt));
+            note_db_error(mysql_stmt_errno(stmt));
+            ok = false;
+        }
+    }
+
+    // The rollups commit or roll back with the rows they summarize
+    for (db_table_e t = DB_TABLE_1S; t < END_DB_TABLE && ok && db_rollups; t++)
+        ok = upsert_rollup(t);
+
+    // And so does the replay progress
+    if (ok && spool_end > 0)
+        ok = set_spool_replayed(spool_end);
+
+    if (ok && mysql_commit(conn)) {
+        fprintf(stderr, "commit failed: %s\n", mysql_error(conn));
+        note_db_error(mysql_errno(conn));
+        ok = false;
+    }
+
+    int64_t const end = time_now_us();
+    int64_t const lat = end - start;
+
+    if (ok) {
+        db_stats.rows += db_batch.len;
+        db_stats.batches++;
+        db_stats.lat_sum_us += lat;
+        if (lat > db_stats.lat_max_us) db_stats.lat_max_us = lat;
+        db_stats.win_rows += db_batch.len;
+        db_stats.win_batches++;
+        db_stats.win_lat_sum_us += lat;
+        if (lat > db_stats.win_lat_max_us) db_stats.win_lat_max_us = lat;
+        kpm_hist_record(&kpm_metrics.flush[KPM_SINK_MYSQL], lat * 1000);
+        atomic_fetch_add_explicit(&kpm_metrics.sink_rows[KPM_SINK_MYSQL], db_batch.len, memory_order_relaxed);
+        KPM_LOG(KPM_LOG_DEBUG, "%zu metrics inserted successfully in %ld [μs].\n", db_batch.len, lat);
+        return DB_WRITE_OK;
+    }
+
+    if (db_lost)
+        return DB_WRITE_LOST;
+
+    mysql_rollback(conn);
+    db_stats.failed++;
+    atomic_fetch_add_explicit(&kpm_metrics.sink_failed[KPM_SINK_MYSQL], 1, memory_order_relaxed);
+    return DB_WRITE_FAILED;
+}
+
+// Write every queued row in one transaction, or to the spool while MySQL is unreachable
+static void flush_database() {
+    if (db_batch.len == 0)
+        return;
+
+    if (conn != NULL && commit_batch(0) == DB_WRITE_LOST)
+        disconnect_database(time_now_us());
+    if (conn == NULL)
+        spool_batch();
+
+    db_batch.len = 0;
+}
+
+static void queue_db_row(kpi_metrics_t const* m, int64_t ts_us, int64_t collect_us) {
+    if (db_batch.len == 0)
+        db_batch.first_us = time_now_us();
+
+    db_batch.rows[db_batch.len] = *m;
+    for (size_t k = 0; k < END_KPM_MEAS; k++)
+        db_batch.is_null[db_batch.len][k] = (m->present & (1u << k)) == 0;
+    db_batch.ts[db_batch.len] = ts_us / 1000000;
+    db_batch.ts_us[db_batch.len] = ts_us;
+    db_batch.collect_us[db_batch.len] = collect_us;
+    db_batch.len++;
+}
+
+// Queue one row; it is written by the next flush_database()
+static void insert_to_database(kpi_metrics_t const* m, int64_t ts_us, int64_t collect_us) {
+    if (db_batch.len == DB_BATCH_ROWS)
+        flush_database();
+
+    queue_db_row(m, ts_us, collect_us);
+}
+
+// Write the spooled rows back, DB_BATCH_ROWS per transaction, for at most DB_SPOOL_REPLAY_US
+static void replay_spool(int64_t now) {
+    // The live rows go first, db_batch is reused
+    flush_database();
+
+    while (conn != NULL && db_spool.read_off < db_spool.write_off && time_now_us() - now < DB_SPOOL_REPLAY_US) {
+        if (db_spool.replay_rows == 0)
+            db_spool.replay_start_us = time_now_us();
+
+        uint64_t const left = (db_spool.write_off - db_spool.read_off) / sizeof(db_spool_rec_t);
+        size_t const n = left < DB_BATCH_ROWS ? (size_t) left : DB_BATCH_ROWS;
+        ssize_t const len = (ssize_t)(n * sizeof(db_spool_rec_t));
+        if (pread(db_spool.fd, db_spool.buf, (size_t) len, (off_t) db_spool.read_off) != len) {
+            fprintf(stderr, "[DB]: spool read failed: %s\n", strerror(errno));
+            return;
+        }
+
+        // Rows committed by a replay that lost the connection before read_off moved on
+        uint64_t const first = spool_seq(db_spool.read_off);
+        uint64_t replayed = 0;
+        if (!get_spool_replayed(&replayed)) {
+            if (db_lost)
+                disconnect_database(time_now_us());
+            else
+                mysql_rollback(conn);
+            return;
+        }
+        size_t const skip = replayed <= first ? 0 : replayed - first < n ? (size_t) (replayed - first) : n;
+        if (skip > 0)
+            KPM_LOG(KPM_LOG_INFO, "[DB]: %zu spooled rows already committed, skipped\n", skip);
+
+        for (size_t i = skip; i < n; i++)
+            queue_db_row(&db_spool.buf[i].row, db_spool.buf[i].ts_us, db_spool.buf[i].collect_us);
+        db_write_e res = DB_WRITE_OK;
+        if (db_batch.len > 0)
+            res = commit_batch(first + n);
+        else
+            mysql_rollback(conn);
+        db_batch.len = 0;
+
+        // The rows stay in the spool for the next connection
+        if (res == DB_WRITE_LOST) {
+            disconnect_database(time_now_us());
+            return;
+        }
+
+        // Rows the server rejects are dropped, as live ones
+        db_spool.read_off += (uint64_t) len;
+        if (res == DB_WRITE_OK) {
+            db_spool.replay_rows += n - skip;
+            db_stats.win_replayed += n - skip;
+            atomic_fetch_add_explicit(&kpm_metrics.spool_replayed, n - skip, memory_order_relaxed);
+        }
+
+        if (db_spool.read_off == db_spool.write_off) {
+            double const secs = (time_now_us() - db_spool.replay_start_us) / 1e6;
+            printf("[DB]: spool replayed, %lu rows in %.1f [s] (%.0f rows/s)\n", db_spool.replay_rows, secs,
+                   secs > 0 ? db_spool.replay_rows / secs : 0.0);
+            db_spool.replay_rows = 0;
+            db_spool.base_seq = spool_seq(db_spool.write_off);
+            db_spool.read_off = sizeof(db_spool_hdr_t);
+            db_spool.write_off = sizeof(db_spool_hdr_t);
+            if (ftruncate(db_spool.fd, (off_t) db_spool.write_off) != 0)
+                fprintf(stderr, "[DB]: spool truncate failed: %s\n", strerror(errno));
+        }
+        if (!write_spool_hdr())
+            fprintf(stderr, "[DB]: spool header write failed: %s\n", strerror(errno));
+        publish_spool();
+    }
+}
+
+// Flush once the configured accumulation time has elapsed, reconnect after the backoff,
+// replay the spool and maintain the partitions every DB_MAINT_PERIOD_US. No transaction is
+// open outside flush_database() and replay_spool().
+static void maybe_flush_database() {
+    int64_t const now = time_now_us();
+
+    if (conn == NULL && now >= db_reconnect_at_us)
+        connect_database(now);
+
+    if (db_batch.len > 0 && (db_flush_us == 0 || now - db_batch.first_us >= db_flush_us))
+        flush_database();
+
+    if (conn != NULL && db_spool.read_off < db_spool.write_off)
+        replay_spool(now);
+
+    if (conn != NULL && now >= db_maint_next_us) {
+        maintain_database(now);
+        if (db_lost)
+            disconnect_database(now);
+    }
+}
+
+// Function to close the MySQL connection. Rows that cannot be written stay in the spool
+// for the next run.
+static void close_database() {
+    flush_database();
+    report_db_stats(time_now_us());
+
+    printf("[DB]: total %lu rows in %lu batches, batch latency avg = %ld [μs] max = %ld [μs]\n",
+           db_stats.rows, db_stats.batches,
+           db_stats.batches ? db_stats.lat_sum_us / (int64_t) db_stats.batches : 0,
+           db_stats.lat_max_us);
+
+    if (conn != NULL) {
+        close_db_stmts();
+        mysql_close(conn);
+        conn = NULL;
+        atomic_store(&kpm_metrics.db_connected, 0);
+        printf("database connection closed.\n");
+    }
+
+    if (db_spool.fd >= 0) {
+        if (db_spool.write_off > db_spool.read_off)
+            printf("[DB]: %lu rows left in the spool %s\n",
+                   (db_spool.write_off - db_spool.read_off) / sizeof(db_spool_rec_t), db_spool.path);
+        close(db_spool.fd);
+        db_spool.fd = -1;
+    }
+}
+
+// ======================================== MySql Functions ========================================
+
+// ======================================== Binary Log ========================================
+
+// Alternative to MySQL for bulk collection (KPM_SINKS=binlog). Rows are gathered column by
+// column into a block of up to BINLOG_BLOCK_ROWS rows, which is appended to the current file
+// behind its block header (format in kpm_binlog.h). Files live in KPM_BINLOG_DIR and are
+// rotated after KPM_BINLOG_MAX_MB or KPM_BINLOG_ROTATE_S. When built with KPM_BINLOG_ZLIB,
+// KPM_BINLOG_COMPRESS=1 deflates every block. tools/kpm_binlog_export reads them back.
+
+#define BINLOG_BLOCK_ROWS 4096
+
+typedef struct {
+  int64_t ts_us[BINLOG_BLOCK_ROWS];
+  int64_t collect_us[BINLOG_BLOCK_ROWS];
+  uint64_t amf_ue_ngap_id[BINLOG_BLOCK_ROWS];
+  uint64_t ran_ue_id[BINLOG_BLOCK_ROWS];
+  uint32_t ind_seq[BINLOG_BLOCK_ROWS];
+  uint32_t sd[BINLOG_BLOCK_ROWS];
+  uint32_t present[BINLOG_BLOCK_ROWS];
+  uint8_t sst[BINLOG_BLOCK_ROWS];
+  double meas[END_KPM_MEAS][BINLOG_BLOCK_ROWS];
+  size_t len;
+  int64_t first_us; // time_now_us() of the oldest row
+} binlog_block_t;
+
+typedef struct {
+  FILE* f;
+  char dir[256];
+  char path[512];
+  int64_t file_start_us;
+  uint64_t file_size;
+
+  uint64_t max_bytes;
+  int64_t rotate_us;
+  int64_t flush_us;
+  bool compress;
+
+  uint8_t* payload;
+  uint8_t* zbuf;
+  size_t zbuf_cap;
+
+  uint64_t rows;
+  uint64_t blocks;
+  uint64_t files;
+  uint64_t failed;
+  uint64_t raw_bytes;
+  uint64_t stored_bytes;
+  int64_t win_start_us;
+  uint64_t win_rows;
+} binlog_t;
+
+static binlog_block_t binlog_block = {0};
+
+static binlog_t binlog = {0};
+
+static
+void init_binlog(void)
+{
+  const char* dir = getenv("KPM_BINLOG_DIR");
+  if (!dir) dir = "kpm_binlog";
+  if (strlen(dir) >= sizeof(binlog.dir))
+    cfg_error("KPM_BINLOG_DIR", "path too long", dir);
+  snprintf(binlog.dir, sizeof(binlog.dir), "%s", dir);
+
+  binlog.max_bytes = (uint64_t)cfg_long("KPM_BINLOG_MAX_MB", 256, 1, 1L << 20) << 20;
+  binlog.rotate_us = (int64_t)cfg_long("KPM_BINLOG_ROTATE_S", 3600, 1, 7 * 24 * 3600) * 1000000;
+  binlog.flush_us = (int64_t)cfg_long("KPM_BINLOG_FLUSH_MS", 1000, 0, 3600000) * 1000;
+  binlog.compress = cfg_long("KPM_BINLOG_COMPRESS", 0, 0, 1) != 0;
+#ifndef KPM_BINLOG_ZLIB
+  if (binlog.compress) {
+    printf("[BINLOG]: built without KPM_BINLOG_ZLIB, blocks are stored uncompressed\n");
+    binlog.compress = false;
+  }
+#endif
+
+  if (mkdir(binlog.dir, 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "[BINLOG]: cannot create %s: %s\n", binlog.dir, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  binlog.payload = malloc(kpm_binlog_raw_size(BINLOG_BLOCK_ROWS, (1u << END_KPM_MEAS) - 1));
+  assert(binlog.payload != NULL && "Memory exhausted");
+#ifdef KPM_BINLOG_ZLIB
+  binlog.zbuf_cap = compressBound(kpm_binlog_raw_size(BINLOG_BLOCK_ROWS, (1u << END_KPM_MEAS) - 1));
+  binlog.zbuf = malloc(binlog.zbuf_cap);
+  assert(binlog.zbuf != NULL && "Memory exhausted");
+#endif
+
+  binlog.win_start_us = time_now_us();
+  printf("[BINLOG]: writing to %s, rotating every %lu MB or %ld s%s\n", binlog.dir, binlog.max_bytes >> 20,
+         binlog.rotate_us / 1000000, binlog.compress ? ", zlib compressed" : "");
+}
+
+static
+void close_binlog_file(void)
+{
+  if (binlog.f == NULL)
+    return;
+
+  if (fclose(binlog.f) != 0)
+    fprintf(stderr, "[BINLOG]: closing %s failed: %s\n", binlog.path, strerror(errno));
+  binlog.f = NULL;
+}
+
+static
+bool open_binlog_file(int64_t now)
+{
+  time_t const sec = (time_t)(now / 1000000);
+  struct tm tm;
+  gmtime_r(&sec, &tm);
+  char stamp[32];
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+  snprintf(binlog.path, sizeof(binlog.path), "%s/kpm_%s_%06ld.kpmlog", binlog.dir, stamp, (long)(now % 1000000));
+
+  binlog.f = fopen(binlog.path, "wb");
+  if (binlog.f == NULL) {
+    fprintf(stderr, "[BINLOG]: cannot create %s: %s\n", binlog.path, strerror(errno));
+    return false;
+  }
+
+  kpm_binlog_file_hdr_t hdr = {
+    .magic = KPM_BINLOG_MAGIC,
+    .version = KPM_BINLOG_VERSION,
+    .hdr_size = sizeof(kpm_binlog_file_hdr_t),
+    .meas_len = END_KPM_MEAS,
+    .created_us = now,
+  };
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    snprintf(hdr.meas_name[k], KPM_BINLOG_MEAS_NAME_LEN, "%s", kpm_meas_name[k]);
+
+  if (fwrite(&hdr, sizeof(hdr), 1, binlog.f) != 1) {
+    fprintf(stderr, "[BINLOG]: writing %s failed: %s\n", binlog.path, strerror(errno));
+    close_binlog_file();
+    return false;
+  }
+
+  binlog.file_start_us = now;
+  binlog.file_size = sizeof(hdr);
+  binlog.files++;
+  printf("[BINLOG]: new file %s\n", binlog.path);
+  return true;
+}
+
+// Lay the block out column after column, in the order documented in kpm_binlog.h
+static
+size_t encode_binlog_block(binlog_block_t const* b, uint32_t meas_mask, uint8_t* out)
+{
+  size_t const n = b->len;
+  uint8_t* p = out;
+
+#define BINLOG_PUT_COL(col) \
+  do { memcpy(p, b->col, n * sizeof(b->col[0])); p += n * sizeof(b->col[0]); } while (0)
+
+  BINLOG_PUT_COL(ts_us);
+  BINLOG_PUT_COL(collect_us);
+  BINLOG_PUT_COL(amf_ue_ngap_id);
+  BINLOG_PUT_COL(ran_ue_id);
+  BINLOG_PUT_COL(ind_seq);
+  BINLOG_PUT_COL(sd);
+  BINLOG_PUT_COL(present);
+  BINLOG_PUT_COL(sst);
+#undef BINLOG_PUT_COL
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    if (meas_mask & (1u << k)) {
+      memcpy(p, b->meas[k], n * sizeof(double));
+      p += n * sizeof(double);
+    }
+  }
+
+  assert((size_t)(p - out) == kpm_binlog_raw_size((uint32_t)n, meas_mask));
+  return (size_t)(p - out);
+}
+
+static
+void flush_binlog(void)
+{
+  binlog_block_t* b = &binlog_block;
+  if (b->len == 0)
+    return;
+
+  int64_t const start = mono_now_ns();
+  int64_t const now = time_now_us();
+  if (binlog.f != NULL && (binlog.file_size >= binlog.max_bytes || now - binlog.file_start_us >= binlog.rotate_us))
+    close_binlog_file();
+  if (binlog.f == NULL && !open_binlog_file(now)) {
+    binlog.failed++;
+    atomic_fetch_add_explicit(&kpm_metrics.sink_failed[KPM_SINK_BINLOG], 1, memory_order_relaxed);
+    b->len = 0;
+    return;
+  }
+
+  uint32_t const meas_mask = kpm_cfg.meas_mask;
+  size_t const raw_size = encode_binlog_block(b, meas_mask, binlog.payload);
+
+  kpm_binlog_blk_hdr_t hdr = {
+    .magic = KPM_BINLOG_BLK_MAGIC,
+    .rows = (uint32_t)b->len,
+    .codec = KPM_BINLOG_CODEC_RAW,
+    .meas_mask = meas_mask,
+    .raw_size = (uint32_t)raw_size,
+    .stored_size = (uint32_t)raw_size,
+    .first_ts_us = b->ts_us[0],
+    .last_ts_us = b->ts_us[b->len - 1],
+  };
+  uint8_t const* stored = binlog.payload;
+
+#ifdef KPM_BINLOG_ZLIB
+  if (binlog.compress) {
+    uLongf zlen = (uLongf)binlog.zbuf_cap;
+    if (compress2(binlog.zbuf, &zlen, binlog.payload, (uLong)raw_size, Z_BEST_SPEED) == Z_OK && zlen < raw_size) {
+      hdr.codec = KPM_BINLOG_CODEC_ZLIB;
+      hdr.stored_size = (uint32_t)zlen;
+      stored = binlog.zbuf;
+    }
+  }
+#endif
+  hdr.crc = kpm_binlog_crc32(0, stored, hdr.stored_size);
+
+  if (fwrite(&hdr, sizeof(hdr), 1, binlog.f) != 1 || fwrite(stored, 1, hdr.stored_size, binlog.f) != hdr.stored_size
+      || fflush(binlog.f) != 0) {
+    // The partial block is skipped by readers, the next one goes to a new file
+    fprintf(stderr, "[BINLOG]: writing %s failed: %s\n", binlog.path, strerror(errno));
+    close_binlog_file();
+    binlog.failed++;
+    atomic_fetch_add_explicit(&kpm_metrics.sink_failed[KPM_SINK_BINLOG], 1, memory_order_relaxed);
+    b->len = 0;
+    return;
+  }
+
+  kpm_hist_record(&kpm_metrics.flush[KPM_SINK_BINLOG], mono_now_ns() - start);
+  atomic_fetch_add_explicit(&kpm_metrics.sink_rows[KPM_SINK_BINLOG], b->len, memory_order_relaxed);
+  binlog.file_size += sizeof(hdr) + hdr.stored_size;
+  binlog.rows += b->len;
+  binlog.win_rows += b->len;
+  binlog.blocks++;
+  binlog.raw_bytes += raw_size;
+  binlog.stored_bytes += hdr.stored_size;
+  b->len = 0;
+}
+
+// Queue one row; it is written with its block
+static
+void write_binlog(kpi_metrics_t const* m, int64_t ts_us, int64_t collect_us, uint32_t ind_seq)
+{
+  binlog_block_t* b = &binlog_block;
+  if (b->len == BINLOG_BLOCK_ROWS)
+    flush_binlog();
+
+  if (b->len == 0)
+    b->first_us = time_now_us();
+
+  size_t const i = b->len++;
+  b->ts_us[i] = ts_us;
+  b->collect_us[i] = collect_us;
+  b->amf_ue_ngap_id[i] = m->amf_ue_ngap_id;
+  b->ran_ue_id[i] = m->ran_ue_id;
+  b->ind_seq[i] = ind_seq;
+  b->sd[i] = m->sd;
+  b->present[i] = m->present;
+  b->sst[i] = m->sst;
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    b->meas[k][i] = m->meas[k];
+}
+
+// Blocks are written when full, or once KPM_BINLOG_FLUSH_MS after their first row
+static
+void maybe_flush_binlog(void)
+{
+  if (binlog_block.len > 0 && time_now_us() - binlog_block.first_us >= binlog.flush_us)
+    flush_binlog();
+}
+
+static
+void report_binlog_stats(int64_t now)
+{
+  int64_t const elapsed = now - binlog.win_start_us;
+  if (elapsed <= 0)
+    return;
+
+  printf("[BINLOG]: %.1f rows/s, total %lu rows in %lu blocks and %lu files, %lu bytes stored for %lu raw (failed blocks = %lu)\n",
+         binlog.win_rows * 1000000.0 / elapsed, binlog.rows, binlog.blocks, binlog.files,
+         binlog.stored_bytes, binlog.raw_bytes, binlog.failed);
+
+  binlog.win_start_us = now;
+  binlog.win_rows = 0;
+}
+
+static
+void close_binlog(void)
+{
+  flush_binlog();
+  report_binlog_stats(time_now_us());
+  close_binlog_file();
+
+  free(binlog.payload);
+  free(binlog.zbuf);
+  binlog.payload = NULL;
+  binlog.zbuf = NULL;
+}
+
+// ======================================== Binary Log ========================================
+
+// ======================================== Telemetry Sinks ========================================
+
+// The writer thread hands every row to each sink of KPM_SINKS (default "mysql"; "binlog", or
+// both as "mysql,binlog"). A sink queues rows in write() and decides in maybe_flush(), called
+// after every indication and on idle wake-ups, whether its batch is due.
+
+typedef struct {
+  kpi_metrics_t metrics;
+  int64_t ts_us;           // time_now_us() at decode
+  int64_t collect_us;      // collectStartTime of the indication
+  int64_t latency_us;      // xApp <-> E2 Node latency of the indication
+  uint32_t ind_seq;        // Indication counter
+  bool last_of_ind;        // Last UE row of the indication
+} kpm_rec_t;
+
+typedef struct {
+  const char* name;
+  void (*init)(void);
+  void (*write)(kpm_rec_t const* rec);
+  void (*maybe_flush)(void);
+  void (*flush)(void);
+  void (*report)(int64_t now);
+  void (*close)(void);
+} kpm_sink_t;
+
+static
+void write_mysql_sink(kpm_rec_t const* rec)
+{
+  insert_to_database(&rec->metrics, rec->ts_us, rec->collect_us);
+}
+
+static
+void write_binlog_sink(kpm_rec_t const* rec)
+{
+  write_binlog(&rec->metrics, rec->ts_us, rec->collect_us, rec->ind_seq);
+}
+
+static
+kpm_sink_t const kpm_sink_avail[END_KPM_SINK] = {
+  [KPM_SINK_MYSQL] = {"mysql", init_database, write_mysql_sink, maybe_flush_database, flush_database, report_db_stats, close_database},
+  [KPM_SINK_BINLOG] = {"binlog", init_binlog, write_binlog_sink, maybe_flush_binlog, flush_binlog, report_binlog_stats, close_binlog},
+};
+
+static kpm_sink_t const* kpm_sinks[END_KPM_SINK];
+
+static size_t kpm_sinks_len = 0;
+
+static
+void init_sinks(void)
+{
+  const char* val = getenv("KPM_SINKS");
+  if (!val) val = "mysql";
+
+  char* buf = strdup(val);
+  assert(buf != NULL && "Memory exhausted");
+  char* save = NULL;
+  for (char* tok = strtok_r(buf, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+    size_t i = 0;
+    while (i < END_KPM_SINK && strcmp(kpm_sink_avail[i].name, tok) != 0)
+      i++;
+    if (i == END_KPM_SINK)
+      cfg_error("KPM_SINKS", "unknown sink, expected mysql or binlog:", tok);
+
+    bool dup = false;
+    for (size_t j = 0; j < kpm_sinks_len; j++)
+      dup |= kpm_sinks[j] == &kpm_sink_avail[i];
+    if (!dup)
+      kpm_sinks[kpm_sinks_len++] = &kpm_sink_avail[i];
+  }
+  free(buf);
+
+  if (kpm_sinks_len == 0)
+    cfg_error("KPM_SINKS", "no sink in", val);
+
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->init();
+}
+
+static
+void write_sinks(kpm_rec_t const* rec)
+{
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->write(rec);
+}
+
+static
+void maybe_flush_sinks(void)
+{
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->maybe_flush();
+}
+
+static
+void flush_sinks(void)
+{
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->flush();
+}
+
+static
+void report_sinks(int64_t now)
+{
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->report(now);
+}
+
+// Drains the record ring and flushes what is left (see DB Writer Thread)
+static void stop_db_writer(void);
+
+static
+void close_sinks(void)
+{
+  stop_db_writer();
+
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    kpm_sinks[i]->close();
+  kpm_sinks_len = 0;
+}
+
+// ======================================== Telemetry Sinks ========================================
+
+// ======================================== DB Writer Thread ========================================
+
+// sm_cb_kpm only decodes into kpm_rec_t and pushes into the single-producer/single-consumer
+// ring of its shard. db_writer_thread drains the rings in turn into the telemetry sinks, so
+// MySQL or disk latency never reaches the E2 callback threads.
+
+typedef enum {
+  RING_DROP_OLDEST,
+  RING_DROP_NEWEST,
+  RING_BLOCK,
+} ring_overflow_e;
+
+typedef struct {
+  kpm_rec_t* buf;
+  uint64_t mask;
+  ring_overflow_e policy;
+
+  // head is only written by the producer. tail is advanced by the consumer, and by the
+  // producer when it discards the oldest record, hence the CAS on both sides.
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+
+  _Atomic uint64_t enqueued;
+  _Atomic uint64_t dropped;
+} kpm_ring_t;
+
+// One ring per shard, indexed like kpm_shard
+static kpm_ring_t kpm_ring[MAX_KPM_SHARDS];
+static size_t kpm_ring_len = 0;
+
+// Records taken from one ring before the writer moves on to the next
+#define DB_WRITER_BURST 256
+
+static pthread_t db_writer;
+static pthread_mutex_t db_writer_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t db_writer_cv = PTHREAD_COND_INITIALIZER;
+static atomic_bool db_writer_stop = false;
+static atomic_bool db_writer_idle = false;  // Set while the writer waits for db_writer_cv
+static bool db_writer_running = false;
+
+static
+void init_kpm_ring(kpm_ring_t* r)
+{
+  uint64_t cap = 4096;
+  const char* size_str = getenv("DB_RING_SIZE");
+  if (size_str != NULL && atoi(size_str) > 0)
+    cap = (uint64_t)atoi(size_str);
+
+  // Round up to a power of two
+  uint64_t pow2 = 1;
+  while (pow2 < cap)
+    pow2 <<= 1;
+
+  r->buf = calloc(pow2, sizeof(kpm_rec_t));
+  assert(r->buf != NULL && "Memory exhausted");
+  r->mask = pow2 - 1;
+
+  r->policy = RING_DROP_OLDEST;
+  const char* policy_str = getenv("DB_RING_OVERFLOW");
+  if (policy_str != NULL) {
+    if (strcmp(policy_str, "drop_oldest") == 0) {
+      r->policy = RING_DROP_OLDEST;
+    } else if (strcmp(policy_str, "drop_newest") == 0) {
+      r->policy = RING_DROP_NEWEST;
+    } else if (strcmp(policy_str, "block") == 0) {
+      r->policy = RING_BLOCK;
+    } else {
+      fprintf(stderr, "Unknown DB_RING_OVERFLOW = %s, using drop_oldest\n", policy_str);
+    }
+  }
+
+  atomic_store(&r->head, 0);
+  atomic_store(&r->tail, 0);
+  atomic_store(&r->enqueued, 0);
+  atomic_store(&r->dropped, 0);
+}
+
+static
+void free_kpm_ring(kpm_ring_t* r)
+{
+  free(r->buf);
+  r->buf = NULL;
+}
+
+// Producer side, called from sm_cb_kpm with the lock of the ring's shard held
+static
+bool push_kpm_ring(kpm_ring_t* r, kpm_rec_t const* rec)
+{
+  uint64_t const h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  for (;;) {
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (h - t <= r->mask)
+      break;
+
+    if (r->policy == RING_DROP_NEWEST) {
+      atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+      return false;
+    } else if (r->policy == RING_DROP_OLDEST) {
+      if (atomic_compare_exchange_weak_explicit(&r->tail, &t, t + 1, memory_order_acq_rel, memory_order_relaxed))
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    } else {
+      struct timespec const ts = {.tv_sec = 0, .tv_nsec = 50000};
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  r->buf[h & r->mask] = *rec;
+  atomic_store_explicit(&r->head, h + 1, memory_order_release);
+  atomic_fetch_add_explicit(&r->enqueued, 1, memory_order_relaxed);
+  return true;
+}
+
+// Consumer side, called from db_writer_thread only
+static
+bool pop_kpm_ring(kpm_ring_t* r, kpm_rec_t* out)
+{
+  uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  for (;;) {
+    uint64_t const h = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (t == h)
+      return false;
+
+    *out = r->buf[t & r->mask];
+    // Fails if the producer discarded this slot meanwhile; the copy is then stale and t
+    // holds the new tail
+    if (atomic_compare_exchange_weak_explicit(&r->tail, &t, t + 1, memory_order_acq_rel, memory_order_relaxed))
+      return true;
+  }
+}
+
+static
+bool empty_kpm_ring(kpm_ring_t* r)
+{
+  return atomic_load_explicit(&r->tail, memory_order_acquire) == atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+static
+bool empty_kpm_rings(void)
+{
+  for (size_t i = 0; i < kpm_ring_len; i++) {
+    if (!empty_kpm_ring(&kpm_ring[i]))
+      return false;
+  }
+  return true;
+}
+
+static
+void report_ring_stats(void)
+{
+  uint64_t enqueued = 0;
+  uint64_t dropped = 0;
+  for (size_t i = 0; i < kpm_ring_len; i++) {
+    enqueued += atomic_load(&kpm_ring[i].enqueued);
+    dropped += atomic_load(&kpm_ring[i].dropped);
+  }
+  printf("[DB]: records enqueued = %lu, dropped = %lu, written = %lu\n", enqueued, dropped, db_stats.rows);
+}
+
+// Wake up the writer at the end of every indication. The shards only take db_writer_mtx when
+// the writer sleeps; the fence pairs with the one in db_writer_thread, so either the writer
+// sees the new records or the shard sees db_writer_idle.
+static
+void notify_db_writer(void)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&db_writer_idle, memory_order_relaxed))
+    return;
+
+  lock_guard(&db_writer_mtx);
+  pthread_cond_signal(&db_writer_cv);
+}
+
+static
+void* db_writer_thread(void* arg)
+{
+  (void)arg;
+  kpm_rec_t rec = {0};
+  int64_t stats_us = time_now_us();
+
+  for (;;) {
+    // Round robin, so that a busy shard cannot hold back the rows of the others
+    bool more = true;
+    while (more) {
+      more = false;
+      for (size_t i = 0; i < kpm_ring_len; i++) {
+        size_t n = 0;
+        while (n < DB_WRITER_BURST && pop_kpm_ring(&kpm_ring[i], &rec)) {
+          write_sinks(&rec);
+          n++;
+
+          KPM_LOG(KPM_LOG_DEBUG, "UE amf_ue_ngap_id = %lu, ran_ue_id = %lx, sst = %u, sd = %06x\n", rec.metrics.amf_ue_ngap_id,
+                  rec.metrics.ran_ue_id, rec.metrics.sst, rec.metrics.sd);
+          if (rec.last_of_ind) {
+            KPM_LOG(KPM_LOG_DEBUG, "\n%7u KPM ind_msg latency = %ld [μs]\n", rec.ind_seq, rec.latency_us); // xApp <-> E2 Node
+            maybe_flush_sinks();
+          }
+        }
+        more |= n == DB_WRITER_BURST;
+      }
+    }
+
+    // Accumulated rows whose flush period expired while the ring was idle
+    maybe_flush_sinks();
+
+    int64_t const now = time_now_us();
+    if (now - stats_us >= DB_STATS_PERIOD_US) {
+      report_ring_stats();
+      report_sinks(now);
+      report_kpm_latency();
+      stats_us = now;
+    }
+
+    if (atomic_load(&db_writer_stop) && empty_kpm_rings())
+      break;
+
+    pthread_mutex_lock(&db_writer_mtx);
+    atomic_store(&db_writer_idle, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (empty_kpm_rings() && !atomic_load(&db_writer_stop)) {
+      struct timespec deadline = {0};
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 100 * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&db_writer_cv, &db_writer_mtx, &deadline);
+    }
+    atomic_store(&db_writer_idle, false);
+    pthread_mutex_unlock(&db_writer_mtx);
+  }
+
+  flush_sinks();
+  report_ring_stats();
+  return NULL;
+}
+
+// One ring per shard
+static
+void start_db_writer(size_t rings)
+{
+  assert(rings > 0 && rings <= MAX_KPM_SHARDS);
+  for (size_t i = 0; i < rings; i++)
+    init_kpm_ring(&kpm_ring[i]);
+  kpm_ring_len = rings;
+
+  kpm_ring_t const* r = &kpm_ring[0];
+  printf("[DB]: %zu record ring(s) of %lu entries, overflow policy = %s\n", rings, r->mask + 1,
+         r->policy == RING_DROP_OLDEST ? "drop_oldest" : r->policy == RING_DROP_NEWEST ? "drop_newest" : "block");
+
+  atomic_store(&db_writer_stop, false);
+  int const rc = pthread_create(&db_writer, NULL, db_writer_thread, NULL);
+  assert(rc == 0);
+  db_writer_running = true;
+}
+
+static
+void stop_db_writer(void)
+{
+  if (db_writer_running == false)
+    return;
+
+  atomic_store(&db_writer_stop, true);
+  {
+    lock_guard(&db_writer_mtx);
+    pthread_cond_signal(&db_writer_cv);
+  }
+  pthread_join(db_writer, NULL);
+  db_writer_running = false;
+
+  // kpm_ring_len is kept, GET /metrics still reads the counters of the rings
+  for (size_t i = 0; i < kpm_ring_len; i++)
+    free_kpm_ring(&kpm_ring[i]);
+}
+
+// ======================================== DB Writer Thread ========================================
+
+// ======================================== UE State Table ========================================
+
+// Latest metrics of every UE, keyed by (amf_ue_ngap_id, ran_ue_id, S-NSSAI). Entries live in
+// a preallocated pool and keep their index for their whole lifetime; the open-addressing
+// index only stores a hash tag and the entry index, so probing stays within a few cache
+// lines. Entries of UEs not seen for KPM_UE_EXPIRE_PERIODS report periods are released and
+// their pool slot is reused by the next UE that attaches.
+
+typedef struct {
+  uint64_t amf_ue_ngap_id;
+  uint64_t ran_ue_id;
+  uint8_t sst;
+  uint32_t sd;
+} ue_key_t;
+
+typedef struct {
+  ue_key_t key;
+  kpi_metrics_t metrics;   // Latest report, fields not reported are cleared in present
+  uint64_t last_period;    // Report period the UE was last seen in
+  uint32_t gen;            // Bumped every time the entry is handed to a new UE
+  bool used;
+} ue_entry_t;
+
+typedef struct {
+  uint32_t tag;    // High bits of the key hash, 0 = empty
+  uint32_t entry;  // Index into the pool
+} ue_idx_slot_t;
+
+typedef struct {
+  ue_entry_t* pool;
+  uint32_t* free_lst;
+  size_t free_len;
+  size_t cap;
+
+  ue_idx_slot_t* idx;
+  size_t idx_mask;
+
+  uint64_t expire_periods;
+  uint64_t cur_period;
+  size_t len;
+} ue_table_t;
+
+static
+uint64_t hash_ue_key(ue_key_t const* k)
+{
+  // splitmix64 finalizer over the folded key
+  uint64_t h = k->amf_ue_ngap_id * 0x9E3779B97F4A7C15ULL;
+  h ^= k->ran_ue_id + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+  h ^= ((uint64_t)k->sst << 32 | k->sd) + 0x8CB92BA72F3D8DD7ULL + (h << 6) + (h >> 2);
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
+
+static
+bool eq_ue_key(ue_key_t const* a, ue_key_t const* b)
+{
+  return a->amf_ue_ngap_id == b->amf_ue_ngap_id && a->ran_ue_id == b->ran_ue_id
+         && a->sst == b->sst && a->sd == b->sd;
+}
+
+static
+uint32_t tag_ue_hash(uint64_t h)
+{
+  uint32_t const tag = (uint32_t)(h >> 32);
+  return tag == 0 ? 1 : tag;
+}
+
+static
+void init_ue_table(ue_table_t* t)
+{
+  size_t cap = 1024;
+  const char* cap_str = getenv("KPM_UE_TABLE_SIZE");
+  if (cap_str != NULL && atoi(cap_str) > 0)
+    cap = (size_t)atoi(cap_str);
+
+  t->expire_periods = 10;
+  const char* exp_str = getenv("KPM_UE_EXPIRE_PERIODS");
+  if (exp_str != NULL && atoi(exp_str) > 0)
+    t->expire_periods = (uint64_t)atoi(exp_str);
+
+  t->cap = cap;
+  t->pool = calloc(cap, sizeof(ue_entry_t));
+  assert(t->pool != NULL && "Memory exhausted");
+  t->free_lst = calloc(cap, sizeof(uint32_t));
+  assert(t->free_lst != NULL && "Memory exhausted");
+  // Hand out low indices first
+  for (size_t i = 0; i < cap; i++)
+    t->free_lst[i] = (uint32_t)(cap - 1 - i);
+  t->free_len = cap;
+
+  // Keep the load factor at or below 0.5
+  size_t idx_sz = 1;
+  while (idx_sz < 2 * cap)
+    idx_sz <<= 1;
+  t->idx = calloc(idx_sz, sizeof(ue_idx_slot_t));
+  assert(t->idx != NULL && "Memory exhausted");
+  t->idx_mask = idx_sz - 1;
+
+  t->cur_period = 0;
+  t->len = 0;
+}
+
+static
+void free_ue_table(ue_table_t* t)
+{
+  free(t->pool);
+  free(t->free_lst);
+  free(t->idx);
+  memset(t, 0, sizeof(*t));
+}
+
+// Backward-shift deletion, keeps probe sequences intact without tombstones
+static
+void rm_ue_idx_slot(ue_table_t* t, size_t hole)
+{
+  size_t i = hole;
+  for (;;) {
+    i = (i + 1) & t->idx_mask;
+    if (t->idx[i].tag == 0)
+      break;
+
+    ue_entry_t const* e = &t->pool[t->idx[i].entry];
+    size_t const home = hash_ue_key(&e->key) & t->idx_mask;
+    // Move the slot back unless its home lies cyclically in (hole, i]
+    bool const stays = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+    if (stays)
+      continue;
+
+    t->idx[hole] = t->idx[i];
+    hole = i;
+  }
+  t->idx[hole].tag = 0;
+  t->idx[hole].entry = 0;
+}
+
+// Find the UE or attach it. Returns NULL only if the pool is exhausted.
+static
+ue_entry_t* upsert_ue_table(ue_table_t* t, ue_key_t const* key)
+{
+  uint64_t const h = hash_ue_key(key);
+  uint32_t const tag = tag_ue_hash(h);
+
+  size_t i = h & t->idx_mask;
+  while (t->idx[i].tag != 0) {
+    if (t->idx[i].tag == tag) {
+      ue_entry_t* e = &t->pool[t->idx[i].entry];
+      if (eq_ue_key(&e->key, key)) {
+        e->last_period = t->cur_period;
+        return e;
+      }
+    }
+    i = (i + 1) & t->idx_mask;
+  }
+
+  if (t->free_len == 0)
+    return NULL;
+
+  uint32_t const entry = t->free_lst[--t->free_len];
+  ue_entry_t* e = &t->pool[entry];
+  uint32_t const gen = e->gen + 1;
+  memset(e, 0, sizeof(*e));
+  e->key = *key;
+  e->gen = gen;
+  e->last_period = t->cur_period;
+  e->used = true;
+
+  t->idx[i].tag = tag;
+  t->idx[i].entry = entry;
+  t->len++;
+  return e;
+}
+
+static
+size_t expire_ue_table(ue_table_t* t)
+{
+  size_t expired = 0;
+  size_t i = 0;
+  while (i <= t->idx_mask) {
+    if (t->idx[i].tag != 0) {
+      uint32_t const entry = t->idx[i].entry;
+      ue_entry_t* e = &t->pool[entry];
+      if (t->cur_period - e->last_period > t->expire_periods) {
+        e->used = false;
+        t->free_lst[t->free_len++] = entry;
+        t->len--;
+        expired++;
+        rm_ue_idx_slot(t, i);
+        // Slot i may now hold a shifted entry, check it again
+        continue;
+      }
+    }
+    i++;
+  }
+  return expired;
+}
+
+// Advance the report period clock; runs the expiry sweep once per period and returns the
+// number of entries it released
+static
+size_t tick_ue_table(ue_table_t* t, int64_t now_us, uint64_t period_us)
+{
+  uint64_t const period = (uint64_t)now_us / period_us;
+  if (period == t->cur_period)
+    return 0;
+
+  t->cur_period = period;
+  size_t const expired = expire_ue_table(t);
+  if (expired > 0)
+    KPM_LOG(KPM_LOG_INFO, "[UE]: %zu UE entries expired, %zu attached\n", expired, t->len);
+  return expired;
+}
+
+// ======================================== UE State Table ========================================
+
+// ======================================== Subscription Context ========================================
+
+// FlexRIC hands the indication callback nothing but the indication, so every subscription
+// gets its own trampoline from kpm_sub_cb[] that forwards to sm_cb_kpm() with the context
+// (E2 node, S-NSSAI) the subscription was created for.
+
+#define MAX_KPM_SUBS 64
+#define MAX_MEAS_INFO 32
+
+typedef struct {
+  size_t node_idx;
+  uint32_t nb_id;
+  kpm_slice_cfg_t const* slice;
+  uint8_t sst;
+  uint32_t sd;
+  size_t shard;     // Index into kpm_shard, whose lock serializes the callbacks of the subscription
+
+  // meas_info_lst position -> kpm_meas_e (-1 = not stored), resolved once per subscription
+  int8_t slot[MAX_MEAS_INFO];
+  uint16_t slot_name_len[MAX_MEAS_INFO];
+  size_t slot_len;
+
+  // Written by sm_cb_kpm, read by GET /metrics
+  kpm_hist_t e2_latency;
+  _Atomic uint64_t indications;
+  _Atomic uint64_t ue_reports;
+  _Atomic uint64_t ue_dropped;      // UE table full
+} kpm_sub_ctx_t;
+
+static kpm_sub_ctx_t kpm_sub_ctx[MAX_KPM_SUBS];
+
+static size_t kpm_sub_ctx_len = 0;
+
+static
+void sm_cb_kpm(sm_ag_if_rd_t const* rd, kpm_sub_ctx_t* ctx);
+
+// Shard of subscription idx on E2 node node_idx (see Indication Shards)
+static
+size_t kpm_shard_of(size_t node_idx, size_t idx);
+
+#define KPM_SUB_CB(i) \
+  static void sm_cb_kpm_sub_##i(sm_ag_if_rd_t const* rd) { sm_cb_kpm(rd, &kpm_sub_ctx[i]); }
+
+KPM_SUB_CB(0)  KPM_SUB_CB(1)  KPM_SUB_CB(2)  KPM_SUB_CB(3)  KPM_SUB_CB(4)  KPM_SUB_CB(5)  KPM_SUB_CB(6)  KPM_SUB_CB(7)
+KPM_SUB_CB(8)  KPM_SUB_CB(9)  KPM_SUB_CB(10) KPM_SUB_CB(11) KPM_SUB_CB(12) KPM_SUB_CB(13) KPM_SUB_CB(14) KPM_SUB_CB(15)
+KPM_SUB_CB(16) KPM_SUB_CB(17) KPM_SUB_CB(18) KPM_SUB_CB(19) KPM_SUB_CB(20) KPM_SUB_CB(21) KPM_SUB_CB(22) KPM_SUB_CB(23)
+KPM_SUB_CB(24) KPM_SUB_CB(25) KPM_SUB_CB(26) KPM_SUB_CB(27) KPM_SUB_CB(28) KPM_SUB_CB(29) KPM_SUB_CB(30) KPM_SUB_CB(31)
+KPM_SUB_CB(32) KPM_SUB_CB(33) KPM_SUB_CB(34) KPM_SUB_CB(35) KPM_SUB_CB(36) KPM_SUB_CB(37) KPM_SUB_CB(38) KPM_SUB_CB(39)
+KPM_SUB_CB(40) KPM_SUB_CB(41) KPM_SUB_CB(42) KPM_SUB_CB(43) KPM_SUB_CB(44) KPM_SUB_CB(45) KPM_SUB_CB(46) KPM_SUB_CB(47)
+KPM_SUB_CB(48) KPM_SUB_CB(49) KPM_SUB_CB(50) KPM_SUB_CB(51) KPM_SUB_CB(52) KPM_SUB_CB(53) KPM_SUB_CB(54) KPM_SUB_CB(55)
+KPM_SUB_CB(56) KPM_SUB_CB(57) KPM_SUB_CB(58) KPM_SUB_CB(59) KPM_SUB_CB(60) KPM_SUB_CB(61) KPM_SUB_CB(62) KPM_SUB_CB(63)
+
+static
+sm_cb const kpm_sub_cb[MAX_KPM_SUBS] = {
+  sm_cb_kpm_sub_0,  sm_cb_kpm_sub_1,  sm_cb_kpm_sub_2,  sm_cb_kpm_sub_3,  sm_cb_kpm_sub_4,  sm_cb_kpm_sub_5,  sm_cb_kpm_sub_6,  sm_cb_kpm_sub_7,
+  sm_cb_kpm_sub_8,  sm_cb_kpm_sub_9,  sm_cb_kpm_sub_10, sm_cb_kpm_sub_11, sm_cb_kpm_sub_12, sm_cb_kpm_sub_13, sm_cb_kpm_sub_14, sm_cb_kpm_sub_15,
+  sm_cb_kpm_sub_16, sm_cb_kpm_sub_17, sm_cb_kpm_sub_18, sm_cb_kpm_sub_19, sm_cb_kpm_sub_20, sm_cb_kpm_sub_21, sm_cb_kpm_sub_22, sm_cb_kpm_sub_23,
+  sm_cb_kpm_sub_24, sm_cb_kpm_sub_25, sm_cb_kpm_sub_26, sm_cb_kpm_sub_27, sm_cb_kpm_sub_28, sm_cb_kpm_sub_29, sm_cb_kpm_sub_30, sm_cb_kpm_sub_31,
+  sm_cb_kpm_sub_32, sm_cb_kpm_sub_33, sm_cb_kpm_sub_34, sm_cb_kpm_sub_35, sm_cb_kpm_sub_36, sm_cb_kpm_sub_37, sm_cb_kpm_sub_38, sm_cb_kpm_sub_39,
+  sm_cb_kpm_sub_40, sm_cb_kpm_sub_41, sm_cb_kpm_sub_42, sm_cb_kpm_sub_43, sm_cb_kpm_sub_44, sm_cb_kpm_sub_45, sm_cb_kpm_sub_46, sm_cb_kpm_sub_47,
+  sm_cb_kpm_sub_48, sm_cb_kpm_sub_49, sm_cb_kpm_sub_50, sm_cb_kpm_sub_51, sm_cb_kpm_sub_52, sm_cb_kpm_sub_53, sm_cb_kpm_sub_54, sm_cb_kpm_sub_55,
+  sm_cb_kpm_sub_56, sm_cb_kpm_sub_57, sm_cb_kpm_sub_58, sm_cb_kpm_sub_59, sm_cb_kpm_sub_60, sm_cb_kpm_sub_61, sm_cb_kpm_sub_62, sm_cb_kpm_sub_63,
+};
+
+// Reserve a context and return the index of its trampoline
+static
+size_t add_kpm_sub_ctx(size_t node_idx, uint32_t nb_id, kpm_slice_cfg_t const* slice)
+{
+  assert(kpm_sub_ctx_len < MAX_KPM_SUBS && "Too many KPM subscriptions, raise MAX_KPM_SUBS");
+
+  size_t const idx = kpm_sub_ctx_len++;
+  kpm_sub_ctx_t* ctx = &kpm_sub_ctx[idx];
+  ctx->node_idx = node_idx;
+  ctx->nb_id = nb_id;
+  ctx->slice = slice;
+  ctx->sst = (uint8_t)slice->nssai[0];
+  ctx->sd = (uint32_t)slice->nssai[1] << 16 | (uint32_t)slice->nssai[2] << 8 | (uint32_t)slice->nssai[3];
+  ctx->shard = kpm_shard_of(node_idx, idx);
+  return idx;
+}
+
+// ======================================== Subscription Context ========================================
+
+static
+void log_gnb_ue_id(ue_id_e2sm_t ue_id, ue_key_t* key)
+{
+  if (ue_id.gnb.gnb_cu_ue_f1ap_lst != NULL) {
+    for (size_t i = 0; i < ue_id.gnb.gnb_cu_ue_f1ap_lst_len; i++) {
+      KPM_LOG(KPM_LOG_DEBUG, "UE ID type = gNB-CU, gnb_cu_ue_f1ap = %u\n", ue_id.gnb.gnb_cu_ue_f1ap_lst[i]);
+    }
+  } else {
+    key->amf_ue_ngap_id = ue_id.gnb.amf_ue_ngap_id;
+  }
+  if (ue_id.gnb.ran_ue_id != NULL) {
+    key->ran_ue_id = *ue_id.gnb.ran_ue_id;
+  }
+}
+
+static
+void log_du_ue_id(ue_id_e2sm_t ue_id, ue_key_t* key)
+{
+  KPM_LOG(KPM_LOG_DEBUG, "UE ID type = gNB-DU, gnb_cu_ue_f1ap = %u\n", ue_id.gnb_du.gnb_cu_ue_f1ap);
+  if (ue_id.gnb_du.ran_ue_id != NULL) {
+    KPM_LOG(KPM_LOG_DEBUG, "ran_ue_id = %lx\n", *ue_id.gnb_du.ran_ue_id); // RAN UE NGAP ID
+    key->ran_ue_id = *ue_id.gnb_du.ran_ue_id;
+  }
+}
+
+static
+void log_cuup_ue_id(ue_id_e2sm_t ue_id, ue_key_t* key)
+{
+  KPM_LOG(KPM_LOG_DEBUG, "UE ID type = gNB-CU-UP, gnb_cu_cp_ue_e1ap = %u\n", ue_id.gnb_cu_up.gnb_cu_cp_ue_e1ap);
+  if (ue_id.gnb_cu_up.ran_ue_id != NULL) {
+    KPM_LOG(KPM_LOG_DEBUG, "ran_ue_id = %lx\n", *ue_id.gnb_cu_up.ran_ue_id); // RAN UE NGAP ID
+    key->ran_ue_id = *ue_id.gnb_cu_up.ran_ue_id;
+  }
+}
+
+typedef void (*log_ue_id)(ue_id_e2sm_t ue_id, ue_key_t* key);
+
+static
+log_ue_id log_ue_id_e2sm[END_UE_ID_E2SM] = {
+    log_gnb_ue_id, // common for gNB-mono, CU and CU-CP
+    log_du_ue_id,
+    log_cuup_ue_id,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+// ======================================== Measurement Decoding ========================================
+
+// The measurement list of a subscription is fixed once fill_act_def_frm_1() built it, so the
+// names in meas_info_lst are matched against kpm_meas_name only on the first indication of
+// the subscription. Decoding a record is then an indexed store into a struct-of-arrays block
+// holding every UE of the indication.
+
+typedef struct {
+  size_t len;
+  size_t cap;
+  double* col[END_KPM_MEAS];  // col[k][i] = measurement k of the i-th UE report
+  uint32_t* present;
+  ue_key_t* key;
+} kpm_meas_block_t;
+
+static
+void reserve_meas_block(kpm_meas_block_t* b, size_t n)
+{
+  if (n <= b->cap)
+    return;
+
+  size_t cap = b->cap == 0 ? 64 : b->cap;
+  while (cap < n)
+    cap <<= 1;
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    b->col[k] = realloc(b->col[k], cap * sizeof(double));
+    assert(b->col[k] != NULL && "Memory exhausted");
+  }
+  b->present = realloc(b->present, cap * sizeof(uint32_t));
+  assert(b->present != NULL && "Memory exhausted");
+  b->key = realloc(b->key, cap * sizeof(ue_key_t));
+  assert(b->key != NULL && "Memory exhausted");
+  b->cap = cap;
+}
+
+static
+void free_meas_block(kpm_meas_block_t* b)
+{
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    free(b->col[k]);
+  free(b->present);
+  free(b->key);
+  memset(b, 0, sizeof(*b));
+}
+
+static
+int8_t find_meas_slot(meas_type_t const* meas_type)
+{
+  if (meas_type->type != NAME_MEAS_TYPE) {
+    KPM_LOG(KPM_LOG_DEBUG, "ID Measurement Type not yet supported\n");
+    return -1;
+  }
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    if (cmp_str_ba(kpm_meas_name[k], meas_type->name) == 0)
+      return (kpm_cfg.meas_mask & (1u << k)) ? (int8_t)k : -1;
+  }
+
+  KPM_LOG(KPM_LOG_DEBUG, "Measurement Name not yet supported: %.*s\n", (int)meas_type->name.len, meas_type->name.buf);
+  return -1;
+}
+
+static
+void resolve_meas_slots(kpm_sub_ctx_t* ctx, kpm_ind_msg_format_1_t const* msg_frm_1)
+{
+  size_t const len = msg_frm_1->meas_info_lst_len;
+  assert(len <= MAX_MEAS_INFO && "Too many measurements in one subscription");
+
+  for (size_t z = 0; z < len; z++) {
+    meas_type_t const* meas_type = &msg_frm_1->meas_info_lst[z].meas_type;
+    ctx->slot[z] = find_meas_slot(meas_type);
+    ctx->slot_name_len[z] = meas_type->type == NAME_MEAS_TYPE ? (uint16_t)meas_type->name.len : 0;
+  }
+  ctx->slot_len = len;
+}
+
+// Cheap guard against an E2 node changing the list under an existing subscription
+static
+bool meas_slots_match(kpm_sub_ctx_t const* ctx, kpm_ind_msg_format_1_t const* msg_frm_1)
+{
+  if (ctx->slot_len != msg_frm_1->meas_info_lst_len)
+    return false;
+
+  for (size_t z = 0; z < ctx->slot_len; z++) {
+    meas_type_t const* meas_type = &msg_frm_1->meas_info_lst[z].meas_type;
+    if (meas_type->type == NAME_MEAS_TYPE && meas_type->name.len != ctx->slot_name_len[z])
+      return false;
+  }
+  return true;
+}
+
+static inline
+double meas_record_value(meas_record_lst_t const* r)
+{
+  return r->value == INTEGER_MEAS_VALUE ? (double)r->int_val : r->real_val;
+}
+
+static
+void decode_kpm_measurements(kpm_sub_ctx_t* ctx, kpm_ind_msg_format_1_t const* msg_frm_1, kpm_meas_block_t* b, size_t i)
+{
+  assert(msg_frm_1->meas_info_lst_len > 0 && "Cannot correctly print measurements");
+
+  if (!meas_slots_match(ctx, msg_frm_1))
+    resolve_meas_slots(ctx, msg_frm_1);
+
+  uint32_t present = 0;
+
+  // Process measurements
+  for (size_t j = 0; j < msg_frm_1->meas_data_lst_len; j++) {
+    meas_data_lst_t const* data_item = &msg_frm_1->meas_data_lst[j];
+    size_t const len = data_item->meas_record_len < ctx->slot_len ? data_item->meas_record_len : ctx->slot_len;
+
+    for (size_t z = 0; z < len; z++) {
+      int8_t const k = ctx->slot[z];
+      meas_record_lst_t const* record_item = &data_item->meas_record_lst[z];
+      if (k < 0 || record_item->value == NO_VALUE_MEAS_VALUE)
+        continue;
+
+      b->col[k][i] = meas_record_value(record_item);
+      present |= 1u << k;
+    }
+
+    if (data_item->incomplete_flag && *data_item->incomplete_flag == TRUE_ENUM_VALUE) {
+      KPM_LOG(KPM_LOG_WARN, "Measurement Record not reliable\n");
+    }
+  }
+
+  b->present[i] = present;
+}
+
+// Decode every UE report of a format 3 indication into b
+static
+void decode_kpm_ind_frm_3(kpm_sub_ctx_t* ctx, kpm_ind_msg_format_3_t const* msg_frm_3, kpm_meas_block_t* b)
+{
+  size_t const len = msg_frm_3->ue_meas_report_lst_len;
+  reserve_meas_block(b, len);
+  b->len = len;
+
+  for (size_t i = 0; i < len; i++) {
+    // UE ID
+    ue_id_e2sm_t const ue_id_e2sm = msg_frm_3->meas_report_per_ue[i].ue_meas_report_lst;
+    ue_id_e2sm_e const type = ue_id_e2sm.type;
+    b->key[i] = (ue_key_t){.sst = ctx->sst, .sd = ctx->sd};
+    log_ue_id_e2sm[type](ue_id_e2sm, &b->key[i]);
+
+    // Measurements
+    decode_kpm_measurements(ctx, &msg_frm_3->meas_report_per_ue[i].ind_msg_format_1, b, i);
+  }
+}
+
+// ======================================== Measurement Decoding ========================================
+
+// ======================================== Indication Shards ========================================
+
+// The state sm_cb_kpm() updates is split into KPM_SHARDS shards (default: one per online CPU,
+// at most MAX_KPM_SHARDS). The subscriptions of an E2 node share a shard (KPM_SHARD_BY = node,
+// the default), or every subscription is dealt on its own (KPM_SHARD_BY = sub), round robin
+// in the order they are created. A shard owns its lock, UE table, decoding block, record ring
+// and indication counter, so callbacks of different shards run in parallel and never write to
+// the same cache lines. Shard s holds KPM_UE_TABLE_SIZE UEs, whose windows and snapshot records
+// start at s * KPM_UE_TABLE_SIZE.
+
+typedef struct {
+  _Alignas(64) pthread_mutex_t mtx;
+  ue_table_t ue_table;
+  size_t ue_base;           // UE slot of ue_table.pool[0] in kpm_agg.ue and kpm_shm.ue
+  kpm_meas_block_t block;
+  kpm_ring_t* ring;
+  uint64_t ind_seq;         // Indications processed by the shard
+} kpm_shard_t;
+
+static kpm_shard_t kpm_shard[MAX_KPM_SHARDS];
+
+static size_t kpm_shard_len = 0;
+
+static bool kpm_shard_by_sub = false;
+
+static
+void init_kpm_shards(void)
+{
+  long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t len = cpus > 0 ? (size_t)cpus : 1;
+  if (len > MAX_KPM_SHARDS)
+    len = MAX_KPM_SHARDS;
+
+  // Empty for the default
+  const char* len_str = getenv("KPM_SHARDS");
+  if (len_str != NULL && len_str[0] != '\0') {
+    char* end = NULL;
+    unsigned long const v = strtoul(len_str, &end, 10);
+    if (end == len_str || *end != '\0' || v == 0 || v > MAX_KPM_SHARDS)
+      cfg_error("KPM_SHARDS", "expected 1 to 16 shards (MAX_KPM_SHARDS), got", len_str);
+    len = v;
+  }
+
+  const char* by_str = getenv("KPM_SHARD_BY");
+  if (by_str != NULL && strcmp(by_str, "sub") != 0 && strcmp(by_str, "node") != 0)
+    cfg_error("KPM_SHARD_BY", "expected node or sub, got", by_str);
+  kpm_shard_by_sub = by_str != NULL && strcmp(by_str, "sub") == 0;
+
+  for (size_t i = 0; i < len; i++) {
+    kpm_shard_t* sh = &kpm_shard[i];
+    memset(sh, 0, sizeof(*sh));
+    int const rc = pthread_mutex_init(&sh->mtx, NULL);
+    assert(rc == 0);
+    init_ue_table(&sh->ue_table);
+    sh->ue_base = i * sh->ue_table.cap;
+    sh->ring = &kpm_ring[i];
+  }
+  kpm_shard_len = len;
+
+  printf("[SHARD]: %zu shard(s) by %s, %zu UEs each\n", len, kpm_shard_by_sub ? "subscription" : "E2 node",
+         kpm_shard[0].ue_table.cap);
+}
+
+static
+void free_kpm_shards(void)
+{
+  for (size_t i = 0; i < kpm_shard_len; i++) {
+    kpm_shard_t* sh = &kpm_shard[i];
+    free_ue_table(&sh->ue_table);
+    free_meas_block(&sh->block);
+    pthread_mutex_destroy(&sh->mtx);
+  }
+  kpm_shard_len = 0;
+}
+
+// UE slots of all the shards together
+static
+size_t kpm_shards_ue_cap(void)
+{
+  return kpm_shard_len * kpm_shard[0].ue_table.cap;
+}
+
+static
+size_t kpm_shard_of(size_t node_idx, size_t idx)
+{
+  assert(kpm_shard_len > 0 && "init_kpm_shards() first");
+  return (kpm_shard_by_sub ? idx : node_idx) % kpm_shard_len;
+}
+
+// ======================================== Indication Shards ========================================
+
+// ======================================== Sliding Windows ========================================
+
+// Every UE and every subscription (E2 node, slice) keeps its recent samples in a ring sized
+// for the longest of KPM_WINDOWS_MS. Each window only tracks where it starts in that ring,
+// the running sum and count, an EWMA and monotonic min/max queues, so adding a sample costs
+// O(1) amortized per window and measurement. p95 is the nearest-rank value of the window,
+// selected when it is queried.
+//
+// Samples are timed by the indication header (collectStartTime) and summed as integers of
+// 1e-6 units, so an aggregate only depends on the samples in the window and a replayed trace
+// gives bit-identical results. The sample of a slice is the sum over the UEs of the
+// indication, except for the RLC delay which is their mean.
+
+#define MAX_KPM_WINDOWS 4
+#define KPM_AGG_SCALE 1000000.0
+
+typedef struct {
+  uint32_t* seq;   // Samples whose value is monotonic from head to tail
+  uint32_t head;
+  uint32_t tail;
+} kpm_mono_q_t;
+
+typedef struct {
+  uint32_t start;  // Sequence number of the oldest sample inside the window
+  int64_t sum[END_KPM_MEAS];
+  uint32_t cnt[END_KPM_MEAS];
+  double ewma[END_KPM_MEAS];
+  uint32_t ewma_set;
+  double alpha;
+  kpm_mono_q_t min[END_KPM_MEAS];
+  kpm_mono_q_t max[END_KPM_MEAS];
+} kpm_window_t;
+
+typedef struct {
+  int64_t* ts;     // collectStartTime of every sample [μs]
+  uint32_t* present;
+  int64_t* val[END_KPM_MEAS];
+  uint32_t end;    // Sequence number of the next sample
+  uint32_t gen;    // Generation of the UE entry the samples belong to
+  kpm_window_t win[MAX_KPM_WINDOWS];
+} kpm_series_t;
+
+typedef struct {
+  int64_t win_us[MAX_KPM_WINDOWS];
+  size_t win_len;
+  uint32_t cap;    // Samples per ring, power of two
+  uint32_t mask;
+
+  kpm_series_t* ue;  // UE slot, i.e. ue_base of the shard + index in its ue_table.pool
+  size_t ue_len;
+  kpm_series_t sub[MAX_KPM_SUBS];
+
+  int64_t* scratch;  // p95 selection, used by the query thread only
+} kpm_agg_t;
+
+static kpm_agg_t kpm_agg = {0};
+
+static inline
+int64_t agg_fixed(double v)
+{
+  return llround(v * KPM_AGG_SCALE);
+}
+
+static inline
+double agg_double(int64_t v)
+{
+  return (double)v / KPM_AGG_SCALE;
+}
+
+static
+void init_kpm_agg(kpm_agg_t* a, size_t ue_cap)
+{
+  memset(a, 0, sizeof(*a));
+
+  const char* win_str = getenv("KPM_WINDOWS_MS");
+  if (!win_str) win_str = "1000,10000,60000";
+
+  char* buf = strdup(win_str);
+  assert(buf != NULL && "Memory exhausted");
+  char* save = NULL;
+  for (char* tok = strtok_r(buf, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+    if (a->win_len == MAX_KPM_WINDOWS)
+      cfg_error("KPM_WINDOWS_MS", "too many windows, raise MAX_KPM_WINDOWS", win_str);
+    a->win_us[a->win_len++] = (int64_t)cfg_period_ms("KPM_WINDOWS_MS", tok) * 1000;
+  }
+  free(buf);
+
+  // Samples the longest window holds at the fastest report period
+  int64_t max_win_us = 0;
+  for (size_t w = 0; w < a->win_len; w++)
+    max_win_us = a->win_us[w] > max_win_us ? a->win_us[w] : max_win_us;
+  uint32_t min_report_ms = UINT32_MAX;
+  for (size_t i = 0; i < kpm_cfg.slice_len; i++)
+    min_report_ms = kpm_cfg.slice[i].report_period_ms < min_report_ms ? kpm_cfg.slice[i].report_period_ms : min_report_ms;
+  uint64_t const need = a->win_len > 0 ? (uint64_t)max_win_us / ((uint64_t)min_report_ms * 1000) + 1 : 1;
+
+  const char* max_str = getenv("KPM_WINDOW_MAX_SAMPLES");
+  uint64_t const max_samples = max_str ? strtoull(max_str, NULL, 10) : 1024;
+
+  uint32_t cap = 2;
+  while (cap < need && cap < max_samples && cap < (1u << 30))
+    cap <<= 1;
+  if (cap < need)
+    printf("[AGG]: windows limited to the last %u samples, raise KPM_WINDOW_MAX_SAMPLES to cover %lu\n", cap, need);
+  a->cap = cap;
+  a->mask = cap - 1;
+
+  a->ue_len = ue_cap;
+  a->ue = calloc(ue_cap, sizeof(kpm_series_t));
+  assert(a->ue != NULL && "Memory exhausted");
+  a->scratch = calloc(cap, sizeof(int64_t));
+  assert(a->scratch != NULL && "Memory exhausted");
+
+  printf("[AGG]: %zu windows, %u samples per UE and slice\n", a->win_len, cap);
+}
+
+// Rings are allocated on the first sample of a UE or slice, in one block, and kept when the
+// entry is reused
+static
+void alloc_series(kpm_agg_t const* a, kpm_series_t* s)
+{
+  size_t const cap = a->cap;
+  size_t const sz = cap * (sizeof(int64_t) + sizeof(uint32_t) + END_KPM_MEAS * sizeof(int64_t))
+                    + a->win_len * END_KPM_MEAS * 2 * cap * sizeof(uint32_t);
+  uint8_t* p = calloc(1, sz);
+  assert(p != NULL && "Memory exhausted");
+
+  s->ts = (int64_t*)p;
+  p += cap * sizeof(int64_t);
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    s->val[k] = (int64_t*)p;
+    p += cap * sizeof(int64_t);
+  }
+  s->present = (uint32_t*)p;
+  p += cap * sizeof(uint32_t);
+
+  for (size_t w = 0; w < a->win_len; w++) {
+    for (size_t k = 0; k < END_KPM_MEAS; k++) {
+      s->win[w].min[k].seq = (uint32_t*)p;
+      p += cap * sizeof(uint32_t);
+      s->win[w].max[k].seq = (uint32_t*)p;
+      p += cap * sizeof(uint32_t);
+    }
+  }
+}
+
+static
+void free_series(kpm_series_t* s)
+{
+  free(s->ts);
+  memset(s, 0, sizeof(*s));
+}
+
+static
+void free_kpm_agg(kpm_agg_t* a)
+{
+  for (size_t i = 0; i < a->ue_len; i++)
+    free_series(&a->ue[i]);
+  for (size_t i = 0; i < MAX_KPM_SUBS; i++)
+    free_series(&a->sub[i]);
+  free(a->ue);
+  free(a->scratch);
+  memset(a, 0, sizeof(*a));
+}
+
+// Drop every sample; the EWMA weight follows the report period of the series
+static
+void reset_series(kpm_agg_t const* a, kpm_series_t* s, uint32_t gen, uint32_t report_period_ms)
+{
+  if (s->ts == NULL)
+    alloc_series(a, s);
+
+  s->end = 0;
+  s->gen = gen;
+  for (size_t w = 0; w < a->win_len; w++) {
+    kpm_window_t* win = &s->win[w];
+    win->start = 0;
+    memset(win->sum, 0, sizeof(win->sum));
+    memset(win->cnt, 0, sizeof(win->cnt));
+    win->ewma_set = 0;
+    for (size_t k = 0; k < END_KPM_MEAS; k++) {
+      win->min[k].head = win->min[k].tail = 0;
+      win->max[k].head = win->max[k].tail = 0;
+    }
+
+    // Same weight as an N sample moving average, N = samples per window
+    uint64_t const n = (uint64_t)a->win_us[w] / ((uint64_t)report_period_ms * 1000);
+    win->alpha = 2.0 / (double)((n > 0 ? n : 1) + 1);
+  }
+}
+
+static
+void evict_window(kpm_agg_t const* a, kpm_series_t* s, kpm_window_t* win)
+{
+  uint32_t const seq = win->start;
+  uint32_t const pos = seq & a->mask;
+  uint32_t const present = s->present[pos];
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    if ((present & (1u << k)) == 0)
+      continue;
+
+    win->sum[k] -= s->val[k][pos];
+    win->cnt[k]--;
+    kpm_mono_q_t* min = &win->min[k];
+    if (min->head != min->tail && min->seq[min->head & a->mask] == seq)
+      min->head++;
+    kpm_mono_q_t* max = &win->max[k];
+    if (max->head != max->tail && max->seq[max->head & a->mask] == seq)
+      max->head++;
+  }
+  win->start++;
+}
+
+static
+void add_window(kpm_agg_t const* a, kpm_series_t* s, kpm_window_t* win, uint32_t seq)
+{
+  uint32_t const pos = seq & a->mask;
+  uint32_t const present = s->present[pos];
+
+  for (size_t k = 0; k < END_KPM_MEAS; k++) {
+    if ((present & (1u << k)) == 0)
+      continue;
+
+    int64_t const* val = s->val[k];
+    int64_t const v = val[pos];
+    win->sum[k] += v;
+    win->cnt[k]++;
+
+    double const d = agg_double(v);
+    if (win->ewma_set & (1u << k)) {
+      win->ewma[k] += win->alpha * (d - win->ewma[k]);
+    } else {
+      win->ewma[k] = d;
+      win->ewma_set |= 1u << k;
+    }
+
+    kpm_mono_q_t* min = &win->min[k];
+    while (min->head != min->tail && val[min->seq[(min->tail - 1) & a->mask] & a->mask] >= v)
+      min->tail--;
+    min->seq[min->tail++ & a->mask] = seq;
+
+    kpm_mono_q_t* max = &win->max[k];
+    while (max->head != max->tail && val[max->seq[(max->tail - 1) & a->mask] & a->mask] <= v)
+      max->tail--;
+    max->seq[max->tail++ & a->mask] = seq;
+  }
+}
+
+static
+void push_series(kpm_agg_t const* a, kpm_series_t* s, int64_t ts, uint32_t present, int64_t const val[END_KPM_MEAS])
+{
+  // Indications arriving out of order would break the window boundaries
+  if (s->end != 0 && ts < s->ts[(s->end - 1) & a->mask])
+    return;
+
+  uint32_t const seq = s->end;
+  for (size_t w = 0; w < a->win_len; w++) {
+    if (seq - s->win[w].start == a->cap)
+      evict_window(a, s, &s->win[w]);
+  }
+
+  uint32_t const pos = seq & a->mask;
+  s->ts[pos] = ts;
+  s->present[pos] = present;
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    s->val[k][pos] = val[k];
+  s->end++;
+
+  for (size_t w = 0; w < a->win_len; w++) {
+    kpm_window_t* win = &s->win[w];
+    add_window(a, s, win, seq);
+    while (win->start != s->end && s->ts[win->start & a->mask] <= ts - a->win_us[w])
+      evict_window(a, s, win);
+  }
+}
+
+// Row i of the decoded indication, reported by the UE of entry e in UE slot slot
+static
+void push_ue_agg(kpm_agg_t* a, size_t slot, ue_entry_t const* e, kpm_sub_ctx_t const* ctx, kpm_meas_block_t const* b, size_t i, int64_t ts)
+{
+  if (a->win_len == 0)
+    return;
+
+  uint32_t const present = b->present[i];
+  int64_t val[END_KPM_MEAS] = {0};
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    val[k] = (present & (1u << k)) ? agg_fixed(b->col[k][i]) : 0;
+
+  kpm_series_t* s = &a->ue[slot];
+  if (s->ts == NULL || s->gen != e->gen)
+    reset_series(a, s, e->gen, ctx->slice->report_period_ms);
+  push_series(a, s, ts, present, val);
+}
+
+// One sample per indication for the (E2 node, slice) of the subscription
+static
+void push_slice_agg(kpm_agg_t* a, kpm_sub_ctx_t const* ctx, kpm_meas_block_t const* b, int64_t ts)
+{
+  if (a->win_len == 0)
+    return;
+
+  int64_t val[END_KPM_MEAS] = {0};
+  uint32_t cnt[END_KPM_MEAS] = {0};
+  for (size_t i = 0; i < b->len; i++) {
+    uint32_t const present = b->present[i];
+    for (size_t k = 0; k < END_KPM_MEAS; k++) {
+      if (present & (1u << k)) {
+        val[k] += agg_fixed(b->col[k][i]);
+        cnt[k]++;
+      }
+    }
+  }
+
+  // An idle slice reports zero volume and PRBs, but no delay
+  uint32_t present = kpm_cfg.meas_mask;
+  if (cnt[DRB_RLC_SDU_DELAY_DL] > 0)
+    val[DRB_RLC_SDU_DELAY_DL] /= cnt[DRB_RLC_SDU_DELAY_DL];
+  else
+    present &= ~(1u << DRB_RLC_SDU_DELAY_DL);
+
+  kpm_series_t* s = &a->sub[ctx - kpm_sub_ctx];
+  if (s->ts == NULL)
+    reset_series(a, s, 0, ctx->slice->report_period_ms);
+  push_series(a, s, ts, present, val);
+}
+
+static inline
+void swap_int64(int64_t* a, int64_t* b)
+{
+  int64_t const tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Nearest-rank percentile of measurement k over the window, by quickselect on a copy
+static
+int64_t window_percentile(kpm_agg_t* a, kpm_series_t const* s, kpm_window_t const* win, size_t k, uint32_t pct)
+{
+  int64_t* v = a->scratch;
+  size_t n = 0;
+  for (uint32_t seq = win->start; seq != s->end; seq++) {
+    uint32_t const pos = seq & a->mask;
+    if (s->present[pos] & (1u << k))
+      v[n++] = s->val[k][pos];
+  }
+  assert(n > 0);
+
+  size_t const rank = (pct * n + 99) / 100;
+  size_t const target = rank > 0 ? rank - 1 : 0;
+
+  size_t lo = 0;
+  size_t hi = n;
+  while (hi - lo > 1) {
+    // [lo, lt) < pivot, [lt, gt) == pivot, [gt, hi) > pivot
+    int64_t const pivot = v[lo + (hi - lo) / 2];
+    size_t lt = lo;
+    size_t gt = hi;
+    size_t i = lo;
+    while (i < gt) {
+      if (v[i] < pivot)
+        swap_int64(&v[lt++], &v[i++]);
+      else if (v[i] > pivot)
+        swap_int64(&v[i], &v[--gt]);
+      else
+        i++;
+    }
+
+    if (target < lt)
+      hi = lt;
+    else if (target >= gt)
+      lo = gt;
+    else
+      return pivot;
+  }
+  return v[lo];
+}
+
+// ======================================== Sliding Windows ========================================
+
+// ======================================== Window Query API ========================================
+
+// GET /windows on KPM_AGG_ADDR:KPM_AGG_PORT answers with the windows of every slice and UE as
+// JSON. Optional arguments narrow the answer: scope=slice|ue, sst, sd, amf_ue_ngap_id and
+// window_ms. json-c prints doubles with 17 significant digits, so the client reads back the
+// exact values computed here.
+
+static struct MHD_Daemon* agg_daemon = NULL;
+
+typedef struct {
+  bool slices;
+  bool ues;
+  int64_t sst;     // -1 = any
+  int64_t sd;      // -1 = any
+  int64_t amf_ue_ngap_id; // -1 = any
+  int64_t win_us;  // 0 = all
+} agg_query_t;
+
+static
+struct json_object* window_to_json(kpm_agg_t* a, kpm_series_t const* s, size_t w)
+{
+  kpm_window_t const* win = &s->win[w];
+
+  struct json_object* jw = json_object_new_object();
+  json_object_object_add(jw, "window_ms", json_object_new_int64(a->win_us[w] / 1000));
+  json_object_object_add(jw, "samples", json_object_new_int64(s->end - win->start));
+
+  for (size_t j = 0; j < kpm_cfg.meas_len; j++) {
+    kpm_meas_e const k = kpm_cfg.meas[j];
+    if (win->cnt[k] == 0)
+      continue;
+
+    int64_t const* val = s->val[k];
+    int64_t const min = val[win->min[k].seq[win->min[k].head & a->mask] & a->mask];
+    int64_t const max = val[win->max[k].seq[win->max[k].head & a->mask] & a->mask];
+
+    struct json_object* jm = json_object_new_object();
+    json_object_object_add(jm, "n", json_object_new_int64(win->cnt[k]));
+    json_object_object_add(jm, "mean", json_object_new_double((double)win->sum[k] / win->cnt[k] / KPM_AGG_SCALE));
+    json_object_object_add(jm, "min", json_object_new_double(agg_double(min)));
+    json_object_object_add(jm, "max", json_object_new_double(agg_double(max)));
+    json_object_object_add(jm, "p95", json_object_new_double(agg_double(window_percentile(a, s, win, k, 95))));
+    json_object_object_add(jm, "ewma", json_object_new_double(win->ewma[k]));
+    json_object_object_add(jw, kpm_meas_name[k], jm);
+  }
+  return jw;
+}
+
+static
+struct json_object* series_windows_to_json(kpm_agg_t* a, kpm_series_t const* s, agg_query_t const* q)
+{
+  struct json_object* arr = json_object_new_array();
+  for (size_t w = 0; w < a->win_len; w++) {
+    if (q->win_us == 0 || q->win_us == a->win_us[w])
+      json_object_array_add(arr, window_to_json(a, s, w));
+  }
+  return arr;
+}
+
+static
+bool match_slice(agg_query_t const* q, uint8_t sst, uint32_t sd)
+{
+  return (q->sst < 0 || q->sst == sst) && (q->sd < 0 || q->sd == sd);
+}
+
+// Takes the lock of one shard at a time, so a query holds up one E2 node at most
+static
+struct json_object* kpm_agg_to_json(kpm_agg_t* a, agg_query_t const* q)
+{
+  struct json_object* root = json_object_new_object();
+
+  if (q->slices) {
+    struct json_object* slices = json_object_new_array();
+    for (size_t i = 0; i < kpm_sub_ctx_len; i++) {
+      kpm_sub_ctx_t const* ctx = &kpm_sub_ctx[i];
+      lock_guard(&kpm_shard[ctx->shard].mtx);
+      kpm_series_t const* s = &a->sub[i];
+      if (s->end == 0 || !match_slice(q, ctx->sst, ctx->sd))
+        continue;
+
+      struct json_object* js = json_object_new_object();
+      json_object_object_add(js, "nb_id", json_object_new_int64(ctx->nb_id));
+      json_object_object_add(js, "sst", json_object_new_int(ctx->sst));
+      json_object_object_add(js, "sd", json_object_new_int64(ctx->sd));
+      json_object_object_add(js, "last_ts_us", json_object_new_int64(s->ts[(s->end - 1) & a->mask]));
+      json_object_object_add(js, "windows", series_windows_to_json(a, s, q));
+      json_object_array_add(slices, js);
+    }
+    json_object_object_add(root, "slices", slices);
+  }
+
+  if (q->ues) {
+    struct json_object* ues = json_object_new_array();
+    for (size_t h = 0; h < kpm_shard_len; h++) {
+      kpm_shard_t* sh = &kpm_shard[h];
+      lock_guard(&sh->mtx);
+      for (size_t i = 0; i < sh->ue_table.cap; i++) {
+        ue_entry_t const* e = &sh->ue_table.pool[i];
+        kpm_series_t const* s = &a->ue[sh->ue_base + i];
+        if (!e->used || s->ts == NULL || s->gen != e->gen || s->end == 0)
+          continue;
+        if (!match_slice(q, e->key.sst, e->key.sd))
+          continue;
+        if (q->amf_ue_ngap_id >= 0 && (uint64_t)q->amf_ue_ngap_id != e->key.amf_ue_ngap_id)
+          continue;
+
+        struct json_object* ju = json_object_new_object();
+        json_object_object_add(ju, "amf_ue_ngap_id", json_object_new_uint64(e->key.amf_ue_ngap_id));
+        json_object_object_add(ju, "ran_ue_id", json_object_new_uint64(e->key.ran_ue_id));
+        json_object_object_add(ju, "sst", json_object_new_int(e->key.sst));
+        json_object_object_add(ju, "sd", json_object_new_int64(e->key.sd));
+        json_object_object_add(ju, "last_ts_us", json_object_new_int64(s->ts[(s->end - 1) & a->mask]));
+        json_object_object_add(ju, "windows", series_windows_to_json(a, s, q));
+        json_object_array_add(ues, ju);
+      }
+    }
+    json_object_object_add(root, "ues", ues);
+  }
+
+  return root;
+}
+
+static
+int send_agg_text(struct MHD_Connection* connection, unsigned int status, const char* msg)
+{
+  struct MHD_Response* resp = MHD_create_response_from_buffer(strlen(msg), (void*)msg, MHD_RESPMEM_PERSISTENT);
+  int ret = MHD_queue_response(connection, status, resp);
+  MHD_destroy_response(resp);
+  return ret;
+}
+
+// Unsigned decimal or 0x hex argument, -1 if absent
+static
+bool parse_agg_arg(struct MHD_Connection* connection, const char* key, int64_t* out)
+{
+  *out = -1;
+  const char* val = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+  if (val == NULL)
+    return true;
+
+  char* end = NULL;
+  unsigned long long const v = strtoull(val, &end, 0);
+  if (end == val || *end != '\0' || v > INT64_MAX)
+    return false;
+  *out = (int64_t)v;
+  return true;
+}
+
+static
+void write_prom_summary(FILE* f, const char* name, const char* labels, kpm_hist_t const* h)
+{
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  bool const has_labels = labels[0] != '\0';
+
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    fprintf(f, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, has_labels ? "," : "", quantiles[i],
+            kpm_hist_quantile(h, quantiles[i]) / 1e9);
+  fprintf(f, "%s_sum%s%s%s %.9f\n", name, has_labels ? "{" : "", labels, has_labels ? "}" : "",
+          atomic_load(&((kpm_hist_t*)h)->sum) / 1e9);
+  fprintf(f, "%s_count%s%s%s %lu\n", name, has_labels ? "{" : "", labels, has_labels ? "}" : "",
+          atomic_load(&((kpm_hist_t*)h)->count));
+}
+
+// Prometheus text exposition of the instrumentation. Nothing here takes a shard lock, every
+// value is an atomic counter or histogram.
+static
+void write_prom_metrics(FILE* f)
+{
+  char labels[128];
+  static kpm_hist_t merged;
+
+  fprintf(f, "# HELP kpm_e2_latency_seconds collectStartTime of an indication to its callback in the xApp\n");
+  fprintf(f, "# TYPE kpm_e2_latency_seconds summary\n");
+  kpm_hist_merge(&merged, kpm_metrics.e2_latency);
+  write_prom_summary(f, "kpm_e2_latency_seconds", "", &merged);
+  for (size_t i = 0; i < kpm_sub_ctx_len; i++) {
+    kpm_sub_ctx_t const* ctx = &kpm_sub_ctx[i];
+    snprintf(labels, sizeof(labels), "nb_id=\"%u\",sst=\"%u\",sd=\"%06x\"", ctx->nb_id, ctx->sst, ctx->sd);
+    write_prom_summary(f, "kpm_e2_latency_seconds", labels, &ctx->e2_latency);
+  }
+
+  // All shards, then per shard
+  fprintf(f, "# HELP kpm_decode_seconds Decoding of an indication into the measurement block\n");
+  fprintf(f, "# TYPE kpm_decode_seconds summary\n");
+  kpm_hist_merge(&merged, kpm_metrics.decode);
+  write_prom_summary(f, "kpm_decode_seconds", "", &merged);
+  for (size_t i = 0; i < kpm_shard_len; i++) {
+    snprintf(labels, sizeof(labels), "shard=\"%zu\"", i);
+    write_prom_summary(f, "kpm_decode_seconds", labels, &kpm_metrics.decode[i]);
+  }
+
+  fprintf(f, "# HELP kpm_lock_wait_seconds Wait for the shard lock in the indication callback\n");
+  fprintf(f, "# TYPE kpm_lock_wait_seconds summary\n");
+  kpm_hist_merge(&merged, kpm_metrics.lock_wait);
+  write_prom_summary(f, "kpm_lock_wait_seconds", "", &merged);
+  for (size_t i = 0; i < kpm_shard_len; i++) {
+    snprintf(labels, sizeof(labels), "shard=\"%zu\"", i);
+    write_prom_summary(f, "kpm_lock_wait_seconds", labels, &kpm_metrics.lock_wait[i]);
+  }
+
+  fprintf(f, "# HELP kpm_sink_flush_seconds Write of one batch by a telemetry sink\n");
+  fprintf(f, "# TYPE kpm_sink_flush_seconds summary\n");
+  for (size_t i = 0; i < kpm_sinks_len; i++) {
+    kpm_sink_e const k = (kpm_sink_e)(kpm_sinks[i] - kpm_sink_avail);
+    snprintf(labels, sizeof(labels), "sink=\"%s\"", kpm_sink_name[k]);
+    write_prom_summary(f, "kpm_sink_flush_seconds", labels, &kpm_metrics.flush[k]);
+  }
+
+  fprintf(f, "# HELP kpm_sink_rows_total Rows written by a telemetry sink\n");
+  fprintf(f, "# TYPE kpm_sink_rows_total counter\n");
+  for (size_t i = 0; i < kpm_sinks_len; i++) {
+    kpm_sink_e const k = (kpm_sink_e)(kpm_sinks[i] - kpm_sink_avail);
+    fprintf(f, "kpm_sink_rows_total{sink=\"%s\"} %lu\n", kpm_sink_name[k], atomic_load(&kpm_metrics.sink_rows[k]));
+  }
+  fprintf(f, "# HELP kpm_sink_failed_total Batches a telemetry sink failed to write\n");
+  fprintf(f, "# TYPE kpm_sink_failed_total counter\n");
+  for (size_t i = 0; i < kpm_sinks_len; i++) {
+    kpm_sink_e const k = (kpm_sink_e)(kpm_sinks[i] - kpm_sink_avail);
+    fprintf(f, "kpm_sink_failed_total{sink=\"%s\"} %lu\n", kpm_sink_name[k], atomic_load(&kpm_metrics.sink_failed[k]));
+  }
+
+  fprintf(f, "# HELP kpm_ring_enqueued_total Rows handed to the writer thread by a shard\n");
+  fprintf(f, "# TYPE kpm_ring_enqueued_total counter\n");
+  for (size_t i = 0; i < kpm_ring_len; i++)
+    fprintf(f, "kpm_ring_enqueued_total{shard=\"%zu\"} %lu\n", i, atomic_load(&kpm_ring[i].enqueued));
+  fprintf(f, "# HELP kpm_ring_dropped_total Rows of a shard dropped by the DB_RING_OVERFLOW policy\n");
+  fprintf(f, "# TYPE kpm_ring_dropped_total counter\n");
+  for (size_t i = 0; i < kpm_ring_len; i++)
+    fprintf(f, "kpm_ring_dropped_total{shard=\"%zu\"} %lu\n", i, atomic_load(&kpm_ring[i].dropped));
+
+  bool has_mysql = false;
+  for (size_t i = 0; i < kpm_sinks_len; i++)
+    has_mysql |= kpm_sinks[i] == &kpm_sink_avail[KPM_SINK_MYSQL];
+  if (has_mysql) {
+    fprintf(f, "# HELP kpm_db_connected 1 while the MySQL sink is connected\n");
+    fprintf(f, "# TYPE kpm_db_connected gauge\n");
+    fprintf(f, "kpm_db_connected %lu\n", atomic_load(&kpm_metrics.db_connected));
+    fprintf(f, "# HELP kpm_db_reconnects_total MySQL connections after the first one\n");
+    fprintf(f, "# TYPE kpm_db_reconnects_total counter\n");
+    fprintf(f, "kpm_db_reconnects_total %lu\n", atomic_load(&kpm_metrics.db_reconnects));
+    fprintf(f, "# HELP kpm_db_spool_rows Rows spooled to DB_SPOOL_FILE and not replayed yet\n");
+    fprintf(f, "# TYPE kpm_db_spool_rows gauge\n");
+    fprintf(f, "kpm_db_spool_rows %lu\n", atomic_load(&kpm_metrics.spool_rows));
+    fprintf(f, "# HELP kpm_db_spool_bytes Bytes of the rows not replayed yet\n");
+    fprintf(f, "# TYPE kpm_db_spool_bytes gauge\n");
+    fprintf(f, "kpm_db_spool_bytes %lu\n", atomic_load(&kpm_metrics.spool_bytes));
+    fprintf(f, "# HELP kpm_db_spool_replayed_total Spooled rows written once MySQL was back\n");
+    fprintf(f, "# TYPE kpm_db_spool_replayed_total counter\n");
+    fprintf(f, "kpm_db_spool_replayed_total %lu\n", atomic_load(&kpm_metrics.spool_replayed));
+    fprintf(f, "# HELP kpm_db_spool_dropped_total Rows lost while MySQL was unreachable, spool full or disabled\n");
+    fprintf(f, "# TYPE kpm_db_spool_dropped_total counter\n");
+    fprintf(f, "kpm_db_spool_dropped_total %lu\n", atomic_load(&kpm_metrics.spool_dropped));
+  }
+
+  // Per subscription, then summed per E2 node
+  static const char* const counter_name[3] = {"kpm_indications_total", "kpm_ue_reports_total", "kpm_ue_dropped_total"};
+  static const char* const counter_help[3] = {"Indications received", "UE reports decoded", "UE reports dropped because the UE table was full"};
+  for (size_t c = 0; c < 3; c++) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", counter_name[c], counter_help[c], counter_name[c]);
+    for (size_t i = 0; i < kpm_sub_ctx_len; i++) {
+      kpm_sub_ctx_t* ctx = &kpm_sub_ctx[i];
+      _Atomic uint64_t* val[3] = {&ctx->indications, &ctx->ue_reports, &ctx->ue_dropped};
+      fprintf(f, "%s{nb_id=\"%u\",sst=\"%u\",sd=\"%06x\"} %lu\n", counter_name[c], ctx->nb_id, ctx->sst, ctx->sd,
+              atomic_load(val[c]));
+    }
+  }
+
+  // The same counters summed over the subscriptions of every E2 node
+  static const char* const node_name[2] = {"kpm_node_indications_total", "kpm_node_ue_reports_total"};
+  for (size_t c = 0; c < 2; c++) {
+    fprintf(f, "# HELP %s %s from an E2 node, all slices\n# TYPE %s counter\n", node_name[c], counter_help[c], node_name[c]);
+    for (size_t i = 0; i < kpm_sub_ctx_len; i++) {
+      size_t const node = kpm_sub_ctx[i].node_idx;
+      bool seen = false;
+      for (size_t j = 0; j < i && !seen; j++)
+        seen = kpm_sub_ctx[j].node_idx == node;
+      if (seen)
+        continue;
+
+      uint64_t sum = 0;
+      for (size_t j = i; j < kpm_sub_ctx_len; j++) {
+        if (kpm_sub_ctx[j].node_idx == node)
+          sum += atomic_load(c == 0 ? &kpm_sub_ctx[j].indications : &kpm_sub_ctx[j].ue_reports);
+      }
+      fprintf(f, "%s{nb_id=\"%u\"} %lu\n", node_name[c], kpm_sub_ctx[i].nb_id, sum);
+    }
+  }
+}
+
+static
+int send_prom_metrics(struct MHD_Connection* connection)
+{
+  char* body = NULL;
+  size_t len = 0;
+  FILE* f = open_memstream(&body, &len);
+  assert(f != NULL && "Memory exhausted");
+  write_prom_metrics(f);
+  fclose(f);
+
+  struct MHD_Response* resp = MHD_create_response_from_buffer(len, body, MHD_RESPMEM_MUST_FREE);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+  int ret = MHD_queue_response(connection, MHD_HTTP_OK, resp);
+  MHD_destroy_response(resp);
+  return ret;
+}
+
+static
+int handle_window_query(void* cls, struct MHD_Connection* connection,
+                        const char* url, const char* method,
+                        const char* version, const char* upload_data,
+                        size_t* upload_data_size, void** con_cls)
+{
+  (void)cls;
+  (void)version;
+  (void)upload_data;
+  (void)upload_data_size;
+  (void)con_cls;
+
+  bool const metrics = strcmp(url, "/metrics") == 0;
+  if (strcmp(url, "/windows") != 0 && !metrics)
+    return send_agg_text(connection, MHD_HTTP_NOT_FOUND, "Unknown endpoint\nAvailable endpoints: ( /windows, /metrics )\n");
+  if (strcmp(method, "GET") != 0)
+    return send_agg_text(connection, MHD_HTTP_METHOD_NOT_ALLOWED, "Only GET is supported\n");
+  if (metrics)
+    return send_prom_metrics(connection);
+  if (kpm_agg.win_len == 0)
+    return send_agg_text(connection, MHD_HTTP_NOT_FOUND, "No sliding window configured, see KPM_WINDOWS_MS\n");
+
+  agg_query_t q = {.slices = true, .ues = true};
+  const char* scope = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "scope");
+  if (scope != NULL) {
+    q.slices = strcmp(scope, "slice") == 0;
+    q.ues = strcmp(scope, "ue") == 0;
+    if (!q.slices && !q.ues)
+      return send_agg_text(connection, MHD_HTTP_BAD_REQUEST, "scope must be one of ( slice, ue )\n");
+  }
+
+  int64_t win_ms = -1;
+  if (!parse_agg_arg(connection, "sst", &q.sst) || !parse_agg_arg(connection, "sd", &q.sd)
+      || !parse_agg_arg(connection, "amf_ue_ngap_id", &q.amf_ue_ngap_id) || !parse_agg_arg(connection, "window_ms", &win_ms))
+    return send_agg_text(connection, MHD_HTTP_BAD_REQUEST, "Invalid argument\nNumeric arguments: ( sst, sd, amf_ue_ngap_id, window_ms )\n");
+  q.win_us = win_ms > 0 ? win_ms * 1000 : 0;
+
+  struct json_object* root = kpm_agg_to_json(&kpm_agg, &q);
+
+  const char* body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+  struct MHD_Response* resp = MHD_create_response_from_buffer(strlen(body), (void*)body, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  int ret = MHD_queue_response(connection, MHD_HTTP_OK, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
+
+static
+void start_agg_api(void)
+{
+  const char* port_str = getenv("KPM_AGG_PORT");
+  uint16_t const port = port_str ? (uint16_t)atoi(port_str) : 8090;
+  if (port == 0) {
+    printf("[AGG]: window query and metrics API disabled\n");
+    return;
+  }
+
+  // Local by default, the DRL agent runs next to the monitor
+  const char* addr_str = getenv("KPM_AGG_ADDR");
+  if (!addr_str) addr_str = "127.0.0.1";
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr_str, &addr.sin_addr) != 1)
+    cfg_error("KPM_AGG_ADDR", "invalid IPv4 address", addr_str);
+
+  agg_daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, port, NULL, NULL, &handle_window_query, NULL,
+                                MHD_OPTION_SOCK_ADDR, (struct sockaddr*)&addr, MHD_OPTION_END);
+  if (agg_daemon == NULL) {
+    fprintf(stderr, "[AGG]: Failed to start the window query API on %s:%u\n", addr_str, port);
+    return;
+  }
+  printf("[AGG]: window query API on http://%s:%u/windows, metrics on /metrics\n", addr_str, port);
+}
+
+static
+void stop_agg_api(void)
+{
+  if (agg_daemon != NULL)
+    MHD_stop_daemon(agg_daemon);
+  agg_daemon = NULL;
+}
+
+// ======================================== Window Query API ========================================
+
+// ======================================== Shared Snapshot ========================================
+
+// The latest metrics of every UE and slice are also published in a shared memory segment
+// (KPM_SHM_NAME, layout in kpm_shm.h) for readers on the same host. Records are indexed like
+// the UE slots of the shards and kpm_sub_ctx, and sm_cb_kpm() writes them under their
+// sequence lock, so a reader never holds up the indication path. A record belongs to a single
+// shard, which keeps one writer per record.
+
+_Static_assert(END_KPM_MEAS <= KPM_SHM_MAX_MEAS, "kpm_shm_rec_t cannot hold every measurement");
+
+static kpm_shm_t kpm_shm = {0};
+
+static char kpm_shm_name[256] = {0};
+
+static
+void init_kpm_shm(kpm_shm_t* shm, size_t ue_cap)
+{
+  memset(shm, 0, sizeof(*shm));
+
+  const char* name = getenv("KPM_SHM_NAME");
+  if (!name) name = "/kpm_mon";
+  if (name[0] == '\0') {
+    printf("[SHM]: snapshot disabled\n");
+    return;
+  }
+  if (name[0] != '/' || strlen(name) >= sizeof(kpm_shm_name))
+    cfg_error("KPM_SHM_NAME", "expected /name or an absolute path, got", name);
+
+  // Readers still mapping the segment of a previous run keep it, this run starts a new one
+  kpm_shm_unlink(name);
+
+  size_t const size = kpm_shm_size((uint32_t)ue_cap, MAX_KPM_SUBS);
+  int fd = kpm_shm_open_fd(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "[SHM]: cannot create %s: %s\n", name, strerror(errno));
+    return;
+  }
+  if (ftruncate(fd, (off_t)size) < 0) {
+    fprintf(stderr, "[SHM]: cannot size %s: %s\n", name, strerror(errno));
+    close(fd);
+    kpm_shm_unlink(name);
+    return;
+  }
 
-volatile sig_atomic_t sig_recv = 0;
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "[SHM]: cannot map %s: %s\n", name, strerror(errno));
+    kpm_shm_unlink(name);
+    return;
+  }
+
+  kpm_shm_hdr_t* hdr = p;
+  hdr->version = KPM_SHM_VERSION;
+  hdr->hdr_size = KPM_SHM_HDR_SIZE;
+  hdr->rec_size = sizeof(kpm_shm_rec_t);
+  hdr->ue_cap = (uint32_t)ue_cap;
+  hdr->slice_cap = MAX_KPM_SUBS;
+  hdr->meas_len = END_KPM_MEAS;
+  hdr->writer_pid = (uint32_t)getpid();
+  hdr->start_us = time_now_us();
+  for (size_t k = 0; k < END_KPM_MEAS; k++)
+    snprintf(hdr->meas_name[k], KPM_SHM_MEAS_NAME_LEN, "%s", kpm_meas_name[k]);
+  atomic_store(&hdr->alive, 1);
+
+  // Readers check the magic first
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = KPM_SHM_MAGIC;
+
+  shm->hdr = hdr;
+  shm->size = size;
+  kpm_shm_map_recs(shm);
+  snprintf(kpm_shm_name, sizeof(kpm_shm_name), "%s", name);
+
+  printf("[SHM]: snapshot of %zu UEs and %d slices published in %s\n", ue_cap, MAX_KPM_SUBS, name);
+}
 
 static
-uint64_t const period_ms = 1000;
+void close_kpm_shm(kpm_shm_t* shm)
+{
+  if (shm->hdr == NULL)
+    return;
+
+  atomic_store(&shm->hdr->alive, 0);
+  munmap(shm->hdr, shm->size);
+  kpm_shm_unlink(kpm_shm_name);
+  memset(shm, 0, sizeof(*shm));
+}
 
 static
-pthread_mutex_t mtx;
+void publish_ue_shm(kpm_shm_t* shm, size_t idx, kpi_metrics_t const* m, int64_t ts, uint64_t ind_seq)
+{
+  if (shm->hdr == NULL)
+    return;
 
-void signal_handler_thread(void *arg){
-  sigset_t signal_set;
-  int sig_number;
+  kpm_shm_rec_t* r = &shm->ue[idx];
+  kpm_shm_write_begin(r);
+  r->kind = KPM_SHM_REC_UE;
+  r->amf_ue_ngap_id = m->amf_ue_ngap_id;
+  r->ran_ue_id = m->ran_ue_id;
+  r->ts_us = ts;
+  r->ind_seq = ind_seq;
+  r->present = m->present;
+  r->sst = m->sst;
+  r->sd = m->sd;
+  memcpy(r->meas, m->meas, sizeof(m->meas));
+  kpm_shm_write_end(r);
+}
 
-  // Block SIGINT and SIGTERM
-  sigemptyset(&signal_set);
-  sigaddset(&signal_set, SIGINT);
-  sigaddset(&signal_set, SIGTERM);
+// Same rule as the slice windows: sum over the UEs, mean RLC delay
+static
+void publish_slice_shm(kpm_shm_t* shm, kpm_sub_ctx_t const* ctx, kpm_meas_block_t const* b, int64_t ts, uint64_t ind_seq)
+{
+  if (shm->hdr == NULL)
+    return;
 
-  if(sigwait(&signal_set, &sig_number) == 0) {
-    printf("Received %d, cleaning up", sig_number);
-    sig_recv = 1;
+  double val[END_KPM_MEAS] = {0};
+  uint32_t cnt[END_KPM_MEAS] = {0};
+  for (size_t i = 0; i < b->len; i++) {
+    for (size_t k = 0; k < END_KPM_MEAS; k++) {
+      if (b->present[i] & (1u << k)) {
+        val[k] += b->col[k][i];
+        cnt[k]++;
+      }
+    }
   }
+
+  uint32_t present = kpm_cfg.meas_mask;
+  if (cnt[DRB_RLC_SDU_DELAY_DL] > 0)
+    val[DRB_RLC_SDU_DELAY_DL] /= cnt[DRB_RLC_SDU_DELAY_DL];
+  else
+    present &= ~(1u << DRB_RLC_SDU_DELAY_DL);
+
+  kpm_shm_rec_t* r = &shm->slice[ctx - kpm_sub_ctx];
+  kpm_shm_write_begin(r);
+  r->kind = KPM_SHM_REC_SLICE;
+  r->ts_us = ts;
+  r->ind_seq = ind_seq;
+  r->present = present;
+  r->sst = ctx->sst;
+  r->sd = ctx->sd;
+  r->nb_id = ctx->nb_id;
+  r->n_ues = (uint32_t)b->len;
+  memcpy(r->meas, val, sizeof(val));
+  kpm_shm_write_end(r);
 }
 
-// ======================================== MySql Functions ========================================
+// Free the records of the UE entries released by the last expiry sweep of a shard
+static
+void release_ue_shm(kpm_shm_t* shm, kpm_shard_t const* sh)
+{
+  if (shm->hdr == NULL)
+    return;
 
-// Define a structure to hold KPI metrics
-typedef struct {
-    double rru_prb_tot_dl;
-    double rru_prb_tot_ul;
-    double drb_pdcp_sdu_volume_dl;
-    double drb_pdcp_sdu_volume_ul;
-    double drb_rlc_sdu_delay_dl;
-    double drb_ue_thp_dl;
-    double drb_ue_thp_ul;
-    unsigned long amf_ue_ngap_id;
-    unsigned long ran_ue_id;
-} kpi_metrics_t;
+  ue_table_t const* t = &sh->ue_table;
+  for (size_t i = 0; i < t->cap; i++) {
+    kpm_shm_rec_t* r = &shm->ue[sh->ue_base + i];
+    if (t->pool[i].used || r->kind == KPM_SHM_REC_FREE)
+      continue;
 
-// Initialize a static variable to hold the metrics
-static kpi_metrics_t kpi_metrics = {0};
+    kpm_shm_write_begin(r);
+    r->kind = KPM_SHM_REC_FREE;
+    kpm_shm_write_end(r);
+  }
+}
 
-static MYSQL* conn = NULL;
+static
+void end_shm_update(kpm_shm_t* shm)
+{
+  if (shm->hdr != NULL)
+    atomic_fetch_add_explicit(&shm->hdr->updates, 1, memory_order_release);
+}
 
-static void init_database() {
-    const char* host = getenv("DB_HOST");
-    if (!host) host = "127.0.0.1";
+// ======================================== Shared Snapshot ========================================
 
-    const char* user = getenv("DB_USER");
-    if (!user) user = "admin";
+// ======================================== Indication Trace ========================================
 
-    const char* password = getenv("DB_PASSWORD");
-    if (!password) password = "password";
+// KPM_TRACE_FILE records every indication as sm_cb_kpm() receives it, with its subscription
+// context and reception time (format in kpm_trace.h), until the file reaches KPM_TRACE_MAX_MB.
+// KPM_REPLAY runs the xApp on such a trace instead of the RIC: every indication goes through
+// sm_cb_kpm() again, with its recorded reception time as the xApp clock, so the same trace and
+// configuration give the same rows, windows and snapshot. KPM_REPLAY_SPEED scales the recorded
+// pace (default 1), 0 replays as fast as possible. The replay ends with the throughput of the
+// whole path, stored rows included.
 
-    const char* database = getenv("DB_NAME");
-    if (!database) database = "flexric_db";
+typedef struct {
+  // Recording, under mtx since the shards record in parallel
+  pthread_mutex_t mtx;
+  FILE* f;
+  char path[256];      // Set once by init_kpm_trace(), empty if nothing is recorded
+  uint64_t max_bytes;
+  uint64_t size;
+  uint64_t records;
+  uint8_t* buf;       // Payload of the record being written
+  size_t len;
+  size_t cap;
 
-    const char* port_str = getenv("DB_PORT");
-    unsigned int port = 3307;
-    if (port_str) port = (unsigned int) atoi(port_str);
+  // Replay
+  const char* replay;
+  double speed;
+  int64_t now_us;     // Recorded reception time of the indication in sm_cb_kpm
+} kpm_trace_t;
 
-    // Initialize MySQL connection
-    conn = mysql_init(NULL);
-    if (conn == NULL) {
-        fprintf(stderr, "mysql_init() failed\n");
-        exit(EXIT_FAILURE);
-    }
+static kpm_trace_t kpm_trace = {.mtx = PTHREAD_MUTEX_INITIALIZER};
 
-    // Connect to the database
-    if (mysql_real_connect(conn, host, user, password, database, port, NULL, 0) == NULL) {
-        fprintf(stderr, "mysql_real_connect() failed: %s\n", mysql_error(conn));
-        mysql_close(conn);
-        exit(EXIT_FAILURE);
+static
+void init_kpm_trace(void)
+{
+  const char* replay = getenv("KPM_REPLAY");
+  if (replay != NULL && replay[0] != '\0') {
+    kpm_trace.replay = replay;
+    kpm_trace.speed = 1.0;
+    const char* speed_str = getenv("KPM_REPLAY_SPEED");
+    if (speed_str != NULL) {
+      char* end = NULL;
+      kpm_trace.speed = strtod(speed_str, &end);
+      if (end == speed_str || *end != '\0' || kpm_trace.speed < 0)
+        cfg_error("KPM_REPLAY_SPEED", "expected a factor >= 0:", speed_str);
     }
+    // The rows are the output of a replay, none is dropped unless asked for. The indications
+    // are fed from one thread, and a single shard keeps the rows in their recorded order.
+    setenv("DB_RING_OVERFLOW", "block", 0);
+    const char* shards_str = getenv("KPM_SHARDS");
+    if (shards_str == NULL || shards_str[0] == '\0')
+      setenv("KPM_SHARDS", "1", 1);
+    return;
+  }
 
-    // SQL statement to create the table
-    const char* sql = "CREATE TABLE IF NOT EXISTS xapp_kpi_metrics ("
-                      "id INT AUTO_INCREMENT PRIMARY KEY, "
-                      "rru_prb_tot_dl DOUBLE, "
-                      "rru_prb_tot_ul DOUBLE, "
-                      "drb_pdcp_sdu_volume_dl DOUBLE, "
-                      "drb_pdcp_sdu_volume_ul DOUBLE, "
-                      "drb_rlc_sdu_delay_dl DOUBLE, "
-                      "drb_ue_thp_dl DOUBLE, "
-                      "drb_ue_thp_ul DOUBLE, "
-                      "amf_ue_ngap_id BIGINT, "
-                      "ran_ue_id BIGINT, "
-                      "timestamp BIGINT NOT NULL);";
+  const char* path = getenv("KPM_TRACE_FILE");
+  if (path == NULL || path[0] == '\0')
+    return;
+  if (strlen(path) >= sizeof(kpm_trace.path))
+    cfg_error("KPM_TRACE_FILE", "path too long", path);
+  snprintf(kpm_trace.path, sizeof(kpm_trace.path), "%s", path);
 
-    // Execute the SQL statement
-    if (mysql_query(conn, sql)) {
-        fprintf(stderr, "create table failed: %s\n", mysql_error(conn));
-        mysql_close(conn);
-        exit(EXIT_FAILURE);
-    }
+  const char* max_str = getenv("KPM_TRACE_MAX_MB");
+  kpm_trace.max_bytes = (uint64_t)(max_str ? atoi(max_str) : 1024) << 20;
 
-    printf("database and table initialized successfully.\n");
-}
+  kpm_trace.f = fopen(kpm_trace.path, "wb");
+  if (kpm_trace.f == NULL) {
+    fprintf(stderr, "[TRACE]: cannot create %s: %s\n", kpm_trace.path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(kpm_trace.f, NULL, _IOFBF, 1 << 20);
 
-// Function to insert the metrics into the database
-static void insert_to_database() {
-    if (conn == NULL) {
-        fprintf(stderr, "database connection is not initialized.\n");
-        return;
-    }
+  kpm_trace_file_hdr_t const hdr = {
+    .magic = KPM_TRACE_MAGIC,
+    .version = KPM_TRACE_VERSION,
+    .hdr_size = sizeof(kpm_trace_file_hdr_t),
+    .created_us = time_now_us(),
+  };
+  if (fwrite(&hdr, sizeof(hdr), 1, kpm_trace.f) != 1) {
+    fprintf(stderr, "[TRACE]: writing %s failed: %s\n", kpm_trace.path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  kpm_trace.size = sizeof(hdr);
+  printf("[TRACE]: recording the indications to %s, up to %lu MB\n", kpm_trace.path, kpm_trace.max_bytes >> 20);
+}
 
-    // Get the current timestamp
-    time_t now = time(NULL);
+static
+void close_kpm_trace(void)
+{
+  if (kpm_trace.f != NULL) {
+    if (fclose(kpm_trace.f) != 0)
+      fprintf(stderr, "[TRACE]: closing %s failed: %s\n", kpm_trace.path, strerror(errno));
+    kpm_trace.f = NULL;
+    printf("[TRACE]: %lu records, %lu bytes in %s\n", kpm_trace.records, kpm_trace.size, kpm_trace.path);
+  }
 
-    // Construct the SQL query
-    char query[1024];
-    snprintf(query, sizeof(query),
-            "INSERT INTO xapp_kpi_metrics (rru_prb_tot_dl, rru_prb_tot_ul, drb_pdcp_sdu_volume_dl, "
-            "drb_pdcp_sdu_volume_ul, drb_rlc_sdu_delay_dl, drb_ue_thp_dl, drb_ue_thp_ul, "
-            "amf_ue_ngap_id, ran_ue_id, timestamp) "
-            "VALUES (%.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %lu, %lu, %ld);",
-            kpi_metrics.rru_prb_tot_dl, kpi_metrics.rru_prb_tot_ul,
-            kpi_metrics.drb_pdcp_sdu_volume_dl, kpi_metrics.drb_pdcp_sdu_volume_ul,
-            kpi_metrics.drb_rlc_sdu_delay_dl, kpi_metrics.drb_ue_thp_dl, kpi_metrics.drb_ue_thp_ul,
-            kpi_metrics.amf_ue_ngap_id, kpi_metrics.ran_ue_id, now);
-
-    // Execute the query
-    if (mysql_query(conn, query)) {
-        fprintf(stderr, "insert failed: %s\n", mysql_error(conn));
-    } else {
-        printf("metrics inserted successfully.\n");
-    }
+  free(kpm_trace.buf);
+  kpm_trace.buf = NULL;
+  kpm_trace.cap = 0;
 }
 
-// Function to close the MySQL connection
-static void close_database() {
-    if (conn != NULL) {
-        mysql_close(conn);
-        printf("database connection closed.\n");
-    }
+static
+void put_trace(void const* src, size_t n)
+{
+  kpm_trace_t* t = &kpm_trace;
+  if (t->len + n > t->cap) {
+    size_t cap = t->cap == 0 ? 4096 : t->cap;
+    while (cap < t->len + n)
+      cap <<= 1;
+    t->buf = realloc(t->buf, cap);
+    assert(t->buf != NULL && "Memory exhausted");
+    t->cap = cap;
+  }
+  memcpy(t->buf + t->len, src, n);
+  t->len += n;
 }
 
-// ======================================== MySql Functions ========================================
+#define PUT_TRACE(type, val) \
+  do { type const v_ = (type)(val); put_trace(&v_, sizeof(v_)); } while (0)
 
+// Append the record staged in kpm_trace.buf. Recording stops at KPM_TRACE_MAX_MB or on the first
+// failed write, so that a trace never has a hole.
 static
-void log_gnb_ue_id(ue_id_e2sm_t ue_id)
+void write_trace_rec(kpm_trace_rec_e type, size_t sub, int64_t recv_us)
 {
-  if (ue_id.gnb.gnb_cu_ue_f1ap_lst != NULL) {
-    for (size_t i = 0; i < ue_id.gnb.gnb_cu_ue_f1ap_lst_len; i++) {
-      printf("UE ID type = gNB-CU, gnb_cu_ue_f1ap = %u\n", ue_id.gnb.gnb_cu_ue_f1ap_lst[i]);
-    }
-  } else {
-    printf("UE ID type = gNB, amf_ue_ngap_id = %lu\n", ue_id.gnb.amf_ue_ngap_id);
-    kpi_metrics.amf_ue_ngap_id = ue_id.gnb.amf_ue_ngap_id;
+  kpm_trace_t* t = &kpm_trace;
+  kpm_trace_rec_hdr_t const hdr = {.len = (uint32_t)t->len, .type = (uint8_t)type, .sub = (uint16_t)sub, .recv_us = recv_us};
+
+  if (t->size + sizeof(hdr) + t->len > t->max_bytes) {
+    printf("[TRACE]: %s reached KPM_TRACE_MAX_MB, recording stopped\n", t->path);
+    close_kpm_trace();
+    return;
   }
-  if (ue_id.gnb.ran_ue_id != NULL) {
-    printf("ran_ue_id = %lx\n", *ue_id.gnb.ran_ue_id); // RAN UE NGAP ID
-    kpi_metrics.ran_ue_id = *ue_id.gnb.ran_ue_id;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, t->f) != 1 || fwrite(t->buf, 1, t->len, t->f) != t->len) {
+    fprintf(stderr, "[TRACE]: writing %s failed: %s, recording stopped\n", t->path, strerror(errno));
+    close_kpm_trace();
+    return;
   }
+  t->size += sizeof(hdr) + t->len;
+  t->records++;
 }
 
+// Declare the context of a new subscription, before its first indication
 static
-void log_du_ue_id(ue_id_e2sm_t ue_id)
+void write_trace_sub(size_t idx)
 {
-  printf("UE ID type = gNB-DU, gnb_cu_ue_f1ap = %u\n", ue_id.gnb_du.gnb_cu_ue_f1ap);
-  if (ue_id.gnb_du.ran_ue_id != NULL) {
-    printf("ran_ue_id = %lx\n", *ue_id.gnb_du.ran_ue_id); // RAN UE NGAP ID
-  }
+  lock_guard(&kpm_trace.mtx);
+  if (kpm_trace.f == NULL)
+    return;
+
+  kpm_sub_ctx_t const* ctx = &kpm_sub_ctx[idx];
+  kpm_trace_sub_t const sub = {
+    .nb_id = ctx->nb_id,
+    .sd = ctx->sd,
+    .report_period_ms = ctx->slice->report_period_ms,
+    .gran_period_ms = ctx->slice->gran_period_ms,
+    .sst = ctx->sst,
+  };
+  kpm_trace.len = 0;
+  put_trace(&sub, sizeof(sub));
+  write_trace_rec(KPM_TRACE_SUB, idx, time_now_us());
 }
 
 static
-void log_cuup_ue_id(ue_id_e2sm_t ue_id)
+void put_trace_info(kpm_ind_msg_format_1_t const* frm_1)
 {
-  printf("UE ID type = gNB-CU-UP, gnb_cu_cp_ue_e1ap = %u\n", ue_id.gnb_cu_up.gnb_cu_cp_ue_e1ap);
-  if (ue_id.gnb_cu_up.ran_ue_id != NULL) {
-    printf("ran_ue_id = %lx\n", *ue_id.gnb_cu_up.ran_ue_id); // RAN UE NGAP ID
+  PUT_TRACE(uint16_t, frm_1->meas_info_lst_len);
+  for (size_t z = 0; z < frm_1->meas_info_lst_len; z++) {
+    meas_type_t const* meas_type = &frm_1->meas_info_lst[z].meas_type;
+    PUT_TRACE(uint8_t, meas_type->type);
+    if (meas_type->type == NAME_MEAS_TYPE) {
+      size_t const len = meas_type->name.len < UINT8_MAX ? meas_type->name.len : UINT8_MAX;
+      PUT_TRACE(uint8_t, len);
+      put_trace(meas_type->name.buf, len);
+    } else {
+      PUT_TRACE(uint16_t, meas_type->id);
+    }
   }
 }
 
-typedef void (*log_ue_id)(ue_id_e2sm_t ue_id);
+static
+bool eq_trace_info(kpm_ind_msg_format_1_t const* a, kpm_ind_msg_format_1_t const* b)
+{
+  if (a->meas_info_lst_len != b->meas_info_lst_len)
+    return false;
+
+  for (size_t z = 0; z < a->meas_info_lst_len; z++) {
+    meas_type_t const* x = &a->meas_info_lst[z].meas_type;
+    meas_type_t const* y = &b->meas_info_lst[z].meas_type;
+    if (x->type != y->type)
+      return false;
+    if (x->type == NAME_MEAS_TYPE && (x->name.len != y->name.len || memcmp(x->name.buf, y->name.buf, x->name.len) != 0))
+      return false;
+    if (x->type != NAME_MEAS_TYPE && x->id != y->id)
+      return false;
+  }
+  return true;
+}
 
+// Called with the shard lock held, so that the records of a shard are in the order sm_cb_kpm
+// processed them
 static
-log_ue_id log_ue_id_e2sm[END_UE_ID_E2SM] = {
-    log_gnb_ue_id, // common for gNB-mono, CU and CU-CP
-    log_du_ue_id,
-    log_cuup_ue_id,
-    NULL,
-    NULL,
-    NULL,
-    NULL,
-};
+void write_trace_ind(kpm_sub_ctx_t const* ctx, kpm_ind_data_t const* ind, int64_t recv_us)
+{
+  // Without recording, the shards do not meet here
+  if (kpm_trace.path[0] == '\0')
+    return;
 
-// Update the metric values based on the measurement type and value
-static void update_metrics(byte_array_t name, meas_record_lst_t meas_record) {
-  if (cmp_str_ba("RRU.PrbTotDl", name) == 0) {
-    kpi_metrics.rru_prb_tot_dl = (double)meas_record.int_val;
+  lock_guard(&kpm_trace.mtx);
+  if (kpm_trace.f == NULL)
+    return;
 
-  } else if (cmp_str_ba("RRU.PrbTotUl", name) == 0) {
-    kpi_metrics.rru_prb_tot_ul = (double)meas_record.int_val;
+  kpm_ind_msg_format_3_t const* msg_frm_3 = &ind->msg.frm_3;
+  size_t const len = msg_frm_3->ue_meas_report_lst_len;
 
-  } else if (cmp_str_ba("DRB.PdcpSduVolumeDL", name) == 0) {
-    kpi_metrics.drb_pdcp_sdu_volume_dl = (double)meas_record.int_val;
+  kpm_trace.len = 0;
+  PUT_TRACE(uint64_t, ind->hdr.kpm_ric_ind_hdr_format_1.collectStartTime);
+  PUT_TRACE(uint32_t, len);
 
-  } else if (cmp_str_ba("DRB.PdcpSduVolumeUL", name) == 0) {
-    kpi_metrics.drb_pdcp_sdu_volume_ul = (double)meas_record.int_val;
+  // The UEs of a subscription report the same measurements, whose names are written once
+  kpm_ind_msg_format_1_t const empty = {0};
+  kpm_ind_msg_format_1_t const* info = len > 0 ? &msg_frm_3->meas_report_per_ue[0].ind_msg_format_1 : &empty;
+  put_trace_info(info);
 
-  } else if (cmp_str_ba("DRB.RlcSduDelayDl", name) == 0) {
-    kpi_metrics.drb_rlc_sdu_delay_dl = meas_record.real_val;
+  for (size_t i = 0; i < len; i++) {
+    ue_id_e2sm_t const* ue_id = &msg_frm_3->meas_report_per_ue[i].ue_meas_report_lst;
+    kpm_ind_msg_format_1_t const* frm_1 = &msg_frm_3->meas_report_per_ue[i].ind_msg_format_1;
 
-  } else if (cmp_str_ba("DRB.UEThpDl", name) == 0) {
-    kpi_metrics.drb_ue_thp_dl = meas_record.real_val;
+    uint64_t const* ran_ue_id = NULL;
+    if (ue_id->type == GNB_UE_ID_E2SM)
+      ran_ue_id = ue_id->gnb.ran_ue_id;
+    else if (ue_id->type == GNB_DU_UE_ID_E2SM)
+      ran_ue_id = ue_id->gnb_du.ran_ue_id;
+    else if (ue_id->type == GNB_CU_UP_UE_ID_E2SM)
+      ran_ue_id = ue_id->gnb_cu_up.ran_ue_id;
+    bool const own_info = !eq_trace_info(frm_1, info);
 
-  } else if (cmp_str_ba("DRB.UEThpUl", name) == 0) {
-    kpi_metrics.drb_ue_thp_ul = meas_record.real_val;
-      
-  } else {
-    printf("Measurement Name not yet supported: %.*s\n", (int)name.len, name.buf);
+    PUT_TRACE(uint8_t, ue_id->type);
+    PUT_TRACE(uint8_t, (ran_ue_id != NULL ? KPM_TRACE_UE_RAN_UE_ID : 0) | (own_info ? KPM_TRACE_UE_OWN_INFO : 0));
+    if (ue_id->type == GNB_UE_ID_E2SM) {
+      size_t const f1ap_len = ue_id->gnb.gnb_cu_ue_f1ap_lst != NULL ? ue_id->gnb.gnb_cu_ue_f1ap_lst_len : 0;
+      PUT_TRACE(uint64_t, ue_id->gnb.amf_ue_ngap_id);
+      PUT_TRACE(uint16_t, f1ap_len);
+      for (size_t j = 0; j < f1ap_len; j++)
+        PUT_TRACE(uint32_t, ue_id->gnb.gnb_cu_ue_f1ap_lst[j]);
+    } else if (ue_id->type == GNB_DU_UE_ID_E2SM) {
+      PUT_TRACE(uint32_t, ue_id->gnb_du.gnb_cu_ue_f1ap);
+    } else if (ue_id->type == GNB_CU_UP_UE_ID_E2SM) {
+      PUT_TRACE(uint32_t, ue_id->gnb_cu_up.gnb_cu_cp_ue_e1ap);
+    }
+    if (ran_ue_id != NULL)
+      PUT_TRACE(uint64_t, *ran_ue_id);
+    if (own_info)
+      put_trace_info(frm_1);
+
+    PUT_TRACE(uint16_t, frm_1->meas_data_lst_len);
+    for (size_t j = 0; j < frm_1->meas_data_lst_len; j++) {
+      meas_data_lst_t const* data_item = &frm_1->meas_data_lst[j];
+      PUT_TRACE(uint8_t, data_item->incomplete_flag != NULL);
+      PUT_TRACE(uint16_t, data_item->meas_record_len);
+      for (size_t z = 0; z < data_item->meas_record_len; z++) {
+        meas_record_lst_t const* r = &data_item->meas_record_lst[z];
+        PUT_TRACE(uint8_t, r->value);
+        if (r->value == INTEGER_MEAS_VALUE)
+          PUT_TRACE(uint32_t, r->int_val);
+        else if (r->value == REAL_MEAS_VALUE)
+          PUT_TRACE(double, r->real_val);
+      }
+    }
   }
+
+  write_trace_rec(KPM_TRACE_IND, (size_t)(ctx - kpm_sub_ctx), recv_us);
 }
 
+// A replayed indication lives in arrays reused from one record to the next; names point
+// into the record itself
+typedef struct {
+  size_t ue;
+  size_t info;
+  size_t data;
+  size_t rec;
+  size_t u32;
+  size_t u64;
+} trace_ind_len_t;
+
+typedef struct {
+  trace_ind_len_t len;  // Needed by the current record
+  trace_ind_len_t cap;
+  meas_report_per_ue_t* ue;
+  meas_info_format_1_lst_t* info;
+  meas_data_lst_t* data;
+  meas_record_lst_t* rec;
+  uint32_t* u32;
+  uint64_t* u64;
+} trace_ind_buf_t;
+
+typedef struct {
+  uint8_t const* p;
+  uint8_t const* end;
+} trace_cur_t;
+
+static enum_value_e trace_incomplete = TRUE_ENUM_VALUE;
+
 static
-void log_int_value(byte_array_t name, meas_record_lst_t meas_record)
+bool get_trace(trace_cur_t* c, void* dst, size_t n)
 {
-  update_metrics(name, meas_record);
+  if ((size_t)(c->end - c->p) < n)
+    return false;
+  memcpy(dst, c->p, n);
+  c->p += n;
+  return true;
 }
 
+// Without out, the walks below only check the payload and count the array entries it needs;
+// with out, they fill the entries reserved from those counts
 static
-void log_real_value(byte_array_t name, meas_record_lst_t meas_record)
+bool walk_trace_info(trace_cur_t* c, trace_ind_buf_t* b, trace_ind_len_t* n, kpm_ind_msg_format_1_t* out)
 {
-  update_metrics(name, meas_record);
-}
+  uint16_t len = 0;
+  if (!get_trace(c, &len, sizeof(len)))
+    return false;
 
-typedef void (*log_meas_value)(byte_array_t name, meas_record_lst_t meas_record);
+  size_t const first = n->info;
+  n->info += len;
+  if (out != NULL) {
+    out->meas_info_lst_len = len;
+    out->meas_info_lst = len > 0 ? &b->info[first] : NULL;
+  }
+
+  for (size_t z = 0; z < len; z++) {
+    meas_info_format_1_lst_t info = {0};
+    uint8_t type = 0;
+    if (!get_trace(c, &type, sizeof(type)))
+      return false;
+
+    if (type == NAME_MEAS_TYPE) {
+      uint8_t name_len = 0;
+      if (!get_trace(c, &name_len, sizeof(name_len)) || (size_t)(c->end - c->p) < name_len)
+        return false;
+      info.meas_type.type = NAME_MEAS_TYPE;
+      info.meas_type.name.len = name_len;
+      info.meas_type.name.buf = (uint8_t*)c->p;
+      c->p += name_len;
+    } else if (type == ID_MEAS_TYPE) {
+      info.meas_type.type = ID_MEAS_TYPE;
+      if (!get_trace(c, &info.meas_type.id, sizeof(uint16_t)))
+        return false;
+    } else {
+      return false;
+    }
+
+    if (out != NULL)
+      b->info[first + z] = info;
+  }
+  return true;
+}
 
 static
-log_meas_value get_meas_value[END_MEAS_VALUE] = {
-  log_int_value,
-  log_real_value,
-  NULL,
-};
+bool walk_trace_ue(trace_cur_t* c, trace_ind_buf_t* b, trace_ind_len_t* n, kpm_ind_msg_format_1_t const* info, meas_report_per_ue_t* out)
+{
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  if (!get_trace(c, &type, sizeof(type)) || !get_trace(c, &flags, sizeof(flags)))
+    return false;
+
+  ue_id_e2sm_t ue_id = {.type = (ue_id_e2sm_e)type};
+  uint64_t** ran_ue_id = NULL;
+  if (type == GNB_UE_ID_E2SM) {
+    uint16_t f1ap_len = 0;
+    if (!get_trace(c, &ue_id.gnb.amf_ue_ngap_id, sizeof(uint64_t)) || !get_trace(c, &f1ap_len, sizeof(f1ap_len)))
+      return false;
+    size_t const first = n->u32;
+    n->u32 += f1ap_len;
+    for (size_t j = 0; j < f1ap_len; j++) {
+      uint32_t v = 0;
+      if (!get_trace(c, &v, sizeof(v)))
+        return false;
+      if (out != NULL)
+        b->u32[first + j] = v;
+    }
+    if (out != NULL && f1ap_len > 0) {
+      ue_id.gnb.gnb_cu_ue_f1ap_lst = &b->u32[first];
+      ue_id.gnb.gnb_cu_ue_f1ap_lst_len = f1ap_len;
+    }
+    ran_ue_id = &ue_id.gnb.ran_ue_id;
+  } else if (type == GNB_DU_UE_ID_E2SM) {
+    if (!get_trace(c, &ue_id.gnb_du.gnb_cu_ue_f1ap, sizeof(uint32_t)))
+      return false;
+    ran_ue_id = &ue_id.gnb_du.ran_ue_id;
+  } else if (type == GNB_CU_UP_UE_ID_E2SM) {
+    if (!get_trace(c, &ue_id.gnb_cu_up.gnb_cu_cp_ue_e1ap, sizeof(uint32_t)))
+      return false;
+    ran_ue_id = &ue_id.gnb_cu_up.ran_ue_id;
+  } else {
+    return false;
+  }
+
+  if (flags & KPM_TRACE_UE_RAN_UE_ID) {
+    size_t const idx = n->u64++;
+    uint64_t v = 0;
+    if (!get_trace(c, &v, sizeof(v)))
+      return false;
+    if (out != NULL) {
+      b->u64[idx] = v;
+      *ran_ue_id = &b->u64[idx];
+    }
+  }
+
+  kpm_ind_msg_format_1_t frm_1 = {0};
+  if (flags & KPM_TRACE_UE_OWN_INFO) {
+    if (!walk_trace_info(c, b, n, out != NULL ? &frm_1 : NULL))
+      return false;
+  } else if (out != NULL) {
+    frm_1.meas_info_lst_len = info->meas_info_lst_len;
+    frm_1.meas_info_lst = info->meas_info_lst;
+  }
+
+  uint16_t data_len = 0;
+  if (!get_trace(c, &data_len, sizeof(data_len)))
+    return false;
+  size_t const first_data = n->data;
+  n->data += data_len;
+
+  for (size_t j = 0; j < data_len; j++) {
+    uint8_t incomplete = 0;
+    uint16_t rec_len = 0;
+    if (!get_trace(c, &incomplete, sizeof(incomplete)) || !get_trace(c, &rec_len, sizeof(rec_len)))
+      return false;
+    size_t const first_rec = n->rec;
+    n->rec += rec_len;
+
+    for (size_t z = 0; z < rec_len; z++) {
+      meas_record_lst_t r = {0};
+      uint8_t value = 0;
+      if (!get_trace(c, &value, sizeof(value)))
+        return false;
+      r.value = (meas_value_e)value;
+      if (value == INTEGER_MEAS_VALUE) {
+        if (!get_trace(c, &r.int_val, sizeof(uint32_t)))
+          return false;
+      } else if (value == REAL_MEAS_VALUE) {
+        if (!get_trace(c, &r.real_val, sizeof(double)))
+          return false;
+      } else if (value != NO_VALUE_MEAS_VALUE) {
+        return false;
+      }
+      if (out != NULL)
+        b->rec[first_rec + z] = r;
+    }
+
+    if (out != NULL) {
+      b->data[first_data + j] = (meas_data_lst_t){
+        .meas_record_len = rec_len,
+        .meas_record_lst = rec_len > 0 ? &b->rec[first_rec] : NULL,
+        .incomplete_flag = incomplete ? &trace_incomplete : NULL,
+      };
+    }
+  }
+
+  if (out != NULL) {
+    frm_1.meas_data_lst_len = data_len;
+    frm_1.meas_data_lst = data_len > 0 ? &b->data[first_data] : NULL;
+    *out = (meas_report_per_ue_t){.ue_meas_report_lst = ue_id, .ind_msg_format_1 = frm_1};
+  }
+  return true;
+}
 
 static
-void match_meas_name_type(meas_type_t meas_type, meas_record_lst_t meas_record)
+bool walk_trace_ind(trace_cur_t c, trace_ind_buf_t* b, kpm_ind_data_t* out)
 {
-  // Get the value of the Measurement
-  get_meas_value[meas_record.value](meas_type.name, meas_record);
+  trace_ind_len_t n = {0};
+  uint64_t collect_start = 0;
+  uint32_t len = 0;
+  if (!get_trace(&c, &collect_start, sizeof(collect_start)) || !get_trace(&c, &len, sizeof(len)))
+    return false;
+  n.ue = len;
+
+  kpm_ind_msg_format_1_t info = {0};
+  if (!walk_trace_info(&c, b, &n, out != NULL ? &info : NULL))
+    return false;
+
+  for (size_t i = 0; i < len; i++) {
+    if (!walk_trace_ue(&c, b, &n, &info, out != NULL ? &b->ue[i] : NULL))
+      return false;
+  }
+  if (c.p != c.end)
+    return false;
+
+  if (out == NULL) {
+    b->len = n;
+    return true;
+  }
+
+  memset(out, 0, sizeof(*out));
+  out->hdr.type = FORMAT_1_INDICATION_HEADER;
+  out->hdr.kpm_ric_ind_hdr_format_1.collectStartTime = collect_start;
+  out->msg.type = FORMAT_3_INDICATION_MESSAGE;
+  out->msg.frm_3.ue_meas_report_lst_len = len;
+  out->msg.frm_3.meas_report_per_ue = len > 0 ? b->ue : NULL;
+  return true;
 }
 
 static
-void match_id_meas_type(meas_type_t meas_type, meas_record_lst_t meas_record)
+void reserve_trace_ind(trace_ind_buf_t* b)
 {
-  (void)meas_type;
-  (void)meas_record;
-  assert(false && "ID Measurement Type not yet supported");
+#define RESERVE_TRACE_ARR(arr) \
+  do { \
+    if (b->len.arr > b->cap.arr) { \
+      b->arr = realloc(b->arr, b->len.arr * sizeof(b->arr[0])); \
+      assert(b->arr != NULL && "Memory exhausted"); \
+      b->cap.arr = b->len.arr; \
+    } \
+  } while (0)
+
+  RESERVE_TRACE_ARR(ue);
+  RESERVE_TRACE_ARR(info);
+  RESERVE_TRACE_ARR(data);
+  RESERVE_TRACE_ARR(rec);
+  RESERVE_TRACE_ARR(u32);
+  RESERVE_TRACE_ARR(u64);
+#undef RESERVE_TRACE_ARR
 }
 
-typedef void (*check_meas_type)(meas_type_t meas_type, meas_record_lst_t meas_record);
+static
+void free_trace_ind(trace_ind_buf_t* b)
+{
+  free(b->ue);
+  free(b->info);
+  free(b->data);
+  free(b->rec);
+  free(b->u32);
+  free(b->u64);
+  memset(b, 0, sizeof(*b));
+}
 
+// Context of a recorded subscription: its slice must be one of KPM_SLICES, and its E2 node
+// is numbered in order of appearance, as the live xApp numbers the connected nodes
 static
-check_meas_type match_meas_type[END_MEAS_TYPE] = {
-  match_meas_name_type,
-  match_id_meas_type,
-};
+size_t add_replay_sub_ctx(kpm_trace_sub_t const* sub)
+{
+  kpm_slice_cfg_t const* slice = NULL;
+  for (size_t s = 0; s < kpm_cfg.slice_len && slice == NULL; s++) {
+    int const* nssai = kpm_cfg.slice[s].nssai;
+    uint32_t const sd = (uint32_t)nssai[1] << 16 | (uint32_t)nssai[2] << 8 | (uint32_t)nssai[3];
+    if (nssai[0] == sub->sst && sd == sub->sd)
+      slice = &kpm_cfg.slice[s];
+  }
+  if (slice == NULL) {
+    fprintf(stderr, "[REPLAY]: the trace reports slice sst = %u sd = %06x, which is not in KPM_SLICES\n", sub->sst, sub->sd);
+    exit(EXIT_FAILURE);
+  }
+  if (kpm_sub_ctx_len == MAX_KPM_SUBS) {
+    fprintf(stderr, "[REPLAY]: the trace declares more than %d subscriptions (MAX_KPM_SUBS)\n", MAX_KPM_SUBS);
+    exit(EXIT_FAILURE);
+  }
+  if (slice->report_period_ms != sub->report_period_ms)
+    printf("[REPLAY]: slice sst = %u sd = %06x was recorded with a %u ms report period, KPM_SLICES sets %u ms\n",
+           sub->sst, sub->sd, sub->report_period_ms, slice->report_period_ms);
 
+  size_t node_idx = SIZE_MAX;
+  size_t nodes = 0;
+  for (size_t i = 0; i < kpm_sub_ctx_len; i++) {
+    if (kpm_sub_ctx[i].nb_id == sub->nb_id)
+      node_idx = kpm_sub_ctx[i].node_idx;
+    if (kpm_sub_ctx[i].node_idx + 1 > nodes)
+      nodes = kpm_sub_ctx[i].node_idx + 1;
+  }
+  return add_kpm_sub_ctx(node_idx != SIZE_MAX ? node_idx : nodes, sub->nb_id, slice);
+}
+
+// Feed KPM_REPLAY through sm_cb_kpm() until its end or SIGINT / SIGTERM, then drain the sinks
 static
-void log_kpm_measurements(kpm_ind_msg_format_1_t const* msg_frm_1)
+void replay_kpm_trace(void)
 {
-  assert(msg_frm_1->meas_info_lst_len > 0 && "Cannot correctly print measurements");
+  kpm_trace_t* t = &kpm_trace;
+  FILE* f = fopen(t->replay, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "[REPLAY]: cannot open %s: %s\n", t->replay, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
 
-  // Process measurements
-  for (size_t j = 0; j < msg_frm_1->meas_data_lst_len; j++) {
-    meas_data_lst_t const data_item = msg_frm_1->meas_data_lst[j];
+  kpm_trace_file_hdr_t hdr = {0};
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != KPM_TRACE_MAGIC || hdr.version != KPM_TRACE_VERSION
+      || fseek(f, hdr.hdr_size, SEEK_SET) != 0) {
+    fprintf(stderr, "[REPLAY]: %s is not a version %d KPM trace\n", t->replay, KPM_TRACE_VERSION);
+    exit(EXIT_FAILURE);
+  }
+  printf("[REPLAY]: %s at %s\n", t->replay, t->speed > 0 ? "the recorded pace" : "full speed");
+  if (t->speed > 0 && t->speed != 1.0)
+    printf("[REPLAY]: pace scaled by %.2f\n", t->speed);
 
-    for (size_t z = 0; z < data_item.meas_record_len; z++) {
-      meas_type_t const meas_type = msg_frm_1->meas_info_lst[z].meas_type;
-      meas_record_lst_t const record_item = data_item.meas_record_lst[z];
+  // Recorded subscription -> context of this run
+  size_t sub_ctx[MAX_KPM_SUBS];
+  for (size_t i = 0; i < MAX_KPM_SUBS; i++)
+    sub_ctx[i] = SIZE_MAX;
 
-      match_meas_type[meas_type.type](meas_type, record_item);
+  trace_ind_buf_t b = {0};
+  uint8_t* payload = NULL;
+  size_t payload_cap = 0;
 
-      if (data_item.incomplete_flag && *data_item.incomplete_flag == TRUE_ENUM_VALUE) {
-        printf("Measurement Record not reliable\n");
-      }
+  sm_ag_if_rd_t rd = {.type = INDICATION_MSG_AGENT_IF_ANS_V0};
+  rd.ind.type = KPM_STATS_V3_0;
+
+  uint64_t inds = 0;
+  uint64_t ue_reports = 0;
+  uint64_t skipped = 0;
+  int64_t first_recv_us = 0;
+  int64_t const start = time_now_us();
+
+  kpm_trace_rec_hdr_t rec = {0};
+  while (!sig_recv && fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (rec.len > payload_cap) {
+      payload = realloc(payload, rec.len);
+      assert(payload != NULL && "Memory exhausted");
+      payload_cap = rec.len;
+    }
+    if (fread(payload, 1, rec.len, f) != rec.len) {
+      printf("[REPLAY]: partial record at the end of %s\n", t->replay);
+      break;
+    }
+    trace_cur_t const c = {.p = payload, .end = payload + rec.len};
+
+    if (rec.type == KPM_TRACE_SUB) {
+      kpm_trace_sub_t sub = {0};
+      trace_cur_t sub_cur = c;
+      if (rec.sub < MAX_KPM_SUBS && get_trace(&sub_cur, &sub, sizeof(sub)))
+        sub_ctx[rec.sub] = add_replay_sub_ctx(&sub);
+      else
+        skipped++;
+      continue;
+    }
+
+    if (rec.type != KPM_TRACE_IND || rec.sub >= MAX_KPM_SUBS || sub_ctx[rec.sub] == SIZE_MAX || !walk_trace_ind(c, &b, NULL)) {
+      skipped++;
+      continue;
     }
+    reserve_trace_ind(&b);
+    walk_trace_ind(c, &b, &rd.ind.kpm.ind);
+
+    if (inds == 0)
+      first_recv_us = rec.recv_us;
+    if (t->speed > 0) {
+      int64_t const due = start + (int64_t)((rec.recv_us - first_recv_us) / t->speed);
+      for (int64_t wait = due - time_now_us(); wait > 0 && !sig_recv; wait = due - time_now_us())
+        usleep(wait < 100000 ? (useconds_t)wait : 100000);
+    }
+
+    t->now_us = rec.recv_us;
+    sm_cb_kpm(&rd, &kpm_sub_ctx[sub_ctx[rec.sub]]);
+    inds++;
+    ue_reports += rd.ind.kpm.ind.msg.frm_3.ue_meas_report_lst_len;
+  }
+  int64_t const fed = time_now_us();
+
+  // The rows are stored once db_writer_thread drained the ring
+  close_sinks();
+  int64_t const end = time_now_us();
+  double const elapsed = (end - start) / 1e6;
+
+  printf("[REPLAY]: %lu indications and %lu UE reports in %.3f s (last rows stored %.3f s after the last indication): "
+         "%.1f indications/s, %.1f UE reports/s\n", inds, ue_reports, elapsed, (end - fed) / 1e6,
+         elapsed > 0 ? inds / elapsed : 0.0, elapsed > 0 ? ue_reports / elapsed : 0.0);
+  for (size_t i = 0; i < END_KPM_SINK; i++) {
+    uint64_t const rows = atomic_load(&kpm_metrics.sink_rows[i]);
+    if (rows > 0)
+      printf("[REPLAY]: %s sink %lu rows, %.1f rows/s\n", kpm_sink_name[i], rows, elapsed > 0 ? rows / elapsed : 0.0);
   }
-  // Insert the metrics into the database after processing all measurements
-  insert_to_database();
+  if (skipped > 0)
+    printf("[REPLAY]: %lu malformed or unknown records skipped\n", skipped);
+  report_kpm_latency();
+
+  free(payload);
+  free_trace_ind(&b);
+  fclose(f);
 }
 
+// ======================================== Indication Trace ========================================
+
 static
-void sm_cb_kpm(sm_ag_if_rd_t const* rd)
+void sm_cb_kpm(sm_ag_if_rd_t const* rd, kpm_sub_ctx_t* ctx)
 {
   assert(rd != NULL);
+  assert(ctx != NULL);
   assert(rd->type == INDICATION_MSG_AGENT_IF_ANS_V0);
   assert(rd->ind.type == KPM_STATS_V3_0);
 
@@ -329,25 +4720,86 @@ void sm_cb_kpm(sm_ag_if_rd_t const* rd)
   kpm_ric_ind_hdr_format_1_t const* hdr_frm_1 = &ind->hdr.kpm_ric_ind_hdr_format_1;
   kpm_ind_msg_format_3_t const* msg_frm_3 = &ind->msg.frm_3;
 
-  int64_t const now = time_now_us();
-  static int counter = 1;
+  // A replay runs on the recorded reception times
+  int64_t const now = kpm_trace.replay != NULL ? kpm_trace.now_us : time_now_us();
+  // Windows run on the E2 node clock, so a replayed trace aggregates the same way
+  int64_t const ind_ts = (int64_t)hdr_frm_1->collectStartTime;
+
+  // Everything below only touches the shard of the subscription, and the records of its UEs
+  // and its slice
+  kpm_shard_t* sh = &kpm_shard[ctx->shard];
+
+  kpm_hist_record(&kpm_metrics.e2_latency[ctx->shard], (now - ind_ts) * 1000);
+  kpm_hist_record(&ctx->e2_latency, (now - ind_ts) * 1000);
+  atomic_fetch_add_explicit(&ctx->indications, 1, memory_order_relaxed);
+
+  int64_t const wait_start = mono_now_ns();
   {
-    lock_guard(&mtx);
+    lock_guard(&sh->mtx);
+    int64_t const locked = mono_now_ns();
+    kpm_hist_record(&kpm_metrics.lock_wait[ctx->shard], locked - wait_start);
 
-    printf("\n%7d KPM ind_msg latency = %ld [μs]\n", counter, now - hdr_frm_1->collectStartTime); // xApp <-> E2 Node
+    // UEs of the slowest slice must not expire between two of its reports
+    if (tick_ue_table(&sh->ue_table, now, (uint64_t)kpm_cfg.max_report_period_ms * 1000) > 0)
+      release_ue_shm(&kpm_shm, sh);
 
     // Reported list of measurements per UE
-    for (size_t i = 0; i < msg_frm_3->ue_meas_report_lst_len; i++) {
-      // log UE ID
-      ue_id_e2sm_t const ue_id_e2sm = msg_frm_3->meas_report_per_ue[i].ue_meas_report_lst;
-      ue_id_e2sm_e const type = ue_id_e2sm.type;
-      log_ue_id_e2sm[type](ue_id_e2sm);
+    kpm_meas_block_t* b = &sh->block;
+    decode_kpm_ind_frm_3(ctx, msg_frm_3, b);
+    kpm_hist_record(&kpm_metrics.decode[ctx->shard], mono_now_ns() - locked);
+    write_trace_ind(ctx, ind, now);
+    atomic_fetch_add_explicit(&ctx->ue_reports, b->len, memory_order_relaxed);
+
+    // Unique over the shards, ind_seq % KPM_SHARDS is the shard
+    uint64_t const ind_seq = ++sh->ind_seq * kpm_shard_len + ctx->shard;
+
+    kpm_rec_t rec = {0};
+    rec.ts_us = now;
+    rec.collect_us = ind_ts;
+    rec.latency_us = now - ind_ts; // xApp <-> E2 Node
+    rec.ind_seq = (uint32_t)ind_seq;
+    bool pending = false;
+
+    for (size_t i = 0; i < b->len; i++) {
+      ue_key_t const* key = &b->key[i];
+      ue_entry_t* e = upsert_ue_table(&sh->ue_table, key);
+      if (e == NULL) {
+        atomic_fetch_add_explicit(&ctx->ue_dropped, 1, memory_order_relaxed);
+        KPM_LOG(KPM_LOG_WARN, "[UE]: table of shard %zu full (%zu entries), report of amf_ue_ngap_id = %lu dropped\n",
+                ctx->shard, sh->ue_table.cap, key->amf_ue_ngap_id);
+        continue;
+      }
+      size_t const slot = sh->ue_base + (size_t)(e - sh->ue_table.pool);
+      push_ue_agg(&kpm_agg, slot, e, ctx, b, i, ind_ts);
 
-      // log measurements
-      log_kpm_measurements(&msg_frm_3->meas_report_per_ue[i].ind_msg_format_1);
-      
+      // A field the UE does not report stays NULL
+      kpi_metrics_t* m = &e->metrics;
+      uint32_t const present = b->present[i];
+      for (size_t k = 0; k < END_KPM_MEAS; k++)
+        m->meas[k] = (present & (1u << k)) ? b->col[k][i] : 0.0;
+      m->present = present;
+      m->amf_ue_ngap_id = key->amf_ue_ngap_id;
+      m->ran_ue_id = key->ran_ue_id;
+      m->sst = key->sst;
+      m->sd = key->sd;
+      publish_ue_shm(&kpm_shm, slot, m, ind_ts, ind_seq);
+
+      // Hand the previous row over to db_writer_thread, the last one is flagged below
+      if (pending)
+        push_kpm_ring(sh->ring, &rec);
+      rec.metrics = *m;
+      pending = true;
+    }
+    push_slice_agg(&kpm_agg, ctx, b, ind_ts);
+    publish_slice_shm(&kpm_shm, ctx, b, ind_ts, ind_seq);
+    end_shm_update(&kpm_shm);
+
+    if (pending) {
+      // The last row of the indication triggers the flush
+      rec.last_of_ind = true;
+      push_kpm_ring(sh->ring, &rec);
+      notify_db_writer();
     }
-    counter++;
   }
 }
 
@@ -394,26 +4846,47 @@ label_info_lst_t fill_kpm_label(void)
   return label_item;
 }
 
+// True if the E2 node offered measurement is one of KPM_MEASUREMENTS
+static
+bool is_subscribed_meas(byte_array_t name)
+{
+  for (size_t i = 0; i < kpm_cfg.meas_len; i++) {
+    if (cmp_str_ba(kpm_meas_name[kpm_cfg.meas[i]], name) == 0)
+      return true;
+  }
+  return false;
+}
+
 static
-kpm_act_def_format_1_t fill_act_def_frm_1(ric_report_style_item_t const* report_item)
+kpm_act_def_format_1_t fill_act_def_frm_1(ric_report_style_item_t const* report_item, kpm_slice_cfg_t const* slice)
 {
   assert(report_item != NULL);
+  assert(slice != NULL);
 
   kpm_act_def_format_1_t ad_frm_1 = {0};
 
-  size_t const sz = report_item->meas_info_for_action_lst_len;
+  size_t sz = 0;
+  for (size_t i = 0; i < report_item->meas_info_for_action_lst_len; i++) {
+    if (is_subscribed_meas(report_item->meas_info_for_action_lst[i].name))
+      sz++;
+  }
+  assert(sz > 0 && "E2 node offers none of KPM_MEASUREMENTS");
 
   // [1, 65535]
   ad_frm_1.meas_info_lst_len = sz;
   ad_frm_1.meas_info_lst = calloc(sz, sizeof(meas_info_format_1_lst_t));
   assert(ad_frm_1.meas_info_lst != NULL && "Memory exhausted");
 
-  for (size_t i = 0; i < sz; i++) {
-    meas_info_format_1_lst_t* meas_item = &ad_frm_1.meas_info_lst[i];
+  for (size_t i = 0, j = 0; i < report_item->meas_info_for_action_lst_len; i++) {
+    byte_array_t const name = report_item->meas_info_for_action_lst[i].name;
+    if (!is_subscribed_meas(name))
+      continue;
+
+    meas_info_format_1_lst_t* meas_item = &ad_frm_1.meas_info_lst[j++];
     // 8.3.9
     // Measurement Name
     meas_item->meas_type.type = NAME_MEAS_TYPE;
-    meas_item->meas_type.name = copy_byte_array(report_item->meas_info_for_action_lst[i].name);
+    meas_item->meas_type.name = copy_byte_array(name);
 
     // [1, 2147483647]
     // 8.3.11
@@ -423,7 +4896,7 @@ kpm_act_def_format_1_t fill_act_def_frm_1(ric_report_style_item_t const* report_
   }
 
   // 8.3.8 [0, 4294967295]
-  ad_frm_1.gran_period_ms = period_ms;
+  ad_frm_1.gran_period_ms = slice->gran_period_ms;
 
   // 8.3.20 - OPTIONAL
   ad_frm_1.cell_global_id = NULL;
@@ -438,7 +4911,7 @@ kpm_act_def_format_1_t fill_act_def_frm_1(ric_report_style_item_t const* report_
 }
 
 static
-kpm_act_def_t fill_report_style_4(ric_report_style_item_t const* report_item, const int *value)
+kpm_act_def_t fill_report_style_4(ric_report_style_item_t const* report_item, kpm_slice_cfg_t const* slice)
 {
   assert(report_item != NULL);
   assert(report_item->act_def_format_type == FORMAT_4_ACTION_DEFINITION);
@@ -454,16 +4927,16 @@ kpm_act_def_t fill_report_style_4(ric_report_style_item_t const* report_item, co
   test_cond_type_e const type = S_NSSAI_TEST_COND_TYPE; // CQI_TEST_COND_TYPE
   test_cond_e const condition = EQUAL_TEST_COND; // GREATERTHAN_TEST_COND
 
-  act_def.frm_4.matching_cond_lst[0].test_info_lst = filter_predicate(type, condition, value);
+  act_def.frm_4.matching_cond_lst[0].test_info_lst = filter_predicate(type, condition, slice->nssai);
 
   // Fill Action Definition Format 1
   // 8.2.1.2.1
-  act_def.frm_4.action_def_format_1 = fill_act_def_frm_1(report_item);
+  act_def.frm_4.action_def_format_1 = fill_act_def_frm_1(report_item, slice);
 
   return act_def;
 }
 
-typedef kpm_act_def_t (*fill_kpm_act_def)(ric_report_style_item_t const* report_item, const int *value);
+typedef kpm_act_def_t (*fill_kpm_act_def)(ric_report_style_item_t const* report_item, kpm_slice_cfg_t const* slice);
 
 static
 fill_kpm_act_def get_kpm_act_def[END_RIC_SERVICE_REPORT] = {
@@ -475,7 +4948,7 @@ fill_kpm_act_def get_kpm_act_def[END_RIC_SERVICE_REPORT] = {
 };
 
 static
-kpm_sub_data_t gen_kpm_subs(kpm_ran_function_def_t const* ran_func, const int *value)
+kpm_sub_data_t gen_kpm_subs(kpm_ran_function_def_t const* ran_func, kpm_slice_cfg_t const* slice)
 {
   assert(ran_func != NULL);
   assert(ran_func->ric_event_trigger_style_list != NULL);
@@ -485,7 +4958,7 @@ kpm_sub_data_t gen_kpm_subs(kpm_ran_function_def_t const* ran_func, const int *v
   // Generate Event Trigger
   assert(ran_func->ric_event_trigger_style_list[0].format_type == FORMAT_1_RIC_EVENT_TRIGGER);
   kpm_sub.ev_trg_def.type = FORMAT_1_RIC_EVENT_TRIGGER;
-  kpm_sub.ev_trg_def.kpm_ric_event_trigger_format_1.report_period_ms = period_ms;
+  kpm_sub.ev_trg_def.kpm_ric_event_trigger_format_1.report_period_ms = slice->report_period_ms;
 
   // Generate Action Definition
   kpm_sub.sz_ad = 1;
@@ -496,7 +4969,7 @@ kpm_sub_data_t gen_kpm_subs(kpm_ran_function_def_t const* ran_func, const int *v
   // Multiple REPORT Styles = Multiple Action Definition = Multiple SUBSCRIPTION messages
   ric_report_style_item_t* const report_item = &ran_func->ric_report_style_list[0];
   ric_service_report_e const report_style_type = report_item->report_style_type;
-  *kpm_sub.ad = get_kpm_act_def[report_style_type](report_item, value);
+  *kpm_sub.ad = get_kpm_act_def[report_style_type](report_item, slice);
 
   return kpm_sub;
 }
@@ -521,17 +4994,15 @@ size_t find_sm_idx(sm_ran_function_t* rf, size_t sz, bool (*f)(sm_ran_function_t
   assert(0 != 0 && "SM ID could not be found in the RAN Function List");
 }
 
-int main(int argc, char* argv[])
+// The programs in ../bench include this file with KPM_MON_BENCH defined to drive the
+// indication path without a RIC
+#ifndef KPM_MON_BENCH
+// Subscribe to the slices of KPM_SLICES on every E2 node connected at start-up, until SIGINT or SIGTERM
+static
+void run_kpm_mon(fr_args_t* args)
 {
-  // Initialize the database
-  init_database();
-
-  fr_args_t args = init_fr_args(argc, argv);
-  pthread_t thread;
-  sigset_t signal_set;
-
   // Init the xApp
-  init_xapp_api(&args);
+  init_xapp_api(args);
   sleep(1);
 
   e2_node_arr_xapp_t nodes = e2_nodes_xapp_api();
@@ -541,11 +5012,11 @@ int main(int argc, char* argv[])
 
   printf("Connected E2 nodes = %d\n", nodes.len);
 
-  pthread_mutexattr_t attr = {0};
-  int rc = pthread_mutex_init(&mtx, &attr);
-  assert(rc == 0);
+  // Slices from KPM_SLICES, each subscribed with its own periods
+  const size_t num_slices = kpm_cfg.slice_len;
 
-  sm_ans_xapp_t* hndl = calloc(3*nodes.len, sizeof(sm_ans_xapp_t));
+  // One handle per (node, slice) subscription
+  sm_ans_xapp_t* hndl = calloc(num_slices*nodes.len, sizeof(sm_ans_xapp_t));
   assert(hndl != NULL);
 
   ////////////
@@ -561,17 +5032,13 @@ int main(int argc, char* argv[])
     // if REPORT Service is supported by E2 node, send SUBSCRIPTION
     // e.g. OAI CU-CP
     if (n->rf[idx].defn.kpm.ric_report_style_list != NULL) {
-      // Define S-NSSAIs: {sst, sd16, sd8, sd0}
-      const int nassai_list[][4] = {
-        {128, 0x00, 0x00, 0x80},  // sst=128, sd=0x000080
-        {1,   0x00, 0x00, 0x01},  // sst=1,   sd=0x000001
-        {5,   0x00, 0x00, 0x82}   // sst=5,   sd=0x000082
-      };
-      const int num_slices = 3;
-      for (int s = 0; s < num_slices; s++) {
-        kpm_sub_data_t kpm_sub = gen_kpm_subs(&n->rf[idx].defn.kpm, nassai_list[s]);
-        hndl[i] = report_sm_xapp_api(&n->id, KPM_ran_function, &kpm_sub, sm_cb_kpm);
-        assert(hndl[i].success == true);
+      for (size_t s = 0; s < num_slices; s++) {
+        kpm_slice_cfg_t const* slice = &kpm_cfg.slice[s];
+        size_t const ctx = add_kpm_sub_ctx(i, n->id.nb_id.nb_id, slice);
+        write_trace_sub(ctx);
+        kpm_sub_data_t kpm_sub = gen_kpm_subs(&n->rf[idx].defn.kpm, slice);
+        hndl[i*num_slices + s] = report_sm_xapp_api(&n->id, KPM_ran_function, &kpm_sub, kpm_sub_cb[ctx]);
+        assert(hndl[i*num_slices + s].success == true);
         free_kpm_sub_data(&kpm_sub);
       }
     }
@@ -580,19 +5047,11 @@ int main(int argc, char* argv[])
   // END KPM
   ////////////
 
-  // Block SIGINT and SIGTERM in main thread (so only sigwait can handle them)
-  sigemptyset(&signal_set);
-  sigaddset(&signal_set, SIGINT);
-  sigaddset(&signal_set, SIGTERM);
-  pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
-
-  pthread_create(&thread, NULL, signal_handler_thread, NULL);
-
   while(!sig_recv){
     sleep(1);
   }
 
-  for (int i = 0; i < 3*nodes.len; ++i) {
+  for (size_t i = 0; i < num_slices*nodes.len; ++i) {
     // Remove the handle previously returned
     if (hndl[i].success == true)
       rm_report_sm_xapp_api(hndl[i].u.handle);
@@ -602,8 +5061,50 @@ int main(int argc, char* argv[])
   // Stop the xApp
   while (try_stop_xapp_api() == false)
     usleep(1000);
+}
+
+int main(int argc, char* argv[])
+{
+  sigset_t signal_set;
+
+  // Block SIGINT and SIGTERM before any thread starts (so only sigwait can handle them)
+  sigemptyset(&signal_set);
+  sigaddset(&signal_set, SIGINT);
+  sigaddset(&signal_set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
+
+  // Subscription set and, from it, the table columns
+  init_kpm_log();
+  load_kpm_mon_cfg(&kpm_cfg);
+  init_kpm_trace();
+
+  // Indication shards, then the telemetry sinks and the writer thread draining the shards
+  init_kpm_shards();
+  init_sinks();
+  start_db_writer(kpm_shard_len);
 
-  close_database();
+  fr_args_t args = init_fr_args(argc, argv);
+  pthread_t thread;
+  pthread_create(&thread, NULL, signal_handler_thread, NULL);
+
+  init_kpm_agg(&kpm_agg, kpm_shards_ue_cap());
+  start_agg_api();
+  init_kpm_shm(&kpm_shm, kpm_shards_ue_cap());
+
+  // A replay stands in for the RIC and ends with its trace
+  if (kpm_trace.replay != NULL)
+    replay_kpm_trace();
+  else
+    run_kpm_mon(&args);
+
+  close_sinks();
+  close_kpm_trace();
+
+  stop_agg_api();
+  free_kpm_agg(&kpm_agg);
+  close_kpm_shm(&kpm_shm);
+  free_kpm_shards();
 
   printf("Test xApp run SUCCESSFULLY\n");
 }
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Reader of the KPM binary telemetry log (see ../src/kpm_binlog.h).
+//
+//   gcc -O2 -o kpm_binlog_export kpm_binlog_export.c
+//   gcc -O2 -DKPM_BINLOG_ZLIB -o kpm_binlog_export kpm_binlog_export.c -lz   for compressed logs
+//
+//   kpm_binlog_export [--csv] file...          one CSV row per UE sample on stdout, absent
+//                                              measurements as empty cells
+//   kpm_binlog_export --columns dir file...    one raw little endian file per column in dir
+//                                              (<column>.i64/.u64/.u32/.u8/.f64, NaN for absent
+//                                              measurements) plus schema.txt, e.g. for
+//                                              numpy.fromfile()
+//   kpm_binlog_export --info file...           block summary
+//
+// A block cut by a crash, or whose crc does not match, ends the file: it is reported on
+// stderr and the rows before it are still exported. The exit status is 1 only when a file
+// cannot be read at all.
+
+#include "../src/kpm_binlog.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef KPM_BINLOG_ZLIB
+#include <zlib.h>
+#endif
+
+typedef enum {
+  EXPORT_CSV,
+  EXPORT_COLUMNS,
+  EXPORT_INFO,
+} export_mode_e;
+
+// Columns of a decoded block, pointing into the raw payload
+typedef struct {
+  uint32_t rows;
+  uint32_t meas_mask;
+  int64_t const* ts_us;
+  int64_t const* collect_us;
+  uint64_t const* amf_ue_ngap_id;
+  uint64_t const* ran_ue_id;
+  uint32_t const* ind_seq;
+  uint32_t const* sd;
+  uint32_t const* present;
+  uint8_t const* sst;
+  double const* meas[KPM_BINLOG_MAX_MEAS];
+} blk_cols_t;
+
+typedef struct {
+  export_mode_e mode;
+  const char* dir;
+  FILE* col_f[8 + KPM_BINLOG_MAX_MEAS];
+  kpm_binlog_file_hdr_t schema; // Measurement names of the first file, the others must agree
+  bool has_schema;
+  bool csv_header;
+
+  uint8_t* stored;
+  size_t stored_cap;
+  uint8_t* raw;
+  size_t raw_cap;
+
+  uint64_t rows;
+  uint64_t blocks;
+  uint64_t bad_blocks;
+} export_t;
+
+static const char* const key_col_name[8] = {
+  "ts_us", "collect_start_us", "amf_ue_ngap_id", "ran_ue_id", "ind_seq", "sd", "present", "sst",
+};
+
+static const char* const key_col_ext[8] = {
+  "i64", "i64", "u64", "u64", "u32", "u32", "u32", "u8",
+};
+
+static
+void reserve(uint8_t** buf, size_t* cap, size_t len)
+{
+  if (len <= *cap)
+    return;
+  *buf = realloc(*buf, len);
+  assert(*buf != NULL && "Memory exhausted");
+  *cap = len;
+}
+
+static
+void map_block_cols(uint8_t const* p, uint32_t rows, uint32_t meas_mask, blk_cols_t* c)
+{
+  c->rows = rows;
+  c->meas_mask = meas_mask;
+
+#define BLK_GET_COL(col) \
+  do { c->col = (void const*)p; p += (size_t)rows * sizeof(c->col[0]); } while (0)
+
+  BLK_GET_COL(ts_us);
+  BLK_GET_COL(collect_us);
+  BLK_GET_COL(amf_ue_ngap_id);
+  BLK_GET_COL(ran_ue_id);
+  BLK_GET_COL(ind_seq);
+  BLK_GET_COL(sd);
+  BLK_GET_COL(present);
+  BLK_GET_COL(sst);
+#undef BLK_GET_COL
+
+  for (size_t k = 0; k < KPM_BINLOG_MAX_MEAS; k++) {
+    c->meas[k] = NULL;
+    if (meas_mask & (1u << k)) {
+      c->meas[k] = (double const*)p;
+      p += (size_t)rows * sizeof(double);
+    }
+  }
+}
+
+// Read the next block of f; 1 on success, 0 at the end of the file, -1 on a bad block
+static
+int read_block(export_t* ex, FILE* f, const char* path, kpm_binlog_blk_hdr_t* hdr, blk_cols_t* c)
+{
+  size_t const n = fread(hdr, 1, sizeof(*hdr), f);
+  if (n == 0)
+    return 0;
+  if (n != sizeof(*hdr)) {
+    fprintf(stderr, "%s: truncated block header after %" PRIu64 " blocks\n", path, ex->blocks);
+    return -1;
+  }
+
+  if (hdr->magic != KPM_BINLOG_BLK_MAGIC || (hdr->meas_mask >> KPM_BINLOG_MAX_MEAS) != 0
+      || hdr->raw_size != kpm_binlog_raw_size(hdr->rows, hdr->meas_mask)
+      || (hdr->codec == KPM_BINLOG_CODEC_RAW && hdr->stored_size != hdr->raw_size)) {
+    fprintf(stderr, "%s: corrupted block header\n", path);
+    return -1;
+  }
+
+  reserve(&ex->stored, &ex->stored_cap, hdr->stored_size);
+  if (fread(ex->stored, 1, hdr->stored_size, f) != hdr->stored_size) {
+    fprintf(stderr, "%s: truncated block of %u rows, skipped\n", path, hdr->rows);
+    return -1;
+  }
+  if (kpm_binlog_crc32(0, ex->stored, hdr->stored_size) != hdr->crc) {
+    fprintf(stderr, "%s: crc mismatch in block of %u rows\n", path, hdr->rows);
+    return -1;
+  }
+
+  uint8_t const* raw = ex->stored;
+  if (hdr->codec == KPM_BINLOG_CODEC_ZLIB) {
+#ifdef KPM_BINLOG_ZLIB
+    reserve(&ex->raw, &ex->raw_cap, hdr->raw_size);
+    uLongf len = hdr->raw_size;
+    if (uncompress(ex->raw, &len, ex->stored, hdr->stored_size) != Z_OK || len != hdr->raw_size) {
+      fprintf(stderr, "%s: cannot inflate block of %u rows\n", path, hdr->rows);
+      return -1;
+    }
+    raw = ex->raw;
+#else
+    fprintf(stderr, "%s: compressed block, rebuild with -DKPM_BINLOG_ZLIB -lz\n", path);
+    return -1;
+#endif
+  } else if (hdr->codec != KPM_BINLOG_CODEC_RAW) {
+    fprintf(stderr, "%s: unknown codec %u\n", path, hdr->codec);
+    return -1;
+  }
+
+  map_block_cols(raw, hdr->rows, hdr->meas_mask, c);
+  return 1;
+}
+
+static
+void write_csv(export_t* ex, blk_cols_t const* c)
+{
+  kpm_binlog_file_hdr_t const* s = &ex->schema;
+  if (!ex->csv_header) {
+    printf("ts_us,collect_start_us,ind_seq,amf_ue_ngap_id,ran_ue_id,sst,sd");
+    for (uint32_t k = 0; k < s->meas_len; k++)
+      printf(",%.*s", KPM_BINLOG_MEAS_NAME_LEN, s->meas_name[k]);
+    printf("\n");
+    ex->csv_header = true;
+  }
+
+  for (uint32_t i = 0; i < c->rows; i++) {
+    printf("%" PRId64 ",%" PRId64 ",%u,%" PRIu64 ",%" PRIu64 ",%u,%u", c->ts_us[i], c->collect_us[i], c->ind_seq[i],
+           c->amf_ue_ngap_id[i], c->ran_ue_id[i], c->sst[i], c->sd[i]);
+    for (uint32_t k = 0; k < s->meas_len; k++) {
+      if (c->meas[k] != NULL && (c->present[i] & (1u << k)))
+        printf(",%.17g", c->meas[k][i]);
+      else
+        printf(",");
+    }
+    printf("\n");
+  }
+}
+
+static
+bool open_columns(export_t* ex)
+{
+  const char* dir = ex->dir;
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    perror(dir);
+    return false;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/schema.txt", dir);
+  FILE* schema = fopen(path, "w");
+  if (schema == NULL) {
+    perror(path);
+    return false;
+  }
+
+  kpm_binlog_file_hdr_t const* s = &ex->schema;
+  for (size_t j = 0; j < 8 + s->meas_len; j++) {
+    char name[KPM_BINLOG_MEAS_NAME_LEN + 1];
+    const char* ext = "f64";
+    if (j < 8) {
+      snprintf(name, sizeof(name), "%s", key_col_name[j]);
+      ext = key_col_ext[j];
+    } else {
+      snprintf(name, sizeof(name), "%.*s", KPM_BINLOG_MEAS_NAME_LEN, s->meas_name[j - 8]);
+    }
+    fprintf(schema, "%s %s\n", name, ext);
+
+    snprintf(path, sizeof(path), "%s/%s.%s", dir, name, ext);
+    ex->col_f[j] = fopen(path, "wb");
+    if (ex->col_f[j] == NULL) {
+      perror(path);
+      fclose(schema);
+      return false;
+    }
+  }
+  fclose(schema);
+  return true;
+}
+
+static
+void write_columns(export_t* ex, blk_cols_t const* c)
+{
+  size_t const n = c->rows;
+  fwrite(c->ts_us, sizeof(int64_t), n, ex->col_f[0]);
+  fwrite(c->collect_us, sizeof(int64_t), n, ex->col_f[1]);
+  fwrite(c->amf_ue_ngap_id, sizeof(uint64_t), n, ex->col_f[2]);
+  fwrite(c->ran_ue_id, sizeof(uint64_t), n, ex->col_f[3]);
+  fwrite(c->ind_seq, sizeof(uint32_t), n, ex->col_f[4]);
+  fwrite(c->sd, sizeof(uint32_t), n, ex->col_f[5]);
+  fwrite(c->present, sizeof(uint32_t), n, ex->col_f[6]);
+  fwrite(c->sst, sizeof(uint8_t), n, ex->col_f[7]);
+
+  // Measurements that were not subscribed or reported become NaN, so every column has a row per sample
+  for (uint32_t k = 0; k < ex->schema.meas_len; k++) {
+    FILE* f = ex->col_f[8 + k];
+    for (size_t i = 0; i < n; i++) {
+      double const v = c->meas[k] != NULL && (c->present[i] & (1u << k)) ? c->meas[k][i] : NAN;
+      fwrite(&v, sizeof(v), 1, f);
+    }
+  }
+}
+
+static
+bool export_file(export_t* ex, const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  kpm_binlog_file_hdr_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != KPM_BINLOG_MAGIC || hdr.version != KPM_BINLOG_VERSION
+      || hdr.hdr_size != sizeof(hdr) || hdr.meas_len > KPM_BINLOG_MAX_MEAS) {
+    fprintf(stderr, "%s: not a KPM binary log of this version\n", path);
+    fclose(f);
+    return false;
+  }
+
+  if (!ex->has_schema) {
+    // Column files are created once the measurement names are known
+    ex->schema = hdr;
+    ex->has_schema = true;
+    if (ex->mode == EXPORT_COLUMNS && !open_columns(ex))
+      exit(EXIT_FAILURE);
+  } else if (hdr.meas_len != ex->schema.meas_len || memcmp(hdr.meas_name, ex->schema.meas_name, sizeof(hdr.meas_name)) != 0) {
+    fprintf(stderr, "%s: measurements differ from the first file\n", path);
+    fclose(f);
+    return false;
+  }
+
+  if (ex->mode == EXPORT_INFO)
+    printf("%s: created %" PRId64 " [μs], %u measurements\n", path, hdr.created_us, hdr.meas_len);
+
+  kpm_binlog_blk_hdr_t blk;
+  blk_cols_t cols;
+  int rc;
+  while ((rc = read_block(ex, f, path, &blk, &cols)) > 0) {
+    ex->blocks++;
+    ex->rows += blk.rows;
+
+    if (ex->mode == EXPORT_CSV)
+      write_csv(ex, &cols);
+    else if (ex->mode == EXPORT_COLUMNS)
+      write_columns(ex, &cols);
+    else
+      printf("  %5u rows, ts = [%" PRId64 ", %" PRId64 "] [μs], %s %u -> %u bytes, meas_mask = %#x\n", blk.rows,
+             blk.first_ts_us, blk.last_ts_us, blk.codec == KPM_BINLOG_CODEC_ZLIB ? "zlib" : "raw", blk.raw_size,
+             blk.stored_size, blk.meas_mask);
+  }
+  ex->bad_blocks += rc < 0;
+
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  export_t ex = {.mode = EXPORT_CSV};
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      ex.mode = EXPORT_CSV;
+    } else if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc) {
+      ex.mode = EXPORT_COLUMNS;
+      ex.dir = argv[++i];
+    } else if (strcmp(argv[i], "--info") == 0) {
+      ex.mode = EXPORT_INFO;
+    } else {
+      break;
+    }
+  }
+  if (i == argc || argv[i][0] == '-') {
+    fprintf(stderr, "usage: %s [--csv | --columns dir | --info] file...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int rc = EXIT_SUCCESS;
+  for (; i < argc; i++) {
+    if (!export_file(&ex, argv[i]))
+      rc = EXIT_FAILURE;
+  }
+
+  for (size_t j = 0; j < sizeof(ex.col_f) / sizeof(ex.col_f[0]); j++) {
+    if (ex.col_f[j] != NULL)
+      fclose(ex.col_f[j]);
+  }
+  free(ex.stored);
+  free(ex.raw);
+
+  fprintf(stderr, "%" PRIu64 " rows in %" PRIu64 " blocks, %" PRIu64 " bad blocks skipped\n", ex.rows, ex.blocks,
+          ex.bad_blocks);
+  return rc;
+}
@@ -0,0 +1,269 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Reader of the KPM snapshot segment (see ../src/kpm_shm.h).
+//
+//   gcc -O2 -o kpm_shm_dump kpm_shm_dump.c -lpthread -lrt
+//
+//   kpm_shm_dump [-n name] [-i interval_ms]   print the snapshot once, or every interval_ms
+//   kpm_shm_dump --stress seconds [-r readers] check the sequence locks: one writer thread
+//                                               rewrites records of a private segment as fast
+//                                               as it can while reader threads validate every
+//                                               copy they get; exits with 1 on a torn read
+
+#include "../src/kpm_shm.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define READ_RETRY 64
+
+static
+int64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static
+void print_rec(kpm_shm_hdr_t const* hdr, kpm_shm_rec_t const* r)
+{
+  if (r->kind == KPM_SHM_REC_UE)
+    printf("UE    amf_ue_ngap_id = %" PRIu64 ", ran_ue_id = %" PRIx64 ", sst = %u, sd = %06x",
+           r->amf_ue_ngap_id, r->ran_ue_id, r->sst, r->sd);
+  else
+    printf("SLICE nb_id = %u, sst = %u, sd = %06x, UEs = %u", r->nb_id, r->sst, r->sd, r->n_ues);
+  printf(", ts = %" PRId64 " [μs], ind = %" PRIu64 "\n", r->ts_us, r->ind_seq);
+
+  for (uint32_t k = 0; k < hdr->meas_len && k < KPM_SHM_MAX_MEAS; k++) {
+    if (r->present & (1u << k))
+      printf("  %-22.*s = %.6f\n", KPM_SHM_MEAS_NAME_LEN, hdr->meas_name[k], r->meas[k]);
+  }
+}
+
+static
+void dump_shm(kpm_shm_t const* shm)
+{
+  kpm_shm_hdr_t const* hdr = shm->hdr;
+  printf("writer pid = %u %s, %" PRIu64 " indications, %u UE and %u slice records\n", hdr->writer_pid,
+         atomic_load(&hdr->alive) ? "(running)" : "(stopped)", atomic_load(&hdr->updates), hdr->ue_cap, hdr->slice_cap);
+
+  kpm_shm_rec_t r;
+  size_t busy = 0;
+  for (uint32_t i = 0; i < hdr->slice_cap; i++) {
+    if (kpm_shm_read(&shm->slice[i], &r, READ_RETRY))
+      print_rec(hdr, &r);
+  }
+  for (uint32_t i = 0; i < hdr->ue_cap; i++) {
+    if (kpm_shm_read(&shm->ue[i], &r, READ_RETRY))
+      print_rec(hdr, &r);
+    else if (atomic_load(&shm->ue[i].seq) & 1u)
+      busy++;
+  }
+  if (busy > 0)
+    printf("%zu records skipped while being written\n", busy);
+}
+
+// ======================================== Stress ========================================
+
+// Every field of a record written by the stress writer derives from one value v, so a copy
+// mixing two updates is detected field by field.
+
+#define STRESS_RECS 64
+
+typedef struct {
+  kpm_shm_t shm;
+  _Atomic bool stop;
+  _Atomic uint64_t writes;
+  _Atomic uint64_t reads;
+  _Atomic uint64_t missed;
+  _Atomic uint64_t torn;
+} stress_t;
+
+static
+void stress_fill(kpm_shm_rec_t* r, uint64_t v)
+{
+  r->kind = KPM_SHM_REC_UE;
+  r->amf_ue_ngap_id = v;
+  r->ran_ue_id = ~v;
+  r->ts_us = (int64_t)(v * 3);
+  r->ind_seq = v ^ 0x5a5a5a5a5a5a5a5aull;
+  r->present = (uint32_t)v;
+  r->sd = (uint32_t)(v >> 8) & 0xFFFFFF;
+  r->sst = (uint8_t)v;
+  for (size_t k = 0; k < KPM_SHM_MAX_MEAS; k++)
+    r->meas[k] = (double)v + (double)k;
+}
+
+static
+bool stress_valid(kpm_shm_rec_t const* r)
+{
+  uint64_t const v = r->amf_ue_ngap_id;
+  if (r->ran_ue_id != ~v || r->ts_us != (int64_t)(v * 3) || r->ind_seq != (v ^ 0x5a5a5a5a5a5a5a5aull)
+      || r->present != (uint32_t)v || r->sd != ((uint32_t)(v >> 8) & 0xFFFFFF) || r->sst != (uint8_t)v)
+    return false;
+  for (size_t k = 0; k < KPM_SHM_MAX_MEAS; k++) {
+    if (r->meas[k] != (double)v + (double)k)
+      return false;
+  }
+  return true;
+}
+
+static
+void* stress_writer(void* arg)
+{
+  stress_t* st = arg;
+  uint64_t v = 1;
+  while (!atomic_load_explicit(&st->stop, memory_order_relaxed)) {
+    kpm_shm_rec_t* r = &st->shm.ue[v % STRESS_RECS];
+    kpm_shm_write_begin(r);
+    stress_fill(r, v);
+    kpm_shm_write_end(r);
+    v++;
+  }
+  atomic_store(&st->writes, v - 1);
+  return NULL;
+}
+
+static
+void* stress_reader(void* arg)
+{
+  stress_t* st = arg;
+  uint64_t reads = 0, missed = 0, torn = 0;
+  kpm_shm_rec_t r;
+  size_t i = 0;
+  while (!atomic_load_explicit(&st->stop, memory_order_relaxed)) {
+    if (kpm_shm_read(&st->shm.ue[i++ % STRESS_RECS], &r, READ_RETRY)) {
+      reads++;
+      torn += !stress_valid(&r);
+    } else {
+      missed++;
+    }
+  }
+  atomic_fetch_add(&st->reads, reads);
+  atomic_fetch_add(&st->missed, missed);
+  atomic_fetch_add(&st->torn, torn);
+  return NULL;
+}
+
+static
+int stress(int seconds, int readers)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/kpm_shm_stress_%d", (int)getpid());
+
+  int fd = kpm_shm_open_fd(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  size_t const size = kpm_shm_size(STRESS_RECS, 0);
+  if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+    perror(name);
+    return EXIT_FAILURE;
+  }
+
+  stress_t st = {0};
+  st.shm.hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  kpm_shm_unlink(name);
+  assert(st.shm.hdr != MAP_FAILED);
+  st.shm.hdr->ue_cap = STRESS_RECS;
+  st.shm.size = size;
+  kpm_shm_map_recs(&st.shm);
+
+  // Start from valid records so that a free one is never confused with a torn one
+  for (size_t i = 0; i < STRESS_RECS; i++)
+    stress_fill(&st.shm.ue[i], 0);
+
+  pthread_t w;
+  pthread_t* r = calloc((size_t)readers, sizeof(pthread_t));
+  assert(r != NULL && "Memory exhausted");
+  pthread_create(&w, NULL, stress_writer, &st);
+  for (int i = 0; i < readers; i++)
+    pthread_create(&r[i], NULL, stress_reader, &st);
+
+  int64_t const start = now_us();
+  while (now_us() - start < (int64_t)seconds * 1000000)
+    usleep(10000);
+  atomic_store(&st.stop, true);
+
+  pthread_join(w, NULL);
+  for (int i = 0; i < readers; i++)
+    pthread_join(r[i], NULL);
+  free(r);
+  munmap(st.shm.hdr, size);
+
+  double const elapsed = (now_us() - start) / 1e6;
+  printf("%d s, 1 writer, %d readers on %d records\n", seconds, readers, STRESS_RECS);
+  printf("writes = %" PRIu64 " (%.1f M/s), consistent reads = %" PRIu64 " (%.1f M/s), retries exhausted = %" PRIu64 ", torn = %" PRIu64 "\n",
+         atomic_load(&st.writes), atomic_load(&st.writes) / elapsed / 1e6, atomic_load(&st.reads),
+         atomic_load(&st.reads) / elapsed / 1e6, atomic_load(&st.missed), atomic_load(&st.torn));
+
+  return atomic_load(&st.torn) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ======================================== Stress ========================================
+
+int main(int argc, char* argv[])
+{
+  const char* name = getenv("KPM_SHM_NAME");
+  if (!name) name = "/kpm_mon";
+  int interval_ms = 0;
+  int stress_s = 0;
+  int readers = 3;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      name = argv[++i];
+    } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+      stress_s = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      readers = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-n name] [-i interval_ms] | --stress seconds [-r readers]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (stress_s > 0)
+    return stress(stress_s, readers > 0 ? readers : 1);
+
+  kpm_shm_t shm;
+  int rc = kpm_shm_open(&shm, name);
+  if (rc != 0) {
+    fprintf(stderr, "%s: %s\n", name, rc == -EPROTO ? "not a KPM snapshot of this version" : strerror(-rc));
+    return EXIT_FAILURE;
+  }
+
+  do {
+    dump_shm(&shm);
+    if (interval_ms > 0) {
+      usleep((useconds_t)interval_ms * 1000);
+      printf("\n");
+    }
+  } while (interval_ms > 0);
+
+  kpm_shm_close(&shm);
+  return EXIT_SUCCESS;
+}
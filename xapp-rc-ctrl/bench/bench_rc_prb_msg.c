@@ -0,0 +1,97 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Build + free cost of the slice level PRB quota control message.
+//
+// Build it next to the xApp inside the FlexRIC tree, with the same libraries as
+// xapp_rc_slice_ctrl, and run:
+//   ./bench_rc_prb_msg [iterations]
+//
+// For 3, 16 and 64 slices two paths are timed:
+//   calloc tree - gen_rc_ctrl_slice_level_PRB_quata_msg() + free_e2sm_rc_ctrl_msg(), the former path
+//   template    - gen_rc_ctrl_slice_level_PRB_quota_tmpl() + free() of the arena
+// and the messages of both paths are checked to be equal.
+
+#define RC_CTRL_BENCH
+#include "../src/xapp_rc_slice_ctrl.c"
+#include "../../../../src/sm/rc_sm/ie/ir/e2sm_rc_ctrl_msg.h"
+
+static
+void print_result(const char* name, size_t num_slices, int64_t elapsed_us, size_t iter)
+{
+  double const per_msg_us = (double)elapsed_us / iter;
+  printf("%3zu slices  %-12s %9.3f [μs/message] %8.1f [ns/slice]\n", num_slices, name, per_msg_us,
+         per_msg_us * 1000.0 / num_slices);
+}
+
+static
+void bench_slices(size_t num_slices, size_t iter)
+{
+  const char* sst_str[RC_MAX_SLICES];
+  const char* sd_str[RC_MAX_SLICES];
+  int ratio[RC_MAX_SLICES];
+  char sst_buf[RC_MAX_SLICES][8];
+  char sd_buf[RC_MAX_SLICES][16];
+  for (size_t i = 0; i < num_slices; i++) {
+    snprintf(sst_buf[i], sizeof(sst_buf[i]), "%zu", 1 + i % 255);
+    snprintf(sd_buf[i], sizeof(sd_buf[i]), "0x%06zx", 0x80 + i);
+    sst_str[i] = sst_buf[i];
+    sd_str[i] = sd_buf[i];
+    ratio[i] = (int)(100 / num_slices);
+  }
+
+  // Both paths must build the same message
+  e2sm_rc_ctrl_msg_t ref = gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str, ratio, num_slices);
+  e2sm_rc_ctrl_msg_t msg = {0};
+  void* arena = NULL;
+  bool const ok = gen_rc_ctrl_slice_level_PRB_quota_tmpl(sst_str, sd_str, ratio, num_slices, &msg, &arena);
+  assert(ok && eq_e2sm_rc_ctrl_msg(&ref, &msg) && "Template and calloc tree disagree");
+  free_e2sm_rc_ctrl_msg(&ref);
+  free(arena);
+
+  int64_t start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    ratio[it % num_slices] = (int)(it % 100);
+    e2sm_rc_ctrl_msg_t m = gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str, ratio, num_slices);
+    free_e2sm_rc_ctrl_msg(&m);
+  }
+  print_result("calloc tree", num_slices, time_now_us() - start, iter);
+
+  start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    ratio[it % num_slices] = (int)(it % 100);
+    gen_rc_ctrl_slice_level_PRB_quota_tmpl(sst_str, sd_str, ratio, num_slices, &msg, &arena);
+    free(arena);
+  }
+  print_result("template", num_slices, time_now_us() - start, iter);
+}
+
+int main(int argc, char* argv[])
+{
+  size_t const iter = argc > 1 ? (size_t)atoi(argv[1]) : 100000;
+  assert(iter > 0);
+
+  size_t const num_slices[] = {3, 16, 64};
+  for (size_t i = 0; i < sizeof(num_slices) / sizeof(num_slices[0]); i++)
+    bench_slices(num_slices[i], iter);
+
+  return 0;
+}
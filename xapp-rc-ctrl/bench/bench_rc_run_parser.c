@@ -0,0 +1,370 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Cost and robustness of the streaming POST /run parser.
+//
+// Build it next to the xApp inside the FlexRIC tree, with the same libraries as
+// xapp_rc_slice_ctrl (preferably with -fsanitize=address,undefined for --fuzz), and run:
+//   ./bench_rc_run_parser [iterations]
+//   ./bench_rc_run_parser --fuzz seconds [seed]
+//
+// The benchmark parses /run bodies of 3, 16 and 64 slices with
+//   json-c     - body buffer + json_tokener_parse() + parse_rc_slices(), the former path
+//   streaming  - feed_rc_run_req() on the whole body, and on 64 byte chunks
+//
+// The fuzzer generates valid bodies (random member order, whitespace, unknown members and SD
+// formats), mutates them, and checks that
+//   - valid bodies are accepted with the generated values
+//   - any split into chunks gives the same answer as the whole body
+//   - an accepted body is valid JSON for json-c (strict mode) with the same slices
+//   - oversized and too deeply nested bodies are refused
+// It exits with 1 on the first failed check, printing the body.
+
+#define RC_CTRL_BENCH
+#include "../src/xapp_rc_slice_ctrl.c"
+
+#include <inttypes.h>
+
+#define BODY_CAP 65536
+
+typedef struct {
+  size_t n;
+  char sst[RC_MAX_SLICES][RC_SST_STR_LEN + 1];
+  char sd[RC_MAX_SLICES][RC_SD_STR_LEN + 1];
+  int ratio[RC_MAX_SLICES];
+} policy_t;
+
+static
+void rand_policy(policy_t* pol, size_t n)
+{
+  pol->n = n;
+  int left = 100;
+  for (size_t i = 0; i < n; i++) {
+    snprintf(pol->sst[i], sizeof(pol->sst[i]), "%d", rand() % 256);
+    int const sd = rand() % 0x1000000;
+    switch (rand() % 3) {
+      case 0: snprintf(pol->sd[i], sizeof(pol->sd[i]), "%06x", sd); break;
+      case 1: snprintf(pol->sd[i], sizeof(pol->sd[i]), "0x%06X", sd); break;
+      default: snprintf(pol->sd[i], sizeof(pol->sd[i]), "%d", sd % 1000); break;
+    }
+    pol->ratio[i] = rand() % (left / (int)(n - i) + 1);
+    left -= pol->ratio[i];
+  }
+}
+
+static
+size_t rand_ws(char* out)
+{
+  static const char ws[] = " \t\n\r";
+  size_t const n = rand() % 4 == 0 ? rand() % 3 : 0;
+  for (size_t i = 0; i < n; i++)
+    out[i] = ws[rand() % 4];
+  return n;
+}
+
+// A valid /run body for pol, with noise around it if messy
+static
+size_t gen_body(char* out, policy_t const* pol, bool messy)
+{
+  size_t len = 0;
+  len += sprintf(out + len, "{");
+  int order[6] = {0, 1, 2, 3, 4, 5};
+  for (int i = 5; messy && i > 0; i--) {
+    int const j = rand() % (i + 1);
+    int const t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+  bool first = true;
+  for (int k = 0; k < 6; k++) {
+    if (order[k] >= 3 && (!messy || rand() % 2))
+      continue;
+    len += sprintf(out + len, "%s", first ? "" : ",");
+    first = false;
+    len += rand_ws(out + len);
+    switch (order[k]) {
+      case 0:
+      case 1:
+        len += sprintf(out + len, "\"%s\":[", order[k] == 0 ? "sst" : "sd");
+        for (size_t i = 0; i < pol->n; i++) {
+          len += rand_ws(out + len);
+          len += sprintf(out + len, "%s\"%s\"", i > 0 ? "," : "", order[k] == 0 ? pol->sst[i] : pol->sd[i]);
+        }
+        len += sprintf(out + len, "]");
+        break;
+      case 2:
+        len += sprintf(out + len, "\"dedicated_ratio_prb\" : [");
+        for (size_t i = 0; i < pol->n; i++)
+          len += sprintf(out + len, "%s%d", i > 0 ? ", " : "", pol->ratio[i]);
+        len += sprintf(out + len, "]");
+        break;
+      case 3:
+        len += sprintf(out + len, "\"note\": {\"a\": [1.5e3, -0, null, \"x\\\"\\u00e9\"], \"b\": {}}");
+        break;
+      case 4:
+        len += sprintf(out + len, "\"wait\": false, \"timeout_ms\": %d", rand() % 10000);
+        break;
+      case 5:
+        len += sprintf(out + len, "\"force\": true");
+        break;
+    }
+    len += rand_ws(out + len);
+  }
+  len += sprintf(out + len, "}");
+  return len;
+}
+
+static
+void parse_chunks(rc_run_req_t* req, const char* body, size_t len, size_t max_chunk)
+{
+  init_rc_run_req(req, BODY_CAP);
+  for (size_t off = 0; off < len;) {
+    size_t const n = max_chunk == 0 ? len - off : 1 + (size_t)rand() % max_chunk;
+    size_t const take = n < len - off ? n : len - off;
+    feed_rc_run_req(req, body + off, take);
+    off += take;
+  }
+  finish_rc_run_req(req);
+}
+
+static
+bool same_answer(rc_run_req_t const* a, rc_run_req_t const* b)
+{
+  if (a->status != b->status || strcmp(a->err, b->err) != 0)
+    return false;
+  if (a->status != 0)
+    return true;
+  size_t const n = a->len[RC_RUN_SST];
+  if (b->len[RC_RUN_SST] != n || a->wait != b->wait || a->force != b->force || a->timeout_ms != b->timeout_ms)
+    return false;
+  for (size_t i = 0; i < n; i++) {
+    if (strcmp(a->sst[i], b->sst[i]) != 0 || strcmp(a->sd[i], b->sd[i]) != 0 || a->dedicated_ratio_prb[i] != b->dedicated_ratio_prb[i])
+      return false;
+  }
+  return true;
+}
+
+static
+void fuzz_fail(const char* what, const char* body, size_t len, rc_run_req_t const* req)
+{
+  printf("FAILED: %s\nstatus = %u, err = %sbody (%zu bytes) = %.*s\n", what, req->status, req->err, len, (int)len, body);
+  exit(EXIT_FAILURE);
+}
+
+// An accepted body must be valid JSON with the same slices for json-c
+static
+void check_with_json_c(const char* body, size_t len, rc_run_req_t const* req)
+{
+  struct json_tokener* tok = json_tokener_new();
+  json_tokener_set_flags(tok, JSON_TOKENER_STRICT);
+  struct json_object* obj = json_tokener_parse_ex(tok, body, (int)len);
+  json_tokener_free(tok);
+  if (obj == NULL)
+    fuzz_fail("accepted, json-c refuses it", body, len, req);
+
+  const char* sst[RC_MAX_SLICES];
+  const char* sd[RC_MAX_SLICES];
+  int ratio[RC_MAX_SLICES];
+  size_t n = 0;
+  if (parse_rc_slices(obj, sst, sd, ratio, &n) != NULL || n != req->len[RC_RUN_SST])
+    fuzz_fail("accepted, json-c slices differ", body, len, req);
+  for (size_t i = 0; i < n; i++) {
+    if (strcmp(sst[i], req->sst[i]) != 0 || strcmp(sd[i], req->sd[i]) != 0 || ratio[i] != req->dedicated_ratio_prb[i])
+      fuzz_fail("accepted, json-c slices differ", body, len, req);
+  }
+  json_object_put(obj);
+}
+
+static
+size_t mutate(char* body, size_t len)
+{
+  static const char tokens[] = "{}[],:\"\\ -0123456789.eEtrufalsn\x01";
+  switch (rand() % 6) {
+    case 0: // Replace a byte
+      body[rand() % len] = rand() % 4 == 0 ? (char)(rand() % 256) : tokens[rand() % (sizeof(tokens) - 1)];
+      return len;
+    case 1: // Insert a byte
+      if (len + 1 >= BODY_CAP)
+        return len;
+      {
+        size_t const at = rand() % (len + 1);
+        memmove(body + at + 1, body + at, len - at);
+        body[at] = tokens[rand() % (sizeof(tokens) - 1)];
+      }
+      return len + 1;
+    case 2: // Delete a byte
+      {
+        size_t const at = rand() % len;
+        memmove(body + at, body + at + 1, len - at - 1);
+      }
+      return len - 1;
+    case 3: // Truncate
+      return rand() % len;
+    case 4: // Bump a ratio digit, often above the sum
+      for (size_t i = rand() % len; i < len; i++) {
+        if (body[i] >= '0' && body[i] <= '8') {
+          body[i] = '9';
+          break;
+        }
+      }
+      return len;
+    default: // Duplicate a slice of the body
+      {
+        size_t const from = rand() % len;
+        size_t const n = 1 + rand() % (len - from);
+        if (len + n >= BODY_CAP)
+          return len;
+        size_t const at = rand() % (len + 1);
+        char tmp[BODY_CAP];
+        memcpy(tmp, body + from, n);
+        memmove(body + at + n, body + at, len - at);
+        memcpy(body + at, tmp, n);
+        return len + n;
+      }
+  }
+}
+
+static
+void fuzz(int seconds, unsigned int seed)
+{
+  srand(seed);
+  static char body[BODY_CAP];
+  static rc_run_req_t whole;
+  static rc_run_req_t chunked;
+  uint64_t runs = 0;
+  uint64_t status_cnt[600] = {0};
+
+  int64_t const end_us = time_now_us() + (int64_t)seconds * 1000000;
+  while (time_now_us() < end_us) {
+    policy_t pol;
+    rand_policy(&pol, 1 + rand() % (rand() % 8 == 0 ? RC_MAX_SLICES : 8));
+    size_t len = gen_body(body, &pol, true);
+
+    // Valid as generated
+    parse_chunks(&whole, body, len, 0);
+    if (whole.status != 0 || whole.len[RC_RUN_SST] != pol.n)
+      fuzz_fail("valid body refused", body, len, &whole);
+    for (size_t i = 0; i < pol.n; i++) {
+      if (strcmp(whole.sst[i], pol.sst[i]) != 0 || strcmp(whole.sd[i], pol.sd[i]) != 0 || whole.dedicated_ratio_prb[i] != pol.ratio[i])
+        fuzz_fail("valid body misread", body, len, &whole);
+    }
+
+    for (int m = 1 + rand() % 3; m > 0 && len > 0; m--)
+      len = mutate(body, len);
+
+    parse_chunks(&whole, body, len, 0);
+    parse_chunks(&chunked, body, len, 1 + rand() % 16);
+    if (!same_answer(&whole, &chunked))
+      fuzz_fail("chunked parse differs", body, len, &chunked);
+    if (whole.status == 0)
+      check_with_json_c(body, len, &whole);
+    status_cnt[whole.status]++;
+    runs++;
+  }
+
+  // Oversized and deeply nested bodies
+  memset(body, ' ', BODY_CAP);
+  body[0] = '{';
+  init_rc_run_req(&whole, BODY_CAP / 2);
+  for (size_t off = 0; off < BODY_CAP; off += 4096)
+    feed_rc_run_req(&whole, body + off, 4096);
+  finish_rc_run_req(&whole);
+  if (whole.status != MHD_HTTP_PAYLOAD_TOO_LARGE)
+    fuzz_fail("oversized body not refused", body, 64, &whole);
+
+  size_t len = sprintf(body, "{\"x\":");
+  for (int i = 0; i < 4 * RC_RUN_MAX_DEPTH; i++)
+    len += sprintf(body + len, "[");
+  parse_chunks(&whole, body, len, 0);
+  if (whole.status != MHD_HTTP_BAD_REQUEST)
+    fuzz_fail("deep nesting not refused", body, len, &whole);
+
+  printf("%" PRIu64 " mutated bodies in %d s, seed %u:", runs, seconds, seed);
+  for (int s = 0; s < 600; s++) {
+    if (status_cnt[s] > 0)
+      printf(" %d x %" PRIu64, s, status_cnt[s]);
+  }
+  printf("\n");
+}
+
+static
+void bench_slices(size_t num_slices, size_t iter)
+{
+  policy_t pol;
+  rand_policy(&pol, num_slices);
+  static char body[BODY_CAP];
+  size_t const len = gen_body(body, &pol, false);
+  static rc_run_req_t req;
+
+  int64_t start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    // Former handle_request() + handle_run(): one realloc per chunk, a tree, and the slices
+    char* copy = malloc(len + 1);
+    memcpy(copy, body, len + 1);
+    struct json_object* obj = json_tokener_parse(copy);
+    const char* sst[RC_MAX_SLICES];
+    const char* sd[RC_MAX_SLICES];
+    int ratio[RC_MAX_SLICES];
+    size_t n = 0;
+    const char* invalid = parse_rc_slices(obj, sst, sd, ratio, &n);
+    assert(invalid == NULL && n == num_slices);
+    json_object_put(obj);
+    free(copy);
+  }
+  int64_t const json_c_us = time_now_us() - start;
+
+  start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    init_rc_run_req(&req, BODY_CAP);
+    feed_rc_run_req(&req, body, len);
+    finish_rc_run_req(&req);
+    assert(req.status == 0 && req.len[RC_RUN_SST] == num_slices);
+  }
+  int64_t const whole_us = time_now_us() - start;
+
+  start = time_now_us();
+  for (size_t it = 0; it < iter; it++) {
+    init_rc_run_req(&req, BODY_CAP);
+    for (size_t off = 0; off < len; off += 64)
+      feed_rc_run_req(&req, body + off, len - off < 64 ? len - off : 64);
+    finish_rc_run_req(&req);
+    assert(req.status == 0);
+  }
+  int64_t const chunk_us = time_now_us() - start;
+
+  printf("%3zu slices %5zu bytes  json-c %8.3f  streaming %8.3f  streaming, 64 B chunks %8.3f [μs/body]\n", num_slices, len,
+         (double)json_c_us / iter, (double)whole_us / iter, (double)chunk_us / iter);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 3 && strcmp(argv[1], "--fuzz") == 0) {
+    fuzz(atoi(argv[2]), argc > 3 ? (unsigned int)atoi(argv[3]) : (unsigned int)time(NULL));
+    return EXIT_SUCCESS;
+  }
+
+  size_t const iter = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+  size_t const slices[] = {3, 16, 64};
+  for (size_t i = 0; i < sizeof(slices) / sizeof(slices[0]); i++)
+    bench_slices(slices[i], iter);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+#ifndef RC_CTRL_PROTO_H
+#define RC_CTRL_PROTO_H
+
+// Binary control channel of xapp_rc_slice_ctrl, next to its REST API.
+//
+// A client keeps one stream connection (Unix domain or TCP socket, see rc_proto_addr()) open
+// and writes requests back to back without waiting for the answers. A request is
+//
+//   rc_proto_req_t, then num_slices times: rc_proto_slice_t, sst[sst_len], sd[sd_len]
+//
+// and every request gets exactly one rc_proto_resp_t followed by nodes_len rc_proto_node_t.
+// Responses are written as their jobs complete, so they may come out of order: match them on
+// corr_id. len, the first field of both, counts the bytes of the frame after itself. All
+// integers are in host byte order (little endian on every platform we run on). The layout
+// only changes together with RC_PROTO_VERSION, sent in every request.
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define RC_PROTO_VERSION 1
+#define RC_PROTO_MAX_FRAME 65536
+
+typedef enum {
+  RC_PROTO_PRB_QUOTA = 1,   // Slice level PRB quota, as POST /run
+  RC_PROTO_HANDOVER = 2,    // UE handover to the first slice, see POST /batch
+  RC_PROTO_UE_POLICY = 3,   // Slice level PRB quota for one UE, see POST /batch
+} rc_proto_msg_e;
+
+typedef enum {
+  RC_PROTO_F_WAIT = 1 << 0,   // Answer once every node answered, or after timeout_ms
+  RC_PROTO_F_FORCE = 1 << 1,  // Send even to the nodes that got the policy last
+  RC_PROTO_F_NB_ID = 1 << 2,  // Only the E2 node nb_id, else every node
+} rc_proto_flag_e;
+
+typedef struct {
+  uint32_t len;
+  uint32_t corr_id;         // Echoed in the response
+  uint8_t version;          // RC_PROTO_VERSION
+  uint8_t type;             // rc_proto_msg_e
+  uint8_t flags;            // rc_proto_flag_e
+  uint8_t num_slices;
+  uint32_t nb_id;           // With RC_PROTO_F_NB_ID
+  uint32_t timeout_ms;      // With RC_PROTO_F_WAIT; 0 for the xApp default, which also bounds it
+  uint32_t reserved;
+  uint64_t amf_ue_ngap_id;  // RC_PROTO_HANDOVER and RC_PROTO_UE_POLICY
+} rc_proto_req_t;
+
+_Static_assert(sizeof(rc_proto_req_t) == 32, "rc_proto_req_t layout changed, bump RC_PROTO_VERSION");
+
+typedef struct {
+  uint8_t sst_len;
+  uint8_t sd_len;
+  uint8_t ratio;            // Dedicated PRB ratio [%]
+  uint8_t reserved;
+} rc_proto_slice_t;
+
+_Static_assert(sizeof(rc_proto_slice_t) == 4, "rc_proto_slice_t layout changed, bump RC_PROTO_VERSION");
+
+typedef enum {
+  RC_PROTO_OK = 0,          // Done, every node acked or skipped
+  RC_PROTO_QUEUED = 1,      // Not waited for, or still running at timeout_ms
+  RC_PROTO_FAILED = 2,      // Done, at least one node failed
+  RC_PROTO_BAD_REQUEST = 3, // Malformed request, no job
+  RC_PROTO_NO_NODE = 4,     // No connected E2 node, or unknown nb_id, no job
+  RC_PROTO_NO_UE = 5,       // UE not in the KPM reports, see GET /ue/<amf_ue_ngap_id>, no job
+  RC_PROTO_SHUTTING_DOWN = 6, // The xApp is draining after SIGTERM, no job
+} rc_proto_status_e;
+
+typedef struct {
+  uint32_t len;
+  uint32_t corr_id;
+  uint8_t status;           // rc_proto_status_e
+  uint8_t action;           // 0 new, 1 cache hit, 2 no-op (see GET /run/<id>)
+  uint16_t nodes_len;
+  uint32_t reserved;
+  uint64_t job_id;          // 0 without job
+  int64_t latency_us;       // Job latency, -1 while running
+} rc_proto_resp_t;
+
+_Static_assert(sizeof(rc_proto_resp_t) == 32, "rc_proto_resp_t layout changed, bump RC_PROTO_VERSION");
+
+typedef struct {
+  uint32_t nb_id;
+  uint8_t state;            // 0 queued, 1 sent, 2 acked, 3 failed, 4 skipped
+  uint8_t reserved[3];
+  int64_t latency_us;
+} rc_proto_node_t;
+
+_Static_assert(sizeof(rc_proto_node_t) == 16, "rc_proto_node_t layout changed, bump RC_PROTO_VERSION");
+
+// "unix:/path/to.sock" or "tcp:host:port"; false if addr is neither
+static inline
+bool rc_proto_addr(const char* addr, struct sockaddr_storage* sa, socklen_t* sa_len)
+{
+  memset(sa, 0, sizeof(*sa));
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un* un = (struct sockaddr_un*)sa;
+    if (strlen(addr + 5) >= sizeof(un->sun_path))
+      return false;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, addr + 5);
+    *sa_len = sizeof(struct sockaddr_un);
+    return true;
+  }
+
+  if (strncmp(addr, "tcp:", 4) != 0)
+    return false;
+  char host[64];
+  const char* colon = strrchr(addr + 4, ':');
+  if (colon == NULL || (size_t)(colon - (addr + 4)) >= sizeof(host))
+    return false;
+  memcpy(host, addr + 4, colon - (addr + 4));
+  host[colon - (addr + 4)] = '\0';
+
+  struct sockaddr_in* in = (struct sockaddr_in*)sa;
+  in->sin_family = AF_INET;
+  in->sin_port = htons((uint16_t)atoi(colon + 1));
+  *sa_len = sizeof(struct sockaddr_in);
+  return inet_pton(AF_INET, host, &in->sin_addr) == 1;
+}
+
+// Read or write exactly len bytes; false on error or end of stream
+static inline
+bool rc_proto_read_full(int fd, void* buf, size_t len)
+{
+  uint8_t* p = buf;
+  while (len > 0) {
+    ssize_t const n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static inline
+bool rc_proto_write_full(int fd, void const* buf, size_t len)
+{
+  uint8_t const* p = buf;
+  while (len > 0) {
+    ssize_t const n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+#endif
@@ -25,14 +25,20 @@
 #include "../../../../src/util/time_now_us.h"
 #include "../../../../src/util/alg_ds/ds/lock_guard/lock_guard.h"
 #include "../../../../src/sm/rc_sm/rc_sm_id.h"
+#include "rc_ctrl_proto.h"
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <microhttpd.h>
 #include <json-c/json.h>
+#include <netinet/tcp.h>
 
 #define PORT 8080
 
@@ -408,58 +414,3221 @@ ue_id_e2sm_t gen_rc_ue_id(ue_id_e2sm_e type)
   return ue_id;
 }
 
-void HO_rc_slice_level_UE(ue_id_e2sm_t* ue_id, const char* sst_str, const char* sd_str) // Dest SST and SD
+// ======================================== RRM Policy Template ========================================
+
+// The RRM Policy Ratio List of gen_rc_ctrl_slice_level_PRB_quata_msg() costs about 20 callocs
+// per slice, and as many frees once sent, although its shape only depends on the number of
+// slices. It is therefore built once per slice count into a single block, the template, which
+// also records where every pointer and every per-slice leaf lies in the block. A request
+// copies the template into its own arena, rebases the pointers and patches SST, SD and the
+// ratios: one malloc and one free per message. Only the fixed 8.4.3.6 tree the baseline
+// builds is supported: one member per group with PLMN 00101, and the three ratios set alike.
+
+#define RC_MAX_SLICES 64
+#define RC_TMPL_STR_LEN 16  // Room for an SST or SD string in the template
+
+typedef struct {
+  // Offsets of the ran_parameter_value_t leaves of the slice
+  uint32_t sst;
+  uint32_t sd;
+  uint32_t min_ratio;
+  uint32_t max_ratio;
+  uint32_t ded_ratio;
+} rc_tmpl_slice_t;
+
+typedef struct {
+  uint8_t* buf;
+  size_t len;
+  size_t cap;
+  uint32_t* reloc;        // Offsets of the pointers inside buf
+  size_t reloc_len;
+  size_t reloc_cap;
+  size_t num_slices;
+  rc_tmpl_slice_t slice[];
+} rc_tmpl_t;
+
+static pthread_mutex_t rc_tmpl_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static rc_tmpl_t* rc_tmpl[RC_MAX_SLICES + 1];
+
+// Zeroed room for n objects of size sz; field is the template pointer that will hold it, or
+// NULL for the root, which lies outside of the template
+static
+void* rc_tmpl_alloc(rc_tmpl_t* t, void* field, size_t n, size_t sz)
+{
+  size_t const align = _Alignof(max_align_t);
+  size_t const off = (t->len + align - 1) & ~(align - 1);
+  assert(off + n * sz <= t->cap && "RRM Policy template too small");
+  t->len = off + n * sz;
+
+  if (field != NULL) {
+    assert(t->reloc_len < t->reloc_cap);
+    t->reloc[t->reloc_len++] = (uint32_t)((uint8_t*)field - t->buf);
+  }
+  return t->buf + off;
+}
+
+static
+uint32_t rc_tmpl_off(rc_tmpl_t const* t, void const* p)
+{
+  return (uint32_t)((uint8_t const*)p - t->buf);
+}
+
+static
+ran_parameter_value_t* rc_tmpl_element(rc_tmpl_t* t, seq_ran_param_t* p, uint32_t id, ran_parameter_value_e type)
+{
+  p->ran_param_id = id;
+  p->ran_param_val.type = ELEMENT_KEY_FLAG_FALSE_RAN_PARAMETER_VAL_TYPE;
+  p->ran_param_val.flag_false = rc_tmpl_alloc(t, &p->ran_param_val.flag_false, 1, sizeof(ran_parameter_value_t));
+  p->ran_param_val.flag_false->type = type;
+  return p->ran_param_val.flag_false;
+}
+
+static
+ran_parameter_value_t* rc_tmpl_octet_str(rc_tmpl_t* t, seq_ran_param_t* p, uint32_t id, const char* str)
+{
+  ran_parameter_value_t* v = rc_tmpl_element(t, p, id, OCTET_STRING_RAN_PARAMETER_VALUE);
+  v->octet_str_ran.buf = rc_tmpl_alloc(t, &v->octet_str_ran.buf, 1, RC_TMPL_STR_LEN);
+  v->octet_str_ran.len = strlen(str);
+  memcpy(v->octet_str_ran.buf, str, v->octet_str_ran.len);
+  return v;
+}
+
+static
+seq_ran_param_t* rc_tmpl_struct(rc_tmpl_t* t, seq_ran_param_t* p, uint32_t id, size_t sz)
+{
+  p->ran_param_id = id;
+  p->ran_param_val.type = STRUCTURE_RAN_PARAMETER_VAL_TYPE;
+  p->ran_param_val.strct = rc_tmpl_alloc(t, &p->ran_param_val.strct, 1, sizeof(ran_param_struct_t));
+  p->ran_param_val.strct->sz_ran_param_struct = sz;
+  p->ran_param_val.strct->ran_param_struct = rc_tmpl_alloc(t, &p->ran_param_val.strct->ran_param_struct, sz, sizeof(seq_ran_param_t));
+  return p->ran_param_val.strct->ran_param_struct;
+}
+
+// Same tree as gen_rrm_policy_ratio_group()
+static
+void rc_tmpl_ratio_group(rc_tmpl_t* t, lst_ran_param_t* grp, rc_tmpl_slice_t* s)
+{
+  grp->ran_param_struct.sz_ran_param_struct = 4;
+  grp->ran_param_struct.ran_param_struct = rc_tmpl_alloc(t, &grp->ran_param_struct.ran_param_struct, 4, sizeof(seq_ran_param_t));
+  seq_ran_param_t* grp_param = grp->ran_param_struct.ran_param_struct;
+
+  // RRM Policy -> RRM Policy Member List
+  seq_ran_param_t* member_list = rc_tmpl_struct(t, &grp_param[0], RRM_Policy_8_4_3_6, 1);
+  member_list->ran_param_id = RRM_Policy_Member_List_8_4_3_6;
+  member_list->ran_param_val.type = LIST_RAN_PARAMETER_VAL_TYPE;
+  member_list->ran_param_val.lst = rc_tmpl_alloc(t, &member_list->ran_param_val.lst, 1, sizeof(ran_param_list_t));
+  member_list->ran_param_val.lst->sz_lst_ran_param = 1;
+  member_list->ran_param_val.lst->lst_ran_param = rc_tmpl_alloc(t, &member_list->ran_param_val.lst->lst_ran_param, 1, sizeof(lst_ran_param_t));
+
+  // RRM Policy Member -> PLMN Identity, S-NSSAI
+  lst_ran_param_t* member = &member_list->ran_param_val.lst->lst_ran_param[0];
+  member->ran_param_struct.sz_ran_param_struct = 2;
+  member->ran_param_struct.ran_param_struct = rc_tmpl_alloc(t, &member->ran_param_struct.ran_param_struct, 2, sizeof(seq_ran_param_t));
+  seq_ran_param_t* member_param = member->ran_param_struct.ran_param_struct;
+  rc_tmpl_octet_str(t, &member_param[0], PLMN_Identity_8_4_3_6, "00101"); // Fixed, see RC_PLMN
+
+  seq_ran_param_t* s_nssai = rc_tmpl_struct(t, &member_param[1], S_NSSAI_8_4_3_6, 2);
+  s->sst = rc_tmpl_off(t, rc_tmpl_octet_str(t, &s_nssai[0], SST_8_4_3_6, ""));
+  s->sd = rc_tmpl_off(t, rc_tmpl_octet_str(t, &s_nssai[1], SD_8_4_3_6, ""));
+
+  s->min_ratio = rc_tmpl_off(t, rc_tmpl_element(t, &grp_param[1], Min_PRB_Policy_Ratio_8_4_3_6, INTEGER_RAN_PARAMETER_VALUE));
+  s->max_ratio = rc_tmpl_off(t, rc_tmpl_element(t, &grp_param[2], Max_PRB_Policy_Ratio_8_4_3_6, INTEGER_RAN_PARAMETER_VALUE));
+  s->ded_ratio = rc_tmpl_off(t, rc_tmpl_element(t, &grp_param[3], Dedicated_PRB_Policy_Ratio_8_4_3_6, INTEGER_RAN_PARAMETER_VALUE));
+}
+
+static
+rc_tmpl_t* build_rc_tmpl(size_t num_slices)
+{
+  rc_tmpl_t* t = calloc(1, sizeof(rc_tmpl_t) + num_slices * sizeof(rc_tmpl_slice_t));
+  assert(t != NULL && "Memory exhausted");
+  t->num_slices = num_slices;
+  // 17 pointers and well under 2 KiB per slice
+  t->cap = 512 + num_slices * 2048;
+  t->buf = calloc(1, t->cap);
+  assert(t->buf != NULL && "Memory exhausted");
+  t->reloc_cap = 2 + num_slices * 17;
+  t->reloc = calloc(t->reloc_cap, sizeof(uint32_t));
+  assert(t->reloc != NULL && "Memory exhausted");
+
+  // RRM Policy Ratio List, LIST
+  seq_ran_param_t* list = rc_tmpl_alloc(t, NULL, 1, sizeof(seq_ran_param_t));
+  list->ran_param_id = RRM_Policy_Ratio_List_8_4_3_6;
+  list->ran_param_val.type = LIST_RAN_PARAMETER_VAL_TYPE;
+  list->ran_param_val.lst = rc_tmpl_alloc(t, &list->ran_param_val.lst, 1, sizeof(ran_param_list_t));
+  list->ran_param_val.lst->sz_lst_ran_param = num_slices;
+  list->ran_param_val.lst->lst_ran_param = rc_tmpl_alloc(t, &list->ran_param_val.lst->lst_ran_param, num_slices, sizeof(lst_ran_param_t));
+
+  for (size_t i = 0; i < num_slices; i++)
+    rc_tmpl_ratio_group(t, &list->ran_param_val.lst->lst_ran_param[i], &t->slice[i]);
+
+  assert(t->reloc_len == t->reloc_cap);
+  return t;
+}
+
+static
+rc_tmpl_t const* get_rc_tmpl(size_t num_slices)
+{
+  lock_guard(&rc_tmpl_mtx);
+  if (rc_tmpl[num_slices] == NULL)
+    rc_tmpl[num_slices] = build_rc_tmpl(num_slices);
+  return rc_tmpl[num_slices];
+}
+
+static
+void patch_rc_tmpl_str(uint8_t* blk, uint32_t off, const char* str, size_t len)
+{
+  ran_parameter_value_t* v = (ran_parameter_value_t*)(blk + off);
+  v->octet_str_ran.len = len;
+  memcpy(v->octet_str_ran.buf, str, len);
+}
+
+// Same message as gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, ...), built in
+// *arena, which must be freed with free_rc_ctrl_arena(). False if the message does not fit a
+// template, i.e. too many slices or a too long SST or SD.
+static
+bool gen_rc_ctrl_slice_level_PRB_quota_tmpl(
+  const char* sst_str[],
+  const char* sd_str[],
+  const int dedicated_ratio_prb[],
+  size_t num_slices,
+  e2sm_rc_ctrl_msg_t* msg,
+  void** arena)
+{
+  if (num_slices == 0 || num_slices > RC_MAX_SLICES)
+    return false;
+  for (size_t i = 0; i < num_slices; i++) {
+    if (strlen(sst_str[i]) > RC_TMPL_STR_LEN || strlen(sd_str[i]) > RC_TMPL_STR_LEN)
+      return false;
+  }
+
+  rc_tmpl_t const* t = get_rc_tmpl(num_slices);
+  uint8_t* blk = malloc(t->len);
+  assert(blk != NULL && "Memory exhausted");
+  memcpy(blk, t->buf, t->len);
+
+  // Rebase the pointers from the template onto the copy
+  for (size_t r = 0; r < t->reloc_len; r++) {
+    uint8_t* p;
+    memcpy(&p, blk + t->reloc[r], sizeof(p));
+    p = blk + (p - t->buf);
+    memcpy(blk + t->reloc[r], &p, sizeof(p));
+  }
+
+  for (size_t i = 0; i < num_slices; i++) {
+    rc_tmpl_slice_t const* s = &t->slice[i];
+    patch_rc_tmpl_str(blk, s->sst, sst_str[i], strlen(sst_str[i]));
+    patch_rc_tmpl_str(blk, s->sd, sd_str[i], strlen(sd_str[i]));
+    // OAI only applies the dedicated ratio, min and max get the same value
+    ((ran_parameter_value_t*)(blk + s->min_ratio))->int_ran = dedicated_ratio_prb[i];
+    ((ran_parameter_value_t*)(blk + s->max_ratio))->int_ran = dedicated_ratio_prb[i];
+    ((ran_parameter_value_t*)(blk + s->ded_ratio))->int_ran = dedicated_ratio_prb[i];
+  }
+
+  *msg = (e2sm_rc_ctrl_msg_t){0};
+  msg->format = FORMAT_1_E2SM_RC_CTRL_MSG;
+  msg->frmt_1.sz_ran_param = 1;
+  msg->frmt_1.ran_param = (seq_ran_param_t*)blk;
+  *arena = blk;
+  return true;
+}
+
+// Free a control request whose message was calloc'ed (arena == NULL) or built in arena
+static
+void free_rc_ctrl_arena(rc_ctrl_req_data_t* ctrl, void* arena)
+{
+  if (arena == NULL) {
+    free_rc_ctrl_req_data(ctrl);
+    return;
+  }
+
+  free_e2sm_rc_ctrl_hdr(&ctrl->hdr);
+  free(arena);
+}
+
+// ======================================== RRM Policy Template ========================================
+
+// ======================================== Control Message Cache ========================================
+
+// The DRL agent often sends the PRB split of its previous step again. Built messages are kept in
+// a small LRU cache of RC_MSG_CACHE entries, keyed by the canonical policy: the PLMN, then the
+// slices sorted by SST and SD with their ratios. A repeated policy, in any slice order, is
+// neither rebuilt nor copied. A message is shared read only by the cache and the jobs sending
+// it, and freed with its last reference.
+//
+// FlexRIC encodes the E2SM-RC message inside control_sm_xapp_api(), so what is cached is the
+// message ready to encode, not the encoded bytes.
+
+#define RC_MSG_CACHE_MAX 1024
+#define RC_PLMN "00101"
+
+// Slices of a PRB quota message, for the control loop latency (see rc_loop)
+typedef struct {
+  size_t len;
+  struct {
+    uint8_t sst;
+    uint32_t sd;
+    int ratio;
+  } slice[];
+} rc_policy_t;
+
+typedef struct {
+  rc_ctrl_req_data_t ctrl;
+  void* arena;            // See free_rc_ctrl_arena()
+  rc_policy_t* policy;    // NULL if not a slice level PRB quota for every UE
+  uint64_t key;           // Hash of canon, 0 if never cached nor skipped
+  _Atomic size_t refs;
+  char canon[];
+} rc_msg_t;
+
+typedef struct {
+  pthread_mutex_t mtx;
+  rc_msg_t* msg[RC_MSG_CACHE_MAX];
+  uint64_t last_use[RC_MSG_CACHE_MAX];
+  size_t cap;
+  uint64_t tick;
+  _Atomic uint64_t hits;
+  _Atomic uint64_t misses;
+} rc_msg_cache_t;
+
+static rc_msg_cache_t rc_msg_cache = {
+  .mtx = PTHREAD_MUTEX_INITIALIZER,
+  .cap = 64,
+};
+
+// Takes ownership of ctrl and arena; canon NULL for a message that is never cached
+static
+rc_msg_t* new_rc_msg(rc_ctrl_req_data_t ctrl, void* arena, const char* canon, uint64_t key)
+{
+  size_t const len = canon != NULL ? strlen(canon) : 0;
+  rc_msg_t* m = malloc(sizeof(rc_msg_t) + len + 1);
+  assert(m != NULL && "Memory exhausted");
+  m->ctrl = ctrl;
+  m->arena = arena;
+  m->policy = NULL;
+  m->key = canon != NULL ? key : 0;
+  atomic_init(&m->refs, 1);
+  memcpy(m->canon, canon != NULL ? canon : "", len + 1);
+  return m;
+}
+
+static
+void put_rc_msg(rc_msg_t* m)
+{
+  if (atomic_fetch_sub(&m->refs, 1) > 1)
+    return;
+
+  free_rc_ctrl_arena(&m->ctrl, m->arena);
+  free(m->policy);
+  free(m);
+}
+
+// SD strings with a 0x prefix are hex, the others decimal as in the README examples; the
+// few SDs given as bare hex digits (see valid_rc_sd()) fall back to hex
+static
+uint32_t rc_sd_value(const char* sd_str)
+{
+  char* end = NULL;
+  if (sd_str[0] == '0' && (sd_str[1] == 'x' || sd_str[1] == 'X'))
+    return (uint32_t)strtoul(sd_str + 2, NULL, 16);
+  unsigned long const v = strtoul(sd_str, &end, 10);
+  return *end == '\0' ? (uint32_t)v : (uint32_t)strtoul(sd_str, NULL, 16);
+}
+
+static
+rc_policy_t* new_rc_policy(const char* sst_str[], const char* sd_str[], const int dedicated_ratio_prb[], size_t num_slices)
+{
+  rc_policy_t* p = malloc(sizeof(rc_policy_t) + num_slices * sizeof(p->slice[0]));
+  assert(p != NULL && "Memory exhausted");
+  p->len = num_slices;
+  for (size_t i = 0; i < num_slices; i++) {
+    p->slice[i].sst = (uint8_t)atoi(sst_str[i]);
+    p->slice[i].sd = rc_sd_value(sd_str[i]);
+    p->slice[i].ratio = dedicated_ratio_prb[i];
+  }
+  return p;
+}
+
+static
+int cmp_rc_slice(const char* sst0, const char* sd0, const char* sst1, const char* sd1)
+{
+  int const c = strcmp(sst0, sst1);
+  return c != 0 ? c : strcmp(sd0, sd1);
+}
+
+// Canonical form of a PRB policy, with every string prefixed by its length so that no SST or SD
+// can fake a separator. order[] receives the slices sorted by SST and SD. Free the result.
+static
+char* canon_rc_policy(const char* sst_str[], const char* sd_str[], const int dedicated_ratio_prb[],
+                      size_t num_slices, size_t order[])
+{
+  for (size_t i = 0; i < num_slices; i++) {
+    size_t j = i;
+    for (; j > 0 && cmp_rc_slice(sst_str[i], sd_str[i], sst_str[order[j - 1]], sd_str[order[j - 1]]) < 0; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+  }
+
+  char* canon = NULL;
+  size_t len = 0;
+  FILE* f = open_memstream(&canon, &len);
+  assert(f != NULL && "Memory exhausted");
+  fprintf(f, "%zu:%s", strlen(RC_PLMN), RC_PLMN);
+  for (size_t i = 0; i < num_slices; i++) {
+    size_t const k = order[i];
+    fprintf(f, "|%zu:%s%zu:%s=%d", strlen(sst_str[k]), sst_str[k], strlen(sd_str[k]), sd_str[k], dedicated_ratio_prb[k]);
+  }
+  fclose(f);
+  return canon;
+}
+
+// FNV-1a, never 0
+static
+uint64_t hash_rc_policy(const char* canon)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const char* c = canon; *c != '\0'; c++)
+    h = (h ^ (uint8_t)*c) * 0x100000001b3ull;
+  return h | 1;
+}
+
+// Slice level PRB quota message for the policy, with a reference for the caller (put_rc_msg()
+// it); *hit tells whether it came from the cache
+static
+rc_msg_t* get_rc_prb_msg(const char* sst_str[], const char* sd_str[], const int dedicated_ratio_prb[],
+                         size_t num_slices, bool* hit)
+{
+  size_t order[RC_MAX_SLICES];
+  assert(num_slices <= RC_MAX_SLICES);
+  char* canon = canon_rc_policy(sst_str, sd_str, dedicated_ratio_prb, num_slices, order);
+  defer({ free(canon); });
+  uint64_t const key = hash_rc_policy(canon);
+
+  rc_msg_cache_t* c = &rc_msg_cache;
+  if (c->cap > 0) {
+    lock_guard(&c->mtx);
+    for (size_t i = 0; i < c->cap; i++) {
+      rc_msg_t* m = c->msg[i];
+      if (m != NULL && m->key == key && strcmp(m->canon, canon) == 0) {
+        c->last_use[i] = ++c->tick;
+        atomic_fetch_add(&m->refs, 1);
+        atomic_fetch_add(&c->hits, 1);
+        *hit = true;
+        return m;
+      }
+    }
+  }
+  atomic_fetch_add(&c->misses, 1);
+  *hit = false;
+
+  // Built in canonical order, so that every order of the slices shares one message
+  const char* sst[RC_MAX_SLICES];
+  const char* sd[RC_MAX_SLICES];
+  int ratio[RC_MAX_SLICES];
+  for (size_t i = 0; i < num_slices; i++) {
+    sst[i] = sst_str[order[i]];
+    sd[i] = sd_str[order[i]];
+    ratio[i] = dedicated_ratio_prb[order[i]];
+  }
+
+  rc_ctrl_req_data_t rc_ctrl = {0};
+  ue_id_e2sm_t ue_id = gen_rc_ue_id(GNB_UE_ID_E2SM);
+
+  // Slice creation logic
+  rc_ctrl.hdr = gen_rc_ctrl_hdr(FORMAT_1_E2SM_RC_CTRL_HDR, ue_id, 2, Slice_level_PRB_quotal_7_6_3_1);
+  void* arena = NULL;
+  if (!gen_rc_ctrl_slice_level_PRB_quota_tmpl(sst, sd, ratio, num_slices, &rc_ctrl.msg, &arena))
+    rc_ctrl.msg = gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst, sd, ratio, num_slices);
+
+  rc_msg_t* m = new_rc_msg(rc_ctrl, arena, canon, key);
+  m->policy = new_rc_policy(sst, sd, ratio, num_slices);
+  if (c->cap == 0)
+    return m;
+
+  // Replace the least recently used entry; a concurrent miss on the same policy may insert it
+  // twice, which only costs a slot
+  lock_guard(&c->mtx);
+  size_t lru = 0;
+  for (size_t i = 0; i < c->cap; i++) {
+    if (c->msg[i] == NULL) {
+      lru = i;
+      break;
+    }
+    if (c->last_use[i] < c->last_use[lru])
+      lru = i;
+  }
+  if (c->msg[lru] != NULL)
+    put_rc_msg(c->msg[lru]);
+  atomic_fetch_add(&m->refs, 1);
+  c->msg[lru] = m;
+  c->last_use[lru] = ++c->tick;
+  return m;
+}
+
+static
+void init_rc_msg_cache(void)
+{
+  const char* cap_str = getenv("RC_MSG_CACHE");
+  if (cap_str) rc_msg_cache.cap = (size_t)atoi(cap_str);
+  if (rc_msg_cache.cap > RC_MSG_CACHE_MAX) rc_msg_cache.cap = RC_MSG_CACHE_MAX;
+  printf("[xApp]: Control message cache of %zu policies\n", rc_msg_cache.cap);
+}
+
+// ======================================== Control Message Cache ========================================
+
+// ======================================== E2 Node Registry ========================================
+
+// IDs of the connected E2 nodes, copied once from e2_nodes_xapp_api() and refreshed every
+// RC_NODE_REFRESH_MS by a background thread, so a control request only takes the read lock
+// instead of deep copying every node and its RAN functions. The xApp API reports no E2
+// setup/removal events, so changes are detected by comparing the snapshots.
+
+#define RC_MAX_NODES 64
+
+typedef struct {
+  pthread_rwlock_t lock;
+  pthread_mutex_t refresh_mtx;  // One refresh at a time
+  global_e2_node_id_t id[RC_MAX_NODES];
+  size_t len;
+  uint64_t version;             // Bumped on every change
+  int64_t refresh_ms;
+
+  // Refresh thread, stopped by stop_rc_nodes()
+  pthread_t thread;
+  bool started;
+  pthread_mutex_t stop_mtx;
+  pthread_cond_t stop_cv;
+  bool stop;
+} rc_node_reg_t;
+
+static rc_node_reg_t rc_node_reg = {
+  .lock = PTHREAD_RWLOCK_INITIALIZER,
+  .refresh_mtx = PTHREAD_MUTEX_INITIALIZER,
+  .refresh_ms = 1000,
+  .stop_mtx = PTHREAD_MUTEX_INITIALIZER,
+  .stop_cv = PTHREAD_COND_INITIALIZER,
+};
+
+static
+bool find_rc_node(global_e2_node_id_t const* id, size_t len, global_e2_node_id_t const* n)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (eq_global_e2_node_id(&id[i], n))
+      return true;
+  }
+  return false;
+}
+
+static
+void refresh_rc_nodes(void)
+{
+  lock_guard(&rc_node_reg.refresh_mtx);
+
+  e2_node_arr_xapp_t nodes = e2_nodes_xapp_api();
+  defer({ free_e2_node_arr_xapp(&nodes); });
+  size_t const len = nodes.len < RC_MAX_NODES ? nodes.len : RC_MAX_NODES;
+
+  // Only this function writes the registry, the refresh mutex makes reading it lock free here
+  bool same = len == rc_node_reg.len;
+  for (size_t i = 0; same && i < len; i++)
+    same = find_rc_node(rc_node_reg.id, rc_node_reg.len, &nodes.n[i].id);
+  if (same)
+    return;
+
+  if (nodes.len > RC_MAX_NODES)
+    printf("[xApp]: %d E2 nodes connected, only the first %d are controlled\n", (int)nodes.len, RC_MAX_NODES);
+
+  global_e2_node_id_t old[RC_MAX_NODES];
+  size_t const old_len = rc_node_reg.len;
+
+  pthread_rwlock_wrlock(&rc_node_reg.lock);
+  memcpy(old, rc_node_reg.id, old_len * sizeof(global_e2_node_id_t));
+  for (size_t i = 0; i < len; i++)
+    rc_node_reg.id[i] = cp_global_e2_node_id(&nodes.n[i].id);
+  rc_node_reg.len = len;
+  rc_node_reg.version++;
+  pthread_rwlock_unlock(&rc_node_reg.lock);
+
+  for (size_t i = 0; i < old_len; i++) {
+    if (!find_rc_node(rc_node_reg.id, len, &old[i]))
+      printf("[xApp]: E2 node nb_id = %u removed\n", old[i].nb_id.nb_id);
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!find_rc_node(old, old_len, &rc_node_reg.id[i]))
+      printf("[xApp]: E2 node nb_id = %u connected\n", rc_node_reg.id[i].nb_id.nb_id);
+  }
+  printf("[xApp]: Connected E2 nodes = %zu\n", len);
+
+  for (size_t i = 0; i < old_len; i++)
+    free_global_e2_node_id(&old[i]);
+}
+
+static
+void* rc_node_refresh_thread(void* arg)
+{
+  (void)arg;
+  int64_t wake_us = time_now_us() + rc_node_reg.refresh_ms * 1000;
+  pthread_mutex_lock(&rc_node_reg.stop_mtx);
+  while (!rc_node_reg.stop) {
+    if (time_now_us() >= wake_us) {
+      pthread_mutex_unlock(&rc_node_reg.stop_mtx);
+      refresh_rc_nodes();
+      pthread_mutex_lock(&rc_node_reg.stop_mtx);
+      wake_us = time_now_us() + rc_node_reg.refresh_ms * 1000;
+      continue;
+    }
+    struct timespec const wake = {.tv_sec = wake_us / 1000000, .tv_nsec = (wake_us % 1000000) * 1000};
+    pthread_cond_timedwait(&rc_node_reg.stop_cv, &rc_node_reg.stop_mtx, &wake);
+  }
+  pthread_mutex_unlock(&rc_node_reg.stop_mtx);
+  return NULL;
+}
+
+// Call once, after init_xapp_api()
+static
+void init_rc_nodes(void)
+{
+  const char* refresh_str = getenv("RC_NODE_REFRESH_MS");
+  if (refresh_str) rc_node_reg.refresh_ms = atoi(refresh_str);
+
+  refresh_rc_nodes();
+
+  if (rc_node_reg.refresh_ms <= 0) {
+    printf("[xApp]: E2 node registry refreshed only when empty\n");
+    return;
+  }
+  int const rc = pthread_create(&rc_node_reg.thread, NULL, rc_node_refresh_thread, NULL);
+  assert(rc == 0);
+  rc_node_reg.started = true;
+}
+
+// Call before try_stop_xapp_api(), the refresh thread reads the E2 nodes through the xApp API
+static
+void stop_rc_nodes(void)
+{
+  if (!rc_node_reg.started)
+    return;
+
+  pthread_mutex_lock(&rc_node_reg.stop_mtx);
+  rc_node_reg.stop = true;
+  pthread_cond_signal(&rc_node_reg.stop_cv);
+  pthread_mutex_unlock(&rc_node_reg.stop_mtx);
+  pthread_join(rc_node_reg.thread, NULL);
+  rc_node_reg.started = false;
+}
+
+// ======================================== E2 Node Registry ========================================
+
+// ======================================== UE Directory ========================================
+
+// Where every UE is served, learned from the UE reports of the KPM subscriptions (see
+// RC_KPM_SLICES): amf_ue_ngap_id -> UE ID as reported, ran_ue_id, serving E2 node and slice.
+// Handovers and per-UE PRB quotas are built with the UE ID the node reported and sent to that
+// node only. The layout is the one of the UE table of the KPM xApp: a pool of RC_UE_DIR_SIZE
+// entries behind an open-addressing index of (hash tag, entry). A UE not reported for
+// RC_UE_EXPIRE_MS is dropped. Only gNB UE IDs (gNB-mono, CU, CU-CP) carry an amf_ue_ngap_id;
+// reports with other UE ID types are counted and skipped.
+
+typedef struct {
+  uint64_t amf_ue_ngap_id;
+  ue_id_e2sm_t ue_id;       // Copy of the last report's
+  bool has_ran_ue_id;
+  uint64_t ran_ue_id;
+  global_e2_node_id_t const* node; // Serving E2 node, the one reporting the UE (see rc_kpm_sub_ctx_t)
+  uint8_t sst;
+  uint32_t sd;
+  int64_t last_seen_us;
+} rc_ue_t;
+
+typedef struct {
+  uint32_t tag;    // High bits of the key hash, 0 = empty
+  uint32_t entry;  // Index into the pool
+} rc_ue_slot_t;
+
+static struct {
+  pthread_mutex_t mtx;
+  rc_ue_t* pool;
+  uint32_t* free_lst;
+  size_t free_len;
+  size_t cap;
+
+  rc_ue_slot_t* idx;
+  size_t idx_mask;
+  size_t len;
+
+  _Atomic bool fed;         // A KPM report added a UE; until then UE IDs are derived
+  int64_t expire_us;
+  int64_t last_sweep_us;
+  uint64_t moved;           // Reported by another node or in another slice than before
+  uint64_t dropped;         // Directory full
+  uint64_t unsupported;     // UE ID without amf_ue_ngap_id
+} rc_ue_dir = {
+  .mtx = PTHREAD_MUTEX_INITIALIZER,
+  .expire_us = 10000000,
+};
+
+static
+uint64_t hash_rc_ue(uint64_t amf_ue_ngap_id)
+{
+  // splitmix64 finalizer
+  uint64_t h = amf_ue_ngap_id + 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
+
+static
+uint32_t tag_rc_ue_hash(uint64_t h)
+{
+  uint32_t const tag = (uint32_t)(h >> 32);
+  return tag == 0 ? 1 : tag;
+}
+
+// Call once, before the KPM subscriptions
+static
+void init_rc_ue_dir(void)
+{
+  size_t cap = 1024;
+  const char* cap_str = getenv("RC_UE_DIR_SIZE");
+  if (cap_str != NULL && atoi(cap_str) > 0)
+    cap = (size_t)atoi(cap_str);
+  const char* expire_str = getenv("RC_UE_EXPIRE_MS");
+  if (expire_str != NULL && atoi(expire_str) > 0)
+    rc_ue_dir.expire_us = (int64_t)atoi(expire_str) * 1000;
+
+  rc_ue_dir.cap = cap;
+  rc_ue_dir.pool = calloc(cap, sizeof(rc_ue_t));
+  assert(rc_ue_dir.pool != NULL && "Memory exhausted");
+  rc_ue_dir.free_lst = calloc(cap, sizeof(uint32_t));
+  assert(rc_ue_dir.free_lst != NULL && "Memory exhausted");
+  for (size_t i = 0; i < cap; i++)
+    rc_ue_dir.free_lst[i] = (uint32_t)(cap - 1 - i);
+  rc_ue_dir.free_len = cap;
+
+  // Keep the load factor at or below 0.5
+  size_t idx_sz = 1;
+  while (idx_sz < 2 * cap)
+    idx_sz <<= 1;
+  rc_ue_dir.idx = calloc(idx_sz, sizeof(rc_ue_slot_t));
+  assert(rc_ue_dir.idx != NULL && "Memory exhausted");
+  rc_ue_dir.idx_mask = idx_sz - 1;
+}
+
+// Call the following with rc_ue_dir.mtx held
+
+// Index slot of the UE, or the empty slot ending its probe sequence
+static
+size_t find_rc_ue_slot(uint64_t amf_ue_ngap_id, uint64_t h)
+{
+  uint32_t const tag = tag_rc_ue_hash(h);
+  size_t i = h & rc_ue_dir.idx_mask;
+  while (rc_ue_dir.idx[i].tag != 0) {
+    if (rc_ue_dir.idx[i].tag == tag && rc_ue_dir.pool[rc_ue_dir.idx[i].entry].amf_ue_ngap_id == amf_ue_ngap_id)
+      return i;
+    i = (i + 1) & rc_ue_dir.idx_mask;
+  }
+  return i;
+}
+
+// Backward-shift deletion, keeps probe sequences intact without tombstones
+static
+void rm_rc_ue_slot(size_t hole)
+{
+  uint32_t const entry = rc_ue_dir.idx[hole].entry;
+  free_ue_id_e2sm(&rc_ue_dir.pool[entry].ue_id);
+  rc_ue_dir.free_lst[rc_ue_dir.free_len++] = entry;
+  rc_ue_dir.len--;
+
+  size_t i = hole;
+  for (;;) {
+    i = (i + 1) & rc_ue_dir.idx_mask;
+    if (rc_ue_dir.idx[i].tag == 0)
+      break;
+
+    size_t const home = hash_rc_ue(rc_ue_dir.pool[rc_ue_dir.idx[i].entry].amf_ue_ngap_id) & rc_ue_dir.idx_mask;
+    // Move the slot back unless its home lies cyclically in (hole, i]
+    bool const stays = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+    if (stays)
+      continue;
+
+    rc_ue_dir.idx[hole] = rc_ue_dir.idx[i];
+    hole = i;
+  }
+  rc_ue_dir.idx[hole].tag = 0;
+  rc_ue_dir.idx[hole].entry = 0;
+}
+
+static
+void expire_rc_ues(int64_t now)
+{
+  size_t expired = 0;
+  size_t i = 0;
+  while (i <= rc_ue_dir.idx_mask) {
+    if (rc_ue_dir.idx[i].tag != 0 && now - rc_ue_dir.pool[rc_ue_dir.idx[i].entry].last_seen_us > rc_ue_dir.expire_us) {
+      rm_rc_ue_slot(i);
+      expired++;
+      // Slot i may now hold a shifted entry, check it again
+      continue;
+    }
+    i++;
+  }
+  if (expired > 0)
+    printf("[xApp]: %zu UEs not reported for %ld ms left the directory, %zu known\n",
+           expired, (long)(rc_ue_dir.expire_us / 1000), rc_ue_dir.len);
+}
+
+// UE reports of one KPM indication of slice sst/sd from the E2 node node, which must outlive the
+// directory
+static
+void note_rc_ues(kpm_ind_msg_format_3_t const* msg_frm_3, global_e2_node_id_t const* node, uint8_t sst, uint32_t sd, int64_t now)
+{
+  if (rc_ue_dir.cap == 0)
+    return;
+
+  lock_guard(&rc_ue_dir.mtx);
+  if (now - rc_ue_dir.last_sweep_us > 1000000) {
+    rc_ue_dir.last_sweep_us = now;
+    expire_rc_ues(now);
+  }
+
+  for (size_t i = 0; i < msg_frm_3->ue_meas_report_lst_len; i++) {
+    ue_id_e2sm_t const* ue_id = &msg_frm_3->meas_report_per_ue[i].ue_meas_report_lst;
+    if (ue_id->type != GNB_UE_ID_E2SM) {
+      rc_ue_dir.unsupported++;
+      continue;
+    }
+
+    uint64_t const amf_ue_ngap_id = ue_id->gnb.amf_ue_ngap_id;
+    uint64_t const h = hash_rc_ue(amf_ue_ngap_id);
+    size_t const s = find_rc_ue_slot(amf_ue_ngap_id, h);
+    rc_ue_t* e;
+    if (rc_ue_dir.idx[s].tag != 0) {
+      e = &rc_ue_dir.pool[rc_ue_dir.idx[s].entry];
+      // A CU, its DUs and CU-UPs share the nb_id, compare the whole E2 node ID
+      bool const same_node = e->node == node || eq_global_e2_node_id(e->node, node);
+      if (!same_node || e->sst != sst || e->sd != sd)
+        rc_ue_dir.moved++;
+      // The UE ID only changes with the serving node, do not copy it on every report
+      if (!same_node || !eq_ue_id_e2sm(&e->ue_id, ue_id)) {
+        free_ue_id_e2sm(&e->ue_id);
+        e->ue_id = cp_ue_id_e2sm(ue_id);
+      }
+    } else {
+      if (rc_ue_dir.free_len == 0) {
+        rc_ue_dir.dropped++;
+        continue;
+      }
+      uint32_t const entry = rc_ue_dir.free_lst[--rc_ue_dir.free_len];
+      rc_ue_dir.idx[s].tag = tag_rc_ue_hash(h);
+      rc_ue_dir.idx[s].entry = entry;
+      rc_ue_dir.len++;
+      e = &rc_ue_dir.pool[entry];
+      e->amf_ue_ngap_id = amf_ue_ngap_id;
+      e->ue_id = cp_ue_id_e2sm(ue_id);
+      rc_ue_dir.fed = true;
+    }
+
+    e->has_ran_ue_id = ue_id->gnb.ran_ue_id != NULL;
+    e->ran_ue_id = e->has_ran_ue_id ? *ue_id->gnb.ran_ue_id : 0;
+    e->node = node;
+    e->sst = sst;
+    e->sd = sd;
+    e->last_seen_us = now;
+  }
+}
+
+// Serving node of the UE and a copy of its UE ID (free_ue_id_e2sm() it); false if unknown
+static
+bool find_rc_ue(uint64_t amf_ue_ngap_id, ue_id_e2sm_t* ue_id, global_e2_node_id_t const** node)
+{
+  if (rc_ue_dir.cap == 0)
+    return false;
+
+  lock_guard(&rc_ue_dir.mtx);
+  size_t const s = find_rc_ue_slot(amf_ue_ngap_id, hash_rc_ue(amf_ue_ngap_id));
+  if (rc_ue_dir.idx[s].tag == 0)
+    return false;
+  rc_ue_t const* e = &rc_ue_dir.pool[rc_ue_dir.idx[s].entry];
+  if (time_now_us() - e->last_seen_us > rc_ue_dir.expire_us)
+    return false;
+
+  *ue_id = cp_ue_id_e2sm(&e->ue_id);
+  *node = e->node;
+  return true;
+}
+
+// The UE, or NULL if unknown
+static
+struct json_object *rc_ue_to_json(uint64_t amf_ue_ngap_id)
+{
+  if (rc_ue_dir.cap == 0)
+    return NULL;
+
+  lock_guard(&rc_ue_dir.mtx);
+  size_t const s = find_rc_ue_slot(amf_ue_ngap_id, hash_rc_ue(amf_ue_ngap_id));
+  if (rc_ue_dir.idx[s].tag == 0)
+    return NULL;
+  rc_ue_t const* e = &rc_ue_dir.pool[rc_ue_dir.idx[s].entry];
+  int64_t const age_us = time_now_us() - e->last_seen_us;
+  if (age_us > rc_ue_dir.expire_us)
+    return NULL;
+
+  char sd[16];
+  snprintf(sd, sizeof(sd), "0x%06x", e->sd);
+  struct json_object *root = json_object_new_object();
+  json_object_object_add(root, "amf_ue_ngap_id", json_object_new_int64((int64_t)e->amf_ue_ngap_id));
+  if (e->has_ran_ue_id)
+    json_object_object_add(root, "ran_ue_id", json_object_new_int64((int64_t)e->ran_ue_id));
+  json_object_object_add(root, "nb_id", json_object_new_int64(e->node->nb_id.nb_id));
+  if (e->node->cu_du_id != NULL)
+    json_object_object_add(root, "cu_du_id", json_object_new_int64((int64_t)*e->node->cu_du_id));
+  json_object_object_add(root, "sst", json_object_new_int(e->sst));
+  json_object_object_add(root, "sd", json_object_new_string(sd));
+  json_object_object_add(root, "age_ms", json_object_new_int64(age_us / 1000));
+  json_object_object_add(root, "known_ues", json_object_new_int64((int64_t)rc_ue_dir.len));
+  return root;
+}
+
+// ======================================== UE Directory ========================================
+
+// ======================================== Control Loop Latency ========================================
+
+// How long a PRB policy takes to act on the RAN, which bounds the step period of the DRL agent.
+// Every lane reports when it sent a PRB quota message and when its E2 node acked it. With
+// RC_KPM_SLICES set, the xApp also subscribes to RRU.PrbTotDl of those slices on every node (the
+// report style 4 subscription of xapp_kpm_moni_3slices.c). A slice whose dedicated ratio changed
+// then waits for the first indication collected after the ack in which its PRB usage moved in
+// the direction of the change by at least RC_LOOP_MIN_DELTA percent; a newer policy for the
+// slice supersedes the wait, and no move within RC_LOOP_TIMEOUT_MS counts as a timeout. GET
+// /loop serves the histograms per slice and the last RC_LOOP_RECENT effects.
+//
+//   RC_KPM_SLICES       comma separated sst:sd[:report_ms], e.g. "1:0x000001:100,128:0x000080:100" (default: none, acks only)
+//   RC_LOOP_MIN_DELTA   PRB usage change that counts as the effect, in percent of the usage before (default 10)
+//   RC_LOOP_TIMEOUT_MS  wait for the effect at most this long after the ack (default 5000)
+
+#define RC_LOOP_MAX_SLICES 16
+#define RC_LOOP_MAX_TRACKS 256
+#define RC_LOOP_RECENT 32
+#define RC_KPM_MAX_SUBS 64
+
+// Same log-linear histogram as kpm_hist_t of the KPM xApp, guarded by rc_loop.mtx: values in
+// [2^e, 2^(e+1)) are split into RC_HIST_SUB linear buckets
+#define RC_HIST_SUB_BITS 3
+#define RC_HIST_SUB (1u << RC_HIST_SUB_BITS)
+#define RC_HIST_BUCKETS ((64 - RC_HIST_SUB_BITS + 1) * RC_HIST_SUB)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t bucket[RC_HIST_BUCKETS];
+} rc_hist_t;
+
+typedef struct {
+  uint8_t sst;
+  uint32_t sd;
+  uint32_t report_period_ms;  // 0 if not in RC_KPM_SLICES
+  rc_hist_t ack;              // Send -> E2 control ack [us]
+  rc_hist_t effect;           // Send -> indication showing the change [us]
+  rc_hist_t loop;             // Job created (request accepted) -> same indication [us]
+  uint64_t timeouts;
+  uint64_t superseded;
+} rc_loop_slice_t;
+
+// A slice on one E2 node
+typedef struct {
+  uint32_t nb_id;
+  rc_loop_slice_t* slice;
+  bool kpm;                   // Subscribed to the slice on this node
+  int ratio;                  // Last acked dedicated ratio, -1 before the first ack
+
+  // Waiting for the effect of the last change
+  bool pending;
+  int expect;                 // +1 usage should grow, -1 shrink, 0 any move (ratio was unknown)
+  uint64_t job_id;
+  int64_t created_us;
+  int64_t sent_us;
+  int64_t ack_us;
+  bool have_base;
+  double base;                // Usage before the change
+
+  bool have_prb;
+  double prb;                 // Usage of the last indication
+} rc_loop_track_t;
+
+typedef struct {
+  uint64_t job_id;
+  uint32_t nb_id;
+  uint8_t sst;
+  uint32_t sd;
+  int ratio;
+  int64_t ack_us;             // Send -> ack
+  int64_t effect_us;          // Send -> effect, -1 on timeout
+} rc_loop_sample_t;
+
+static struct {
+  pthread_mutex_t mtx;
+  rc_loop_slice_t slice[RC_LOOP_MAX_SLICES];
+  size_t slice_len;
+  rc_loop_track_t track[RC_LOOP_MAX_TRACKS];
+  size_t track_len;
+  rc_loop_sample_t recent[RC_LOOP_RECENT];
+  uint64_t recent_len;        // Ever pushed, recent[] is a ring
+  bool kpm;                   // Subscribed to at least one slice
+  double min_delta_pct;
+  int64_t timeout_us;
+} rc_loop = {
+  .mtx = PTHREAD_MUTEX_INITIALIZER,
+  .min_delta_pct = 10,
+  .timeout_us = 5000000,
+};
+
+static inline
+size_t rc_hist_idx(uint64_t v)
+{
+  if (v < RC_HIST_SUB)
+    return (size_t)v;
+  unsigned const e = 63 - (unsigned)__builtin_clzll(v);
+  return (size_t)(e - RC_HIST_SUB_BITS + 1) * RC_HIST_SUB + ((v >> (e - RC_HIST_SUB_BITS)) & (RC_HIST_SUB - 1));
+}
+
+// Largest value falling into bucket idx
+static
+uint64_t rc_hist_upper(size_t idx)
+{
+  if (idx < RC_HIST_SUB)
+    return idx;
+  unsigned const shift = (unsigned)(idx / RC_HIST_SUB) - 1;
+  uint64_t const lower = (uint64_t)(RC_HIST_SUB + idx % RC_HIST_SUB) << shift;
+  return lower + ((uint64_t)1 << shift) - 1;
+}
+
+static
+void rc_hist_record(rc_hist_t* h, int64_t v)
+{
+  uint64_t const u = v > 0 ? (uint64_t)v : 0;
+  h->bucket[rc_hist_idx(u)]++;
+  h->count++;
+  h->sum += u;
+  if (u > h->max)
+    h->max = u;
+}
+
+// Nearest-rank quantile permille/1000, as the upper bound of its bucket
+static
+uint64_t rc_hist_quantile(rc_hist_t const* h, uint64_t permille)
+{
+  if (h->count == 0)
+    return 0;
+
+  uint64_t const rank = (h->count * permille + 999) / 1000;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < RC_HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen >= rank && seen > 0) {
+      uint64_t const upper = rc_hist_upper(i);
+      return upper < h->max ? upper : h->max;
+    }
+  }
+  return h->max;
+}
+
+static
+struct json_object *rc_hist_to_json(rc_hist_t const* h)
+{
+  struct json_object *o = json_object_new_object();
+  json_object_object_add(o, "count", json_object_new_int64((int64_t)h->count));
+  json_object_object_add(o, "mean_us", json_object_new_int64(h->count > 0 ? (int64_t)(h->sum / h->count) : 0));
+  json_object_object_add(o, "p50_us", json_object_new_int64((int64_t)rc_hist_quantile(h, 500)));
+  json_object_object_add(o, "p90_us", json_object_new_int64((int64_t)rc_hist_quantile(h, 900)));
+  json_object_object_add(o, "p99_us", json_object_new_int64((int64_t)rc_hist_quantile(h, 990)));
+  json_object_object_add(o, "max_us", json_object_new_int64((int64_t)h->max));
+
+  // Non empty buckets as [upper bound, count]
+  struct json_object *buckets = json_object_new_array();
+  for (size_t i = 0; i < RC_HIST_BUCKETS; i++) {
+    if (h->bucket[i] == 0)
+      continue;
+    struct json_object *b = json_object_new_array();
+    json_object_array_add(b, json_object_new_int64((int64_t)rc_hist_upper(i)));
+    json_object_array_add(b, json_object_new_int64((int64_t)h->bucket[i]));
+    json_object_array_add(buckets, b);
+  }
+  json_object_object_add(o, "buckets", buckets);
+  return o;
+}
+
+// Call the following with rc_loop.mtx held
+
+static
+rc_loop_slice_t* find_rc_loop_slice(uint8_t sst, uint32_t sd)
+{
+  for (size_t i = 0; i < rc_loop.slice_len; i++) {
+    if (rc_loop.slice[i].sst == sst && rc_loop.slice[i].sd == sd)
+      return &rc_loop.slice[i];
+  }
+  if (rc_loop.slice_len == RC_LOOP_MAX_SLICES)
+    return NULL;
+
+  rc_loop_slice_t* s = &rc_loop.slice[rc_loop.slice_len++];
+  s->sst = sst;
+  s->sd = sd;
+  return s;
+}
+
+static
+rc_loop_track_t* find_rc_loop_track(uint32_t nb_id, rc_loop_slice_t* s)
+{
+  for (size_t i = 0; i < rc_loop.track_len; i++) {
+    if (rc_loop.track[i].nb_id == nb_id && rc_loop.track[i].slice == s)
+      return &rc_loop.track[i];
+  }
+  if (rc_loop.track_len == RC_LOOP_MAX_TRACKS)
+    return NULL;
+
+  rc_loop_track_t* t = &rc_loop.track[rc_loop.track_len++];
+  t->nb_id = nb_id;
+  t->slice = s;
+  t->ratio = -1;
+  return t;
+}
+
+static
+void push_rc_loop_sample(rc_loop_track_t const* t, int64_t effect_us)
+{
+  rc_loop_sample_t* r = &rc_loop.recent[rc_loop.recent_len++ % RC_LOOP_RECENT];
+  r->job_id = t->job_id;
+  r->nb_id = t->nb_id;
+  r->sst = t->slice->sst;
+  r->sd = t->slice->sd;
+  r->ratio = t->ratio;
+  r->ack_us = t->ack_us - t->sent_us;
+  r->effect_us = effect_us;
+}
+
+static
+void sweep_rc_loop(int64_t now)
+{
+  for (size_t i = 0; i < rc_loop.track_len; i++) {
+    rc_loop_track_t* t = &rc_loop.track[i];
+    if (t->pending && now - t->ack_us > rc_loop.timeout_us) {
+      t->pending = false;
+      t->slice->timeouts++;
+      push_rc_loop_sample(t, -1);
+    }
+  }
+}
+
+// Called by the lane of E2 node nb_id once the node acked a PRB quota message of job job_id
+static
+void note_rc_loop_ack(rc_policy_t const* p, uint32_t nb_id, uint64_t job_id, int64_t created_us, int64_t sent_us, int64_t ack_us)
+{
+  lock_guard(&rc_loop.mtx);
+
+  for (size_t i = 0; i < p->len; i++) {
+    rc_loop_slice_t* s = find_rc_loop_slice(p->slice[i].sst, p->slice[i].sd);
+    if (s == NULL)
+      continue;
+    rc_hist_record(&s->ack, ack_us - sent_us);
+
+    rc_loop_track_t* t = find_rc_loop_track(nb_id, s);
+    int const ratio = p->slice[i].ratio;
+    if (t == NULL || ratio == t->ratio)
+      continue;
+
+    if (t->pending)
+      s->superseded++;
+    // Only the slices subscribed to can show an effect
+    t->pending = t->kpm;
+    t->expect = t->ratio < 0 ? 0 : (ratio > t->ratio ? 1 : -1);
+    t->ratio = ratio;
+    t->job_id = job_id;
+    t->created_us = created_us;
+    t->sent_us = sent_us;
+    t->ack_us = ack_us;
+    t->have_base = t->have_prb;
+    t->base = t->prb;
+  }
+}
+
+// PRB usage prb of a slice on E2 node nb_id, measured from collect_us and received at now
+static
+void note_rc_loop_prb(uint32_t nb_id, rc_loop_slice_t* s, double prb, int64_t collect_us, int64_t now)
+{
+  lock_guard(&rc_loop.mtx);
+  sweep_rc_loop(now);
+
+  rc_loop_track_t* t = find_rc_loop_track(nb_id, s);
+  if (t == NULL)
+    return;
+  t->prb = prb;
+  t->have_prb = true;
+  if (!t->pending)
+    return;
+
+  // Measured (partly) under the previous policy
+  if (collect_us < t->ack_us || !t->have_base) {
+    t->base = prb;
+    t->have_base = true;
+    return;
+  }
+
+  double const delta = prb - t->base;
+  double min_delta = t->base * rc_loop.min_delta_pct / 100;
+  if (min_delta < 1)
+    min_delta = 1;
+  bool const moved = t->expect > 0 ? delta >= min_delta
+                   : t->expect < 0 ? -delta >= min_delta
+                   : (delta >= min_delta || -delta >= min_delta);
+  if (!moved)
+    return;
+
+  t->pending = false;
+  rc_hist_record(&s->effect, now - t->sent_us);
+  rc_hist_record(&s->loop, now - t->created_us);
+  push_rc_loop_sample(t, now - t->sent_us);
+}
+
+static
+struct json_object *rc_loop_to_json(void)
+{
+  lock_guard(&rc_loop.mtx);
+  sweep_rc_loop(time_now_us());
+
+  struct json_object *root = json_object_new_object();
+  json_object_object_add(root, "kpm", json_object_new_boolean(rc_loop.kpm));
+  json_object_object_add(root, "min_delta_pct", json_object_new_double(rc_loop.min_delta_pct));
+  json_object_object_add(root, "timeout_ms", json_object_new_int64(rc_loop.timeout_us / 1000));
+
+  struct json_object *slices = json_object_new_array();
+  for (size_t i = 0; i < rc_loop.slice_len; i++) {
+    rc_loop_slice_t const* s = &rc_loop.slice[i];
+    size_t pending = 0;
+    for (size_t j = 0; j < rc_loop.track_len; j++)
+      pending += rc_loop.track[j].slice == s && rc_loop.track[j].pending;
+
+    char sd[16];
+    snprintf(sd, sizeof(sd), "0x%06x", s->sd);
+    struct json_object *o = json_object_new_object();
+    json_object_object_add(o, "sst", json_object_new_int(s->sst));
+    json_object_object_add(o, "sd", json_object_new_string(sd));
+    json_object_object_add(o, "kpm_report_ms", json_object_new_int64(s->report_period_ms));
+    json_object_object_add(o, "ack", rc_hist_to_json(&s->ack));
+    json_object_object_add(o, "effect", rc_hist_to_json(&s->effect));
+    json_object_object_add(o, "loop", rc_hist_to_json(&s->loop));
+    json_object_object_add(o, "pending", json_object_new_int64((int64_t)pending));
+    json_object_object_add(o, "timeouts", json_object_new_int64((int64_t)s->timeouts));
+    json_object_object_add(o, "superseded", json_object_new_int64((int64_t)s->superseded));
+    json_object_array_add(slices, o);
+  }
+  json_object_object_add(root, "slices", slices);
+
+  // Oldest first
+  struct json_object *recent = json_object_new_array();
+  uint64_t const first = rc_loop.recent_len > RC_LOOP_RECENT ? rc_loop.recent_len - RC_LOOP_RECENT : 0;
+  for (uint64_t k = first; k < rc_loop.recent_len; k++) {
+    rc_loop_sample_t const* r = &rc_loop.recent[k % RC_LOOP_RECENT];
+    char sd[16];
+    snprintf(sd, sizeof(sd), "0x%06x", r->sd);
+    struct json_object *o = json_object_new_object();
+    json_object_object_add(o, "job_id", json_object_new_int64((int64_t)r->job_id));
+    json_object_object_add(o, "nb_id", json_object_new_int64(r->nb_id));
+    json_object_object_add(o, "sst", json_object_new_int(r->sst));
+    json_object_object_add(o, "sd", json_object_new_string(sd));
+    json_object_object_add(o, "dedicated_ratio_prb", json_object_new_int(r->ratio));
+    json_object_object_add(o, "ack_us", json_object_new_int64(r->ack_us));
+    json_object_object_add(o, "effect_us", r->effect_us >= 0 ? json_object_new_int64(r->effect_us) : NULL);
+    json_object_array_add(recent, o);
+  }
+  json_object_object_add(root, "recent", recent);
+  return root;
+}
+
+// FlexRIC hands the indication callback nothing but the indication, so every subscription
+// gets its own trampoline, as in the KPM xApp
+
+typedef struct {
+  uint32_t nb_id;
+  global_e2_node_id_t node;   // Copy, kept for the UE directory until the xApp exits
+  rc_loop_slice_t* slice;
+  bool subscribed;
+  int handle;               // Removed at shutdown
+} rc_kpm_sub_ctx_t;
+
+static rc_kpm_sub_ctx_t rc_kpm_sub_ctx[RC_KPM_MAX_SUBS];
+
+static size_t rc_kpm_sub_ctx_len = 0;
+
+static
+void sm_cb_rc_kpm(sm_ag_if_rd_t const* rd, rc_kpm_sub_ctx_t const* ctx);
+
+#define RC_KPM_SUB_CB(i) \
+  static void sm_cb_rc_kpm_sub_##i(sm_ag_if_rd_t const* rd) { sm_cb_rc_kpm(rd, &rc_kpm_sub_ctx[i]); }
+
+RC_KPM_SUB_CB(0)  RC_KPM_SUB_CB(1)  RC_KPM_SUB_CB(2)  RC_KPM_SUB_CB(3)  RC_KPM_SUB_CB(4)  RC_KPM_SUB_CB(5)  RC_KPM_SUB_CB(6)  RC_KPM_SUB_CB(7)
+RC_KPM_SUB_CB(8)  RC_KPM_SUB_CB(9)  RC_KPM_SUB_CB(10) RC_KPM_SUB_CB(11) RC_KPM_SUB_CB(12) RC_KPM_SUB_CB(13) RC_KPM_SUB_CB(14) RC_KPM_SUB_CB(15)
+RC_KPM_SUB_CB(16) RC_KPM_SUB_CB(17) RC_KPM_SUB_CB(18) RC_KPM_SUB_CB(19) RC_KPM_SUB_CB(20) RC_KPM_SUB_CB(21) RC_KPM_SUB_CB(22) RC_KPM_SUB_CB(23)
+RC_KPM_SUB_CB(24) RC_KPM_SUB_CB(25) RC_KPM_SUB_CB(26) RC_KPM_SUB_CB(27) RC_KPM_SUB_CB(28) RC_KPM_SUB_CB(29) RC_KPM_SUB_CB(30) RC_KPM_SUB_CB(31)
+RC_KPM_SUB_CB(32) RC_KPM_SUB_CB(33) RC_KPM_SUB_CB(34) RC_KPM_SUB_CB(35) RC_KPM_SUB_CB(36) RC_KPM_SUB_CB(37) RC_KPM_SUB_CB(38) RC_KPM_SUB_CB(39)
+RC_KPM_SUB_CB(40) RC_KPM_SUB_CB(41) RC_KPM_SUB_CB(42) RC_KPM_SUB_CB(43) RC_KPM_SUB_CB(44) RC_KPM_SUB_CB(45) RC_KPM_SUB_CB(46) RC_KPM_SUB_CB(47)
+RC_KPM_SUB_CB(48) RC_KPM_SUB_CB(49) RC_KPM_SUB_CB(50) RC_KPM_SUB_CB(51) RC_KPM_SUB_CB(52) RC_KPM_SUB_CB(53) RC_KPM_SUB_CB(54) RC_KPM_SUB_CB(55)
+RC_KPM_SUB_CB(56) RC_KPM_SUB_CB(57) RC_KPM_SUB_CB(58) RC_KPM_SUB_CB(59) RC_KPM_SUB_CB(60) RC_KPM_SUB_CB(61) RC_KPM_SUB_CB(62) RC_KPM_SUB_CB(63)
+
+static
+sm_cb const rc_kpm_sub_cb[RC_KPM_MAX_SUBS] = {
+  sm_cb_rc_kpm_sub_0,  sm_cb_rc_kpm_sub_1,  sm_cb_rc_kpm_sub_2,  sm_cb_rc_kpm_sub_3,  sm_cb_rc_kpm_sub_4,  sm_cb_rc_kpm_sub_5,  sm_cb_rc_kpm_sub_6,  sm_cb_rc_kpm_sub_7,
+  sm_cb_rc_kpm_sub_8,  sm_cb_rc_kpm_sub_9,  sm_cb_rc_kpm_sub_10, sm_cb_rc_kpm_sub_11, sm_cb_rc_kpm_sub_12, sm_cb_rc_kpm_sub_13, sm_cb_rc_kpm_sub_14, sm_cb_rc_kpm_sub_15,
+  sm_cb_rc_kpm_sub_16, sm_cb_rc_kpm_sub_17, sm_cb_rc_kpm_sub_18, sm_cb_rc_kpm_sub_19, sm_cb_rc_kpm_sub_20, sm_cb_rc_kpm_sub_21, sm_cb_rc_kpm_sub_22, sm_cb_rc_kpm_sub_23,
+  sm_cb_rc_kpm_sub_24, sm_cb_rc_kpm_sub_25, sm_cb_rc_kpm_sub_26, sm_cb_rc_kpm_sub_27, sm_cb_rc_kpm_sub_28, sm_cb_rc_kpm_sub_29, sm_cb_rc_kpm_sub_30, sm_cb_rc_kpm_sub_31,
+  sm_cb_rc_kpm_sub_32, sm_cb_rc_kpm_sub_33, sm_cb_rc_kpm_sub_34, sm_cb_rc_kpm_sub_35, sm_cb_rc_kpm_sub_36, sm_cb_rc_kpm_sub_37, sm_cb_rc_kpm_sub_38, sm_cb_rc_kpm_sub_39,
+  sm_cb_rc_kpm_sub_40, sm_cb_rc_kpm_sub_41, sm_cb_rc_kpm_sub_42, sm_cb_rc_kpm_sub_43, sm_cb_rc_kpm_sub_44, sm_cb_rc_kpm_sub_45, sm_cb_rc_kpm_sub_46, sm_cb_rc_kpm_sub_47,
+  sm_cb_rc_kpm_sub_48, sm_cb_rc_kpm_sub_49, sm_cb_rc_kpm_sub_50, sm_cb_rc_kpm_sub_51, sm_cb_rc_kpm_sub_52, sm_cb_rc_kpm_sub_53, sm_cb_rc_kpm_sub_54, sm_cb_rc_kpm_sub_55,
+  sm_cb_rc_kpm_sub_56, sm_cb_rc_kpm_sub_57, sm_cb_rc_kpm_sub_58, sm_cb_rc_kpm_sub_59, sm_cb_rc_kpm_sub_60, sm_cb_rc_kpm_sub_61, sm_cb_rc_kpm_sub_62, sm_cb_rc_kpm_sub_63,
+};
+
+static const char* const rc_kpm_meas = "RRU.PrbTotDl";
+
+// Sum of RRU.PrbTotDl over the UEs of the slice, each UE counting with its last record
+static
+void sm_cb_rc_kpm(sm_ag_if_rd_t const* rd, rc_kpm_sub_ctx_t const* ctx)
+{
+  assert(rd != NULL);
+  assert(ctx != NULL);
+  assert(rd->type == INDICATION_MSG_AGENT_IF_ANS_V0);
+  assert(rd->ind.type == KPM_STATS_V3_0);
+
+  kpm_ind_data_t const* ind = &rd->ind.kpm.ind;
+  kpm_ind_msg_format_3_t const* msg_frm_3 = &ind->msg.frm_3;
+  int64_t const now = time_now_us();
+  int64_t const collect_us = (int64_t)ind->hdr.kpm_ric_ind_hdr_format_1.collectStartTime;
+
+  double prb = 0;
+  for (size_t i = 0; i < msg_frm_3->ue_meas_report_lst_len; i++) {
+    kpm_ind_msg_format_1_t const* msg_frm_1 = &msg_frm_3->meas_report_per_ue[i].ind_msg_format_1;
+    size_t z = 0;
+    while (z < msg_frm_1->meas_info_lst_len) {
+      meas_type_t const* meas_type = &msg_frm_1->meas_info_lst[z].meas_type;
+      if (meas_type->type == NAME_MEAS_TYPE && cmp_str_ba(rc_kpm_meas, meas_type->name) == 0)
+        break;
+      z++;
+    }
+    if (z == msg_frm_1->meas_info_lst_len || msg_frm_1->meas_data_lst_len == 0)
+      continue;
+
+    meas_data_lst_t const* data_item = &msg_frm_1->meas_data_lst[msg_frm_1->meas_data_lst_len - 1];
+    if (z >= data_item->meas_record_len)
+      continue;
+    meas_record_lst_t const* r = &data_item->meas_record_lst[z];
+    if (r->value == INTEGER_MEAS_VALUE)
+      prb += (double)r->int_val;
+    else if (r->value == REAL_MEAS_VALUE)
+      prb += r->real_val;
+  }
+
+  note_rc_loop_prb(ctx->nb_id, ctx->slice, prb, collect_us, now);
+  note_rc_ues(msg_frm_3, &ctx->node, ctx->slice->sst, ctx->slice->sd, now);
+}
+
+static
+test_info_lst_t filter_predicate(test_cond_type_e type, test_cond_e cond, const int value[])
+{
+  test_info_lst_t dst = {0};
+
+  dst.test_cond_type = type;
+  // It can only be TRUE_TEST_COND_TYPE so it does not matter the type
+  dst.S_NSSAI = TRUE_TEST_COND_TYPE;
+
+  dst.test_cond = calloc(1, sizeof(test_cond_e));
+  assert(dst.test_cond != NULL && "Memory exhausted");
+  *dst.test_cond = cond;
+
+  dst.test_cond_value = calloc(1, sizeof(test_cond_value_t));
+  assert(dst.test_cond_value != NULL && "Memory exhausted");
+  dst.test_cond_value->type = OCTET_STRING_TEST_COND_VALUE;
+
+  dst.test_cond_value->octet_string_value = calloc(1, sizeof(byte_array_t));
+  assert(dst.test_cond_value->octet_string_value != NULL && "Memory exhausted");
+  const size_t len_nssai = 4;
+  dst.test_cond_value->octet_string_value->len = len_nssai;
+  dst.test_cond_value->octet_string_value->buf = calloc(len_nssai, sizeof(uint8_t));
+  assert(dst.test_cond_value->octet_string_value->buf != NULL && "Memory exhausted");
+  for (size_t i = 0; i < len_nssai; i++)
+    dst.test_cond_value->octet_string_value->buf[i] = value[i];
+
+  return dst;
+}
+
+// Report style 4 (UEs matching the S-NSSAI) of RRU.PrbTotDl only; false if the node offers neither
+static
+bool gen_rc_kpm_sub(kpm_ran_function_def_t const* ran_func, rc_loop_slice_t const* s, kpm_sub_data_t* kpm_sub)
+{
+  if (ran_func->ric_report_style_list == NULL || ran_func->ric_event_trigger_style_list == NULL)
+    return false;
+  ric_report_style_item_t const* report_item = &ran_func->ric_report_style_list[0];
+  if (report_item->report_style_type != STYLE_4_RIC_SERVICE_REPORT
+      || report_item->act_def_format_type != FORMAT_4_ACTION_DEFINITION)
+    return false;
+
+  byte_array_t name = {0};
+  for (size_t i = 0; i < report_item->meas_info_for_action_lst_len; i++) {
+    if (cmp_str_ba(rc_kpm_meas, report_item->meas_info_for_action_lst[i].name) == 0)
+      name = report_item->meas_info_for_action_lst[i].name;
+  }
+  if (name.len == 0)
+    return false;
+
+  *kpm_sub = (kpm_sub_data_t){0};
+  kpm_sub->ev_trg_def.type = FORMAT_1_RIC_EVENT_TRIGGER;
+  kpm_sub->ev_trg_def.kpm_ric_event_trigger_format_1.report_period_ms = s->report_period_ms;
+
+  kpm_sub->sz_ad = 1;
+  kpm_sub->ad = calloc(1, sizeof(kpm_act_def_t));
+  assert(kpm_sub->ad != NULL && "Memory exhausted");
+  kpm_act_def_t* act_def = kpm_sub->ad;
+  act_def->type = FORMAT_4_ACTION_DEFINITION;
+
+  // Filter connected UEs by S-NSSAI
+  int const nssai[4] = {s->sst, (s->sd >> 16) & 0xFF, (s->sd >> 8) & 0xFF, s->sd & 0xFF};
+  act_def->frm_4.matching_cond_lst_len = 1;
+  act_def->frm_4.matching_cond_lst = calloc(1, sizeof(matching_condition_format_4_lst_t));
+  assert(act_def->frm_4.matching_cond_lst != NULL && "Memory exhausted");
+  act_def->frm_4.matching_cond_lst[0].test_info_lst = filter_predicate(S_NSSAI_TEST_COND_TYPE, EQUAL_TEST_COND, nssai);
+
+  kpm_act_def_format_1_t* ad_frm_1 = &act_def->frm_4.action_def_format_1;
+  ad_frm_1->meas_info_lst_len = 1;
+  ad_frm_1->meas_info_lst = calloc(1, sizeof(meas_info_format_1_lst_t));
+  assert(ad_frm_1->meas_info_lst != NULL && "Memory exhausted");
+  meas_info_format_1_lst_t* meas_item = &ad_frm_1->meas_info_lst[0];
+  meas_item->meas_type.type = NAME_MEAS_TYPE;
+  meas_item->meas_type.name = copy_byte_array(name);
+  meas_item->label_info_lst_len = 1;
+  meas_item->label_info_lst = calloc(1, sizeof(label_info_lst_t));
+  assert(meas_item->label_info_lst != NULL && "Memory exhausted");
+  meas_item->label_info_lst[0].noLabel = calloc(1, sizeof(enum_value_e));
+  assert(meas_item->label_info_lst[0].noLabel != NULL && "Memory exhausted");
+  *meas_item->label_info_lst[0].noLabel = TRUE_ENUM_VALUE;
+
+  ad_frm_1->gran_period_ms = s->report_period_ms;
+  ad_frm_1->cell_global_id = NULL;
+#if defined KPM_V2_03 || defined KPM_V3_00
+  ad_frm_1->meas_bin_range_info_lst_len = 0;
+  ad_frm_1->meas_bin_info_lst = NULL;
+#endif
+  return true;
+}
+
+// "sst:sd[:report_ms]", sst in decimal, sd in hex with 0x or decimal; false if malformed
+static
+bool parse_rc_kpm_slice(const char* tok, uint8_t* sst, uint32_t* sd, uint32_t* report_ms)
+{
+  char* end = NULL;
+  unsigned long const v_sst = strtoul(tok, &end, 10);
+  if (end == tok || *end != ':' || v_sst > 0xFF)
+    return false;
+  const char* p = end + 1;
+  unsigned long const v_sd = strtoul(p, &end, 0);
+  if (end == p || (*end != ':' && *end != '\0') || v_sd > 0xFFFFFF)
+    return false;
+  unsigned long v_ms = 1000;
+  if (*end == ':') {
+    p = end + 1;
+    v_ms = strtoul(p, &end, 10);
+    if (end == p || *end != '\0' || v_ms == 0 || v_ms > UINT32_MAX)
+      return false;
+  }
+  *sst = (uint8_t)v_sst;
+  *sd = (uint32_t)v_sd;
+  *report_ms = (uint32_t)v_ms;
+  return true;
+}
+
+// Call once, after init_rc_nodes(). Only the nodes connected by then are subscribed to.
+static
+void init_rc_loop(void)
+{
+  const char* delta_str = getenv("RC_LOOP_MIN_DELTA");
+  if (delta_str) rc_loop.min_delta_pct = atof(delta_str);
+  const char* timeout_str = getenv("RC_LOOP_TIMEOUT_MS");
+  if (timeout_str) rc_loop.timeout_us = (int64_t)atoi(timeout_str) * 1000;
+
+  const char* slices_str = getenv("RC_KPM_SLICES");
+  if (slices_str == NULL || slices_str[0] == '\0') {
+    printf("[xApp]: RC_KPM_SLICES not set, control loop latency measured up to the E2 ack only\n");
+    return;
+  }
+
+  char* buf = strdup(slices_str);
+  assert(buf != NULL && "Memory exhausted");
+  defer({ free(buf); });
+  char* save = NULL;
+  for (char* tok = strtok_r(buf, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+    uint8_t sst;
+    uint32_t sd;
+    uint32_t report_ms;
+    if (!parse_rc_kpm_slice(tok, &sst, &sd, &report_ms)) {
+      fprintf(stderr, "RC_KPM_SLICES: expected sst:sd[:report_ms], got '%s'\n", tok);
+      exit(EXIT_FAILURE);
+    }
+    rc_loop_slice_t* s = find_rc_loop_slice(sst, sd);
+    assert(s != NULL && "Too many slices in RC_KPM_SLICES, raise RC_LOOP_MAX_SLICES");
+    s->report_period_ms = report_ms;
+  }
+
+  int const KPM_ran_function = 2;
+
+  e2_node_arr_xapp_t nodes = e2_nodes_xapp_api();
+  defer({ free_e2_node_arr_xapp(&nodes); });
+  for (size_t i = 0; i < nodes.len; i++) {
+    e2_node_connected_xapp_t* n = &nodes.n[i];
+    size_t idx = 0;
+    while (idx < n->len_rf && n->rf[idx].id != KPM_ran_function)
+      idx++;
+    if (idx == n->len_rf || n->rf[idx].defn.type != KPM_RAN_FUNC_DEF_E) {
+      printf("[xApp]: E2 node nb_id = %u has no KPM RAN function, no control loop latency\n", n->id.nb_id.nb_id);
+      continue;
+    }
+
+    for (size_t j = 0; j < rc_loop.slice_len; j++) {
+      rc_loop_slice_t* s = &rc_loop.slice[j];
+      kpm_sub_data_t kpm_sub;
+      if (!gen_rc_kpm_sub(&n->rf[idx].defn.kpm, s, &kpm_sub)) {
+        printf("[xApp]: E2 node nb_id = %u reports no %s per S-NSSAI\n", n->id.nb_id.nb_id, rc_kpm_meas);
+        break;
+      }
+      assert(rc_kpm_sub_ctx_len < RC_KPM_MAX_SUBS && "Too many KPM subscriptions, raise RC_KPM_MAX_SUBS");
+      size_t const ctx = rc_kpm_sub_ctx_len++;
+      rc_kpm_sub_ctx[ctx] = (rc_kpm_sub_ctx_t){.nb_id = n->id.nb_id.nb_id, .node = cp_global_e2_node_id(&n->id), .slice = s};
+
+      sm_ans_xapp_t const h = report_sm_xapp_api(&n->id, KPM_ran_function, &kpm_sub, rc_kpm_sub_cb[ctx]);
+      free_kpm_sub_data(&kpm_sub);
+      if (!h.success) {
+        printf("[xApp]: KPM subscription of E2 node nb_id = %u failed\n", n->id.nb_id.nb_id);
+        continue;
+      }
+      rc_kpm_sub_ctx[ctx].subscribed = true;
+      rc_kpm_sub_ctx[ctx].handle = h.u.handle;
+      lock_guard(&rc_loop.mtx);
+      rc_loop_track_t* t = find_rc_loop_track(n->id.nb_id.nb_id, s);
+      assert(t != NULL && "Too many KPM subscriptions, raise RC_LOOP_MAX_TRACKS");
+      t->kpm = true;
+      rc_loop.kpm = true;
+      printf("[xApp]: E2 node nb_id = %u, %s of slice sst = %u sd = 0x%06x every %u ms\n",
+             n->id.nb_id.nb_id, rc_kpm_meas, s->sst, s->sd, s->report_period_ms);
+    }
+  }
+}
+
+// ======================================== Control Loop Latency ========================================
+
+// ======================================== Control Dispatch ========================================
+
+// REST handlers only validate a request, build its RC control message once and queue it as a
+// job. Every E2 node has its own lane, a thread that sends the jobs of that node in order, so
+// a slow node only delays itself and a DRL step costs the slowest node instead of the sum of
+// all of them. A job is done once every node it was sent to answered; the last
+// RC_JOB_HISTORY jobs can be polled with GET /run/<id>.
+//
+// Each lane remembers the policy last queued to its node. A job carrying the same policy skips
+// that node unless forced, and a job skipping every node is a no-op.
+//
+// Once rc_draining is set (see stop_rc_xapp()) no job is accepted anymore and the lanes only
+// empty their queues, until stop_rc_lanes() makes them exit.
+
+#define RC_LANE_QUEUE 256
+#define RC_JOB_HISTORY 1024
+
+typedef enum {
+  RC_JOB_QUEUED,
+  RC_JOB_DONE,
+} rc_job_state_e;
+
+typedef enum {
+  RC_NODE_QUEUED,
+  RC_NODE_SENT,
+  RC_NODE_ACKED,
+  RC_NODE_FAILED,
+  RC_NODE_SKIPPED,
+} rc_node_state_e;
+
+static const char* const rc_node_state_str[] = {"queued", "sent", "acked", "failed", "skipped"};
+
+typedef enum {
+  RC_ACTION_NEW,      // Message built and sent
+  RC_ACTION_HIT,      // Cached message sent
+  RC_ACTION_NOOP,     // Every node already had the policy
+} rc_action_e;
+
+static const char* const rc_action_str[] = {"new", "hit", "noop"};
+
+typedef struct {
+  uint32_t nb_id;
+  rc_node_state_e state;
+  const char* error;
+  int64_t latency_us; // control_sm_xapp_api() round trip
+} rc_node_outcome_t;
+
+// REST request suspended until its jobs are done, see "Waiting requests"
+typedef struct rc_waiter rc_waiter_t;
+
+typedef struct {
+  uint64_t id;
+  rc_job_state_e state;
+  rc_msg_t* msg;            // Released once every node answered
+  rc_action_e action;
+  int64_t created_us;
+  int64_t done_us;
+  size_t pending;
+  size_t refs;              // History slot, lanes holding a task and waiting requests
+  rc_waiter_t* waiter;      // NULL if no request waits for it
+  size_t nodes_len;
+  rc_node_outcome_t node[RC_MAX_NODES];
+} rc_job_t;
+
+typedef struct {
+  rc_job_t* job;
+  size_t node;              // Index in job->node
+} rc_task_t;
+
+typedef struct {
+  global_e2_node_id_t id;
+  pthread_t thread;
+  pthread_cond_t cv;
+  rc_task_t task[RC_LANE_QUEUE];
+  size_t head;
+  size_t tail;
+  rc_msg_t* last_msg;       // Cached message last queued, referenced, valid for registry version last_ver
+  uint64_t last_ver;
+
+  // For /healthz, /readyz and /metrics
+  int64_t busy_since_us;    // Start of the control_sm_xapp_api() in progress, 0 if idle
+  bool exited;              // The thread returned, see stop_rc_lanes()
+  uint64_t acked;
+  uint64_t failed;          // Not acked, or refused because the queue was full
+  rc_hist_t latency;        // control_sm_xapp_api() round trip [us]
+} rc_lane_t;
+
+// Jobs, lanes and their queues are all guarded by rc_dispatch_mtx; it is never held while
+// talking to an E2 node
+static pthread_mutex_t rc_dispatch_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t rc_job_done_cv = PTHREAD_COND_INITIALIZER;
+
+static rc_lane_t rc_lane[RC_MAX_NODES];
+
+static size_t rc_lane_len = 0;
+
+static rc_job_t* rc_job_hist[RC_JOB_HISTORY];
+
+static uint64_t rc_next_job_id = 1;
+
+static uint64_t rc_jobs_total[3];   // By rc_action_e
+
+static _Atomic bool rc_draining = false;
+
+static bool rc_lanes_stop = false;  // Guarded by rc_dispatch_mtx
+
+static const char* const rc_err_shutting_down = "Shutting down";
+
+static void done_rc_waiter_job(rc_waiter_t* w);
+
+// Call with rc_dispatch_mtx held
+static
+void put_rc_job(rc_job_t* job)
+{
+  assert(job->refs > 0);
+  if (--job->refs > 0)
+    return;
+
+  if (job->state != RC_JOB_DONE)
+    put_rc_msg(job->msg);
+  free(job);
+}
+
+// Call with rc_dispatch_mtx held
+static
+void finish_rc_node(rc_job_t* job, size_t i, rc_node_state_e state, const char* error, int64_t latency_us)
+{
+  job->node[i].state = state;
+  job->node[i].error = error;
+  job->node[i].latency_us = latency_us;
+
+  assert(job->pending > 0);
+  if (--job->pending > 0)
+    return;
+
+  job->state = RC_JOB_DONE;
+  job->done_us = time_now_us();
+  put_rc_msg(job->msg);
+  job->msg = NULL;
+  pthread_cond_broadcast(&rc_job_done_cv);
+  if (job->waiter != NULL) {
+    done_rc_waiter_job(job->waiter);
+    job->waiter = NULL;
+  }
+}
+
+static
+void* rc_lane_thread(void* arg)
+{
+  rc_lane_t* lane = arg;
+
+  pthread_mutex_lock(&rc_dispatch_mtx);
+  for (;;) {
+    while (lane->head == lane->tail && !rc_lanes_stop)
+      pthread_cond_wait(&lane->cv, &rc_dispatch_mtx);
+    if (rc_lanes_stop)
+      break;
+
+    rc_task_t const t = lane->task[lane->tail % RC_LANE_QUEUE];
+    lane->tail++;
+    t.job->node[t.node].state = RC_NODE_SENT;
+    rc_msg_t const* msg = t.job->msg;
+    int64_t const start = time_now_us();
+    lane->busy_since_us = start;
+    pthread_mutex_unlock(&rc_dispatch_mtx);
+
+    // The message is read only until the job is done, which cannot happen before this node answered
+    sm_ans_xapp_t const ans = control_sm_xapp_api(&lane->id, SM_RC_ID, (void*)&msg->ctrl);
+    int64_t const lat = time_now_us() - start;
+
+    if (ans.success && msg->policy != NULL)
+      note_rc_loop_ack(msg->policy, lane->id.nb_id.nb_id, t.job->id, t.job->created_us, start, start + lat);
+
+    pthread_mutex_lock(&rc_dispatch_mtx);
+    lane->busy_since_us = 0;
+    rc_hist_record(&lane->latency, lat);
+    if (ans.success)
+      lane->acked++;
+    else
+      lane->failed++;
+    // Unknown state, the next policy is sent whatever it is
+    if (!ans.success && lane->last_msg == msg) {
+      put_rc_msg(lane->last_msg);
+      lane->last_msg = NULL;
+    }
+    finish_rc_node(t.job, t.node, ans.success ? RC_NODE_ACKED : RC_NODE_FAILED,
+                   ans.success ? NULL : "control not acknowledged", lat);
+    put_rc_job(t.job);
+  }
+
+  if (lane->last_msg != NULL) {
+    put_rc_msg(lane->last_msg);
+    lane->last_msg = NULL;
+  }
+  lane->exited = true;
+  pthread_cond_broadcast(&rc_job_done_cv);
+  pthread_mutex_unlock(&rc_dispatch_mtx);
+  return NULL;
+}
+
+// Lane of an E2 node, started on first use. Call with rc_dispatch_mtx held.
+static
+rc_lane_t* get_rc_lane(global_e2_node_id_t const* id)
+{
+  for (size_t i = 0; i < rc_lane_len; i++) {
+    if (eq_global_e2_node_id(&rc_lane[i].id, id))
+      return &rc_lane[i];
+  }
+
+  if (rc_lane_len == RC_MAX_NODES || rc_lanes_stop)
+    return NULL;
+
+  rc_lane_t* lane = &rc_lane[rc_lane_len++];
+  lane->id = cp_global_e2_node_id(id);
+  lane->head = 0;
+  lane->tail = 0;
+  pthread_cond_init(&lane->cv, NULL);
+  int const rc = pthread_create(&lane->thread, NULL, rc_lane_thread, lane);
+  assert(rc == 0);
+  printf("[xApp]: control lane %zu for E2 node nb_id = %u\n", rc_lane_len - 1, id->nb_id.nb_id);
+  return lane;
+}
+
+// Queue msg to the E2 node node, else to every node of the gNB nb_id (a split gNB's CU, DUs and
+// CU-UPs share it), else to every connected node, skipping the nodes that got it last unless
+// forced; the job takes over the caller's reference of msg. Returns a job referenced once more
+// for the caller (put_rc_job() it), or NULL with the reason in *err.
+static
+rc_job_t* submit_rc_job(rc_msg_t* msg, rc_action_e action, bool force, global_e2_node_id_t const* node,
+                        uint32_t const* nb_id, const char** err)
+{
+  if (atomic_load(&rc_draining)) {
+    *err = rc_err_shutting_down;
+    put_rc_msg(msg);
+    return NULL;
+  }
+
+  // A node may have connected since the last refresh
+  pthread_rwlock_rdlock(&rc_node_reg.lock);
+  size_t const len = rc_node_reg.len;
+  pthread_rwlock_unlock(&rc_node_reg.lock);
+  if (len == 0)
+    refresh_rc_nodes();
+
+  pthread_rwlock_rdlock(&rc_node_reg.lock);
+  defer({ pthread_rwlock_unlock(&rc_node_reg.lock); });
+
+  if (rc_node_reg.len == 0) {
+    printf("[xApp]: No connected nodes.\n");
+    *err = "No connected E2 nodes";
+    put_rc_msg(msg);
+    return NULL;
+  }
+
+  size_t sel[RC_MAX_NODES];
+  size_t sel_len = 0;
+  for (size_t i = 0; i < rc_node_reg.len; i++) {
+    global_e2_node_id_t const* id = &rc_node_reg.id[i];
+    if (node != NULL ? eq_global_e2_node_id(id, node) : nb_id == NULL || id->nb_id.nb_id == *nb_id)
+      sel[sel_len++] = i;
+  }
+  if (sel_len == 0) {
+    *err = "Unknown E2 node";
+    put_rc_msg(msg);
+    return NULL;
+  }
+
+  rc_job_t* job = calloc(1, sizeof(rc_job_t));
+  assert(job != NULL && "Memory exhausted");
+  job->msg = msg;
+  job->created_us = time_now_us();
+  job->state = RC_JOB_QUEUED;
+
+  lock_guard(&rc_dispatch_mtx);
+
+  job->id = rc_next_job_id++;
+  job->nodes_len = sel_len;
+  job->pending = job->nodes_len;
+  job->refs = 2; // History and caller
+  job->action = RC_ACTION_NOOP;
+
+  rc_job_t** slot = &rc_job_hist[job->id % RC_JOB_HISTORY];
+  if (*slot != NULL)
+    put_rc_job(*slot);
+  *slot = job;
+
+  for (size_t i = 0; i < job->nodes_len; i++) {
+    global_e2_node_id_t const* id = &rc_node_reg.id[sel[i]];
+    job->node[i].nb_id = id->nb_id.nb_id;
+    job->node[i].state = RC_NODE_QUEUED;
+
+    rc_lane_t* lane = get_rc_lane(id);
+    if (lane == NULL || lane->head - lane->tail == RC_LANE_QUEUE) {
+      if (lane != NULL)
+        lane->failed++;
+      const char* const why = lane != NULL ? "node queue full" : rc_lanes_stop ? rc_err_shutting_down : "too many E2 nodes";
+      finish_rc_node(job, i, RC_NODE_FAILED, why, 0);
+      continue;
+    }
+
+    // Same policy only if the canonical forms match, the key is just a hash
+    if (msg->key != 0 && lane->last_ver == rc_node_reg.version && lane->last_msg != NULL && !force
+        && lane->last_msg->key == msg->key && strcmp(lane->last_msg->canon, msg->canon) == 0) {
+      finish_rc_node(job, i, RC_NODE_SKIPPED, NULL, 0);
+      continue;
+    }
+    if (msg->key != 0) {
+      if (lane->last_msg != msg) {
+        if (lane->last_msg != NULL)
+          put_rc_msg(lane->last_msg);
+        atomic_fetch_add(&msg->refs, 1);
+        lane->last_msg = msg;
+      }
+      lane->last_ver = rc_node_reg.version;
+    }
+    job->action = action;
+
+    job->refs++;
+    lane->task[lane->head % RC_LANE_QUEUE] = (rc_task_t){.job = job, .node = i};
+    lane->head++;
+    pthread_cond_signal(&lane->cv);
+  }
+  rc_jobs_total[job->action]++;
+
+  return job;
+}
+
+// Job from the history with an extra reference, NULL if unknown or already evicted
+static
+rc_job_t* find_rc_job(uint64_t id)
+{
+  lock_guard(&rc_dispatch_mtx);
+  rc_job_t* job = rc_job_hist[id % RC_JOB_HISTORY];
+  if (job == NULL || job->id != id)
+    return NULL;
+  job->refs++;
+  return job;
+}
+
+static
+void release_rc_job(rc_job_t* job)
+{
+  lock_guard(&rc_dispatch_mtx);
+  put_rc_job(job);
+}
+
+static
+struct json_object* rc_job_to_json(rc_job_t* job)
+{
+  lock_guard(&rc_dispatch_mtx);
+
+  struct json_object* root = json_object_new_object();
+  json_object_object_add(root, "id", json_object_new_int64((int64_t)job->id));
+  json_object_object_add(root, "state", json_object_new_string(job->state == RC_JOB_DONE ? "done" : "queued"));
+  json_object_object_add(root, "action", json_object_new_string(rc_action_str[job->action]));
+  json_object_object_add(root, "created_us", json_object_new_int64(job->created_us));
+  if (job->state == RC_JOB_DONE)
+    json_object_object_add(root, "latency_us", json_object_new_int64(job->done_us - job->created_us));
+
+  size_t acked = 0;
+  struct json_object* nodes = json_object_new_array();
+  for (size_t i = 0; i < job->nodes_len; i++) {
+    rc_node_outcome_t const* n = &job->node[i];
+    struct json_object* jn = json_object_new_object();
+    json_object_object_add(jn, "nb_id", json_object_new_int64(n->nb_id));
+    json_object_object_add(jn, "state", json_object_new_string(rc_node_state_str[n->state]));
+    if (n->state == RC_NODE_ACKED || n->state == RC_NODE_FAILED)
+      json_object_object_add(jn, "latency_us", json_object_new_int64(n->latency_us));
+    if (n->error != NULL)
+      json_object_object_add(jn, "error", json_object_new_string(n->error));
+    json_object_array_add(nodes, jn);
+    acked += n->state == RC_NODE_ACKED;
+  }
+  json_object_object_add(root, "acked", json_object_new_int64((int64_t)acked));
+  json_object_object_add(root, "nodes", nodes);
+  return root;
+}
+
+// ======================================== Control Dispatch ========================================
+
+// Hand the UE over to the slice sst/sd through the E2 node node, or the nodes of the gNB nb_id,
+// or every node if both are NULL. Returns the job like submit_rc_job().
+rc_job_t* HO_rc_slice_level_UE(ue_id_e2sm_t* ue_id, const char* sst_str, const char* sd_str, // Dest SST and SD
+                               global_e2_node_id_t const* node, uint32_t const* nb_id, const char** err)
+{
+  ////////////
+  // START RC
+  ////////////
+
+  // RC Control
+  // CONTROL Service Style 3: Connected Mode Mobility Control
+  // Action ID 1: Handover Control
+  // E2SM-RC Control Header Format 1
+  // E2SM-RC Control Message Format 1
+  rc_ctrl_req_data_t rc_ctrl = {0};
+  // ue_id_e2sm_t ue_id = gen_rc_ue_id(GNB_UE_ID_E2SM);  // find the specific UE!!!!!
+
+  rc_ctrl.hdr = gen_rc_ctrl_hdr(FORMAT_1_E2SM_RC_CTRL_HDR, *ue_id, 3, HO_control);
+  rc_ctrl.msg = gen_rc_ctrl_HO_slice_level_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str);
+
+  // Sent to the serving node when the caller knows it, else to all cells
+  return submit_rc_job(new_rc_msg(rc_ctrl, NULL, NULL, 0), RC_ACTION_NEW, true, node, nb_id, err);
+}
+
+// Slice level PRB quota addressed to one UE through the UE ID of the control header, through the
+// E2 node node, or the nodes of the gNB nb_id, or every node if both are NULL. Returns the job
+// like submit_rc_job().
+rc_job_t* ue_policy_rc_slice_level_UE(ue_id_e2sm_t* ue_id, const char* sst_str[], const char* sd_str[],
+                                      const int dedicated_ratio_prb[], size_t num_slices,
+                                      global_e2_node_id_t const* node, uint32_t const* nb_id, const char** err)
+{
+  rc_ctrl_req_data_t rc_ctrl = {0};
+  rc_ctrl.hdr = gen_rc_ctrl_hdr(FORMAT_1_E2SM_RC_CTRL_HDR, *ue_id, 2, Slice_level_PRB_quotal_7_6_3_1);
+  void* arena = NULL;
+  if (!gen_rc_ctrl_slice_level_PRB_quota_tmpl(sst_str, sd_str, dedicated_ratio_prb, num_slices, &rc_ctrl.msg, &arena))
+    rc_ctrl.msg = gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str, dedicated_ratio_prb, num_slices);
+
+  // Not cached: the UE ID is part of the message
+  return submit_rc_job(new_rc_msg(rc_ctrl, arena, NULL, 0), RC_ACTION_NEW, true, node, nb_id, err);
+}
+
+// ======================================== /run Parser ========================================
+
+// POST /run bodies are parsed while they are uploaded, straight into the fixed rc_run_req_t of
+// the connection: no body buffer, no json-c tree and no string copies. Besides checking the
+// JSON grammar, the parser only keeps sst, sd, dedicated_ratio_prb, wait, timeout_ms and
+// force; other members are skipped. The first error sticks, with the status to answer:
+//   400 the body is not a JSON object
+//   413 the body is larger than rc_max_body
+//   422 the request is valid JSON but not a valid policy
+
+#define RC_RUN_MAX_DEPTH 16
+#define RC_RUN_TOK_LEN 31     // Longest key or scalar kept; longer ones can only be skipped
+#define RC_SST_STR_LEN 3      // Decimal, up to 255
+#define RC_SD_STR_LEN 8       // Up to 6 hex digits, optionally 0x prefixed
+
+// SST and SD strings as copied into the control message by cp_str_to_ba()
+static
+bool valid_rc_sst(const char* s, size_t len)
+{
+  if (len == 0 || len > RC_SST_STR_LEN)
+    return false;
+  int v = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9')
+      return false;
+    v = 10 * v + (s[i] - '0');
+  }
+  return v <= 255;
+}
+
+static
+bool valid_rc_sd(const char* s, size_t len)
+{
+  if (len > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    s += 2;
+    len -= 2;
+  }
+  if (len == 0 || len > 6)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    if (!isxdigit((unsigned char)s[i]))
+      return false;
+  }
+  return true;
+}
+
+// Checks shared by every ingress; NULL if the slices make a valid policy, else the reason
+static
+const char* check_rc_slices(const char* sst_str[], const char* sd_str[], const int dedicated_ratio_prb[], size_t num_slices)
+{
+  int sum = 0;
+  for (size_t i = 0; i < num_slices; i++) {
+    if (!valid_rc_sst(sst_str[i], strlen(sst_str[i])))
+      return "sst must be decimal strings in [0, 255]";
+    if (!valid_rc_sd(sd_str[i], strlen(sd_str[i])))
+      return "sd must be strings of up to 6 hex digits, optionally 0x prefixed";
+    sum += dedicated_ratio_prb[i];
+  }
+  return sum > 100 ? "dedicated_ratio_prb must sum to at most 100" : NULL;
+}
+
+typedef enum {
+  RC_RUN_SST,
+  RC_RUN_SD,
+  RC_RUN_RATIO,
+  RC_RUN_WAIT,
+  RC_RUN_TIMEOUT,
+  RC_RUN_FORCE,
+
+  END_RC_RUN_FIELD,
+} rc_run_field_e;
+
+static const char *const rc_run_field_str[END_RC_RUN_FIELD] = {"sst", "sd", "dedicated_ratio_prb", "wait", "timeout_ms", "force"};
+
+typedef enum {
+  RC_RUN_EXP_VALUE,
+  RC_RUN_EXP_VALUE_OR_END,  // After [
+  RC_RUN_EXP_KEY,
+  RC_RUN_EXP_KEY_OR_END,    // After {
+  RC_RUN_EXP_COLON,
+  RC_RUN_EXP_COMMA_OR_END,
+  RC_RUN_EXP_NOTHING,       // After the top level object
+} rc_run_expect_e;
+
+typedef enum {
+  RC_RUN_TOK_NONE,
+  RC_RUN_TOK_STR,
+  RC_RUN_TOK_KEY,
+  RC_RUN_TOK_NUM,
+  RC_RUN_TOK_LIT,
+} rc_run_tok_e;
+
+typedef enum {
+  RC_RUN_NUM_START,
+  RC_RUN_NUM_SIGN,
+  RC_RUN_NUM_ZERO,
+  RC_RUN_NUM_INT,
+  RC_RUN_NUM_DOT,
+  RC_RUN_NUM_FRAC,
+  RC_RUN_NUM_E,
+  RC_RUN_NUM_ESIGN,
+  RC_RUN_NUM_EXP,
+  RC_RUN_NUM_BAD,
+} rc_run_num_e;
+
+typedef struct {
+  // Request
+  size_t len[3];            // Entries of sst, sd and dedicated_ratio_prb
+  char sst[RC_MAX_SLICES][RC_SST_STR_LEN + 1];
+  char sd[RC_MAX_SLICES][RC_SD_STR_LEN + 1];
+  int dedicated_ratio_prb[RC_MAX_SLICES];
+  bool wait;
+  bool force;
+  int64_t timeout_ms;       // 0 if not given
+
+  // First error, 0 while the body is valid so far
+  unsigned int status;
+  char err[128];
+
+  // Parser
+  size_t off;               // Bytes consumed
+  size_t max_body;
+  rc_run_expect_e expect;
+  rc_run_tok_e tok;
+  bool esc;
+  uint8_t hex_left;         // Digits of a \uXXXX escape
+  bool overflow;            // Token longer than tok_buf
+  rc_run_num_e num;         // Grammar state of a number token
+  size_t tok_len;
+  char tok_buf[RC_RUN_TOK_LEN + 1];
+  size_t depth;
+  char stack[RC_RUN_MAX_DEPTH];
+  int field;                // Top level member being parsed, END_RC_RUN_FIELD if skipped
+  uint32_t seen;            // Bit per rc_run_field_e
+} rc_run_req_t;
+
+static
+void init_rc_run_req(rc_run_req_t* p, size_t max_body)
+{
+  memset(p, 0, sizeof(*p));
+  p->max_body = max_body;
+  p->expect = RC_RUN_EXP_VALUE;
+  p->field = END_RC_RUN_FIELD;
+}
+
+static
+void fail_rc_run(rc_run_req_t* p, unsigned int status, const char* fmt, ...)
+{
+  if (p->status != 0)
+    return;
+  p->status = status;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(p->err, sizeof(p->err), fmt, args);
+  va_end(args);
+}
+
+static
+void fail_rc_run_syntax(rc_run_req_t* p)
+{
+  fail_rc_run(p, MHD_HTTP_BAD_REQUEST, "Invalid JSON at byte %zu\n", p->off);
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, one character at a time
+static
+rc_run_num_e step_rc_run_number(rc_run_num_e st, char c)
+{
+  bool const digit = c >= '0' && c <= '9';
+  switch (st) {
+    case RC_RUN_NUM_START:
+      return c == '-' ? RC_RUN_NUM_SIGN : c == '0' ? RC_RUN_NUM_ZERO : digit ? RC_RUN_NUM_INT : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_SIGN:
+      return c == '0' ? RC_RUN_NUM_ZERO : digit ? RC_RUN_NUM_INT : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_ZERO:
+    case RC_RUN_NUM_INT:
+      if (digit && st == RC_RUN_NUM_INT)
+        return RC_RUN_NUM_INT;
+      return c == '.' ? RC_RUN_NUM_DOT : (c == 'e' || c == 'E') ? RC_RUN_NUM_E : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_DOT:
+      return digit ? RC_RUN_NUM_FRAC : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_FRAC:
+      return digit ? RC_RUN_NUM_FRAC : (c == 'e' || c == 'E') ? RC_RUN_NUM_E : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_E:
+      return c == '+' || c == '-' ? RC_RUN_NUM_ESIGN : digit ? RC_RUN_NUM_EXP : RC_RUN_NUM_BAD;
+    case RC_RUN_NUM_ESIGN:
+    case RC_RUN_NUM_EXP:
+      return digit ? RC_RUN_NUM_EXP : RC_RUN_NUM_BAD;
+    default:
+      return RC_RUN_NUM_BAD;
+  }
+}
+
+// A value starts ({ or [) or a scalar ends, at depth p->depth
+static
+void on_rc_run_value(rc_run_req_t* p, rc_run_tok_e tok, char open)
+{
+  if (p->depth == 0) {
+    if (open != '{')
+      fail_rc_run(p, MHD_HTTP_BAD_REQUEST, "Body must be a JSON object\n");
+    return;
+  }
+
+  bool const is_int = p->num == RC_RUN_NUM_ZERO || p->num == RC_RUN_NUM_INT;
+  if (tok == RC_RUN_TOK_NUM && !is_int && p->num != RC_RUN_NUM_FRAC && p->num != RC_RUN_NUM_EXP) {
+    fail_rc_run_syntax(p);
+    return;
+  }
+  if (tok == RC_RUN_TOK_LIT && strcmp(p->tok_buf, "true") != 0 && strcmp(p->tok_buf, "false") != 0
+      && strcmp(p->tok_buf, "null") != 0) {
+    fail_rc_run_syntax(p);
+    return;
+  }
+  if (p->field == END_RC_RUN_FIELD || p->depth > 2)
+    return;
+
+  const char* name = rc_run_field_str[p->field];
+  if (p->depth == 1) {
+    switch (p->field) {
+      case RC_RUN_SST:
+      case RC_RUN_SD:
+      case RC_RUN_RATIO:
+        if (open != '[')
+          fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "%s must be an array\n", name);
+        break;
+      case RC_RUN_WAIT:
+      case RC_RUN_FORCE:
+        if (tok != RC_RUN_TOK_LIT || p->tok_buf[0] == 'n')
+          fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "%s must be true or false\n", name);
+        else if (p->field == RC_RUN_WAIT)
+          p->wait = p->tok_buf[0] == 't';
+        else
+          p->force = p->tok_buf[0] == 't';
+        break;
+      case RC_RUN_TIMEOUT:
+        if (tok != RC_RUN_TOK_NUM || !is_int || p->overflow || p->tok_buf[0] == '-' || p->tok_len > 12)
+          fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "timeout_ms must be a non negative integer\n");
+        else
+          p->timeout_ms = strtoll(p->tok_buf, NULL, 10);
+        break;
+    }
+    return;
+  }
+
+  // An entry of sst, sd or dedicated_ratio_prb
+  size_t const i = p->len[p->field];
+  if (i == RC_MAX_SLICES) {
+    fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "At most %d slices\n", RC_MAX_SLICES);
+    return;
+  }
+  p->len[p->field]++;
+
+  if (p->field == RC_RUN_RATIO) {
+    int const ratio = tok == RC_RUN_TOK_NUM && is_int && p->tok_len <= 3 ? atoi(p->tok_buf) : -1;
+    if (ratio < 0 || ratio > 100)
+      fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "dedicated_ratio_prb[%zu] must be an integer in [0, 100]\n", i);
+    else
+      p->dedicated_ratio_prb[i] = ratio;
+  } else if (p->field == RC_RUN_SST) {
+    if (tok != RC_RUN_TOK_STR || p->overflow || !valid_rc_sst(p->tok_buf, p->tok_len))
+      fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "sst[%zu] must be a decimal string in [0, 255]\n", i);
+    else
+      memcpy(p->sst[i], p->tok_buf, p->tok_len + 1);
+  } else {
+    if (tok != RC_RUN_TOK_STR || p->overflow || !valid_rc_sd(p->tok_buf, p->tok_len))
+      fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "sd[%zu] must be a string of up to 6 hex digits, optionally 0x prefixed\n", i);
+    else
+      memcpy(p->sd[i], p->tok_buf, p->tok_len + 1);
+  }
+}
+
+static
+void on_rc_run_key(rc_run_req_t* p)
+{
+  if (p->depth != 1)
+    return;
+
+  p->field = END_RC_RUN_FIELD;
+  for (int f = 0; !p->overflow && f < END_RC_RUN_FIELD; f++) {
+    if (strcmp(p->tok_buf, rc_run_field_str[f]) == 0)
+      p->field = f;
+  }
+  if (p->field == END_RC_RUN_FIELD)
+    return;
+  if (p->seen & (1u << p->field))
+    fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "%s is given twice\n", rc_run_field_str[p->field]);
+  p->seen |= 1u << p->field;
+}
+
+// After a complete value at depth p->depth
+static
+void end_rc_run_value(rc_run_req_t* p)
+{
+  p->expect = p->depth == 0 ? RC_RUN_EXP_NOTHING : RC_RUN_EXP_COMMA_OR_END;
+}
+
+static
+void end_rc_run_token(rc_run_req_t* p)
+{
+  p->tok_buf[p->tok_len] = '\0';
+  rc_run_tok_e const tok = p->tok;
+  p->tok = RC_RUN_TOK_NONE;
+  if (tok == RC_RUN_TOK_KEY) {
+    on_rc_run_key(p);
+    p->expect = RC_RUN_EXP_COLON;
+    return;
+  }
+  on_rc_run_value(p, tok, 0);
+  end_rc_run_value(p);
+}
+
+static
+void start_rc_run_token(rc_run_req_t* p, rc_run_tok_e tok)
+{
+  p->tok = tok;
+  p->tok_len = 0;
+  p->overflow = false;
+  p->num = RC_RUN_NUM_START;
+}
+
+static
+void push_rc_run_char(rc_run_req_t* p, char c)
+{
+  if (p->tok_len < RC_RUN_TOK_LEN)
+    p->tok_buf[p->tok_len++] = c;
+  else
+    p->overflow = true;
+}
+
+// Next chunk of the body
+static
+void feed_rc_run_req(rc_run_req_t* p, const char* data, size_t len)
+{
+  if (p->status != 0)
+    return;
+  if (len > p->max_body - p->off) {
+    fail_rc_run(p, MHD_HTTP_PAYLOAD_TOO_LARGE, "Body larger than %zu bytes\n", p->max_body);
+    return;
+  }
+
+  for (size_t i = 0; i < len && p->status == 0; i++, p->off++) {
+    char const c = data[i];
+
+    if (p->tok == RC_RUN_TOK_STR || p->tok == RC_RUN_TOK_KEY) {
+      if (p->hex_left > 0) {
+        if (!isxdigit((unsigned char)c))
+          fail_rc_run_syntax(p);
+        p->hex_left--;
+      } else if (p->esc) {
+        // No SST or SD has escapes; \u is kept as a character no such string may contain
+        static const char unesc[256] = {['"'] = '"', ['\\'] = '\\', ['/'] = '/', ['b'] = '\b', ['f'] = '\f',
+                                        ['n'] = '\n', ['r'] = '\r', ['t'] = '\t', ['u'] = '?'};
+        if (unesc[(unsigned char)c] == 0)
+          fail_rc_run_syntax(p);
+        push_rc_run_char(p, unesc[(unsigned char)c]);
+        p->hex_left = c == 'u' ? 4 : 0;
+        p->esc = false;
+      } else if (c == '\\') {
+        p->esc = true;
+      } else if (c == '"') {
+        end_rc_run_token(p);
+      } else if ((unsigned char)c < 0x20) {
+        fail_rc_run_syntax(p);
+      } else {
+        push_rc_run_char(p, c);
+      }
+      continue;
+    }
+
+    if (p->tok == RC_RUN_TOK_NUM || p->tok == RC_RUN_TOK_LIT) {
+      bool const in_tok = p->tok == RC_RUN_TOK_NUM ? (isdigit((unsigned char)c) || strchr("+-.eE", c) != NULL)
+                                                   : (c >= 'a' && c <= 'z');
+      if (in_tok && c != '\0') {
+        if (p->tok == RC_RUN_TOK_NUM)
+          p->num = step_rc_run_number(p->num, c);
+        push_rc_run_char(p, c);
+        continue;
+      }
+      end_rc_run_token(p);
+      if (p->status != 0)
+        return;
+    }
+
+    bool const want_value = p->expect == RC_RUN_EXP_VALUE || p->expect == RC_RUN_EXP_VALUE_OR_END;
+    switch (c) {
+      case ' ':
+      case '\t':
+      case '\n':
+      case '\r':
+        break;
+      case '{':
+      case '[':
+        if (!want_value || p->depth == RC_RUN_MAX_DEPTH) {
+          fail_rc_run_syntax(p);
+          break;
+        }
+        on_rc_run_value(p, RC_RUN_TOK_NONE, c);
+        p->stack[p->depth++] = c;
+        p->expect = c == '{' ? RC_RUN_EXP_KEY_OR_END : RC_RUN_EXP_VALUE_OR_END;
+        break;
+      case '}':
+      case ']':
+        if (p->depth == 0 || p->stack[p->depth - 1] != (c == '}' ? '{' : '[')
+            || (p->expect != RC_RUN_EXP_COMMA_OR_END
+                && p->expect != (c == '}' ? RC_RUN_EXP_KEY_OR_END : RC_RUN_EXP_VALUE_OR_END))) {
+          fail_rc_run_syntax(p);
+          break;
+        }
+        if (--p->depth == 1 && c == ']')
+          p->field = END_RC_RUN_FIELD;
+        end_rc_run_value(p);
+        break;
+      case ',':
+        if (p->expect != RC_RUN_EXP_COMMA_OR_END) {
+          fail_rc_run_syntax(p);
+          break;
+        }
+        p->expect = p->stack[p->depth - 1] == '{' ? RC_RUN_EXP_KEY : RC_RUN_EXP_VALUE;
+        break;
+      case ':':
+        if (p->expect != RC_RUN_EXP_COLON) {
+          fail_rc_run_syntax(p);
+          break;
+        }
+        p->expect = RC_RUN_EXP_VALUE;
+        break;
+      case '"':
+        if (p->expect == RC_RUN_EXP_KEY || p->expect == RC_RUN_EXP_KEY_OR_END)
+          start_rc_run_token(p, RC_RUN_TOK_KEY);
+        else if (want_value)
+          start_rc_run_token(p, RC_RUN_TOK_STR);
+        else
+          fail_rc_run_syntax(p);
+        break;
+      default:
+        if (want_value && (c == '-' || isdigit((unsigned char)c))) {
+          start_rc_run_token(p, RC_RUN_TOK_NUM);
+          p->num = step_rc_run_number(p->num, c);
+          push_rc_run_char(p, c);
+        } else if (want_value && c >= 'a' && c <= 'z') {
+          start_rc_run_token(p, RC_RUN_TOK_LIT);
+          push_rc_run_char(p, c);
+        } else {
+          fail_rc_run_syntax(p);
+        }
+    }
+  }
+}
+
+// End of the body: the whole request is checked
+static
+void finish_rc_run_req(rc_run_req_t* p)
+{
+  if (p->status != 0)
+    return;
+  if (p->tok == RC_RUN_TOK_NUM || p->tok == RC_RUN_TOK_LIT)
+    end_rc_run_token(p);
+  if (p->off == 0) {
+    fail_rc_run(p, MHD_HTTP_BAD_REQUEST, "Empty body\n");
+    return;
+  }
+  if (p->expect != RC_RUN_EXP_NOTHING) {
+    fail_rc_run(p, MHD_HTTP_BAD_REQUEST, "Truncated JSON body\n");
+    return;
+  }
+
+  uint32_t const arrays = (1u << RC_RUN_SST) | (1u << RC_RUN_SD) | (1u << RC_RUN_RATIO);
+  if ((p->seen & arrays) != arrays) {
+    fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "Missing required arrays\nAll arrays must be provided: ( sst, sd, dedicated_ratio_prb )\n");
+    return;
+  }
+  size_t const n = p->len[RC_RUN_SST];
+  if (n == 0 || p->len[RC_RUN_SD] != n || p->len[RC_RUN_RATIO] != n) {
+    fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "sst, sd and dedicated_ratio_prb must have the same, non zero, length, not %zu, %zu and %zu\n",
+                n, p->len[RC_RUN_SD], p->len[RC_RUN_RATIO]);
+    return;
+  }
+
+  int sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum += p->dedicated_ratio_prb[i];
+  if (sum > 100)
+    fail_rc_run(p, MHD_HTTP_UNPROCESSABLE_ENTITY, "dedicated_ratio_prb sums to %d, more than 100\n", sum);
+}
+
+// ======================================== /run Parser ========================================
+
+// ======================================== Health and Metrics ========================================
+
+// GET /healthz (liveness), GET /readyz (readiness) and GET /metrics (Prometheus text format).
+// The xApp is alive unless a lane has been stuck in control_sm_xapp_api() for longer than
+// RC_LANE_STUCK_MS, which only a restart recovers. It is ready when it is not draining, at
+// least one E2 node is connected and no lane has RC_READY_MAX_DEPTH or more controls queued.
+
+typedef enum {
+  RC_EP_RUN,
+  RC_EP_BATCH,
+  RC_EP_JOB,
+  RC_EP_UE,
+  RC_EP_LOOP,
+  RC_EP_HEALTHZ,
+  RC_EP_READYZ,
+  RC_EP_METRICS,
+  RC_EP_OTHER,
+
+  END_RC_EP,
+} rc_endpoint_e;
+
+static const char* const rc_endpoint_str[END_RC_EP] = {
+  "/run", "/batch", "/run/<id>", "/ue/<id>", "/loop", "/healthz", "/readyz", "/metrics", "other",
+};
+
+#define RC_PROTO_STATUS_LEN 7
+
+static struct {
+  _Atomic uint64_t http_requests[END_RC_EP];
+  _Atomic uint64_t http_responses[6];               // By status class, [2] counts the 2xx
+  _Atomic int http_active;                          // Requests received and not completed
+  _Atomic uint64_t proto_requests;
+  _Atomic uint64_t proto_responses[RC_PROTO_STATUS_LEN];
+  int64_t stuck_us;
+  size_t ready_max_depth;
+  int64_t drain_us;                                 // SIGTERM to exit bound, see stop_rc_xapp()
+} rc_ops = {
+  .stuck_us = 10000000,
+  .ready_max_depth = RC_LANE_QUEUE / 2,
+  .drain_us = 5000000,
+};
+
+static
+void init_rc_ops(void)
+{
+  const char* stuck_str = getenv("RC_LANE_STUCK_MS");
+  if (stuck_str && atoi(stuck_str) > 0) rc_ops.stuck_us = atoi(stuck_str) * 1000LL;
+
+  const char* depth_str = getenv("RC_READY_MAX_DEPTH");
+  if (depth_str && atoi(depth_str) > 0) rc_ops.ready_max_depth = (size_t)atoi(depth_str);
+
+  const char* drain_str = getenv("RC_DRAIN_TIMEOUT_MS");
+  if (drain_str && atoi(drain_str) >= 0) rc_ops.drain_us = atoi(drain_str) * 1000LL;
+}
+
+static
+rc_endpoint_e get_rc_endpoint(const char* method, const char* url)
+{
+  if (strcmp(method, "POST") == 0)
+    return strcmp(url, "/run") == 0 ? RC_EP_RUN : strcmp(url, "/batch") == 0 ? RC_EP_BATCH : RC_EP_OTHER;
+  if (strcmp(method, "GET") != 0)
+    return RC_EP_OTHER;
+  if (strncmp(url, "/run/", strlen("/run/")) == 0)
+    return RC_EP_JOB;
+  if (strncmp(url, "/ue/", strlen("/ue/")) == 0)
+    return RC_EP_UE;
+  for (rc_endpoint_e e = RC_EP_LOOP; e < RC_EP_OTHER; e++) {
+    if (strcmp(url, rc_endpoint_str[e]) == 0)
+      return e;
+  }
+  return RC_EP_OTHER;
+}
+
+// Liveness and readiness together; *live and *ready tell which probe passes
+static
+struct json_object *rc_health_to_json(bool* live, bool* ready)
+{
+  pthread_rwlock_rdlock(&rc_node_reg.lock);
+  size_t const nodes = rc_node_reg.len;
+  pthread_rwlock_unlock(&rc_node_reg.lock);
+
+  struct json_object *root = json_object_new_object();
+  struct json_object *stuck = json_object_new_array();
+  size_t depth = 0;
+  size_t max_depth = 0;
+  {
+    lock_guard(&rc_dispatch_mtx);
+    int64_t const now = time_now_us();
+    for (size_t i = 0; i < rc_lane_len; i++) {
+      rc_lane_t const* lane = &rc_lane[i];
+      size_t const d = lane->head - lane->tail;
+      depth += d;
+      if (d > max_depth)
+        max_depth = d;
+      if (lane->busy_since_us != 0 && now - lane->busy_since_us > rc_ops.stuck_us)
+        json_object_array_add(stuck, json_object_new_int64(lane->id.nb_id.nb_id));
+    }
+  }
+
+  bool const draining = atomic_load(&rc_draining);
+  *live = json_object_array_length(stuck) == 0;
+  *ready = !draining && nodes > 0 && max_depth < rc_ops.ready_max_depth;
+
+  json_object_object_add(root, "live", json_object_new_boolean(*live));
+  json_object_object_add(root, "ready", json_object_new_boolean(*ready));
+  json_object_object_add(root, "draining", json_object_new_boolean(draining));
+  json_object_object_add(root, "e2_nodes", json_object_new_int64((int64_t)nodes));
+  json_object_object_add(root, "queued_controls", json_object_new_int64((int64_t)depth));
+  json_object_object_add(root, "max_node_queue", json_object_new_int64((int64_t)max_depth));
+  json_object_object_add(root, "stuck_nodes", stuck);
+  return root;
+}
+
+static
+void write_rc_prom_summary(FILE* f, const char* name, const char* labels, rc_hist_t const* h)
+{
+  static const uint64_t permille[] = {500, 900, 990, 999};
+  bool const has_labels = labels[0] != '\0';
+
+  for (size_t i = 0; i < sizeof(permille) / sizeof(permille[0]); i++)
+    fprintf(f, "%s{%s%squantile=\"%g\"} %.6f\n", name, labels, has_labels ? "," : "", permille[i] / 1000.0,
+            rc_hist_quantile(h, permille[i]) / 1e6);
+  fprintf(f, "%s_sum%s%s%s %.6f\n", name, has_labels ? "{" : "", labels, has_labels ? "}" : "", h->sum / 1e6);
+  fprintf(f, "%s_count%s%s%s %lu\n", name, has_labels ? "{" : "", labels, has_labels ? "}" : "", h->count);
+}
+
+static
+void write_rc_prom_metrics(FILE* f)
+{
+  fprintf(f, "# HELP rc_http_requests_total REST requests by endpoint\n");
+  fprintf(f, "# TYPE rc_http_requests_total counter\n");
+  for (size_t e = 0; e < END_RC_EP; e++)
+    fprintf(f, "rc_http_requests_total{endpoint=\"%s\"} %lu\n", rc_endpoint_str[e], atomic_load(&rc_ops.http_requests[e]));
+  fprintf(f, "# HELP rc_http_responses_total REST responses by status class\n");
+  fprintf(f, "# TYPE rc_http_responses_total counter\n");
+  for (size_t c = 1; c < 6; c++)
+    fprintf(f, "rc_http_responses_total{code=\"%zuxx\"} %lu\n", c, atomic_load(&rc_ops.http_responses[c]));
+
+  fprintf(f, "# HELP rc_proto_requests_total Requests of the binary control channel\n");
+  fprintf(f, "# TYPE rc_proto_requests_total counter\n");
+  fprintf(f, "rc_proto_requests_total %lu\n", atomic_load(&rc_ops.proto_requests));
+  fprintf(f, "# HELP rc_proto_responses_total Responses of the binary control channel by rc_proto_status_e\n");
+  fprintf(f, "# TYPE rc_proto_responses_total counter\n");
+  for (size_t c = 0; c < RC_PROTO_STATUS_LEN; c++)
+    fprintf(f, "rc_proto_responses_total{status=\"%zu\"} %lu\n", c, atomic_load(&rc_ops.proto_responses[c]));
+
+  rc_msg_cache_t* c = &rc_msg_cache;
+  fprintf(f, "# HELP rc_msg_cache_total Control message lookups in the cache\n");
+  fprintf(f, "# TYPE rc_msg_cache_total counter\n");
+  fprintf(f, "rc_msg_cache_total{result=\"hit\"} %lu\n", atomic_load(&c->hits));
+  fprintf(f, "rc_msg_cache_total{result=\"miss\"} %lu\n", atomic_load(&c->misses));
+
+  pthread_rwlock_rdlock(&rc_node_reg.lock);
+  size_t const nodes = rc_node_reg.len;
+  pthread_rwlock_unlock(&rc_node_reg.lock);
+  fprintf(f, "# HELP rc_e2_nodes Connected E2 nodes\n# TYPE rc_e2_nodes gauge\nrc_e2_nodes %zu\n", nodes);
+  fprintf(f, "# HELP rc_draining 1 once SIGTERM was received\n# TYPE rc_draining gauge\nrc_draining %d\n",
+          atomic_load(&rc_draining) ? 1 : 0);
+
+  lock_guard(&rc_dispatch_mtx);
+  fprintf(f, "# HELP rc_jobs_total Control jobs by action\n");
+  fprintf(f, "# TYPE rc_jobs_total counter\n");
+  for (size_t a = 0; a < sizeof(rc_jobs_total) / sizeof(rc_jobs_total[0]); a++)
+    fprintf(f, "rc_jobs_total{action=\"%s\"} %lu\n", rc_action_str[a], rc_jobs_total[a]);
+
+  fprintf(f, "# HELP rc_node_controls_total Controls sent to an E2 node by outcome\n");
+  fprintf(f, "# TYPE rc_node_controls_total counter\n");
+  for (size_t i = 0; i < rc_lane_len; i++) {
+    fprintf(f, "rc_node_controls_total{nb_id=\"%u\",outcome=\"acked\"} %lu\n", rc_lane[i].id.nb_id.nb_id, rc_lane[i].acked);
+    fprintf(f, "rc_node_controls_total{nb_id=\"%u\",outcome=\"failed\"} %lu\n", rc_lane[i].id.nb_id.nb_id, rc_lane[i].failed);
+  }
+  fprintf(f, "# HELP rc_node_queue_depth Controls queued for an E2 node\n");
+  fprintf(f, "# TYPE rc_node_queue_depth gauge\n");
+  for (size_t i = 0; i < rc_lane_len; i++)
+    fprintf(f, "rc_node_queue_depth{nb_id=\"%u\"} %zu\n", rc_lane[i].id.nb_id.nb_id, rc_lane[i].head - rc_lane[i].tail);
+  fprintf(f, "# HELP rc_control_latency_seconds RC control to an E2 node until its answer\n");
+  fprintf(f, "# TYPE rc_control_latency_seconds summary\n");
+  for (size_t i = 0; i < rc_lane_len; i++) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "nb_id=\"%u\"", rc_lane[i].id.nb_id.nb_id);
+    write_rc_prom_summary(f, "rc_control_latency_seconds", labels, &rc_lane[i].latency);
+  }
+}
+
+// ======================================== Health and Metrics ========================================
+
+// ======================================== REST API Functions ========================================
+
+// Bound of POST /run with "wait": true, also the default when it gives no timeout_ms
+static int64_t rc_wait_timeout_ms = 5000;
+
+// Largest POST body accepted
+static size_t rc_max_body = 65536;
+
+rc_job_t* run_rc_control_task(const char* sst_str[], const char* sd_str[],
+                              const int dedicated_ratio_prb[], size_t num_slices, bool force,
+                              uint32_t const* nb_id, const char** err);
+
+struct connection_info {
+  bool is_run;
+  rc_run_req_t run;  // POST /run, parsed while uploaded
+  char *body;        // POST /batch
+  size_t size;
+  size_t cap;
+  rc_waiter_t *wait; // Set while the request is suspended, answered when resumed
+};
+
+// Every REST answer goes through here, for rc_http_responses_total
+static
+int queue_rc_response(struct MHD_Connection *connection, unsigned int status, struct MHD_Response *resp)
+{
+  if (status / 100 < 6)
+    atomic_fetch_add(&rc_ops.http_responses[status / 100], 1);
+  return MHD_queue_response(connection, status, resp);
+}
+
+static
+int send_text(struct MHD_Connection *connection, unsigned int status, const char *msg)
+{
+  // Copied, msg may live in the connection state
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(msg), (void*)msg, MHD_RESPMEM_MUST_COPY);
+  int ret = queue_rc_response(connection, status, resp);
+  MHD_destroy_response(resp);
+  return ret;
+}
+
+static
+int send_job(struct MHD_Connection *connection, rc_job_t *job)
+{
+  struct json_object *root = rc_job_to_json(job);
+  bool const done = json_object_object_get(root, "latency_us") != NULL;
+  const char *body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(body), (void*)body, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  char location[64];
+  snprintf(location, sizeof(location), "/run/%llu", (unsigned long long)job->id);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_LOCATION, location);
+  int ret = queue_rc_response(connection, done ? MHD_HTTP_OK : MHD_HTTP_ACCEPTED, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
+
+// ---------------------------------------- Waiting requests ----------------------------------------
+
+// A request with "wait": true holds no HTTP thread: its connection is suspended once its jobs
+// are queued and resumed by finish_rc_node() when the last one is done, or by rc_wait_thread at
+// its deadline. MHD then calls handle_request() again, which answers with the jobs as they are.
+
+#define RC_MAX_BATCH 64   // Actions of a POST /batch
+
+struct rc_waiter {
+  struct MHD_Connection *connection;
+  int64_t deadline_us;
+  size_t pending;                 // Jobs not done yet
+  bool resumed;
+  size_t len;
+  rc_job_t *job[RC_MAX_BATCH];    // One reference each, NULL if the action was not queued
+  const char *err[RC_MAX_BATCH];  // Why it was not queued
+  const char *type[RC_MAX_BATCH]; // POST /batch action type
+  rc_waiter_t *prev;
+  rc_waiter_t *next;
+};
+
+// Suspended requests, guarded by rc_dispatch_mtx like the jobs
+static rc_waiter_t *rc_waiters = NULL;
+
+static pthread_cond_t rc_wait_cv = PTHREAD_COND_INITIALIZER;
+
+static pthread_t rc_wait_thread_id;
+
+static bool rc_wait_started = false;
+
+static bool rc_wait_stop = false;  // Guarded by rc_dispatch_mtx
+
+// Call with rc_dispatch_mtx held
+static
+void resume_rc_waiter(rc_waiter_t *w)
+{
+  if (w->resumed)
+    return;
+  w->resumed = true;
+
+  for (size_t i = 0; i < w->len; i++) {
+    if (w->job[i] != NULL && w->job[i]->waiter == w)
+      w->job[i]->waiter = NULL;
+  }
+  if (w->prev != NULL)
+    w->prev->next = w->next;
+  else
+    rc_waiters = w->next;
+  if (w->next != NULL)
+    w->next->prev = w->prev;
+  w->prev = w->next = NULL;
+
+  MHD_resume_connection(w->connection);
+}
+
+// Call with rc_dispatch_mtx held, from finish_rc_node()
+static
+void done_rc_waiter_job(rc_waiter_t *w)
+{
+  assert(w->pending > 0);
+  if (--w->pending == 0)
+    resume_rc_waiter(w);
+}
+
+// Suspend the connection until the jobs of w are done or timeout_ms passed; false if they
+// already are, the request is then answered right away. Call from handle_request() only.
+static
+bool wait_rc_jobs(struct MHD_Connection *connection, rc_waiter_t *w, int64_t timeout_ms)
+{
+  lock_guard(&rc_dispatch_mtx);
+  if (rc_wait_stop || !rc_wait_started)
+    return false;
+
+  w->pending = 0;
+  for (size_t i = 0; i < w->len; i++) {
+    if (w->job[i] != NULL && w->job[i]->state != RC_JOB_DONE)
+      w->pending++;
+  }
+  if (w->pending == 0)
+    return false;
+
+  for (size_t i = 0; i < w->len; i++) {
+    if (w->job[i] != NULL && w->job[i]->state != RC_JOB_DONE)
+      w->job[i]->waiter = w;
+  }
+  w->connection = connection;
+  w->deadline_us = time_now_us() + timeout_ms * 1000;
+  w->resumed = false;
+  w->prev = NULL;
+  w->next = rc_waiters;
+  if (rc_waiters != NULL)
+    rc_waiters->prev = w;
+  rc_waiters = w;
+
+  MHD_suspend_connection(connection);
+  pthread_cond_signal(&rc_wait_cv);
+  return true;
+}
+
+// Release the jobs of a waiter, resumed or not (connection dropped)
+static
+void free_rc_waiter(rc_waiter_t *w)
+{
+  {
+    lock_guard(&rc_dispatch_mtx);
+    for (size_t i = 0; i < w->len; i++) {
+      if (w->job[i] == NULL)
+        continue;
+      if (w->job[i]->waiter == w)
+        w->job[i]->waiter = NULL;
+      put_rc_job(w->job[i]);
+    }
+    if (!w->resumed) {
+      if (w->prev != NULL)
+        w->prev->next = w->next;
+      else if (rc_waiters == w)
+        rc_waiters = w->next;
+      if (w->next != NULL)
+        w->next->prev = w->prev;
+    }
+  }
+  free(w);
+}
+
+// Resumes the requests whose deadline passed
+static
+void* rc_wait_thread(void *arg)
+{
+  (void)arg;
+  lock_guard(&rc_dispatch_mtx);
+  while (!rc_wait_stop) {
+    int64_t const now = time_now_us();
+    int64_t next_us = INT64_MAX;
+    for (rc_waiter_t *w = rc_waiters, *next = NULL; w != NULL; w = next) {
+      next = w->next;
+      if (w->deadline_us <= now)
+        resume_rc_waiter(w);
+      else if (w->deadline_us < next_us)
+        next_us = w->deadline_us;
+    }
+
+    if (next_us == INT64_MAX) {
+      pthread_cond_wait(&rc_wait_cv, &rc_dispatch_mtx);
+    } else {
+      struct timespec const wake = {.tv_sec = next_us / 1000000, .tv_nsec = (next_us % 1000000) * 1000};
+      pthread_cond_timedwait(&rc_wait_cv, &rc_dispatch_mtx, &wake);
+    }
+  }
+
+  // Answered with their jobs as they are before MHD_stop_daemon(), which needs every
+  // connection resumed
+  while (rc_waiters != NULL)
+    resume_rc_waiter(rc_waiters);
+  return NULL;
+}
+
+static
+void start_rc_waiters(void)
+{
+  int const rc = pthread_create(&rc_wait_thread_id, NULL, rc_wait_thread, NULL);
+  assert(rc == 0);
+  rc_wait_started = true;
+}
+
+static
+void stop_rc_waiters(void)
+{
+  if (!rc_wait_started)
+    return;
+
+  {
+    lock_guard(&rc_dispatch_mtx);
+    rc_wait_stop = true;
+    pthread_cond_signal(&rc_wait_cv);
+  }
+  pthread_join(rc_wait_thread_id, NULL);
+}
+
+// GET /run/<id>
+static
+int handle_job_query(struct MHD_Connection *connection, const char *url)
+{
+  char *end = NULL;
+  const char *id_str = url + strlen("/run/");
+  unsigned long long const id = strtoull(id_str, &end, 10);
+  if (end == id_str || *end != '\0')
+    return send_text(connection, MHD_HTTP_BAD_REQUEST, "Invalid job id\n");
+
+  rc_job_t *job = find_rc_job(id);
+  if (job == NULL)
+    return send_text(connection, MHD_HTTP_NOT_FOUND, "Unknown job, only the last jobs are kept\n");
+
+  int ret = send_job(connection, job);
+  release_rc_job(job);
+  return ret;
+}
+
+// GET /ue/<amf_ue_ngap_id>
+static
+int handle_ue_query(struct MHD_Connection *connection, const char *url)
 {
+  char *end = NULL;
+  const char *id_str = url + strlen("/ue/");
+  unsigned long long const id = strtoull(id_str, &end, 10);
+  if (end == id_str || *end != '\0')
+    return send_text(connection, MHD_HTTP_BAD_REQUEST, "Invalid amf_ue_ngap_id\n");
 
-  // Temporary argc and argv
-  int argc = 1;
-  char* argv[] = {"RC_Slice", NULL}; 
-  fr_args_t args = init_fr_args(argc, argv);
-  //defer({ free_fr_args(&args); });
+  struct json_object *root = rc_ue_to_json(id);
+  if (root == NULL)
+    return send_text(connection, MHD_HTTP_NOT_FOUND, "Unknown UE, not in the recent KPM reports\n");
 
-  //Init the xApp
-  init_xapp_api(&args);
-  sleep(1);
+  const char *body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(body), (void*)body, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  int ret = queue_rc_response(connection, MHD_HTTP_OK, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
 
-  e2_node_arr_xapp_t nodes = e2_nodes_xapp_api();
-  defer({ free_e2_node_arr_xapp(&nodes); });
-  assert(nodes.len > 0);
-  printf("[xApp]: Connected E2 nodes = %d\n", nodes.len);
+// GET /loop
+static
+int handle_loop_query(struct MHD_Connection *connection)
+{
+  struct json_object *root = rc_loop_to_json();
+  const char *body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
 
-  ////////////
-  // START RC
-  ////////////
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(body), (void*)body, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  int ret = queue_rc_response(connection, MHD_HTTP_OK, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
 
-  // RC Control
-  // CONTROL Service Style 3: Connected Mode Mobility Control
-  // Action ID 1: Handover Control
-  // E2SM-RC Control Header Format 1
-  // E2SM-RC Control Message Format 1
-  rc_ctrl_req_data_t rc_ctrl = {0};
-  // ue_id_e2sm_t ue_id = gen_rc_ue_id(GNB_UE_ID_E2SM);  // find the specific UE!!!!!
+// GET /healthz and GET /readyz
+static
+int handle_health(struct MHD_Connection *connection, bool readiness)
+{
+  bool live = false;
+  bool ready = false;
+  struct json_object *root = rc_health_to_json(&live, &ready);
+  const char *body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
 
-  rc_ctrl.hdr = gen_rc_ctrl_hdr(FORMAT_1_E2SM_RC_CTRL_HDR, *ue_id, 3, HO_control);
-  rc_ctrl.msg = gen_rc_ctrl_HO_slice_level_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str);
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(body), (void*)body, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  bool const ok = readiness ? ready : live;
+  int ret = queue_rc_response(connection, ok ? MHD_HTTP_OK : MHD_HTTP_SERVICE_UNAVAILABLE, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
+
+// GET /metrics
+static
+int handle_metrics(struct MHD_Connection *connection)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&buf, &len);
+  assert(f != NULL && "Memory exhausted");
+  write_rc_prom_metrics(f);
+  fclose(f);
+
+  struct MHD_Response *resp = MHD_create_response_from_buffer(len, buf, MHD_RESPMEM_MUST_FREE);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+  int ret = queue_rc_response(connection, MHD_HTTP_OK, resp);
+  MHD_destroy_response(resp);
+  return ret;
+}
+
+// sst, sd and dedicated_ratio_prb arrays of a /batch action; NULL if valid, else the reason.
+// The strings belong to obj.
+static
+const char *parse_rc_slices(struct json_object *obj, const char *sst_str[], const char *sd_str[],
+                            int dedicated_ratio_prb[], size_t *num_slices)
+{
+  // Extract sst, sd, dedicated_ratio_prb here
+  struct json_object *sst_array = json_object_object_get(obj, "sst");
+  struct json_object *sd_array  = json_object_object_get(obj, "sd");
+  struct json_object *ratio_array = json_object_object_get(obj, "dedicated_ratio_prb");
 
+  if (!json_object_is_type(sst_array, json_type_array) || !json_object_is_type(sd_array, json_type_array)
+      || !json_object_is_type(ratio_array, json_type_array))
+    return "sst, sd and dedicated_ratio_prb arrays must all be provided";
 
-  // We have to find the source node and send Ho request to it. 
-  // Wo wont do it in this case, We send the request to all cells.
-  for(size_t i =0; i < nodes.len; ++i){
-    control_sm_xapp_api(&nodes.n[i].id, SM_RC_ID, &rc_ctrl);
+  size_t const n = json_object_array_length(sst_array);
+  if (n == 0 || n > RC_MAX_SLICES || json_object_array_length(sd_array) != n
+      || json_object_array_length(ratio_array) != n)
+    return "sst, sd and dedicated_ratio_prb must have the same, non zero, length";
+
+  for (size_t i = 0; i < n; i++) {
+    struct json_object *ratio = json_object_array_get_idx(ratio_array, i);
+    if (!json_object_is_type(ratio, json_type_int) || json_object_get_int(ratio) < 0 || json_object_get_int(ratio) > 100)
+      return "dedicated_ratio_prb must be integers in [0, 100]";
+
+    sst_str[i] = json_object_get_string(json_object_array_get_idx(sst_array, i));
+    sd_str[i]  = json_object_get_string(json_object_array_get_idx(sd_array, i));
+    dedicated_ratio_prb[i] = json_object_get_int(ratio);
+    if (!json_object_is_type(json_object_array_get_idx(sst_array, i), json_type_string)
+        || !json_object_is_type(json_object_array_get_idx(sd_array, i), json_type_string))
+      return "sst and sd must be arrays of strings";
   }
-  free_rc_ctrl_req_data(&rc_ctrl);
+
+  *num_slices = n;
+  return check_rc_slices(sst_str, sd_str, dedicated_ratio_prb, n);
 }
 
+// "wait" and "timeout_ms" of a request; returns the wait bound, 0 if the caller does not wait
+static
+int64_t parse_rc_wait(struct json_object *obj)
+{
+  if (!json_object_get_boolean(json_object_object_get(obj, "wait")))
+    return 0;
+
+  int64_t timeout_ms = rc_wait_timeout_ms;
+  struct json_object *timeout = json_object_object_get(obj, "timeout_ms");
+  if (timeout != NULL && json_object_get_int64(timeout) > 0 && json_object_get_int64(timeout) < rc_wait_timeout_ms)
+    timeout_ms = json_object_get_int64(timeout);
+  return timeout_ms;
+}
 
-// ======================================== REST API Functions ========================================
+// POST /run: answer the parse error, or queue and answer 202, or 200 once every node answered
+// with "wait": true
+static
+int handle_run(struct MHD_Connection *connection, struct connection_info *info)
+{
+  rc_run_req_t *req = &info->run;
+  finish_rc_run_req(req);
+  if (req->status != 0)
+    return send_text(connection, req->status, req->err);
+
+  // The strings stay in req until the request completes, after the control message build
+  const char *sst_str[RC_MAX_SLICES];
+  const char *sd_str[RC_MAX_SLICES];
+  size_t const num_slices = req->len[RC_RUN_SST];
+  for (size_t i = 0; i < num_slices; i++) {
+    sst_str[i] = req->sst[i];
+    sd_str[i] = req->sd[i];
+  }
 
-void run_rc_control_task(const char* sst_str[], const char* sd_str[],
-                         const int dedicated_ratio_prb[], size_t num_slices);
+  int64_t timeout_ms = 0;
+  if (req->wait)
+    timeout_ms = req->timeout_ms > 0 && req->timeout_ms < rc_wait_timeout_ms ? req->timeout_ms : rc_wait_timeout_ms;
 
-struct connection_info {
-  char *body;
-  size_t size;
-};
+  // Call run rc function
+  const char *err = NULL;
+  rc_job_t *job = run_rc_control_task(sst_str, sd_str, req->dedicated_ratio_prb, num_slices, req->force, NULL, &err);
+  if (job == NULL) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%s\n", err);
+    return send_text(connection, MHD_HTTP_SERVICE_UNAVAILABLE, msg);
+  }
+
+  if (timeout_ms > 0) {
+    info->wait = calloc(1, sizeof(rc_waiter_t));
+    assert(info->wait != NULL && "Memory exhausted");
+    info->wait->len = 1;
+    info->wait->job[0] = job;
+    if (wait_rc_jobs(connection, info->wait, timeout_ms))
+      return MHD_YES;
+    free(info->wait);
+    info->wait = NULL;
+  }
+
+  int ret = send_job(connection, job);
+  release_rc_job(job);
+  return ret;
+}
+
+// ---------------------------------------- POST /batch ----------------------------------------
+
+// Several actions in one call, each for one E2 node ("nb_id") or all of them:
+//   {"type": "prb_quota", "sst": [...], "sd": [...], "dedicated_ratio_prb": [...], "force": false}
+//   {"type": "handover", "amf_ue_ngap_id": 7, "sst": "1", "sd": "0x000001"}
+//   {"type": "ue_policy", "amf_ue_ngap_id": 7, "sst": [...], "sd": [...], "dedicated_ratio_prb": [...]}
+// The whole batch is validated before any action is queued. Actions run in parallel across
+// nodes and in batch order on each node.
+
+typedef enum {
+  RC_BATCH_PRB_QUOTA,
+  RC_BATCH_HANDOVER,
+  RC_BATCH_UE_POLICY,
+
+  END_RC_BATCH,
+} rc_batch_type_e;
+
+static const char *const rc_batch_type_str[END_RC_BATCH] = {"prb_quota", "handover", "ue_policy"};
+
+typedef struct {
+  rc_batch_type_e type;
+  bool has_nb_id;
+  uint32_t nb_id;
+  bool force;
+  uint64_t amf_ue_ngap_id;
+  size_t num_slices;
+  const char *sst_str[RC_MAX_SLICES];
+  const char *sd_str[RC_MAX_SLICES];
+  int dedicated_ratio_prb[RC_MAX_SLICES];
+} rc_batch_action_t;
+
+static
+const char *parse_rc_batch_action(struct json_object *obj, rc_batch_action_t *a)
+{
+  if (!json_object_is_type(obj, json_type_object))
+    return "an action must be an object";
+
+  const char *type = json_object_get_string(json_object_object_get(obj, "type"));
+  a->type = END_RC_BATCH;
+  for (size_t t = 0; type != NULL && t < END_RC_BATCH; t++) {
+    if (strcmp(type, rc_batch_type_str[t]) == 0)
+      a->type = t;
+  }
+  if (a->type == END_RC_BATCH)
+    return "type must be one of ( prb_quota, handover, ue_policy )";
+
+  struct json_object *nb_id = json_object_object_get(obj, "nb_id");
+  a->has_nb_id = nb_id != NULL;
+  if (a->has_nb_id) {
+    if (!json_object_is_type(nb_id, json_type_int) || json_object_get_int64(nb_id) < 0 || json_object_get_int64(nb_id) > UINT32_MAX)
+      return "nb_id must be an unsigned 32 bit integer";
+    a->nb_id = (uint32_t)json_object_get_int64(nb_id);
+  }
+  a->force = json_object_get_boolean(json_object_object_get(obj, "force"));
+
+  if (a->type != RC_BATCH_PRB_QUOTA) {
+    struct json_object *ue = json_object_object_get(obj, "amf_ue_ngap_id");
+    if (!json_object_is_type(ue, json_type_int) || json_object_get_int64(ue) < 0)
+      return "amf_ue_ngap_id must be an unsigned integer";
+    a->amf_ue_ngap_id = (uint64_t)json_object_get_int64(ue);
+  }
+
+  if (a->type != RC_BATCH_HANDOVER) {
+    return parse_rc_slices(obj, a->sst_str, a->sd_str, a->dedicated_ratio_prb, &a->num_slices);
+  }
+
+  struct json_object *sst = json_object_object_get(obj, "sst");
+  struct json_object *sd = json_object_object_get(obj, "sd");
+  if (!json_object_is_type(sst, json_type_string) || !json_object_is_type(sd, json_type_string))
+    return "a handover needs the destination sst and sd as strings";
+  a->sst_str[0] = json_object_get_string(sst);
+  a->sd_str[0] = json_object_get_string(sd);
+  a->num_slices = 1;
+  a->dedicated_ratio_prb[0] = 0;
+  return check_rc_slices(a->sst_str, a->sd_str, a->dedicated_ratio_prb, 1);
+}
+
+static const char *const rc_err_unknown_ue = "Unknown UE, not in the recent KPM reports";
+
+static
+rc_job_t *submit_rc_batch_action(rc_batch_action_t *a, const char **err)
+{
+  uint32_t const *nb_id = a->has_nb_id ? &a->nb_id : NULL;
+  if (a->type == RC_BATCH_PRB_QUOTA)
+    return run_rc_control_task(a->sst_str, a->sd_str, a->dedicated_ratio_prb, a->num_slices, a->force, nb_id, err);
+
+  // With the UE ID its serving node reported, to that very node (not the other nodes of its
+  // gNB) unless nb_id names another gNB. Until a KPM report listed a UE, the UE ID is guessed
+  // from amf_ue_ngap_id and sent to the nodes of nb_id or every node.
+  ue_id_e2sm_t ue_id;
+  global_e2_node_id_t const *serving = NULL;
+  if (find_rc_ue(a->amf_ue_ngap_id, &ue_id, &serving)) {
+    if (nb_id != NULL && *nb_id != serving->nb_id.nb_id)
+      serving = NULL;
+  } else if (rc_ue_dir.fed) {
+    *err = rc_err_unknown_ue;
+    return NULL;
+  } else {
+    ue_id = gen_rc_ue_id(GNB_UE_ID_E2SM);
+    ue_id.gnb.amf_ue_ngap_id = a->amf_ue_ngap_id;
+  }
+  defer({ free_ue_id_e2sm(&ue_id); });
+
+  if (a->type == RC_BATCH_HANDOVER)
+    return HO_rc_slice_level_UE(&ue_id, a->sst_str[0], a->sd_str[0], serving, nb_id, err);
+  return ue_policy_rc_slice_level_UE(&ue_id, a->sst_str, a->sd_str, a->dedicated_ratio_prb, a->num_slices, serving, nb_id, err);
+}
+
+// The results of a POST /batch, 200 if every action is done, else 202
+static
+int send_rc_batch(struct MHD_Connection *connection, rc_waiter_t *w)
+{
+  bool done = true;
+  struct json_object *root = json_object_new_object();
+  struct json_object *results = json_object_new_array();
+  for (size_t i = 0; i < w->len; i++) {
+    struct json_object *r = w->job[i] != NULL ? rc_job_to_json(w->job[i]) : json_object_new_object();
+    json_object_object_add(r, "index", json_object_new_int64((int64_t)i));
+    json_object_object_add(r, "type", json_object_new_string(w->type[i]));
+    if (w->job[i] == NULL)
+      json_object_object_add(r, "error", json_object_new_string(w->err[i]));
+    else
+      done = done && json_object_object_get(r, "latency_us") != NULL;
+    json_object_array_add(results, r);
+  }
+  json_object_object_add(root, "results", results);
+
+  const char *out = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+  struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(out), (void*)out, MHD_RESPMEM_MUST_COPY);
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+  int ret = queue_rc_response(connection, done ? MHD_HTTP_OK : MHD_HTTP_ACCEPTED, resp);
+  MHD_destroy_response(resp);
+  json_object_put(root);
+  return ret;
+}
+
+// POST /batch: {"actions": [...], "wait": false, "timeout_ms": ...}. Answers 200 once every action
+// is done, else 202, with one result per action: its job, or the reason it was not queued.
+static
+int handle_batch(struct MHD_Connection *connection, struct connection_info *info)
+{
+  struct json_object *parsed = json_tokener_parse(info->body);
+  if (!parsed)
+    return send_text(connection, MHD_HTTP_BAD_REQUEST, "Invalid JSON structure\n");
+  defer({ json_object_put(parsed); });
+
+  struct json_object *actions = json_object_object_get(parsed, "actions");
+  if (!json_object_is_type(actions, json_type_array) || json_object_array_length(actions) == 0
+      || json_object_array_length(actions) > RC_MAX_BATCH)
+    return send_text(connection, MHD_HTTP_BAD_REQUEST, "actions must be a non empty array of at most 64 actions\n");
+
+  size_t const len = json_object_array_length(actions);
+  rc_batch_action_t *a = calloc(len, sizeof(rc_batch_action_t));
+  assert(a != NULL && "Memory exhausted");
+  defer({ free(a); });
+
+  for (size_t i = 0; i < len; i++) {
+    const char *invalid = parse_rc_batch_action(json_object_array_get_idx(actions, i), &a[i]);
+    if (invalid != NULL) {
+      char msg[160];
+      snprintf(msg, sizeof(msg), "Invalid action %zu: %s\n", i, invalid);
+      struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(msg), msg, MHD_RESPMEM_MUST_COPY);
+      int ret = queue_rc_response(connection, MHD_HTTP_BAD_REQUEST, resp);
+      MHD_destroy_response(resp);
+      return ret;
+    }
+  }
+
+  // The jobs are released in request_completed()
+  rc_waiter_t *w = calloc(1, sizeof(rc_waiter_t));
+  assert(w != NULL && "Memory exhausted");
+  info->wait = w;
+  w->len = len;
+  for (size_t i = 0; i < len; i++) {
+    w->job[i] = submit_rc_batch_action(&a[i], &w->err[i]);
+    w->type[i] = rc_batch_type_str[a[i].type];
+  }
+
+  // One bound for the whole batch
+  int64_t const timeout_ms = parse_rc_wait(parsed);
+  if (timeout_ms > 0 && wait_rc_jobs(connection, w, timeout_ms))
+    return MHD_YES;
+  return send_rc_batch(connection, w);
+}
 
 int handle_request(void *cls, struct MHD_Connection *connection,
                    const char *url, const char *method,
@@ -468,169 +3637,639 @@ int handle_request(void *cls, struct MHD_Connection *connection,
 {
   // Allocate per-connection structure
   if (*con_cls == NULL) {
-    struct connection_info *info = calloc(1, sizeof(struct connection_info));
+    struct connection_info *info = malloc(sizeof(struct connection_info));
+    assert(info != NULL && "Memory exhausted");
+    info->is_run = strcmp(method, "POST") == 0 && strcmp(url, "/run") == 0;
+    init_rc_run_req(&info->run, rc_max_body);
+    info->body = NULL;
+    info->size = 0;
+    info->cap = 0;
+    info->wait = NULL;
     *con_cls = info;
+    atomic_fetch_add(&rc_ops.http_requests[get_rc_endpoint(method, url)], 1);
+    atomic_fetch_add(&rc_ops.http_active, 1);
+
+    // Refused before the body is uploaded
+    const char *content_len = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+    if (content_len != NULL && strtoull(content_len, NULL, 10) > rc_max_body) {
+      fail_rc_run(&info->run, MHD_HTTP_PAYLOAD_TOO_LARGE, "Body larger than %zu bytes\n", rc_max_body);
+      return send_text(connection, MHD_HTTP_PAYLOAD_TOO_LARGE, info->run.err);
+    }
     return MHD_YES;
   }
 
   struct connection_info *info = *con_cls;
 
-  // Accumulate POST data
-  if (strcmp(method, "POST") == 0 && *upload_data_size > 0) {
-    info->body = realloc(info->body, info->size + *upload_data_size + 1);
-    memcpy(info->body + info->size, upload_data, *upload_data_size);
-    info->size += *upload_data_size;
-    info->body[info->size] = '\0';
+  // Resumed once its jobs are done or its wait bound passed
+  if (info->wait != NULL)
+    return info->is_run ? send_job(connection, info->wait->job[0]) : send_rc_batch(connection, info->wait);
+
+  if (strcmp(method, "GET") == 0) {
+    if (strncmp(url, "/run/", strlen("/run/")) == 0)
+      return handle_job_query(connection, url);
+    if (strcmp(url, "/loop") == 0)
+      return handle_loop_query(connection);
+    if (strncmp(url, "/ue/", strlen("/ue/")) == 0)
+      return handle_ue_query(connection, url);
+    if (strcmp(url, "/healthz") == 0 || strcmp(url, "/readyz") == 0)
+      return handle_health(connection, strcmp(url, "/readyz") == 0);
+    if (strcmp(url, "/metrics") == 0)
+      return handle_metrics(connection);
+    return send_text(connection, MHD_HTTP_NOT_FOUND, "Unknown endpoint\nAvailable endpoints: ( POST /run, POST /batch, GET /run/<id>, GET /ue/<amf_ue_ngap_id>, GET /loop, GET /healthz, GET /readyz, GET /metrics )\n");
+  }
+
+  if (strcmp(method, "POST") != 0)
+    return send_text(connection, MHD_HTTP_METHOD_NOT_ALLOWED, "Only GET and POST are supported\n");
+
+  // Parse /run chunks as they come, accumulate the others up to rc_max_body. The errors are
+  // answered once the upload is done.
+  if (*upload_data_size > 0) {
+    if (info->is_run) {
+      feed_rc_run_req(&info->run, upload_data, *upload_data_size);
+    } else if (info->size + *upload_data_size > rc_max_body) {
+      fail_rc_run(&info->run, MHD_HTTP_PAYLOAD_TOO_LARGE, "Body larger than %zu bytes\n", rc_max_body);
+    } else if (info->run.status == 0) {
+      if (info->size + *upload_data_size + 1 > info->cap) {
+        info->cap = 2 * (info->size + *upload_data_size + 1);
+        info->body = realloc(info->body, info->cap);
+        assert(info->body != NULL && "Memory exhausted");
+      }
+      memcpy(info->body + info->size, upload_data, *upload_data_size);
+      info->size += *upload_data_size;
+      info->body[info->size] = '\0';
+    }
     *upload_data_size = 0;
     return MHD_YES;
   }
 
   // When upload finished (*upload_data_size == 0), process JSON
-  if (strcmp(method, "POST") == 0 && info->body != NULL) {
-    if (strcmp(url, "/run") != 0) {
-      const char *msg = "Unknown endpoint\nAvailable endpoints: ( /run )\n";
-      struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(msg), (void*)msg, MHD_RESPMEM_PERSISTENT);
-      int ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, resp);
-      MHD_destroy_response(resp);
-      free(info->body);
-      free(info);
-      *con_cls = NULL;
-      return ret;
+  if (strcmp(url, "/run") != 0 && strcmp(url, "/batch") != 0)
+    return send_text(connection, MHD_HTTP_NOT_FOUND, "Unknown endpoint\nAvailable endpoints: ( POST /run, POST /batch, GET /run/<id>, GET /ue/<amf_ue_ngap_id>, GET /loop, GET /healthz, GET /readyz, GET /metrics )\n");
+  if (info->is_run)
+    return handle_run(connection, info);
+  if (info->run.status != 0)
+    return send_text(connection, info->run.status, info->run.err);
+  if (info->body == NULL)
+    return send_text(connection, MHD_HTTP_BAD_REQUEST, "Empty body\n");
+  return handle_batch(connection, info);
+}
+
+// Called by MHD once a request is answered or its connection dropped
+void request_completed(void *cls, struct MHD_Connection *connection,
+                       void **con_cls, enum MHD_RequestTerminationCode toe)
+{
+  struct connection_info *info = *con_cls;
+  if (info == NULL)
+    return;
+
+  if (info->wait != NULL)
+    free_rc_waiter(info->wait);
+  free(info->body);
+  free(info);
+  *con_cls = NULL;
+  atomic_fetch_sub(&rc_ops.http_active, 1);
+}
+
+// Function that performs RC control task on the E2 node nb_id, or every node if NULL; force
+// sends the policy even to the nodes that got it last
+rc_job_t* run_rc_control_task(const char* sst_str[], const char* sd_str[],
+                              const int dedicated_ratio_prb[], size_t num_slices, bool force,
+                              uint32_t const* nb_id, const char** err)
+{
+  printf("[xApp]: Running RC Control with %zu slices\n", num_slices);
+  for (size_t i = 0; i < num_slices; i++) {
+    printf("  Slice %zu -> sst=%s, sd=%s, ratio=%d\n", i, sst_str[i], sd_str[i], dedicated_ratio_prb[i]);
+  }
+
+  bool hit = false;
+  rc_msg_t* msg = get_rc_prb_msg(sst_str, sd_str, dedicated_ratio_prb, num_slices, &hit);
+
+  // Sent by the lane of every connected node
+  return submit_rc_job(msg, hit ? RC_ACTION_HIT : RC_ACTION_NEW, force, NULL, nb_id, err);
+}
+
+static struct MHD_Daemon *rc_http_daemon = NULL;
+
+// Start the REST server, served by its own threads
+static
+void start_rc_rest_server(void)
+{
+  // Requests are served by a pool of epoll threads. None blocks: a request waiting for its jobs
+  // is suspended (see "Waiting requests"), so /healthz, /readyz and /metrics always get a thread.
+  const char *threads_str = getenv("RC_HTTP_THREADS");
+  unsigned int threads = threads_str ? (unsigned int)atoi(threads_str) : 4;
+  if (threads == 0) threads = 1;
+
+  const char *wait_str = getenv("RC_WAIT_TIMEOUT_MS");
+  if (wait_str && atoi(wait_str) > 0) rc_wait_timeout_ms = atoi(wait_str);
+
+  const char *body_str = getenv("RC_HTTP_MAX_BODY");
+  if (body_str && atoi(body_str) > 0) rc_max_body = (size_t)atoi(body_str);
+
+  start_rc_waiters();
+
+  // MHD_USE_ITC lets stop_rc_xapp() close the listening socket while requests finish
+  rc_http_daemon = MHD_start_daemon(MHD_USE_EPOLL_INTERNALLY | MHD_USE_ITC | MHD_ALLOW_SUSPEND_RESUME, PORT, NULL, NULL, &handle_request, NULL,
+                                    MHD_OPTION_THREAD_POOL_SIZE, threads,
+                                    MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                                    MHD_OPTION_END);
+  if (rc_http_daemon == NULL) {
+    fprintf(stderr, "[xApp]: Failed to start REST server\n");
+    return;
+  }
+  printf("[xApp]: REST API running on port %d with %u threads\n", PORT, threads);
+}
+
+// ======================================== REST API Functions ========================================
+
+// ======================================== Binary Control Channel ========================================
+
+// Second control ingress, for a DRL agent that cannot afford an HTTP connection and a JSON
+// parse per action (see rc_ctrl_proto.h). RC_CTRL_SOCK ("unix:/path" or "tcp:host:port",
+// unset to disable) is served by an accept thread. Every connection gets a reader, which
+// parses the pipelined requests and queues their jobs like POST /batch, and a writer, which
+// answers each request as soon as its job is done or needs no waiting.
+
+#define RC_PROTO_MAX_CONN 16
+#define RC_PROTO_INFLIGHT 256  // Requests of a connection not answered yet
+
+typedef struct {
+  uint32_t corr_id;
+  uint8_t status;         // Answer of a request without job
+  rc_job_t* job;
+  int64_t deadline_us;    // 0 if not waited for
+} rc_proto_pending_t;
+
+typedef struct {
+  int fd;
+  // Guarded by rc_dispatch_mtx; the reader and the writer wake each other through
+  // rc_job_done_cv, which is also broadcast whenever a job completes
+  rc_proto_pending_t pending[RC_PROTO_INFLIGHT];
+  size_t len;
+  bool closed;
+} rc_proto_conn_t;
+
+static _Atomic int rc_proto_conns = 0;
+
+// Open connections, guarded by rc_dispatch_mtx, for stop_rc_proto_server()
+static rc_proto_conn_t* rc_proto_conn[RC_PROTO_MAX_CONN];
+
+static int rc_proto_lfd = -1;
+
+// Call with rc_dispatch_mtx held
+static
+size_t encode_rc_proto_resp(rc_proto_pending_t const* p, uint8_t* out)
+{
+  rc_proto_resp_t r = {.corr_id = p->corr_id, .status = p->status, .latency_us = -1};
+
+  rc_job_t const* job = p->job;
+  if (job != NULL) {
+    r.job_id = job->id;
+    r.action = job->action;
+    r.nodes_len = (uint16_t)job->nodes_len;
+    r.status = RC_PROTO_QUEUED;
+    if (job->state == RC_JOB_DONE) {
+      r.status = RC_PROTO_OK;
+      r.latency_us = job->done_us - job->created_us;
     }
 
-    // Parse JSON body safely
-    struct json_object *parsed = json_tokener_parse(info->body);
-    if (!parsed) {
-      const char *msg = "Invalid JSON structure\n";
-      struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(msg), (void*)msg, MHD_RESPMEM_PERSISTENT);
-      int ret = MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, resp);
-      MHD_destroy_response(resp);
-      free(info->body);
-      free(info);
-      *con_cls = NULL;
-      return ret;
+    for (size_t i = 0; i < job->nodes_len; i++) {
+      rc_node_outcome_t const* n = &job->node[i];
+      rc_proto_node_t const pn = {.nb_id = n->nb_id, .state = n->state, .latency_us = n->latency_us};
+      memcpy(out + sizeof(r) + i * sizeof(pn), &pn, sizeof(pn));
+      if (job->state == RC_JOB_DONE && n->state == RC_NODE_FAILED)
+        r.status = RC_PROTO_FAILED;
     }
+  }
 
-    // Extract sst, sd, dedicated_ratio_prb here
-    struct json_object *sst_array = json_object_object_get(parsed, "sst");
-    struct json_object *sd_array  = json_object_object_get(parsed, "sd");
-    struct json_object *ratio_array = json_object_object_get(parsed, "dedicated_ratio_prb");
+  r.len = (uint32_t)(sizeof(r) - sizeof(r.len) + r.nodes_len * sizeof(rc_proto_node_t));
+  memcpy(out, &r, sizeof(r));
+  atomic_fetch_add(&rc_ops.proto_responses[r.status], 1);
+  return sizeof(r.len) + r.len;
+}
 
-    if (!sst_array || !sd_array || !ratio_array) {
-      const char *msg = "Missing required arrays\nAll arrays must be provided: ( sst, sd, dedicated_ratio_prb )\n";
-      struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(msg), (void*)msg, MHD_RESPMEM_PERSISTENT);
-      int ret = MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, resp);
-      MHD_destroy_response(resp);
-      json_object_put(parsed);
-      free(info->body);
-      free(info);
-      *con_cls = NULL;
-      return ret;
-    }
+// Action of a request; strs receives the NUL terminated SST and SD strings. Returns RC_PROTO_OK
+// if the request is valid.
+static
+rc_proto_status_e parse_rc_proto_req(uint8_t const* buf, size_t len, rc_batch_action_t* a, char* strs, int64_t* timeout_ms)
+{
+  rc_proto_req_t req;
+  memcpy(&req, buf, sizeof(req));
+  if (req.version != RC_PROTO_VERSION || req.num_slices == 0 || req.num_slices > RC_MAX_SLICES)
+    return RC_PROTO_BAD_REQUEST;
+
+  static rc_batch_type_e const type[] = {
+    [RC_PROTO_PRB_QUOTA] = RC_BATCH_PRB_QUOTA,
+    [RC_PROTO_HANDOVER] = RC_BATCH_HANDOVER,
+    [RC_PROTO_UE_POLICY] = RC_BATCH_UE_POLICY,
+  };
+  if (req.type < RC_PROTO_PRB_QUOTA || req.type > RC_PROTO_UE_POLICY || (req.type == RC_PROTO_HANDOVER && req.num_slices != 1))
+    return RC_PROTO_BAD_REQUEST;
+
+  a->type = type[req.type];
+  a->has_nb_id = req.flags & RC_PROTO_F_NB_ID;
+  a->nb_id = req.nb_id;
+  a->force = req.flags & RC_PROTO_F_FORCE;
+  a->amf_ue_ngap_id = req.amf_ue_ngap_id;
+  a->num_slices = req.num_slices;
+
+  size_t off = sizeof(req);
+  for (size_t i = 0; i < a->num_slices; i++) {
+    rc_proto_slice_t s;
+    if (off + sizeof(s) > len)
+      return RC_PROTO_BAD_REQUEST;
+    memcpy(&s, buf + off, sizeof(s));
+    off += sizeof(s);
+    if (s.sst_len == 0 || s.sd_len == 0 || s.ratio > 100 || off + s.sst_len + s.sd_len > len)
+      return RC_PROTO_BAD_REQUEST;
+
+    memcpy(strs, buf + off, s.sst_len);
+    strs[s.sst_len] = '\0';
+    a->sst_str[i] = strs;
+    strs += s.sst_len + 1;
+    off += s.sst_len;
+    memcpy(strs, buf + off, s.sd_len);
+    strs[s.sd_len] = '\0';
+    a->sd_str[i] = strs;
+    strs += s.sd_len + 1;
+    off += s.sd_len;
+    a->dedicated_ratio_prb[i] = s.ratio;
+  }
+  if (off != len || check_rc_slices(a->sst_str, a->sd_str, a->dedicated_ratio_prb, a->num_slices) != NULL)
+    return RC_PROTO_BAD_REQUEST;
+
+  *timeout_ms = 0;
+  if (req.flags & RC_PROTO_F_WAIT)
+    *timeout_ms = req.timeout_ms > 0 && req.timeout_ms < rc_wait_timeout_ms ? req.timeout_ms : rc_wait_timeout_ms;
+  return RC_PROTO_OK;
+}
+
+static
+void* rc_proto_reader_thread(void* arg)
+{
+  rc_proto_conn_t* c = arg;
 
-    size_t num_slices = json_object_array_length(sst_array);
-    const char **sst_str = calloc(num_slices, sizeof(char*));
-    const char **sd_str = calloc(num_slices, sizeof(char*));
-    int *dedicated_ratio_prb = calloc(num_slices, sizeof(int));
+  uint8_t* buf = malloc(RC_PROTO_MAX_FRAME);
+  char* strs = malloc(RC_PROTO_MAX_FRAME + 2 * RC_MAX_SLICES);
+  assert(buf != NULL && strs != NULL && "Memory exhausted");
+
+  for (;;) {
+    uint32_t len = 0;
+    if (!rc_proto_read_full(c->fd, &len, sizeof(len)))
+      break;
+    // A bad length leaves no way to find the next frame
+    if (len < sizeof(rc_proto_req_t) - sizeof(len) || len > RC_PROTO_MAX_FRAME - sizeof(len)) {
+      fprintf(stderr, "[xApp]: binary control frame of %u bytes, closing the connection\n", len);
+      break;
+    }
+    memcpy(buf, &len, sizeof(len));
+    if (!rc_proto_read_full(c->fd, buf + sizeof(len), len))
+      break;
 
-    for (size_t i = 0; i < num_slices; i++) {
-      sst_str[i] = strdup(json_object_get_string(json_object_array_get_idx(sst_array, i)));
-      sd_str[i]  = strdup(json_object_get_string(json_object_array_get_idx(sd_array, i)));
-      dedicated_ratio_prb[i] = json_object_get_int(json_object_array_get_idx(ratio_array, i));
+    atomic_fetch_add(&rc_ops.proto_requests, 1);
+    rc_batch_action_t a = {0};
+    int64_t timeout_ms = 0;
+    rc_proto_pending_t p = {.corr_id = ((rc_proto_req_t*)buf)->corr_id};
+    p.status = parse_rc_proto_req(buf, sizeof(len) + len, &a, strs, &timeout_ms);
+    if (p.status == RC_PROTO_OK) {
+      const char* err = NULL;
+      p.job = submit_rc_batch_action(&a, &err);
+      p.status = p.job != NULL ? RC_PROTO_QUEUED
+                 : err == rc_err_unknown_ue ? RC_PROTO_NO_UE
+                 : err == rc_err_shutting_down ? RC_PROTO_SHUTTING_DOWN
+                 : RC_PROTO_NO_NODE;
+      p.deadline_us = p.job != NULL && timeout_ms > 0 ? time_now_us() + timeout_ms * 1000 : 0;
     }
 
-    // Call run rc function
-    run_rc_control_task(sst_str, sd_str, dedicated_ratio_prb, num_slices);
+    lock_guard(&rc_dispatch_mtx);
+    while (c->len == RC_PROTO_INFLIGHT)
+      pthread_cond_wait(&rc_job_done_cv, &rc_dispatch_mtx);
+    c->pending[c->len++] = p;
+    pthread_cond_broadcast(&rc_job_done_cv);
+  }
+
+  free(strs);
+  free(buf);
+
+  lock_guard(&rc_dispatch_mtx);
+  c->closed = true;
+  pthread_cond_broadcast(&rc_job_done_cv);
+  return NULL;
+}
+
+static
+void* rc_proto_writer_thread(void* arg)
+{
+  rc_proto_conn_t* c = arg;
+  uint8_t out[sizeof(rc_proto_resp_t) + RC_MAX_NODES * sizeof(rc_proto_node_t)];
 
-    // Cleanup
-    for (size_t i = 0; i < num_slices; i++) {
-      free((void*)sst_str[i]);
-      free((void*)sd_str[i]);
+  pthread_mutex_lock(&rc_dispatch_mtx);
+  for (;;) {
+    // Any request whose answer is final, or whose wait bound passed
+    int64_t const now = time_now_us();
+    int64_t next_us = INT64_MAX;
+    size_t i = 0;
+    for (; i < c->len; i++) {
+      rc_proto_pending_t const* p = &c->pending[i];
+      if (p->job == NULL || p->deadline_us == 0 || p->job->state == RC_JOB_DONE || p->deadline_us <= now)
+        break;
+      if (p->deadline_us < next_us)
+        next_us = p->deadline_us;
     }
-    free(sst_str);
-    free(sd_str);
-    free(dedicated_ratio_prb);
-    json_object_put(parsed);
 
-    // Send response
-    const char *resp_text = "Task executed successfully\n";
-    struct MHD_Response *resp = MHD_create_response_from_buffer(strlen(resp_text), (void*)resp_text, MHD_RESPMEM_PERSISTENT);
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, resp);
-    MHD_destroy_response(resp);
-    free(info->body);
-    free(info);
-    *con_cls = NULL;
-    return ret;
+    if (i == c->len) {
+      if (c->closed && c->len == 0)
+        break;
+      if (next_us == INT64_MAX) {
+        pthread_cond_wait(&rc_job_done_cv, &rc_dispatch_mtx);
+      } else {
+        struct timespec const deadline = {.tv_sec = next_us / 1000000, .tv_nsec = (next_us % 1000000) * 1000};
+        pthread_cond_timedwait(&rc_job_done_cv, &rc_dispatch_mtx, &deadline);
+      }
+      continue;
+    }
+
+    rc_proto_pending_t const p = c->pending[i];
+    c->pending[i] = c->pending[--c->len];
+    pthread_cond_broadcast(&rc_job_done_cv);
+
+    size_t const len = encode_rc_proto_resp(&p, out);
+    if (p.job != NULL)
+      put_rc_job(p.job);
+
+    pthread_mutex_unlock(&rc_dispatch_mtx);
+    // A dead client ends the reader too; the remaining answers are dropped
+    if (!rc_proto_write_full(c->fd, out, len))
+      shutdown(c->fd, SHUT_RDWR);
+    pthread_mutex_lock(&rc_dispatch_mtx);
   }
+  for (size_t i = 0; i < RC_PROTO_MAX_CONN; i++) {
+    if (rc_proto_conn[i] == c)
+      rc_proto_conn[i] = NULL;
+  }
+  pthread_mutex_unlock(&rc_dispatch_mtx);
 
-  return MHD_NO;
+  close(c->fd);
+  free(c);
+  atomic_fetch_sub(&rc_proto_conns, 1);
+  return NULL;
 }
 
-// Function that performs RC control task
-void run_rc_control_task(const char* sst_str[], const char* sd_str[],
-                         const int dedicated_ratio_prb[], size_t num_slices)
+static
+void* rc_proto_accept_thread(void* arg)
 {
-  printf("[xApp]: Running RC Control with %zu slices\n", num_slices);
-  for (size_t i = 0; i < num_slices; i++) {
-    printf("  Slice %zu -> sst=%s, sd=%s, ratio=%d\n", i, sst_str[i], sd_str[i], dedicated_ratio_prb[i]);
+  int const lfd = *(int*)arg;
+  free(arg);
+
+  for (;;) {
+    int const fd = accept(lfd, NULL, NULL);
+    if (fd < 0) {
+      if (atomic_load(&rc_draining))
+        break;
+      if (errno != EINTR)
+        perror("[xApp]: accept on the binary control socket");
+      continue;
+    }
+    if (atomic_fetch_add(&rc_proto_conns, 1) >= RC_PROTO_MAX_CONN) {
+      fprintf(stderr, "[xApp]: more than %d binary control connections, refused\n", RC_PROTO_MAX_CONN);
+      atomic_fetch_sub(&rc_proto_conns, 1);
+      close(fd);
+      continue;
+    }
+    int const one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+    rc_proto_conn_t* c = calloc(1, sizeof(rc_proto_conn_t));
+    assert(c != NULL && "Memory exhausted");
+    c->fd = fd;
+    {
+      lock_guard(&rc_dispatch_mtx);
+      size_t i = 0;
+      while (rc_proto_conn[i] != NULL)
+        i++;
+      rc_proto_conn[i] = c;
+    }
+
+    pthread_t reader, writer;
+    int rc = pthread_create(&reader, NULL, rc_proto_reader_thread, c);
+    assert(rc == 0);
+    rc = pthread_create(&writer, NULL, rc_proto_writer_thread, c);
+    assert(rc == 0);
+    pthread_detach(reader);
+    pthread_detach(writer);
   }
-  
-  e2_node_arr_xapp_t nodes = e2_nodes_xapp_api();
-  defer({ free_e2_node_arr_xapp(&nodes); });
 
-  if (nodes.len == 0) {
-    printf("[xApp]: No connected nodes.\n");
+  close(lfd);
+  return NULL;
+}
+
+static
+void start_rc_proto_server(void)
+{
+  const char* addr = getenv("RC_CTRL_SOCK");
+  if (addr == NULL || addr[0] == '\0')
     return;
+
+  struct sockaddr_storage sa;
+  socklen_t sa_len = 0;
+  if (!rc_proto_addr(addr, &sa, &sa_len)) {
+    fprintf(stderr, "[xApp]: RC_CTRL_SOCK must be unix:/path or tcp:host:port, not %s\n", addr);
+    exit(EXIT_FAILURE);
   }
 
-  printf("[xApp]: Connected E2 nodes = %d\n", nodes.len);
+  int const fd = socket(sa.ss_family, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  int const one = 1;
+  if (sa.ss_family == AF_UNIX)
+    unlink(((struct sockaddr_un*)&sa)->sun_path);
+  else
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*)&sa, sa_len) < 0 || listen(fd, RC_PROTO_MAX_CONN) < 0) {
+    fprintf(stderr, "[xApp]: binary control socket %s: %s\n", addr, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
 
-  rc_ctrl_req_data_t rc_ctrl = {0};
-  ue_id_e2sm_t ue_id = gen_rc_ue_id(GNB_UE_ID_E2SM);
+  rc_proto_lfd = fd;
+  int* arg = malloc(sizeof(int));
+  assert(arg != NULL && "Memory exhausted");
+  *arg = fd;
+  pthread_t t;
+  int const rc = pthread_create(&t, NULL, rc_proto_accept_thread, arg);
+  assert(rc == 0);
+  pthread_detach(t);
+  printf("[xApp]: Binary control channel listening on %s\n", addr);
+}
 
-  // Slice creation logic
-  rc_ctrl.hdr = gen_rc_ctrl_hdr(FORMAT_1_E2SM_RC_CTRL_HDR, ue_id, 2, Slice_level_PRB_quotal_7_6_3_1);
-  rc_ctrl.msg = gen_rc_ctrl_slice_level_PRB_quata_msg(FORMAT_1_E2SM_RC_CTRL_MSG, sst_str, sd_str, dedicated_ratio_prb, num_slices);
+// Once rc_draining is set: stop accepting, then end every connection after the answers of
+// its queued requests. False if connections are still open at deadline_us.
+static
+bool stop_rc_proto_server(int64_t deadline_us)
+{
+  if (rc_proto_lfd < 0)
+    return true;
+  shutdown(rc_proto_lfd, SHUT_RDWR);
 
-  for(size_t i = 0; i < nodes.len; ++i){
-    control_sm_xapp_api(&nodes.n[i].id, SM_RC_ID, &rc_ctrl);
+  {
+    lock_guard(&rc_dispatch_mtx);
+    for (size_t i = 0; i < RC_PROTO_MAX_CONN; i++) {
+      if (rc_proto_conn[i] != NULL)
+        shutdown(rc_proto_conn[i]->fd, SHUT_RD);
+    }
   }
 
-  free_rc_ctrl_req_data(&rc_ctrl);
+  while (atomic_load(&rc_proto_conns) > 0 && time_now_us() < deadline_us)
+    usleep(1000);
+  return atomic_load(&rc_proto_conns) == 0;
 }
 
-// Thread to run the REST server
-void* rest_server_thread(void* arg)
+// ======================================== Binary Control Channel ========================================
+
+// ======================================== Lifecycle ========================================
+
+// SIGINT and SIGTERM start a bounded shutdown: the listening sockets close, new controls are
+// refused with "Shutting down" (503, RC_PROTO_SHUTTING_DOWN), the queued controls are still
+// sent and the waiting clients answered. What is not done after RC_DRAIN_TIMEOUT_MS is dropped,
+// so a restart costs at most that plus the startup logged as "Ready in".
+
+// Wait until every lane is idle; returns the controls still queued at deadline_us
+static
+size_t drain_rc_lanes(int64_t deadline_us)
 {
-  struct MHD_Daemon *daemon;
-  daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, PORT, NULL, NULL, &handle_request, NULL, MHD_OPTION_END);
-  if (daemon == NULL) {
-    fprintf(stderr, "[xApp]: Failed to start REST server\n");
-    return NULL;
+  lock_guard(&rc_dispatch_mtx);
+  for (;;) {
+    size_t queued = 0;
+    bool busy = false;
+    for (size_t i = 0; i < rc_lane_len; i++) {
+      queued += rc_lane[i].head - rc_lane[i].tail;
+      busy = busy || rc_lane[i].busy_since_us != 0;
+    }
+    int64_t const now = time_now_us();
+    if ((queued == 0 && !busy) || now >= deadline_us)
+      return queued;
+
+    // rc_job_done_cv only fires when a whole job is done, so poll as well
+    int64_t const wake_us = now + 10000 < deadline_us ? now + 10000 : deadline_us;
+    struct timespec const wake = {.tv_sec = wake_us / 1000000, .tv_nsec = (wake_us % 1000000) * 1000};
+    pthread_cond_timedwait(&rc_job_done_cv, &rc_dispatch_mtx, &wake);
   }
-  printf("[xApp]: REST API running on port %d\n", PORT);
-  while (1) sleep(1);
-  MHD_stop_daemon(daemon);
-  return NULL;
 }
 
-// ======================================== REST API Functions ========================================
+// Fail the controls still queued and make the lanes exit, waiting until deadline_us for those in
+// control_sm_xapp_api(); false if one is still in it
+static
+bool stop_rc_lanes(int64_t deadline_us)
+{
+  lock_guard(&rc_dispatch_mtx);
+  rc_lanes_stop = true;
+  for (size_t i = 0; i < rc_lane_len; i++) {
+    rc_lane_t* lane = &rc_lane[i];
+    while (lane->tail != lane->head) {
+      rc_task_t const t = lane->task[lane->tail % RC_LANE_QUEUE];
+      lane->tail++;
+      finish_rc_node(t.job, t.node, RC_NODE_FAILED, rc_err_shutting_down, 0);
+      put_rc_job(t.job);
+    }
+    pthread_cond_signal(&lane->cv);
+  }
+
+  for (;;) {
+    size_t running = 0;
+    for (size_t i = 0; i < rc_lane_len; i++)
+      running += !rc_lane[i].exited;
+    int64_t const now = time_now_us();
+    if (running == 0 || now >= deadline_us)
+      break;
+    struct timespec const wake = {.tv_sec = deadline_us / 1000000, .tv_nsec = (deadline_us % 1000000) * 1000};
+    pthread_cond_timedwait(&rc_job_done_cv, &rc_dispatch_mtx, &wake);
+  }
+
+  bool stopped = true;
+  for (size_t i = 0; i < rc_lane_len; i++) {
+    if (rc_lane[i].exited)
+      pthread_join(rc_lane[i].thread, NULL);
+    else
+      stopped = false;
+  }
+  return stopped;
+}
+
+static
+void stop_rc_xapp(int sig)
+{
+  int64_t const start = time_now_us();
+  int64_t const deadline_us = start + rc_ops.drain_us;
+  printf("[xApp]: %s received, draining for at most %ld ms\n", strsignal(sig), rc_ops.drain_us / 1000);
+
+  atomic_store(&rc_draining, true);
+  if (rc_http_daemon != NULL) {
+    MHD_socket const lfd = MHD_quiesce_daemon(rc_http_daemon);
+    if (lfd != MHD_INVALID_SOCKET)
+      close(lfd);
+  }
+
+  size_t const dropped = drain_rc_lanes(deadline_us);
+  if (!stop_rc_proto_server(deadline_us))
+    fprintf(stderr, "[xApp]: binary control connections still open at the drain timeout\n");
+  stop_rc_waiters();
+  while (atomic_load(&rc_ops.http_active) > 0 && time_now_us() < deadline_us)
+    usleep(1000);
+  if (rc_http_daemon != NULL)
+    MHD_stop_daemon(rc_http_daemon);
+
+  // Nothing may call the xApp API once it is stopped. The idle lanes exit right away.
+  stop_rc_nodes();
+  int64_t const now = time_now_us();
+  if (!stop_rc_lanes(deadline_us > now + 100000 ? deadline_us : now + 100000)) {
+    fprintf(stderr, "[xApp]: a control lane is still waiting for its E2 node, exiting without stopping the xApp API\n");
+    return;
+  }
+
+  for (size_t i = 0; i < rc_kpm_sub_ctx_len; i++) {
+    if (rc_kpm_sub_ctx[i].subscribed)
+      rm_report_sm_xapp_api(rc_kpm_sub_ctx[i].handle);
+  }
+
+  // Stop the xApp
+  while (try_stop_xapp_api() == false)
+    usleep(1000);
+
+  printf("[xApp]: Stopped in %ld ms, %zu queued controls dropped\n", (time_now_us() - start) / 1000, dropped);
+}
 
+// ======================================== Lifecycle ========================================
+
+// The programs in ../bench include this file with RC_CTRL_BENCH defined to drive the
+// message builders without a RIC
+#ifndef RC_CTRL_BENCH
 int main(int argc, char *argv[])
 {
+  int64_t const start = time_now_us();
+
+  // Blocked before init_xapp_api() starts its threads, so that only the sigwait() below gets them
+  sigset_t signal_set;
+  sigemptyset(&signal_set);
+  sigaddset(&signal_set, SIGINT);
+  sigaddset(&signal_set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
+
   fr_args_t args = init_fr_args(argc, argv);
   init_xapp_api(&args);
   sleep(1);
+  init_rc_msg_cache();
+  init_rc_nodes();
+  init_rc_ue_dir();
+  init_rc_loop();
+  init_rc_ops();
 
-  printf("[xApp]: Ready and waiting for REST API calls.\n");
-
-  pthread_t rest_thread;
-  pthread_create(&rest_thread, NULL, rest_server_thread, NULL);
+  start_rc_rest_server();
+  start_rc_proto_server();
+  printf("[xApp]: Ready in %ld ms and waiting for REST API calls.\n", (time_now_us() - start) / 1000);
 
-  // Keep main loop alive
-  while(1)
-    sleep(1);
+  int sig = 0;
+  sigwait(&signal_set, &sig);
+  stop_rc_xapp(sig);
 
   printf("[xApp]: xApp shutting down.\n");
   return 0;
 }
+#endif
@@ -0,0 +1,352 @@
+/*
+ * Licensed to the OpenAirInterface (OAI) Software Alliance under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The OpenAirInterface Software Alliance licenses this file to You under
+ * the OAI Public License, Version 1.1  (the "License"); you may not use this file
+ * except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.openairinterface.org/?page_id=698
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *-------------------------------------------------------------------------------
+ * For more information about the OpenAirInterface (OAI) Software Alliance:
+ *      contact@openairinterface.org
+ */
+
+// Load generator for the control ingresses of xapp_rc_slice_ctrl: sends slice level PRB quota
+// actions through POST /run or the binary control channel (see ../src/rc_ctrl_proto.h) and
+// prints the actions/s and the p50/p99 latency from send to answer.
+//
+//   gcc -O2 -o rc_ctrl_loadgen rc_ctrl_loadgen.c -lpthread
+//
+//   rc_ctrl_loadgen --http host:port [options]       keep-alive HTTP/1.1 connections, one
+//                                                     request in flight per connection
+//   rc_ctrl_loadgen --bin unix:/path|tcp:host:port   binary channel, up to depth requests in
+//                  [-d depth] [options]               flight per connection
+//
+//   -n actions      total number of actions (default 10000)
+//   -c connections  parallel connections (default 1)
+//   -s slices       slices per action (default 3)
+//   -w              wait for the E2 nodes to answer each action
+//   -r              repeat the same policy, which the xApp skips as a no-op; by default the
+//                   ratios change with every action so that each one is sent to the nodes
+
+#define _GNU_SOURCE // strcasestr
+
+#include "../src/rc_ctrl_proto.h"
+
+#include <inttypes.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+static int num_actions = 10000;
+static int num_conns = 1;
+static int num_slices = 3;
+static int depth = 16;
+static bool wait_nodes = false;
+static bool repeat = false;
+
+static const char* http_addr = NULL;
+static const char* bin_addr = NULL;
+
+static int64_t* lat_us;   // Per action
+static _Atomic int errors = 0;
+
+static
+int64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static
+int ratio_of(int action, int slice)
+{
+  if (repeat)
+    return 100 / num_slices;
+  return (action + slice * 7) % (100 / num_slices + 1);
+}
+
+static
+int connect_to(const char* addr)
+{
+  struct sockaddr_storage sa;
+  socklen_t sa_len = 0;
+  if (!rc_proto_addr(addr, &sa, &sa_len)) {
+    fprintf(stderr, "bad address %s\n", addr);
+    exit(EXIT_FAILURE);
+  }
+
+  int const fd = socket(sa.ss_family, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sa_len) < 0) {
+    fprintf(stderr, "connect to %s: %s\n", addr, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  int const one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// ---- HTTP ----
+
+// Reads one response; returns its status code, or -1 if the connection broke
+static
+int read_http_resp(int fd, char* buf, size_t cap)
+{
+  size_t len = 0;
+  char* body = NULL;
+  while (body == NULL) {
+    if (len == cap - 1)
+      return -1;
+    ssize_t const n = read(fd, buf + len, cap - 1 - len);
+    if (n <= 0)
+      return -1;
+    len += (size_t)n;
+    buf[len] = '\0';
+    body = strstr(buf, "\r\n\r\n");
+  }
+  body += 4;
+
+  int status = -1;
+  if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1)
+    return -1;
+
+  // MHD always sets Content-Length for buffered responses
+  const char* cl = strcasestr(buf, "\r\nContent-Length:");
+  size_t const content_len = cl != NULL ? strtoul(cl + 17, NULL, 10) : 0;
+  size_t const have = len - (size_t)(body - buf);
+  if (have < content_len) {
+    char skip[4096];
+    for (size_t left = content_len - have; left > 0;) {
+      ssize_t const n = read(fd, skip, left < sizeof(skip) ? left : sizeof(skip));
+      if (n <= 0)
+        return -1;
+      left -= (size_t)n;
+    }
+  }
+  return status;
+}
+
+static
+void* http_thread(void* arg)
+{
+  int const t = *(int*)arg;
+  int const first = (int)((int64_t)num_actions * t / num_conns);
+  int const last = (int)((int64_t)num_actions * (t + 1) / num_conns);
+
+  char addr[128];
+  snprintf(addr, sizeof(addr), "tcp:%s", http_addr);
+  int fd = connect_to(addr);
+
+  char body[8192];
+  char req[9216];
+  char resp[16384];
+  for (int i = first; i < last; i++) {
+    int len = snprintf(body, sizeof(body), "{\"wait\": %s, \"sst\": [", wait_nodes ? "true" : "false");
+    for (int k = 0; k < num_slices; k++)
+      len += snprintf(body + len, sizeof(body) - len, "%s\"%d\"", k > 0 ? ", " : "", k + 1);
+    len += snprintf(body + len, sizeof(body) - len, "], \"sd\": [");
+    for (int k = 0; k < num_slices; k++)
+      len += snprintf(body + len, sizeof(body) - len, "%s\"%06d\"", k > 0 ? ", " : "", k + 1);
+    len += snprintf(body + len, sizeof(body) - len, "], \"dedicated_ratio_prb\": [");
+    for (int k = 0; k < num_slices; k++)
+      len += snprintf(body + len, sizeof(body) - len, "%s%d", k > 0 ? ", " : "", ratio_of(i, k));
+    len += snprintf(body + len, sizeof(body) - len, "]}");
+    int const req_len = snprintf(req, sizeof(req), "POST /run HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                                 "Content-Length: %d\r\n\r\n%s", http_addr, len, body);
+
+    int64_t const start = now_us();
+    int status = -1;
+    if (rc_proto_write_full(fd, req, req_len))
+      status = read_http_resp(fd, resp, sizeof(resp));
+    if (status < 0) {
+      // The server closed the keep-alive connection, retry once on a new one
+      close(fd);
+      fd = connect_to(addr);
+      if (rc_proto_write_full(fd, req, req_len))
+        status = read_http_resp(fd, resp, sizeof(resp));
+    }
+    lat_us[i] = now_us() - start;
+    if (status < 200 || status >= 300)
+      atomic_fetch_add(&errors, 1);
+  }
+
+  close(fd);
+  return NULL;
+}
+
+// ---- Binary ----
+
+typedef struct {
+  int fd;
+  int first;
+  int last;
+  int64_t* sent_us;   // Indexed by corr_id - first
+  pthread_mutex_t mtx;
+  pthread_cond_t cv;
+  int in_flight;
+} bin_conn_t;
+
+static
+void* bin_recv_thread(void* arg)
+{
+  bin_conn_t* c = arg;
+  rc_proto_node_t node[256];
+
+  for (int i = c->first; i < c->last; i++) {
+    rc_proto_resp_t r;
+    if (!rc_proto_read_full(c->fd, &r, sizeof(r))
+        || r.nodes_len > 256
+        || !rc_proto_read_full(c->fd, node, r.nodes_len * sizeof(rc_proto_node_t))) {
+      fprintf(stderr, "binary control connection closed after %d of %d answers\n", i - c->first, c->last - c->first);
+      exit(EXIT_FAILURE);
+    }
+    if (r.corr_id < (uint32_t)c->first || r.corr_id >= (uint32_t)c->last) {
+      fprintf(stderr, "unexpected corr_id %u\n", r.corr_id);
+      exit(EXIT_FAILURE);
+    }
+
+    if (r.status != RC_PROTO_OK && r.status != RC_PROTO_QUEUED)
+      atomic_fetch_add(&errors, 1);
+
+    pthread_mutex_lock(&c->mtx);
+    lat_us[r.corr_id] = now_us() - c->sent_us[r.corr_id - c->first];
+    c->in_flight--;
+    pthread_cond_signal(&c->cv);
+    pthread_mutex_unlock(&c->mtx);
+  }
+  return NULL;
+}
+
+static
+void* bin_thread(void* arg)
+{
+  int const t = *(int*)arg;
+  bin_conn_t c = {
+    .fd = connect_to(bin_addr),
+    .first = (int)((int64_t)num_actions * t / num_conns),
+    .last = (int)((int64_t)num_actions * (t + 1) / num_conns),
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .cv = PTHREAD_COND_INITIALIZER,
+  };
+  c.sent_us = calloc(c.last - c.first + 1, sizeof(int64_t));
+
+  pthread_t recv;
+  pthread_create(&recv, NULL, bin_recv_thread, &c);
+
+  uint8_t buf[RC_PROTO_MAX_FRAME];
+  for (int i = c.first; i < c.last; i++) {
+    rc_proto_req_t req = {
+      .corr_id = (uint32_t)i,
+      .version = RC_PROTO_VERSION,
+      .type = RC_PROTO_PRB_QUOTA,
+      .flags = wait_nodes ? RC_PROTO_F_WAIT : 0,
+      .num_slices = (uint8_t)num_slices,
+    };
+    size_t len = sizeof(req);
+    for (int k = 0; k < num_slices; k++) {
+      char sst[12], sd[12];
+      snprintf(sst, sizeof(sst), "%d", k + 1);
+      snprintf(sd, sizeof(sd), "%06d", k + 1);
+      rc_proto_slice_t const s = {.sst_len = (uint8_t)strlen(sst), .sd_len = (uint8_t)strlen(sd), .ratio = (uint8_t)ratio_of(i, k)};
+      memcpy(buf + len, &s, sizeof(s));
+      len += sizeof(s);
+      memcpy(buf + len, sst, s.sst_len);
+      len += s.sst_len;
+      memcpy(buf + len, sd, s.sd_len);
+      len += s.sd_len;
+    }
+    req.len = (uint32_t)(len - sizeof(req.len));
+    memcpy(buf, &req, sizeof(req));
+
+    pthread_mutex_lock(&c.mtx);
+    while (c.in_flight == depth)
+      pthread_cond_wait(&c.cv, &c.mtx);
+    c.in_flight++;
+    c.sent_us[i - c.first] = now_us();
+    pthread_mutex_unlock(&c.mtx);
+
+    if (!rc_proto_write_full(c.fd, buf, len)) {
+      fprintf(stderr, "binary control connection closed after %d of %d requests\n", i - c.first, c.last - c.first);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_join(recv, NULL);
+  close(c.fd);
+  free(c.sent_us);
+  return NULL;
+}
+
+static
+int cmp_i64(void const* a, void const* b)
+{
+  int64_t const x = *(int64_t const*)a;
+  int64_t const y = *(int64_t const*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--http") == 0 && i + 1 < argc) {
+      http_addr = argv[++i];
+    } else if (strcmp(argv[i], "--bin") == 0 && i + 1 < argc) {
+      bin_addr = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      num_actions = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      num_conns = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      num_slices = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      depth = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      wait_nodes = true;
+    } else if (strcmp(argv[i], "-r") == 0) {
+      repeat = true;
+    } else {
+      http_addr = bin_addr = NULL;
+      break;
+    }
+  }
+  if ((http_addr == NULL) == (bin_addr == NULL) || num_actions < 1 || num_conns < 1 || num_conns > num_actions
+      || num_slices < 1 || num_slices > 64 || depth < 1) {
+    fprintf(stderr, "usage: %s --http host:port | --bin unix:/path|tcp:host:port [-d depth] [-n actions] [-c connections] [-s slices] [-w] [-r]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  lat_us = calloc(num_actions, sizeof(int64_t));
+  pthread_t* thread = calloc(num_conns, sizeof(pthread_t));
+  int* idx = calloc(num_conns, sizeof(int));
+
+  int64_t const start = now_us();
+  for (int t = 0; t < num_conns; t++) {
+    idx[t] = t;
+    pthread_create(&thread[t], NULL, http_addr != NULL ? http_thread : bin_thread, &idx[t]);
+  }
+  for (int t = 0; t < num_conns; t++)
+    pthread_join(thread[t], NULL);
+  double const elapsed_s = (now_us() - start) / 1e6;
+
+  qsort(lat_us, num_actions, sizeof(int64_t), cmp_i64);
+  printf("%s: %d actions of %d slices over %d connection(s)%s%s\n", http_addr != NULL ? "http" : "bin", num_actions, num_slices,
+         num_conns, wait_nodes ? ", waited" : "", repeat ? ", repeated policy" : "");
+  printf("  %.0f actions/s, p50 = %" PRId64 " μs, p99 = %" PRId64 " μs, max = %" PRId64 " μs, errors = %d\n",
+         num_actions / elapsed_s, lat_us[num_actions / 2], lat_us[(int64_t)num_actions * 99 / 100],
+         lat_us[num_actions - 1], atomic_load(&errors));
+
+  free(idx);
+  free(thread);
+  free(lat_us);
+  return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}